@@ -1,9 +1,15 @@
 
+# counters, tracer and traffic recorder used by the socket and managers
+include(../instrument/instrument.pri)
+
 include(types/types.pri)
 include(managers/managers.pri)
 
 INCLUDEPATH += $$PWD
 
+# clock_gettime() for the rate limiter clock
+linux-*:LIBS *= -lrt
+
 HEADERS += \
 	$$PWD/icqSession.h \
 	$$PWD/icqSocket.h
@@ -34,10 +34,14 @@
 #include "types/icqUserDetails.h"
 #include "types/icqShortUserDetails.h"
 
+#include "messagetracer.h"
+#include "recorder.h"
+
 #include <QDateTime>
 #include <QHostAddress>
 #include <QHostInfo>
 #include <QPair>
+#include <QQueue>
 #include <QStringList>
 #include <QTimer>
 #include <QTextCodec>
@@ -47,6 +51,12 @@ static const int LOGIN_TIMEOUT = 30000;
 static const int KEEP_ALIVE_INTERVAL = 60000;
 static const int CONNECTION_TIMEOUT = 90000;
 
+/* limits of outgoing messages queue */
+static const int MESSAGE_QUEUE_SIZE = 64;
+static const int MESSAGE_QUEUE_BYTES = 65536;
+/* maximum number of messages sent but not acknowledged by server */
+static const int MESSAGE_WINDOW = 16;
+
 namespace ICQ
 {
 
@@ -59,6 +69,19 @@ class Session::Private
 
         void startLogin();
         void processSnacError(SnacBuffer& snac);
+        void sendMessageNow(const QString& recipient, const QString& message);
+
+        /* message waiting to be sent, trace is 0 if the message is not traced */
+        struct QueuedMessage {
+            QString recipient;
+            QString text;
+            quint32 trace;
+        };
+        QQueue<QueuedMessage> messageQueue;
+        int messageQueueBytes;
+        quint64 droppedMessages;
+
+        QList<OfflineMessage> offlineMessages;
 
         typedef QPair<Word, QString> IntStringPair;
         static IntStringPair subtypeOneErrors[];
@@ -112,6 +135,9 @@ Session::Private::Private(Session *parent)
     socket = 0;
 
     codec = 0;
+
+    messageQueueBytes = 0;
+    droppedMessages = 0;
 }
 
 Session::Private::~Private()
@@ -152,6 +178,7 @@ void Session::Private::startLogin()
     connectTimer->start(LOGIN_TIMEOUT);
 
     socket = new Socket(q);
+    socket->setRecorder( Instrument::Recorder::create("icq-" + uin) );
     loginManager->setSocket(socket);
     socket->connectToHost(peer, port);
     qDebug() << "[ICQ:Session] connecting to" << peer.toString()+":"+QString::number(port,10);
@@ -245,6 +272,19 @@ void Session::disconnect()
     delete d->connectTimer; d->connectTimer     = 0;
     delete d->keepAliveTimer; d->keepAliveTimer = 0;
 
+    /* undelivered offline messages stay on server until next login */
+    d->offlineMessages.clear();
+
+    if ( !d->messageQueue.isEmpty() ) {
+        qDebug() << "[ICQ:Session]" << d->messageQueue.size() << "queued messages discarded";
+        d->droppedMessages += d->messageQueue.size();
+        foreach (const Private::QueuedMessage& queued, d->messageQueue) {
+            Instrument::MessageTracer::instance()->abandon(queued.trace);
+        }
+        d->messageQueue.clear();
+        d->messageQueueBytes = 0;
+    }
+
     d->connectionStatus = Disconnected;
     d->onlineStatus = Offline;
 
@@ -341,17 +381,157 @@ void Session::setCodecForMessages(QTextCodec *codec)
 
 /**
  * Sends @a message to @a recipient.
+ *
+ * Messages sent while logging in or while too many messages wait for server ack
+ * are queued. If the queue is full the message is dropped and error() is emitted.
  */
 void Session::sendMessage(const QString& recipient, const QString& message)
 {
-    if (!d->msgManager || !d->userInfoManager) {
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    quint32 trace = Instrument::MessageTracer::current(Instrument::MessageTracer::Outgoing);
+
+    if ( d->connectionStatus == Disconnected ) {
+        tracer->abandon(trace);
+        return;
+    }
+
+    bool ready = d->connectionStatus == Connected && d->messageQueue.isEmpty() && d->msgManager->unackedCount() < MESSAGE_WINDOW;
+    if ( ready ) {
+        d->sendMessageNow(recipient, message);
+        return;
+    }
+
+    if ( d->messageQueue.size() >= MESSAGE_QUEUE_SIZE || d->messageQueueBytes + message.size() > MESSAGE_QUEUE_BYTES ) {
+        qDebug() << "[ICQ:Session]" << "message queue is full, message to" << recipient << "dropped";
+        ++d->droppedMessages;
+        tracer->abandon(trace);
+        emit error( tr("Too many messages are waiting to be sent. Message to %1 was not delivered.").arg(recipient) );
+        return;
+    }
+
+    Private::QueuedMessage queued;
+    queued.recipient = recipient;
+    queued.text = message;
+    queued.trace = trace;
+    d->messageQueue.enqueue(queued);
+    d->messageQueueBytes += message.size();
+    tracer->mark(trace, "session-queued");
+}
+
+/**
+ * Sends queued messages while server acknowledges them fast enough.
+ */
+void Session::processMessageQueue()
+{
+    if ( d->connectionStatus != Connected ) {
         return;
     }
 
+    while ( !d->messageQueue.isEmpty() && d->msgManager->unackedCount() < MESSAGE_WINDOW ) {
+        Private::QueuedMessage queued = d->messageQueue.dequeue();
+        d->messageQueueBytes -= queued.text.size();
+
+        Instrument::TraceScope scope(queued.trace);
+        Instrument::MessageTracer::instance()->mark(queued.trace, "session-dequeued");
+        d->sendMessageNow(queued.recipient, queued.text);
+    }
+}
+
+/**
+ * Returns statistics of outgoing messages.
+ */
+Session::MessageStats Session::messageStats() const
+{
+    MessageStats stats;
+    stats.queued = d->messageQueue.size();
+    stats.queuedBytes = d->messageQueueBytes;
+    stats.dropped = d->droppedMessages;
+
+    if ( d->msgManager ) {
+        stats.unacked = d->msgManager->unackedCount();
+        stats.sent = d->msgManager->sentCount();
+        stats.acked = d->msgManager->ackedCount();
+        stats.expired = d->msgManager->expiredCount();
+        stats.totalLatency = d->msgManager->totalLatency();
+        stats.maxLatency = d->msgManager->maxLatency();
+    } else {
+        stats.unacked = 0;
+        stats.sent = stats.acked = stats.expired = stats.totalLatency = 0;
+        stats.maxLatency = 0;
+    }
+    return stats;
+}
+
+/**
+ * Returns estimated heap memory used by the session. The numbers are computed
+ * from container sizes and are approximate, but cheap enough to be polled periodically.
+ */
+Session::MemoryUsage Session::memoryUsage() const
+{
+    MemoryUsage usage;
+    usage.roster = d->ssiManager ? d->ssiManager->memoryUsage() : 0;
+    usage.rateQueues = d->rateManager ? d->rateManager->memoryUsage() : 0;
+
+    if ( d->userInfoManager ) {
+        usage.userInfo = d->userInfoManager->userInfoMemory();
+        usage.shortDetails = d->userInfoManager->shortDetailsMemory();
+        usage.fullDetails = d->userInfoManager->fullDetailsMemory();
+        usage.requests = d->userInfoManager->requestsMemory();
+    } else {
+        usage.userInfo = usage.shortDetails = usage.fullDetails = usage.requests = 0;
+    }
+
+    /* queue counts characters, not bytes */
+    usage.messages = qint64( d->messageQueueBytes ) * int( sizeof(QChar) )
+        + qint64( d->messageQueue.size() ) * 2 * (HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE);
+    foreach (const OfflineMessage& message, d->offlineMessages) {
+        usage.messages += sizeof(OfflineMessage) + heapSize(message.sender) + heapSize(message.text);
+    }
+    if ( d->msgManager ) {
+        usage.messages += d->msgManager->memoryUsage();
+    }
+    return usage;
+}
+
+/**
+ * Drops cached data which can be requested from the server again.
+ * Used when the session goes over its memory budget.
+ */
+void Session::trimCaches()
+{
+    if ( d->userInfoManager ) {
+        d->userInfoManager->clearDetailsCaches();
+    }
+}
+
+/**
+ * Returns offline messages received during login and removes them from the session.
+ * Once they are delivered, ackOfflineMessages() should be called.
+ * @sa offlineMessagesAvailable()
+ */
+QList<Session::OfflineMessage> Session::takeOfflineMessages()
+{
+    QList<OfflineMessage> messages = d->offlineMessages;
+    d->offlineMessages.clear();
+    return messages;
+}
+
+/**
+ * Tells server that offline messages were delivered, so it deletes them.
+ */
+void Session::ackOfflineMessages()
+{
+    if ( d->msgManager ) {
+        d->msgManager->deleteOfflineMessages();
+    }
+}
+
+void Session::Private::sendMessageNow(const QString& recipient, const QString& message)
+{
     Message msg;
 
-    UserInfo ui = d->userInfoManager->getUserInfo(recipient);
-    if ( d->userInfoManager->getUserStatus(recipient) == UserInfo::Offline || !ui.hasCapability( Capabilities[ccICQServerRelay] ) ) {
+    UserInfo ui = userInfoManager->getUserInfo(recipient);
+    if ( userInfoManager->getUserStatus(recipient) == UserInfo::Offline || !ui.hasCapability( Capabilities[ccICQServerRelay] ) ) {
         // qDebug() << "[ICQ:Session]" << "sending offline message via channel 1";
         msg.setChannel(0x01);
     } else {
@@ -359,11 +539,11 @@ void Session::sendMessage(const QString& recipient, const QString& message)
         msg.setChannel(0x02);
     }
 
-    msg.setSender(d->uin);
+    msg.setSender(uin);
     msg.setReceiver(recipient);
     msg.setType(Message::PlainText);
     msg.setText( message.toUtf8() );
-    d->msgManager->sendMessage(msg);
+    msgManager->sendMessage(msg);
 }
 
 /**
@@ -604,16 +784,17 @@ void Session::requestUserDetails(const QString& uin)
 }
 
 /**
- * Request short user details for @a uin from server.
+ * Request short user details for @a uin from server. @a background requests (e.g. refresh
+ * of cached details) have the lowest send priority.
  * @note this method does nothing if user is not connected to the server
  * @sa requestUserDetails(), userDetails(), shortUserDetails()
  */
-void Session::requestShortUserDetails(const QString& uin)
+void Session::requestShortUserDetails(const QString& uin, bool background)
 {
     if ( !d->userInfoManager ) {
         return;
     }
-    d->userInfoManager->requestShortDetails(uin);
+    d->userInfoManager->requestShortDetails(uin, background);
 }
 
 /**
@@ -766,12 +947,15 @@ void Session::processLoginDone()
     QObject::connect( d->userInfoManager, SIGNAL( userOffline(QString) ),    SIGNAL( userOffline(QString) ) );
     QObject::connect( d->userInfoManager, SIGNAL( userDetailsAvailable(QString) ), SIGNAL( userDetailsAvailable(QString) ) );
     QObject::connect( d->userInfoManager, SIGNAL( shortUserDetailsAvailable(QString) ), SIGNAL( shortUserDetailsAvailable(QString) ) );
-    QObject::connect( d->metaManager, SIGNAL( metaInfoAvailable(Word,Buffer&) ), d->userInfoManager, SLOT( incomingMetaInfo(Word,Buffer&) ) );
+    QObject::connect( d->metaManager, SIGNAL( metaInfoAvailable(Word,Word,Buffer&) ), d->userInfoManager, SLOT( incomingMetaInfo(Word,Word,Buffer&) ) );
     d->userInfoManager->setTextCodec(d->codec);
 
     d->msgManager = new MessageManager(d->socket, this);
-    QObject::connect( d->metaManager, SIGNAL( metaInfoAvailable(Word,Buffer&) ), d->msgManager, SLOT( incomingMetaInfo(Word,Buffer&) ) );
+    QObject::connect( d->metaManager, SIGNAL( metaInfoAvailable(Word,Word,Buffer&) ), d->msgManager, SLOT( incomingMetaInfo(Word,Word,Buffer&) ) );
     QObject::connect( d->msgManager, SIGNAL( incomingMessage(Message) ), SLOT( processIncomingMessage(Message) ) );
+    QObject::connect( d->msgManager, SIGNAL( offlineMessages(QList<Message>) ), SLOT( processOfflineMessages(QList<Message>) ) );
+    QObject::connect( d->msgManager, SIGNAL( messageAcked(QString,int) ), SLOT( processMessageQueue() ) );
+    QObject::connect( d->msgManager, SIGNAL( messageExpired(QString) ),   SLOT( processMessageQueue() ) );
     d->msgManager->setTextCodec(d->codec);
     d->msgManager->setUin(d->uin);
     d->msgManager->requestOfflineMessages();
@@ -788,6 +972,9 @@ void Session::processLoginDone()
 
     qDebug() << "[ICQ:Session]" << "Connected.";
     emit connected();
+
+    /* send messages queued while logging in */
+    processMessageQueue();
 }
 
 void Session::processSnac(SnacBuffer& snac)
@@ -826,6 +1013,35 @@ void Session::processIncomingMessage(const Message& msg)
     }
 }
 
+/**
+ * Collects plain text offline messages into a batch, which is delivered at once.
+ * If there is nothing to deliver, server is asked to delete stored messages right away.
+ */
+void Session::processOfflineMessages(const QList<Message>& messages)
+{
+    if ( !d->codec ) {
+        d->codec = QTextCodec::codecForName("Windows-1251");
+    }
+
+    foreach (const Message& msg, messages) {
+        if ( msg.type() != Message::PlainText ) {
+            processIncomingMessage(msg);
+            continue;
+        }
+        OfflineMessage offline;
+        offline.sender = msg.sender();
+        offline.text = msg.text(d->codec);
+        offline.timestamp = msg.timestamp();
+        d->offlineMessages << offline;
+    }
+
+    if ( d->offlineMessages.isEmpty() ) {
+        ackOfflineMessages();
+    } else {
+        emit offlineMessagesAvailable();
+    }
+}
+
 void Session::processFlap(FlapBuffer& flap)
 {
     if ( flap.channel() == FlapBuffer::CloseChannel ) {
@@ -980,6 +1196,12 @@ QString Session::Private::errDescForCode(Word errorCode)
  * This signal is emitted when the user receives an offline message from @a uin sent at @a timestamp
  */
 
+/**
+ * @fn void Session::offlineMessagesAvailable()
+ * This signal is emitted once per login when offline messages stored on server were received.
+ * @sa takeOfflineMessages(), ackOfflineMessages()
+ */
+
 /**
  * @fn void Session::shortUserDetailsAvailable(const QString& uin)
  * This signal is emitted when the user receives previously requested short user details
@@ -21,9 +21,10 @@
 #ifndef ICQ_SESSION_H_
 #define ICQ_SESSION_H_
 
+#include <QDateTime>
+#include <QList>
 #include <QObject>
 
-class QDateTime;
 class QHostInfo;
 class QString;
 class QStringList;
@@ -49,6 +50,39 @@ class Session : public QObject
         enum ConnectionStatus { Disconnected, Connecting, Connected };
         enum OnlineStatus { Online, FreeForChat, Away, NotAvailable, Occupied, DoNotDisturb, Offline };
 
+        /* outgoing messages statistics */
+        struct MessageStats {
+            int queued;             /* messages waiting in session queue */
+            int queuedBytes;        /* size of queued message texts */
+            int unacked;            /* messages sent, but not acknowledged by server */
+            quint64 sent;
+            quint64 acked;
+            quint64 expired;        /* messages which were never acknowledged */
+            quint64 dropped;        /* messages rejected because queue was full */
+            quint64 totalLatency;   /* msecs */
+            int maxLatency;         /* msecs */
+        };
+
+        /* estimated heap memory used by the session (bytes) */
+        struct MemoryUsage {
+            qint64 roster;          /* server-side contact list */
+            qint64 userInfo;        /* info and statuses of online contacts */
+            qint64 shortDetails;    /* cached short user details */
+            qint64 fullDetails;     /* cached full user details */
+            qint64 requests;        /* pending details requests */
+            qint64 messages;        /* queued, unacked and offline messages */
+            qint64 rateQueues;      /* packets delayed by rate limits */
+
+            qint64 total() const { return roster + userInfo + shortDetails + fullDetails + requests + messages + rateQueues; }
+        };
+
+        /* message stored on server while user was offline */
+        struct OfflineMessage {
+            QString sender;
+            QString text;
+            QDateTime timestamp;
+        };
+
         Session(QObject *parent = 0);
         virtual ~Session();
 
@@ -65,6 +99,12 @@ class Session : public QObject
 
         void setCodecForMessages(QTextCodec *codec);
         void sendMessage(const QString& recipient, const QString& message);
+        MessageStats messageStats() const;
+        MemoryUsage memoryUsage() const;
+        void trimCaches();
+
+        QList<OfflineMessage> takeOfflineMessages();
+        void ackOfflineMessages();
 
         ConnectionStatus connectionStatus() const;
         QStringList contactList() const;
@@ -82,7 +122,7 @@ class Session : public QObject
 
         void requestOwnUserDetails();
         void requestUserDetails(const QString& uin);
-        void requestShortUserDetails(const QString& uin);
+        void requestShortUserDetails(const QString& uin, bool background = false);
 
         ShortUserDetails shortUserDetails(const QString& uin) const;
         UserDetails userDetails(const QString& uin) const;
@@ -107,6 +147,7 @@ class Session : public QObject
 
         void incomingMessage(const QString& uin, const QString& msg);
         void incomingMessage(const QString& uin, const QString& msg, const QDateTime& timestamp);
+        void offlineMessagesAvailable();
 
         void shortUserDetailsAvailable(const QString& uin);
         void userDetailsAvailable(const QString& uin);
@@ -121,8 +162,10 @@ class Session : public QObject
         void processSnac(SnacBuffer& snac);
         void processFlap(FlapBuffer& flap);
         void processIncomingMessage(const Message& msg);
+        void processOfflineMessages(const QList<Message>& messages);
         void processUserStatus(const QString& uin, int status);
         void processStatusChanged(int status);
+        void processMessageQueue();
         void sendKeepAlive();
     private:
         Q_DISABLE_COPY(Session);
@@ -26,6 +26,12 @@
 #include "managers/icqRateManager.h"
 #include "managers/icqMetaInfoManager.h"
 
+#include "messagetracer.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "recorder.h"
+
+#include <QHash>
 #include <QHostAddress>
 #include <QPair>
 #include <QTcpSocket>
@@ -45,7 +51,14 @@ class Socket::Private
         Word flapID();
         DWord snacID();
 
+        enum Direction { In, Out };
+        static void countFlap(Direction direction, int size);
+        static void countSnac(Direction direction, Word family, int size);
+
         QTcpSocket *socket;
+        /* socket or a device set with setIODevice() */
+        QIODevice *device;
+        Instrument::Recorder *recorder;
 
         RateManager     *rateManager;
         MetaInfoManager *metaManager;
@@ -57,6 +70,8 @@ class Socket::Private
 Socket::Private::Private()
 {
     socket = 0;
+    device = 0;
+    recorder = 0;
     rateManager = 0;
     metaManager = 0;
 
@@ -67,6 +82,7 @@ Socket::Private::Private()
 Socket::Private::~Private()
 {
     delete socket;
+    delete recorder;
 }
 
 Word Socket::Private::flapID()
@@ -79,6 +95,44 @@ DWord Socket::Private::snacID()
     return ++m_snacID;
 }
 
+/**
+ * Accounts FLAP packet of @a size bytes in the gateway-wide metrics.
+ */
+void Socket::Private::countFlap(Direction direction, int size)
+{
+    static Instrument::Counter *bytes[2] = { 0, 0 };
+    if ( !bytes[direction] ) {
+        bytes[direction] = Instrument::Registry::instance()->counter( "icq_socket_bytes_total",
+                "Bytes of FLAP packets sent to and received from ICQ servers",
+                direction == In ? "direction=\"in\"" : "direction=\"out\"" );
+    }
+    bytes[direction]->inc(size);
+}
+
+/**
+ * Accounts SNAC packet of @a family in the gateway-wide metrics.
+ */
+void Socket::Private::countSnac(Direction direction, Word family, int size)
+{
+    typedef QPair<Instrument::Counter*, Instrument::Counter*> Counters;
+    static QHash<uint, Counters> counters;
+
+    uint key = (uint(direction) << 16) | family;
+    QHash<uint, Counters>::iterator it = counters.find(key);
+    if ( it == counters.end() ) {
+        QString labels = QString("direction=\"%1\",family=\"%2\"")
+            .arg( direction == In ? "in" : "out" )
+            .arg( family, 2, 16, QChar('0') );
+        Instrument::Registry *registry = Instrument::Registry::instance();
+        Counters c;
+        c.first = registry->counter("icq_snac_packets_total", "SNAC packets by family", labels);
+        c.second = registry->counter("icq_snac_bytes_total", "SNAC bytes by family", labels);
+        it = counters.insert(key, c);
+    }
+    it->first->inc();
+    it->second->inc(size);
+}
+
 /**
  * @class Socket
  * @brief represents icq flap/snac transfer socket.
@@ -104,6 +158,7 @@ Socket::~Socket()
 void Socket::connectToHost(const QHostAddress& host, quint16 port)
 {
     d->socket = new QTcpSocket(this);
+    d->device = d->socket;
     QObject::connect( d->socket, SIGNAL( readyRead() ), SLOT( processIncomingData() ) );
     d->socket->connectToHost(host, port);
 }
@@ -114,11 +169,36 @@ void Socket::connectToHost(const QHostAddress& host, quint16 port)
 void Socket::disconnectFromHost()
 {
     if ( !d->socket ) {
+        d->device = 0;
         return;
     }
     d->socket->disconnectFromHost();
     d->socket->deleteLater();
     d->socket = 0;
+    d->device = 0;
+}
+
+/**
+ * Uses @a device instead of a TCP connection, e.g. to replay recorded traffic.
+ * The device is not owned by the socket.
+ */
+void Socket::setIODevice(QIODevice *device)
+{
+    if ( d->device ) {
+        QObject::disconnect( d->device, SIGNAL( readyRead() ), this, SLOT( processIncomingData() ) );
+    }
+    d->device = device;
+    QObject::connect( d->device, SIGNAL( readyRead() ), SLOT( processIncomingData() ) );
+}
+
+/**
+ * Writes all traffic of this connection with @a recorder, which is owned by the socket
+ * since then. Null disables recording.
+ */
+void Socket::setRecorder(Instrument::Recorder *recorder)
+{
+    delete d->recorder;
+    d->recorder = recorder;
 }
 
 /**
@@ -147,20 +227,20 @@ void Socket::snacRequest(Word family, Word subtype)
     write( SnacBuffer(family, subtype) );
 }
 
-void Socket::sendMetaRequest(Word type)
+Word Socket::sendMetaRequest(Word type, SnacPriority priority)
 {
     if ( !d->metaManager ) {
-        return;
+        return 0;
     }
-    d->metaManager->sendMetaRequest(type);
+    return d->metaManager->sendMetaRequest(type, priority);
 }
 
-void Socket::sendMetaRequest(Word type, Buffer& data)
+Word Socket::sendMetaRequest(Word type, Buffer& data, SnacPriority priority)
 {
     if ( !d->metaManager ) {
-        return;
+        return 0;
     }
-    d->metaManager->sendMetaRequest(type, data);
+    return d->metaManager->sendMetaRequest(type, data, priority);
 }
 
 /**
@@ -181,16 +261,22 @@ void Socket::write(FlapBuffer* flap)
 
     // qDebug() << "[ICQ:Socket] >> flap channel" << flap->channel() << "len" << flap->size() << "sequence" << QByteArray::number(flap->sequence(), 16);
     // qDebug() << "[ICQ:Socket] >> flap data" << flap->data().toHex().toUpper();
-    d->socket->write( flap->data() );
+    QByteArray data = flap->data();
+    d->device->write(data);
+    if ( d->recorder ) {
+        d->recorder->record(Instrument::Recorder::Out, data);
+    }
+    Private::countFlap( Private::Out, data.size() );
 }
 
 /**
- * Sends SNAC packet to the server.
+ * Sends SNAC packet to the server. If the rate limit doesn't allow to send it now, the packet
+ * is queued with the given @a priority.
  */
-void Socket::write(const SnacBuffer& snac)
+void Socket::write(const SnacBuffer& snac, SnacPriority priority)
 {
     if ( d->rateManager && !d->rateManager->canSend(snac) ) {
-        d->rateManager->enqueue(snac);
+        d->rateManager->enqueue(snac, priority);
     } else {
         writeForced( const_cast<SnacBuffer*>(&snac) );
     }
@@ -204,6 +290,11 @@ void Socket::writeForced(SnacBuffer* snac)
     snac->setRequestId( d->snacID() );
 
     write( dynamic_cast<FlapBuffer*>(snac) );
+    Private::countSnac( Private::Out, snac->family(), snac->size() );
+    Instrument::MessageTracer::instance()->mark( Instrument::MessageTracer::current(Instrument::MessageTracer::Outgoing), "socket-write" );
+    if ( d->rateManager ) {
+        d->rateManager->packetSent(*snac);
+    }
 
     /*qDebug() << "[ICQ:Socket] >>"
         << "snac head: family"
@@ -215,31 +306,37 @@ void Socket::writeForced(SnacBuffer* snac)
 
 void Socket::processIncomingData()
 {
-    if ( !d->socket ) {
+    if ( !d->device ) {
         return;
     }
 
-    if ( d->socket->bytesAvailable() < FLAP_HEADER_SIZE ) {
+    if ( d->device->bytesAvailable() < FLAP_HEADER_SIZE ) {
         /* we don't have a header at this point */
         return;
     }
 
-    FlapBuffer flap = FlapBuffer::fromRawData( d->socket->peek(FLAP_HEADER_SIZE) );
+    FlapBuffer flap = FlapBuffer::fromRawData( d->device->peek(FLAP_HEADER_SIZE) );
 
-    if (flap.flapDataSize() > (d->socket->bytesAvailable() - FLAP_HEADER_SIZE) ) {
+    if (flap.flapDataSize() > (d->device->bytesAvailable() - FLAP_HEADER_SIZE) ) {
         /* we don't need an incomplete packet */
         return;
     }
 
-    d->socket->seek(FLAP_HEADER_SIZE);
+    /* skip the header peeked above */
+    QByteArray header = d->device->read(FLAP_HEADER_SIZE);
 
-    flap.setData( d->socket->read( flap.flapDataSize() ) );
+    QByteArray data = d->device->read( flap.flapDataSize() );
+    flap.setData(data);
+    if ( d->recorder ) {
+        d->recorder->record( Instrument::Recorder::In, header + data );
+    }
+    Private::countFlap( Private::In, FLAP_HEADER_SIZE + flap.flapDataSize() );
 
     /* now we emit an incoming flap signal, which will be catched by various
      * services (login manager, rate manager, etc) */
     if ( flap.channel() != FlapBuffer::DataChannel ) {
         emit incomingFlap(flap);
-        if ( !d->socket ) {
+        if ( !d->device ) {
             qDebug() << "[ICQ:Socket] Socket was closed after emitting incomingFlap signal";
             return;
         }
@@ -247,6 +344,7 @@ void Socket::processIncomingData()
 
     if ( flap.channel() == FlapBuffer::DataChannel && flap.pos() == 0 ) { // pos == 0 means that flap wasn't touched by flap handlers.
         SnacBuffer snac = flap;
+        Private::countSnac( Private::In, snac.family(), snac.size() );
 
         /*qDebug()
             << "[ICQ:Socket] << snac head: family" << QByteArray::number(snac.family(), 16)
@@ -280,8 +378,13 @@ void Socket::processIncomingData()
             snac.seekEnd();
         }
 
-        emit incomingSnac(snac);
-        if ( !d->socket ) {
+        {
+            static Instrument::Histogram *duration = Instrument::Registry::instance()->histogram(
+                    "handler_duration_seconds", "Time spent in event handlers", "handler=\"icq-snac\"" );
+            Instrument::ProfileScope scope( duration, "icq-snac", snac.family(), snac.subtype() );
+            emit incomingSnac(snac);
+        }
+        if ( !d->device ) {
             qDebug() << "[ICQ:Socket] Socket was closed after emitting incomingSnac signal";
             return;
         }
@@ -291,7 +394,7 @@ void Socket::processIncomingData()
         }
     }
 
-    if ( d->socket->bytesAvailable() > 0 ) {
+    if ( d->device->bytesAvailable() > 0 ) {
         processIncomingData();
     }
 }
@@ -26,6 +26,11 @@
 #include "types/icqTypes.h"
 
 class QHostAddress;
+class QIODevice;
+
+namespace Instrument {
+    class Recorder;
+}
 
 namespace ICQ
 {
@@ -49,17 +54,20 @@ class Socket : public QObject
         void connectToHost(const QHostAddress& host, quint16 port);
         void disconnectFromHost();
 
+        void setIODevice(QIODevice *device);
+        void setRecorder(Instrument::Recorder *recorder);
+
         void setRateManager(RateManager *ptr);
         void setMetaManager(MetaInfoManager *ptr);
 
         void snacRequest(Word family, Word subtype);
 
-        void sendMetaRequest(Word type);
-        void sendMetaRequest(Word type, Buffer& data);
+        Word sendMetaRequest(Word type, SnacPriority priority);
+        Word sendMetaRequest(Word type, Buffer& data, SnacPriority priority = spLookup);
 
         void write(const FlapBuffer& flap);
         void write(FlapBuffer* flap);
-        void write(const SnacBuffer& snac);
+        void write(const SnacBuffer& snac, SnacPriority priority = spDefault);
 
         void writeForced(SnacBuffer* snac);
     signals:
@@ -22,19 +22,39 @@
 #include "icqSocket.h"
 
 #include "types/icqMessage.h"
+#include "types/icqRateClock.h"
 #include "types/icqSnacBuffer.h"
 #include "types/icqTlvChain.h"
 #include "types/icqTypes.h"
 
+#include "messagetracer.h"
+
+#include <QCryptographicHash>
 #include <QDateTime>
+#include <QHash>
+#include <QSet>
 #include <QTextCodec>
+#include <QTimer>
+#include <QtDebug>
 
 namespace ICQ
 {
 
+/* messages which were not acknowledged during this time (msecs) are forgotten */
+static const int MESSAGE_ACK_TIMEOUT = 120000;
+static const int MESSAGE_ACK_CHECK_INTERVAL = 30000;
 
 class MessageManager::Private {
     public:
+        /* message waiting for server ack */
+        struct PendingAck {
+            QString uin;
+            qint64 sent;
+            quint32 trace;
+        };
+
+        static QByteArray makeCookie();
+
         void send_channel_1_message(const Message& msg);
         void send_channel_2_message(const Message& msg);
         void send_channel_4_message(const Message& msg);
@@ -42,71 +62,83 @@ class MessageManager::Private {
         void processServerAck(SnacBuffer& snac); /* SNAC(04,0B) */
         void processMessageAck(SnacBuffer& snac); /* SNAC(04,0C) */
 
+        MessageManager *q;
+
         QString uin;
         Socket *socket;
         QTextCodec *codec;
-};
-
-void MessageManager::Private::send_channel_1_message(const Message& msg)
-{
-    SnacBuffer snac(0x04,0x06);
-
-    DWord r1 = qrand(), r2 = qrand();
-
-    snac.addDWord(r1);
-    snac.addDWord(r2);
-    snac.addWord( msg.channel() );
-    snac.addByte( msg.receiver().length() );
-    snac.addData( msg.receiver() );
-
-    Tlv msgData(0x02);
 
-    msgData.addByte(0x05); // fragment id
-    msgData.addByte(0x01); // fragment version
-    msgData.addWord(1); // next data len
-    msgData.addByte(1); // required caps, 1 - text.
+        /* offline messages received during this login */
+        QList<Message> offlineBatch;
+        QSet<QByteArray> offlineDigests;
 
-    Buffer msgChunk;
-    msgChunk.addWord(0x0000); // charset
-    msgChunk.addWord(0x0000); // lang num
-    msgChunk.addData( codec->fromUnicode( QString::fromUtf8(msg.text()) ) );
+        /* sent messages waiting for ack, key is icbm cookie */
+        QHash<QByteArray,PendingAck> pendingAcks;
+        QTimer *ackTimer;
 
-    msgData.addByte(0x01); // fragment id: message
-    msgData.addByte(0x01); // fragment version
-    msgData.addWord( msgChunk.size() ); // next data len
-    msgData.addData(msgChunk);
-
-    snac.addTlv(msgData);
-    snac.addTlv( Tlv(0x06) ); // store if recipient offline
+        quint64 sentCount;
+        quint64 ackedCount;
+        quint64 expiredCount;
+        quint64 totalLatency;
+        int maxLatency;
+};
 
-    socket->write(snac);
+QByteArray MessageManager::Private::makeCookie()
+{
+    Buffer cookie;
+    cookie.addDWord( qrand() );
+    cookie.addDWord( qrand() );
+    return cookie.data();
 }
 
-void MessageManager::Private::send_channel_2_message(const Message& msg)
+/* helpers for patching variable parts into message templates */
+static inline void appendWord(QByteArray& data, Word value)
 {
-    SnacBuffer snac(0x04,0x06);
+    data.append( char(value >> 8) );
+    data.append( char(value) );
+}
 
-    DWord r1 = qrand(), r2 = qrand();
+static inline void appendLEWord(QByteArray& data, Word value)
+{
+    data.append( char(value) );
+    data.append( char(value >> 8) );
+}
 
-    snac.addDWord(r1);
-    snac.addDWord(r2);
-    snac.addWord( msg.channel() );
-    snac.addByte( msg.receiver().length() );
-    snac.addData( msg.receiver() );
+/**
+ * Constant parts of channel 1 and channel 2 ICBM layouts.
+ * They are built once and only copied into outgoing messages.
+ */
+struct IcbmTemplates
+{
+    IcbmTemplates();
+
+    QByteArray ch1Caps;     /* required capabilities fragment */
+    QByteArray ch2Caps;     /* server relay capability, TLV(0x0A), TLV(0x0F) and TLV(0x2711) type */
+    QByteArray ch2Chunks;   /* protocol version and downcounter chunks with their lengths */
+    QByteArray ch2Codes;    /* status and priority codes */
+    QByteArray ch2Trailer;  /* null-terminator, colors and UTF-8 capability string */
+    QByteArray ackTlv;      /* request server ack */
+    QByteArray storeTlv;    /* store if recipient offline */
+};
 
-    Tlv msgTlv(0x05);
-    msgTlv.addWord(0x00); // msg type - request
-    msgTlv.addDWord( r1 ); // cookie part1
-    msgTlv.addDWord( r2 ); // cookie part2
-    msgTlv.addData( Capabilities[ccICQServerRelay] );
+IcbmTemplates::IcbmTemplates()
+{
+    Buffer caps;
+    caps.addByte(0x05); // fragment id
+    caps.addByte(0x01); // fragment version
+    caps.addWord(1); // next data len
+    caps.addByte(1); // required caps, 1 - text.
+    ch1Caps = caps.data();
 
     Tlv tlv0A(0x0A);
     tlv0A.addWord(0x01);
 
-    Tlv tlv0F(0x0F);
-
-    msgTlv.addData(tlv0A);
-    msgTlv.addData(tlv0F);
+    Buffer relay;
+    relay.addData( Capabilities[ccICQServerRelay] );
+    relay.addData(tlv0A);
+    relay.addData( Tlv(0x0F) );
+    relay.addWord(0x2711);
+    ch2Caps = relay.data();
 
     Buffer chunk1;
     chunk1.addLEWord(9); // protocol version
@@ -122,34 +154,110 @@ void MessageManager::Private::send_channel_2_message(const Message& msg)
     chunk2.addDWord(0);
     chunk2.addDWord(0);
 
-    Buffer msgChunk;
-    msgChunk.addByte( msg.type() );
-    msgChunk.addByte( msg.flags() );
-    msgChunk.addLEWord(5); // status code
-    msgChunk.addLEWord(2); // priority code
-    QByteArray text = msg.text();
-    msgChunk.addLEWord(text.length() + 1); // msg len
-    msgChunk.addData(text);
-    msgChunk.addByte(0); // null-terminated string.
-    msgChunk.addDWord(0x0); // text color
-    msgChunk.addDWord(0xffffff00); // bg color
+    Buffer chunks;
+    chunks.addLEWord( chunk1.size() );
+    chunks.addData(chunk1);
+    chunks.addLEWord( chunk2.size() );
+    chunks.addData(chunk2);
+    ch2Chunks = chunks.data();
+
+    Buffer codes;
+    codes.addLEWord(5); // status code
+    codes.addLEWord(2); // priority code
+    ch2Codes = codes.data();
 
     QString guidStr = "{" + Capabilities[ccUTF8Messages].toString() + "}"; // UTF-8
-    msgChunk.addLEDWord( guidStr.length() );
-    msgChunk.addData(guidStr);
+    Buffer trailer;
+    trailer.addByte(0); // null-terminated string.
+    trailer.addDWord(0x0); // text color
+    trailer.addDWord(0xffffff00); // bg color
+    trailer.addLEDWord( guidStr.length() );
+    trailer.addData(guidStr);
+    ch2Trailer = trailer.data();
+
+    ackTlv = Tlv(0x03).data();
+    storeTlv = Tlv(0x06).data();
+}
 
-    Tlv extData(0x2711); // TLV 0x2711
+static const IcbmTemplates& icbmTemplates()
+{
+    static const IcbmTemplates templates;
+    return templates;
+}
+
+/**
+ * Appends cookie, channel and recipient, which start every ICBM.
+ */
+static void appendIcbmHeader(QByteArray& data, const Message& msg)
+{
+    QByteArray receiver = msg.receiver().toLocal8Bit();
+
+    data.append( msg.icbmCookie() );
+    appendWord( data, msg.channel() );
+    data.append( char( receiver.size() ) );
+    data.append(receiver);
+}
 
-    extData.addLEWord( chunk1.size() );
-    extData.addData(chunk1);
-    extData.addLEWord( chunk2.size() );
-    extData.addData(chunk2);
-    extData.addData(msgChunk);
+void MessageManager::Private::send_channel_1_message(const Message& msg)
+{
+    const IcbmTemplates& tpl = icbmTemplates();
+
+    QByteArray text = codec->fromUnicode( QString::fromUtf8(msg.text()) );
+    Word chunkLen = 4 + text.size(); // charset, lang num, text
+    Word tlvLen = tpl.ch1Caps.size() + 4 + chunkLen;
+
+    QByteArray data;
+    data.reserve( 11 + msg.receiver().size() + 4 + tlvLen + tpl.ackTlv.size() + tpl.storeTlv.size() );
 
-    msgTlv.addData(extData);
+    appendIcbmHeader(data, msg);
 
-    snac.addData( msgTlv.data() );
+    appendWord(data, 0x02); // message data tlv
+    appendWord(data, tlvLen);
+    data.append(tpl.ch1Caps);
+    data.append( char(0x01) ); // fragment id: message
+    data.append( char(0x01) ); // fragment version
+    appendWord(data, chunkLen); // next data len
+    appendWord(data, 0x0000); // charset
+    appendWord(data, 0x0000); // lang num
+    data.append(text);
 
+    data.append(tpl.ackTlv);
+    data.append(tpl.storeTlv);
+
+    SnacBuffer snac(0x04, 0x06, data);
+    socket->write(snac);
+}
+
+void MessageManager::Private::send_channel_2_message(const Message& msg)
+{
+    const IcbmTemplates& tpl = icbmTemplates();
+
+    QByteArray text = msg.text();
+    Word extLen = tpl.ch2Chunks.size() + 2 + tpl.ch2Codes.size() + 2 + text.size() + tpl.ch2Trailer.size();
+    Word tlvLen = 2 + 8 + tpl.ch2Caps.size() + 2 + extLen; // msg type, cookie, caps, tlv 0x2711
+
+    QByteArray data;
+    data.reserve( 11 + msg.receiver().size() + 4 + tlvLen + tpl.ackTlv.size() );
+
+    appendIcbmHeader(data, msg);
+
+    appendWord(data, 0x05); // rendezvous tlv
+    appendWord(data, tlvLen);
+    appendWord(data, 0x00); // msg type - request
+    data.append( msg.icbmCookie() );
+    data.append(tpl.ch2Caps);
+    appendWord(data, extLen); // tlv 0x2711 length
+    data.append(tpl.ch2Chunks);
+    data.append( char( msg.type() ) );
+    data.append( char( msg.flags() ) );
+    data.append(tpl.ch2Codes);
+    appendLEWord(data, text.size() + 1); // msg len
+    data.append(text);
+    data.append(tpl.ch2Trailer);
+
+    data.append(tpl.ackTlv);
+
+    SnacBuffer snac(0x04, 0x06, data);
     socket->write(snac);
 }
 
@@ -183,20 +291,44 @@ void MessageManager::Private::processMessageAck(SnacBuffer& snac)
 
     Q_UNUSED(channel)
 
-    // qDebug() << "[ICQ:MM] Msg ACK." << "Msg delivered to" << uin << "via channel" << channel;
+    QHash<QByteArray,PendingAck>::iterator it = pendingAcks.find(cookie);
+    if ( it == pendingAcks.end() ) {
+        return;
+    }
+    int latency = int( RateClock::system()->msecs() - it->sent );
+    Instrument::MessageTracer::instance()->finish(it->trace, "server-ack");
+    pendingAcks.erase(it);
+
+    ++ackedCount;
+    totalLatency += latency;
+    maxLatency = qMax(maxLatency, latency);
+
+    // qDebug() << "[ICQ:MM] Msg ACK." << "Msg delivered to" << uin << "via channel" << channel << "in" << latency << "ms";
+    emit q->messageAcked(uin, latency);
 }
 
 MessageManager::MessageManager(Socket *socket, QObject *parent)
     : QObject(parent)
 {
     d = new Private;
+    d->q = this;
     d->socket = socket;
 
+    d->sentCount = d->ackedCount = d->expiredCount = d->totalLatency = 0;
+    d->maxLatency = 0;
+
+    d->ackTimer = new QTimer(this);
+    d->ackTimer->setInterval(MESSAGE_ACK_CHECK_INTERVAL);
+    QObject::connect( d->ackTimer, SIGNAL( timeout() ), SLOT( expireAcks() ) );
+
     QObject::connect(d->socket, SIGNAL( incomingSnac(SnacBuffer&) ), SLOT( incomingSnac(SnacBuffer&) ) );
 }
 
 MessageManager::~MessageManager()
 {
+    foreach (const Private::PendingAck& pending, d->pendingAcks) {
+        Instrument::MessageTracer::instance()->abandon(pending.trace);
+    }
     delete d;
 }
 
@@ -212,11 +344,25 @@ void MessageManager::setUin(const QString& uin)
 
 void MessageManager::requestOfflineMessages()
 {
-    d->socket->sendMetaRequest(0x3C);
+    /* offline messages must not be dropped with lookups under the rate limit */
+    d->socket->sendMetaRequest(0x3C, spInteractive);
 }
 
-void MessageManager::sendMessage(const Message& msg)
+/**
+ * Sends @a message and tracks it by its icbm cookie until the server acknowledges it.
+ * Returns the cookie (it is generated if the message doesn't have one).
+ */
+QByteArray MessageManager::sendMessage(const Message& message)
 {
+    Message msg(message);
+    if ( msg.icbmCookie().size() != 8 ) {
+        msg.setIcbmCookie( Private::makeCookie() );
+    }
+
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    quint32 trace = Instrument::MessageTracer::current(Instrument::MessageTracer::Outgoing);
+    tracer->mark(trace, "icbm");
+
     switch ( msg.channel() ) {
         case 1:
             d->send_channel_1_message(msg);
@@ -226,10 +372,104 @@ void MessageManager::sendMessage(const Message& msg)
             break;
         case 4:
             d->send_channel_4_message(msg);
-            break;
+            /* system messages are not acknowledged */
+            tracer->finish(trace, "sent");
+            return msg.icbmCookie();
         default:
             qCritical("[ICQ:MM] unknown msg channel: %d", msg.channel());
-            break;
+            tracer->abandon(trace);
+            return QByteArray();
+    }
+
+    Private::PendingAck pending;
+    pending.uin = msg.receiver();
+    pending.sent = RateClock::system()->msecs();
+    pending.trace = trace;
+    d->pendingAcks.insert(msg.icbmCookie(), pending);
+    ++d->sentCount;
+    if ( !d->ackTimer->isActive() ) {
+        d->ackTimer->start();
+    }
+    return msg.icbmCookie();
+}
+
+/**
+ * Returns number of sent messages, which were not acknowledged yet.
+ */
+int MessageManager::unackedCount() const
+{
+    return d->pendingAcks.size();
+}
+
+/**
+ * Returns estimated heap memory used by unacknowledged and offline messages in bytes.
+ */
+qint64 MessageManager::memoryUsage() const
+{
+    qint64 size = 0;
+    QHashIterator<QByteArray,Private::PendingAck> ai(d->pendingAcks);
+    while ( ai.hasNext() ) {
+        ai.next();
+        size += HASH_NODE_SIZE + heapSize( ai.key() ) + heapSize( ai.value().uin );
+    }
+    foreach (const Message& msg, d->offlineBatch) {
+        size += HEAP_BLOCK_OVERHEAD + msg.memoryUsage();
+    }
+    size += d->offlineDigests.size() * (HASH_NODE_SIZE + HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE + 16);
+    return size;
+}
+
+quint64 MessageManager::sentCount() const
+{
+    return d->sentCount;
+}
+
+quint64 MessageManager::ackedCount() const
+{
+    return d->ackedCount;
+}
+
+/**
+ * Returns number of messages, which were not acknowledged in time.
+ */
+quint64 MessageManager::expiredCount() const
+{
+    return d->expiredCount;
+}
+
+/**
+ * Returns sum of delivery latencies (msecs) of all acknowledged messages.
+ */
+quint64 MessageManager::totalLatency() const
+{
+    return d->totalLatency;
+}
+
+int MessageManager::maxLatency() const
+{
+    return d->maxLatency;
+}
+
+/**
+ * Forgets messages which were not acknowledged in time.
+ */
+void MessageManager::expireAcks()
+{
+    qint64 now = RateClock::system()->msecs();
+
+    QMutableHashIterator<QByteArray,Private::PendingAck> it(d->pendingAcks);
+    while ( it.hasNext() ) {
+        it.next();
+        if ( now - it.value().sent >= MESSAGE_ACK_TIMEOUT ) {
+            qDebug() << "[ICQ:MM]" << "no ack for message to" << it.value().uin;
+            emit messageExpired( it.value().uin );
+            Instrument::MessageTracer::instance()->abandon( it.value().trace );
+            it.remove();
+            ++d->expiredCount;
+        }
+    }
+    if ( d->pendingAcks.isEmpty() ) {
+        d->ackTimer->stop();
     }
 }
 
@@ -372,6 +612,9 @@ Message MessageManager::handle_channel_4_msg(TlvChain& chain)
 
 void MessageManager::handle_incoming_message(SnacBuffer& snac)
 {
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    quint32 trace = tracer->begin(Instrument::MessageTracer::Incoming, "icq-received");
+
     QByteArray icbmCookie = snac.read(8); // msg-id cookie
     Word msgChannel = snac.getWord();
     Byte uinLen = snac.getByte();
@@ -409,6 +652,7 @@ void MessageManager::handle_incoming_message(SnacBuffer& snac)
     if ( !msg.isValid() ) {
         qWarning( "[ICQ:MM] [User: %s] Incoming message processing failed. Message is not valid.", qPrintable(d->uin) );
         qWarning( "[ICQ:MM] [User: %s] Dumping message SNAC: %s", qPrintable(d->uin), snac.data().toHex().constData() );
+        tracer->abandon(trace);
         return;
     }
 
@@ -422,7 +666,13 @@ void MessageManager::handle_incoming_message(SnacBuffer& snac)
 
     // qDebug() << "[ICQ:MM]" << "type" << msg.type() << "flags" << msg.flags() << "message" << msg.text();
 
-    emit incomingMessage(msg);
+    tracer->mark(trace, "icq-parsed");
+    {
+        Instrument::TraceScope scope(trace);
+        emit incomingMessage(msg);
+    }
+    /* messages which didn't reach the jabber user (e.g. auth requests) are not traced further */
+    tracer->abandon(trace);
 }
 
 void MessageManager::handle_offline_message(Buffer& data)
@@ -456,16 +706,41 @@ void MessageManager::handle_offline_message(Buffer& data)
     msg.setTimestamp(timestamp);
     msg.setOffline(true);
 
-    emit incomingMessage(msg);
+    /* server may store the same message several times */
+    QCryptographicHash digest(QCryptographicHash::Md5);
+    digest.addData( QByteArray::number(senderUin) );
+    digest.addData( timestamp.toString(Qt::ISODate).toLatin1() );
+    digest.addData(message);
+    if ( d->offlineDigests.contains( digest.result() ) ) {
+        return;
+    }
+    d->offlineDigests.insert( digest.result() );
+
+    d->offlineBatch << msg;
 }
 
-void MessageManager::incomingMetaInfo(Word type, Buffer& data)
+/**
+ * Asks server to delete stored offline messages. It should be called only after
+ * the messages were delivered to the user.
+ */
+void MessageManager::deleteOfflineMessages()
+{
+    d->socket->sendMetaRequest(0x3E, spInteractive);
+}
+
+void MessageManager::incomingMetaInfo(Word type, Word sequence, Buffer& data)
 {
+    Q_UNUSED(sequence)
+
     if ( type == 0x41 ) { // offline message block
         handle_offline_message(data);
-    } else if ( type == 0x42 ) {
-        /* delete offline messages */
-        d->socket->sendMetaRequest(0x3E);
+    } else if ( type == 0x42 ) { // end of offline messages
+        QList<Message> batch = d->offlineBatch;
+        d->offlineBatch.clear();
+        d->offlineDigests.clear();
+
+        qDebug() << "[ICQ:MM]" << batch.size() << "offline messages for" << d->uin;
+        emit offlineMessages(batch);
     }
 }
 
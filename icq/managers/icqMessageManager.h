@@ -21,6 +21,7 @@
 #ifndef ICQMESSAGEMANAGER_H_
 #define ICQMESSAGEMANAGER_H_
 
+#include <QList>
 #include <QObject>
 
 #include "types/icqTypes.h"
@@ -49,9 +50,23 @@ class MessageManager : public QObject
         void setUin(const QString& uin);
 
         void requestOfflineMessages();
-        void sendMessage(const Message& msg);
+        void deleteOfflineMessages();
+        QByteArray sendMessage(const Message& msg);
+
+        /* delivery statistics */
+        int unackedCount() const;
+        quint64 sentCount() const;
+        quint64 ackedCount() const;
+        quint64 expiredCount() const;
+        quint64 totalLatency() const;
+        int maxLatency() const;
+
+        qint64 memoryUsage() const;
     signals:
         void incomingMessage(const Message&);
+        void offlineMessages(const QList<Message>&);
+        void messageAcked(const QString& uin, int latency);
+        void messageExpired(const QString& uin);
     private:
         Message handle_channel_1_msg(TlvChain& chain);
         Message handle_channel_2_msg(TlvChain& chain);
@@ -59,8 +74,9 @@ class MessageManager : public QObject
         void handle_incoming_message(SnacBuffer& snac);
         void handle_offline_message(Buffer& data);
     private slots:
-        void incomingMetaInfo(Word type, Buffer& data);
+        void incomingMetaInfo(Word type, Word sequence, Buffer& data);
         void incomingSnac(SnacBuffer& snac);
+        void expireAcks();
     private:
         class Private;
         Private *d;
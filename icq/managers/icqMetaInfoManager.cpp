@@ -31,6 +31,8 @@ namespace ICQ
 class MetaInfoManager::Private
 {
     public:
+        Word nextSequence();
+
         QString uin;
         Socket *socket;
         Word metaSequence;
@@ -56,31 +58,58 @@ void MetaInfoManager::setUin(const QString uin)
     d->uin = uin;
 }
 
-void MetaInfoManager::sendMetaRequest(Word type)
+/**
+ * Returns next request sequence number. Zero is never used, so it can mean "no request".
+ */
+Word MetaInfoManager::Private::nextSequence()
+{
+    if ( ++metaSequence == 0 ) {
+        ++metaSequence;
+    }
+    return metaSequence;
+}
+
+/**
+ * Sends meta request of @a type. Returns request sequence number, which is
+ * passed with the reply in metaInfoAvailable() signal. @a priority is used if
+ * the request has to wait for the rate limit.
+ */
+Word MetaInfoManager::sendMetaRequest(Word type, SnacPriority priority)
 {
+    Word sequence = d->nextSequence();
+
     Tlv tlv(0x01); // ENCAPSULATED_METADATA
     tlv.addLEWord(8); // data chunk size (tlv size - 2 )
     tlv.addLEDWord( d->uin.toUInt() ); // own UIN
     tlv.addLEWord(type);
-    tlv.addLEWord( ++(d->metaSequence) ); // request sequence number
+    tlv.addLEWord(sequence); // request sequence number
 
     SnacBuffer snac(0x15, 0x02);
     snac.addTlv(tlv);
-    d->socket->write(snac);
+    d->socket->write(snac, priority);
+    return sequence;
 }
 
-void MetaInfoManager::sendMetaRequest(Word type, Buffer& metadata)
+/**
+ * Sends meta request of @a type with @a metadata. Returns request sequence number.
+ * @a priority is used if the request has to wait for the rate limit.
+ * @overload
+ */
+Word MetaInfoManager::sendMetaRequest(Word type, Buffer& metadata, SnacPriority priority)
 {
+    Word sequence = d->nextSequence();
+
     Tlv tlv(0x01); // ENCAPSULATED_METADATA
     tlv.addLEWord( metadata.size() + 8 ); // data chunk size (tlv size - 2 )
     tlv.addLEDWord( d->uin.toUInt() ); // own UIN
     tlv.addLEWord(type);
-    tlv.addLEWord( ++(d->metaSequence) ); // request sequence number
+    tlv.addLEWord(sequence); // request sequence number
     tlv.addData(metadata);
 
     SnacBuffer snac(0x15, 0x02);
     snac.addTlv(tlv);
-    d->socket->write(snac);
+    d->socket->write(snac, priority);
+    return sequence;
 }
 
 void MetaInfoManager::handle_meta_info(SnacBuffer& snac)
@@ -91,11 +120,11 @@ void MetaInfoManager::handle_meta_info(SnacBuffer& snac)
 
     Word type = metaReply.getLEWord(); // meta request type
 
-    metaReply.seekForward( sizeof(Word) ); // meta request id
+    Word sequence = metaReply.getLEWord(); // meta request id
 
     Buffer data = metaReply.readAll();
 
-    emit metaInfoAvailable(type, data);
+    emit metaInfoAvailable(type, sequence, data);
 }
 
 void MetaInfoManager::incomingSnac(SnacBuffer& snac)
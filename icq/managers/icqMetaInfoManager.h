@@ -43,10 +43,10 @@ class MetaInfoManager : public QObject
 
         void setUin(const QString uin);
 
-        void sendMetaRequest(Word type);
-        void sendMetaRequest(Word type, Buffer& metadata);
+        Word sendMetaRequest(Word type, SnacPriority priority);
+        Word sendMetaRequest(Word type, Buffer& metadata, SnacPriority priority = spLookup);
     signals:
-        void metaInfoAvailable(Word type, Buffer& data);
+        void metaInfoAvailable(Word type, Word sequence, Buffer& data);
     private:
         void handle_meta_info(SnacBuffer& snac);
     private slots:
@@ -21,7 +21,14 @@
 #include "icqRateManager.h"
 #include "icqSocket.h"
 
+#include "types/icqRateClock.h"
+
+#include "messagetracer.h"
+#include "metrics.h"
+
+#include <QHash>
 #include <QList>
+#include <QTimer>
 #include <QtAlgorithms>
 
 #include <QtDebug>
@@ -36,12 +43,30 @@ class RateManager::Private
         RateClass* findRateClass(const SnacBuffer* snac) const; /* find rate class for the packet */
         RateClass* findRateClass(Word rateClassId) const; /* get rate class by ID */
 
+        static SnacPriority priorityFor(const SnacBuffer& snac); /* default priority of the packet */
+        static DWord snacKey(Word family, Word subtype) { return (DWord(family) << 16) | subtype; }
+
+        void scheduleQueues(); /* arm the timer for the earliest queued packet */
+
         void recv_server_rates(SnacBuffer& reply); /* snac (01,07) handler */
         void recv_rates_update(SnacBuffer& reply); /* snac (01,0a) handler */
 
         RateManager *q;
 
         QList<RateClass*> classList;
+        /* lookup tables, built when server rates are received. snac key is (family << 16 | subtype) */
+        QHash<DWord, RateClass*> snacClasses;
+        QHash<Word, RateClass*> classIds;
+
+        RateClock *clock;
+        /* one timer for all the classes, it fires when the earliest queued packet may be sent */
+        QTimer *queueTimer;
+
+        /* traces of queued message packets */
+        QHash<SnacBuffer*, quint32> traces;
+
+        /* packets dropped since the queues were drained last time, only the first one is logged */
+        int dropped;
 
         Socket *socket;
 };
@@ -52,27 +77,97 @@ RateManager::RateManager(Socket* socket, QObject *parent)
     d = new Private;
     d->q = this;
 
+    d->clock = RateClock::system();
+    d->dropped = 0;
+    d->queueTimer = new QTimer(this);
+    d->queueTimer->setSingleShot(true);
+    QObject::connect( d->queueTimer, SIGNAL( timeout() ), SLOT( sendQueued() ) );
+
     d->socket = socket;
     d->socket->setRateManager(this);
     QObject::connect( d->socket, SIGNAL( incomingSnac(SnacBuffer&) ), SLOT( incomingSnac(SnacBuffer&) ) );
 }
 
+/* gateway-wide rate queue metrics */
+static Instrument::Gauge* queueDepth()
+{
+    static Instrument::Gauge *gauge = Instrument::Registry::instance()->gauge( "icq_rate_queue_depth",
+            "SNAC packets waiting in rate limiter queues of all sessions" );
+    return gauge;
+}
+
+static Instrument::Counter* queueDropped()
+{
+    static Instrument::Counter *counter = Instrument::Registry::instance()->counter( "icq_rate_queue_dropped_total",
+            "SNAC packets dropped because rate limiter queue was full" );
+    return counter;
+}
+
+static Instrument::Histogram* queueDelay()
+{
+    static Instrument::Histogram *histogram = Instrument::Registry::instance()->histogram( "icq_rate_queue_delay_seconds",
+            "Time SNAC packets spent in rate limiter queues" );
+    return histogram;
+}
+
 RateManager::~RateManager()
 {
+    int queued = 0;
+    foreach (RateClass *rc, d->classList) {
+        queued += rc->queuedCount();
+    }
+    queueDepth()->add(-queued);
+
+    foreach (quint32 trace, d->traces) {
+        Instrument::MessageTracer::instance()->abandon(trace);
+    }
     qDeleteAll(d->classList);
     delete d;
 }
 
+/**
+ * Sets time source for all rate classes to @a clock (manager doesn't take ownership).
+ */
+void RateManager::setClock(RateClock *clock)
+{
+    d->clock = clock ? clock : RateClock::system();
+    foreach (RateClass *rc, d->classList) {
+        rc->setClock(d->clock);
+    }
+}
+
 void RateManager::addClass(RateClass* rc)
 {
-    QObject::connect( rc, SIGNAL( dataReady(SnacBuffer*) ), SLOT( dataAvailable(SnacBuffer*) ) );
+    rc->setClock(d->clock);
     d->classList.append(rc);
+    d->classIds.insert(rc->classId(), rc);
+
+    QList< QPair<Word, Word> > members = rc->members();
+    QList< QPair<Word, Word> >::const_iterator it, itEnd = members.constEnd();
+    for ( it = members.constBegin(); it != itEnd; ++it ) {
+        d->snacClasses.insert( Private::snacKey(it->first, it->second), rc );
+    }
+}
+
+/**
+ * Accounts @a snac, which was just written to the socket, in its rate class.
+ */
+void RateManager::packetSent(const SnacBuffer& snac)
+{
+    RateClass *rc = d->findRateClass(&snac);
+    if ( rc ) {
+        rc->packetSent();
+    }
 }
 
 bool RateManager::canSend(const SnacBuffer& snac) const
 {
     RateClass *rc = d->findRateClass(&snac);
     if ( rc ) {
+        /* packets are waiting in the class, new one should take its place in the queues */
+        if ( rc->queuedCount() > 0 ) {
+            return false;
+        }
         if ( rc->timeToNextSend() == 0 ) {
             return true;
         } else {
@@ -84,19 +179,72 @@ bool RateManager::canSend(const SnacBuffer& snac) const
     }
 }
 
-void RateManager::enqueue(const SnacBuffer& packet)
+/**
+ * Puts a copy of @a packet to its rate class queue of @a priority. Low priority packets
+ * may be dropped if the queue is full.
+ */
+void RateManager::enqueue(const SnacBuffer& packet, SnacPriority priority)
 {
     SnacBuffer *p = new SnacBuffer(packet);
     RateClass *rc = d->findRateClass(p);
 
     if ( rc ) {
-        qDebug() << "[ICQ:RM] Enqueuing a packet" << p->channel() << "snac family" << p->family() << "subtype" << p->subtype();
-        rc->enqueue(p);
+        if ( priority == spDefault ) {
+            priority = Private::priorityFor(packet);
+        }
+        qDebug() << "[ICQ:RM] Enqueuing a packet" << p->channel() << "snac family" << p->family() << "subtype" << p->subtype() << "priority" << priority;
+        int queued = rc->queuedCount();
+        /* presence packets may be replaced in the queue, so only other ones are traced */
+        quint32 trace = priority != spPresence ? Instrument::MessageTracer::current(Instrument::MessageTracer::Outgoing) : 0;
+        if ( !rc->enqueue(p, priority) ) {
+            queueDropped()->inc();
+            if ( d->dropped++ == 0 ) {
+                qDebug() << "[ICQ:RM]" << "Rate queue is full, dropping packets of priority" << priority;
+            }
+            Instrument::MessageTracer::instance()->abandon(trace);
+        } else if ( trace ) {
+            d->traces.insert(p, trace);
+            Instrument::MessageTracer::instance()->mark(trace, "rate-queued");
+        }
+        queueDepth()->add( rc->queuedCount() - queued );
+        d->scheduleQueues();
     } else {
         dataAvailable(p);
     }
 }
 
+/**
+ * Returns queue statistics of @a priority summed over all rate classes.
+ */
+RateClass::QueueStats RateManager::queueStats(SnacPriority priority) const
+{
+    RateClass::QueueStats total;
+    foreach (RateClass *rc, d->classList) {
+        RateClass::QueueStats stats = rc->queueStats(priority);
+        total.sent += stats.sent;
+        total.dropped += stats.dropped;
+        total.coalesced += stats.coalesced;
+        total.totalWait += stats.totalWait;
+        total.maxWait = qMax(total.maxWait, stats.maxWait);
+    }
+    return total;
+}
+
+/**
+ * Returns estimated heap memory used by queued packets in bytes.
+ */
+qint64 RateManager::memoryUsage() const
+{
+    /* SnacBuffer object, its QBuffer private data and the data array */
+    static const int packetSize = HEAP_BLOCK_OVERHEAD + sizeof(SnacBuffer) + 256 + HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE;
+
+    qint64 size = 0;
+    foreach (RateClass *rc, d->classList) {
+        size += qint64( rc->queuedCount() ) * packetSize + rc->queuedBytes();
+    }
+    return size;
+}
+
 void RateManager::requestRates()
 {
     d->socket->snacRequest(0x01, 0x06);
@@ -108,42 +256,79 @@ void RateManager::dataAvailable(SnacBuffer* packet)
     delete packet; // delete packet after writing it to the buffer
 }
 
-RateClass* RateManager::Private::findRateClass(const SnacBuffer* packet) const
+/**
+ * Sends queued packets of all the classes which are allowed to send now.
+ */
+void RateManager::sendQueued()
 {
-    RateClass *rc = 0L;
-    if ( classList.size() == 0 ) {
-        return rc;
+    if ( d->dropped > 1 ) {
+        qDebug() << "[ICQ:RM]" << d->dropped << "packets were dropped because rate queue was full";
     }
+    d->dropped = 0;
 
-    QListIterator<RateClass*> i(classList);
-    while ( i.hasNext() ) {
-        RateClass *item = i.next();
-        if ( item->isMember( packet->family(), packet->subtype() ) ) {
-            rc = item;
-            break;
+    foreach (RateClass *rc, d->classList) {
+        while ( rc->queuedCount() > 0 && rc->timeToNextSend() == 0 ) {
+            int wait;
+            SnacBuffer *packet = rc->dequeue(&wait);
+            queueDepth()->add(-1);
+            queueDelay()->observe(wait / 1000.0);
+
+            Instrument::TraceScope scope( d->traces.isEmpty() ? 0 : d->traces.take(packet) );
+            dataAvailable(packet);
         }
     }
-
-    return rc;
+    d->scheduleQueues();
 }
 
-RateClass* RateManager::Private::findRateClass(Word rateClassId) const
+void RateManager::Private::scheduleQueues()
 {
-    RateClass *rc = 0L;
-    if ( classList.size() == 0 ) {
-        return rc;
+    int wait = -1;
+    foreach (RateClass *rc, classList) {
+        if ( rc->queuedCount() == 0 ) {
+            continue;
+        }
+        int ttns = rc->timeToNextSend();
+        if ( wait < 0 || ttns < wait ) {
+            wait = ttns;
+        }
     }
 
-    QListIterator<RateClass*> i(classList);
-    while ( i.hasNext() ) {
-        RateClass *item = i.next();
-        if ( item->classId() == rateClassId ) {
-            rc = item;
-            break;
-        }
+    if ( wait < 0 ) {
+        queueTimer->stop();
+    } else if ( !queueTimer->isActive() || queueTimer->interval() != wait ) {
+        queueTimer->start(wait);
     }
+}
 
-    return rc;
+RateClass* RateManager::Private::findRateClass(const SnacBuffer* packet) const
+{
+    return snacClasses.value( snacKey( packet->family(), packet->subtype() ) );
+}
+
+SnacPriority RateManager::Private::priorityFor(const SnacBuffer& snac)
+{
+    switch ( snac.family() ) {
+        case 0x04: // ICBM
+            return spInteractive;
+        case 0x13: // SSI
+            return spSsi;
+        case 0x02: // location (capabilities, away message)
+            return spPresence;
+        case 0x01:
+            if ( snac.subtype() == 0x1E ) { // set status
+                return spPresence;
+            }
+            return spInteractive;
+        case 0x15: // meta information, user details lookups pass spLookup themselves
+            return spInteractive;
+        default:
+            return spInteractive;
+    }
+}
+
+RateClass* RateManager::Private::findRateClass(Word rateClassId) const
+{
+    return classIds.value(rateClassId);
 }
 
 
@@ -157,6 +342,7 @@ void RateManager::Private::recv_server_rates(SnacBuffer& reply)
     }
 
     SnacBuffer ratesAck(0x01, 0x08);
+    QList<RateClass*> classes;
 
     for ( int i = 0; i < rateCount; i++ ) {
         Word classId = reply.getWord();
@@ -172,7 +358,7 @@ void RateManager::Private::recv_server_rates(SnacBuffer& reply)
             ->setDisconnectLevel( reply.getDWord() )
             ->setCurrentLevel( reply.getDWord() )
             ->setMaxLevel( reply.getDWord() );
-        q->addClass(rc);
+        classes << rc;
 
         reply.getDWord(); // last time (not used)
         reply.getByte(); // current state (not used)
@@ -182,7 +368,13 @@ void RateManager::Private::recv_server_rates(SnacBuffer& reply)
         Word rateClassId = reply.getWord(); // rate class id
         Word pairCount = reply.getWord(); // rate pairs count
 
-        RateClass *rc = findRateClass(rateClassId);
+        RateClass *rc = 0;
+        foreach (RateClass *item, classes) {
+            if ( item->classId() == rateClassId ) {
+                rc = item;
+                break;
+            }
+        }
         if ( !rc ) {
             qCritical() << "[ICQ:RM]" << "[Critical Error]" << "rate class not found" << rateClassId;
             continue;
@@ -195,6 +387,11 @@ void RateManager::Private::recv_server_rates(SnacBuffer& reply)
         }
     }
 
+    /* lookup tables are built once, when all the members are known */
+    foreach (RateClass *rc, classes) {
+        q->addClass(rc);
+    }
+
     /* send out CLI_RATES_ACK */
     socket->write(ratesAck);
 }
@@ -236,7 +433,8 @@ void RateManager::Private::recv_rates_update(SnacBuffer& snac)
         snac.getDWord(); // last time (not used)
         snac.getByte(); // current state (not used)
 
-        rc->updateRateInfo();
+        /* server level may be lower than ours, queued packets should wait longer */
+        scheduleQueues();
     }
     snac.seekEnd(); // mark as read.
 }
@@ -32,6 +32,7 @@
 namespace ICQ
 {
 
+class RateClock;
 class Socket;
 
 
@@ -46,20 +47,33 @@ class RateManager: public QObject
         /* reset the rate manager */
         void reset();
 
+        /* time source for rate classes */
+        void setClock(RateClock *clock);
+
         /* add new rate class */
         void addClass(RateClass* rc);
 
+        /* account the packet which was written to the socket */
+        void packetSent(const SnacBuffer& snac);
+
         /* check if we can send the packet right now */
         bool canSend(const SnacBuffer& snac) const;
 
         /* enqueue the packet */
-        void enqueue(const SnacBuffer& snac);
+        void enqueue(const SnacBuffer& snac, SnacPriority priority = spDefault);
+
+        /* time-in-queue statistics for the priority */
+        RateClass::QueueStats queueStats(SnacPriority priority) const;
+
+        /* estimated memory held by queued packets */
+        qint64 memoryUsage() const;
 
         void requestRates();
     public slots:
         /* this slot sends data to socket */
         void dataAvailable(SnacBuffer* snac);
     private slots:
+        void sendQueued();
         void incomingSnac(SnacBuffer& snac);
     private:
         class Private;
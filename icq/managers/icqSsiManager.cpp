@@ -652,6 +652,21 @@ Word SSIManager::size() const
     return d->ssiList.size();
 }
 
+/**
+ * Returns estimated heap memory used by SSI-list and pending modifications in bytes.
+ */
+qint64 SSIManager::memoryUsage() const
+{
+    qint64 size = qint64( d->existingGroups.size() + d->existingItems.size() ) * HASH_NODE_SIZE;
+    foreach (const Contact& contact, d->ssiList) {
+        size += HEAP_BLOCK_OVERHEAD + contact.memoryUsage();
+    }
+    foreach (const Contact& contact, d->outgoingContacts) {
+        size += HEAP_BLOCK_OVERHEAD + contact.memoryUsage();
+    }
+    return size;
+}
+
 /**
  * Returns roster's last change time.
  */
@@ -68,6 +68,7 @@ class SSIManager: public QObject
         void requestParameters();
 
         Word size() const;
+        qint64 memoryUsage() const;
         QDateTime lastChangeTime() const;
         void setLastChangeTime(const QDateTime& time);
     signals:
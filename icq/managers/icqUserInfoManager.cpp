@@ -26,9 +26,10 @@
 #include "types/icqShortUserDetails.h"
 #include "types/icqUserDetails.h"
 
+#include <QDateTime>
 #include <QHash>
-#include <QQueue>
 #include <QTextCodec>
+#include <QTimer>
 #include <QtDebug>
 
 /*
@@ -39,23 +40,41 @@
 namespace ICQ
 {
 
+/* unanswered meta request is sent again after this time (secs) */
+static const int META_REQUEST_TIMEOUT = 15;
+static const int META_REQUEST_RETRIES = 2;
+/* how often pending requests are checked for timeouts (msecs) */
+static const int META_CHECK_INTERVAL  = 5000;
 
 class UserInfoManager::Private {
     public:
+        /* details request waiting for reply, user details come in several packets */
+        struct MetaRequest {
+            QString uin;
+            Word subtype;
+            uint sent;
+            int retries;
+            SnacPriority priority;
+            UserDetails details;
+        };
+
+        void sendRequest(const QString& uin, Word subtype, SnacPriority priority = spLookup, int retries = 0);
+        void finishRequest(Word sequence, bool success);
+
         void processOwnUserInfo(SnacBuffer& snac); // SNAC(01,0F)
         void processUserOnlineNotification(SnacBuffer& snac); // SNAC(03,0B)
         void processUserOfflineNotification(SnacBuffer& snac); // SNAC(03,0C)
 
-        void processShortUserInfo(Buffer& buf);
+        void processShortUserInfo(const QString& uin, Buffer& buf);
 
-        void processBasicUserInfo(Buffer& buf);
-        void processMoreUserInfo(Buffer& buf);
-        void processEmailUserInfo(Buffer& buf);
-        void processHomepageUserInfo(Buffer& buf);
-        void processWorkUserInfo(Buffer& buf);
-        void processNotesUserInfo(Buffer& buf);
-        void processInterestsUserInfo(Buffer& buf);
-        void processAffiliationsUserInfo(Buffer& buf);
+        void processBasicUserInfo(UserDetails& details, Buffer& buf);
+        void processMoreUserInfo(UserDetails& details, Buffer& buf);
+        void processEmailUserInfo(UserDetails& details, Buffer& buf);
+        void processHomepageUserInfo(UserDetails& details, Buffer& buf);
+        void processWorkUserInfo(UserDetails& details, Buffer& buf);
+        void processNotesUserInfo(UserDetails& details, Buffer& buf);
+        void processInterestsUserInfo(UserDetails& details, Buffer& buf);
+        void processAffiliationsUserInfo(UserDetails& details, Buffer& buf);
 
         QHash<QString, UserInfo> userInfoList;
         QHash<QString, Word> statusList;
@@ -65,10 +84,9 @@ class UserInfoManager::Private {
         QHash<QString,ShortUserDetails> shortDetails;
         QHash<QString,UserDetails> fullDetails;
 
-        /* for multi-step user-details retrieval. */
-        UserDetails lastUserDetails;
-        /* queue of uins for which details were requested */
-        QQueue<QString> uinRequests;
+        /* requests waiting for reply, key is meta request sequence number */
+        QHash<Word,MetaRequest> requests;
+        QTimer *requestTimer;
 
         Socket *socket;
 
@@ -116,13 +134,8 @@ void UserInfoManager::Private::processUserOfflineNotification(SnacBuffer& snac)
     }
 }
 
-void UserInfoManager::Private::processShortUserInfo(Buffer& buf)
+void UserInfoManager::Private::processShortUserInfo(const QString& uin, Buffer& buf)
 {
-    if ( uinRequests.isEmpty() ) {
-        qDebug() << "[ICQ:UIM]" << "error processing short user details. Request queue is empty";
-        return;
-    }
-
     Word nickLen = buf.getLEWord() - 1;
     QString nick = codec->toUnicode( buf.read(nickLen) );
     buf.seekForward( sizeof(Byte) );
@@ -145,7 +158,6 @@ void UserInfoManager::Private::processShortUserInfo(Buffer& buf)
     details.setLastName(ln);
     details.setEmail(email);
 
-    QString uin = uinRequests.dequeue();
     details.setUin(uin);
     shortDetails.insert(uin, details);
 
@@ -154,73 +166,73 @@ void UserInfoManager::Private::processShortUserInfo(Buffer& buf)
     // qDebug() << "short user info!" << "nick" << nick << "first name" << fn << "last name" << ln << "email" << email;
 }
 
-void UserInfoManager::Private::processBasicUserInfo(Buffer& buf)
+void UserInfoManager::Private::processBasicUserInfo(UserDetails& details, Buffer& buf)
 {
     QString nick = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setNick(nick);
+    details.setNick(nick);
 
     QString firstname = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setFirstName(firstname);
+    details.setFirstName(firstname);
 
     QString lastname = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setLastName(lastname);
+    details.setLastName(lastname);
 
     QString email = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setEmail(email);
+    details.setEmail(email);
 
     QString homecity = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomeCity(homecity);
+    details.setHomeCity(homecity);
 
     QString homestate = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomeState(homestate);
+    details.setHomeState(homestate);
 
     QString homephone = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomePhone(homephone);
+    details.setHomePhone(homephone);
 
     QString homefax = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomeFax(homefax);
+    details.setHomeFax(homefax);
 
     QString homeaddress = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomeAddress(homeaddress);
+    details.setHomeAddress(homeaddress);
 
     QString cellphone = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setCellPhone(cellphone);
+    details.setCellPhone(cellphone);
 
     QString homezip = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomeZipCode(homezip);
+    details.setHomeZipCode(homezip);
 
     // Byte gmt_offset = buf.getByte();
 
     // qDebug() << "basic info!" << "nick" << nick << "first name" << firstname << "last name" << lastname << "gmt offset" << gmt_offset;
 }
 
-void UserInfoManager::Private::processMoreUserInfo(Buffer& buf)
+void UserInfoManager::Private::processMoreUserInfo(UserDetails& details, Buffer& buf)
 {
     Word age = buf.getWord();
-    lastUserDetails.setAge(age);
+    details.setAge(age);
     Byte gender = buf.getByte();
     qDebug() << "GENDER!!!" << gender;
     /* TODO: process gender */
 
     QString homepage = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setHomepage(homepage);
+    details.setHomepage(homepage);
 
     Word birth_year = buf.getLEWord();
     Byte birth_month = buf.getByte();
     Byte birth_day = buf.getByte();
-    lastUserDetails.setBirthDate( QDate(birth_year, birth_month, birth_day) );
+    details.setBirthDate( QDate(birth_year, birth_month, birth_day) );
 
     Byte lang1 = buf.getByte();
     Byte lang2 = buf.getByte();
@@ -234,17 +246,17 @@ void UserInfoManager::Private::processMoreUserInfo(Buffer& buf)
 
     QString origCity = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setOriginalCity(origCity);
+    details.setOriginalCity(origCity);
 
     QString origState = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setOriginalState(origState);
+    details.setOriginalState(origState);
 
     /* Word countryCode = buf.getLEWord();
     Byte timezone = buf.getByte(); */
 }
 
-void UserInfoManager::Private::processEmailUserInfo(Buffer& buf)
+void UserInfoManager::Private::processEmailUserInfo(UserDetails& details, Buffer& buf)
 {
     Byte emailCount = buf.getByte();
     for (int i = 0; i < emailCount; ++i) {
@@ -254,11 +266,11 @@ void UserInfoManager::Private::processEmailUserInfo(Buffer& buf)
         QString email = buf.read(buf.getLEWord() - 1);
         buf.seekForward( sizeof(Byte) );
 
-        lastUserDetails.addEmail(email);
+        details.addEmail(email);
     }
 }
 
-void UserInfoManager::Private::processHomepageUserInfo(Buffer& buf)
+void UserInfoManager::Private::processHomepageUserInfo(UserDetails& details, Buffer& buf)
 {
     Q_UNUSED(buf)
     /* what the hell is this?
@@ -272,31 +284,31 @@ void UserInfoManager::Private::processHomepageUserInfo(Buffer& buf)
     */
 }
 
-void UserInfoManager::Private::processWorkUserInfo(Buffer& buf)
+void UserInfoManager::Private::processWorkUserInfo(UserDetails& details, Buffer& buf)
 {
     QString city = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkCity(city);
+    details.setWorkCity(city);
 
     QString state = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkState(state);
+    details.setWorkState(state);
 
     QString phone = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkPhone(phone);
+    details.setWorkPhone(phone);
 
     QString fax = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkFax(fax);
+    details.setWorkFax(fax);
 
     QString address = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkAddress(address);
+    details.setWorkAddress(address);
 
     QString zipcode = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkZipCode(zipcode);
+    details.setWorkZipCode(zipcode);
 
     Word countryCode = buf.getLEWord();
     Q_UNUSED(countryCode)
@@ -304,33 +316,33 @@ void UserInfoManager::Private::processWorkUserInfo(Buffer& buf)
 
     QString company = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkCompany(company);
+    details.setWorkCompany(company);
 
     QString department = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkDepartment(department);
+    details.setWorkDepartment(department);
 
     QString position = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkPosition(position);
+    details.setWorkPosition(position);
 
     buf.seekForward( sizeof(Word) ); // occupation code
 
     QString webpage = buf.read(buf.getLEWord() - 1);
     buf.seekForward( sizeof(Byte) );
-    lastUserDetails.setWorkWebpage(webpage);
+    details.setWorkWebpage(webpage);
 }
 
-void UserInfoManager::Private::processNotesUserInfo(Buffer& buf)
+void UserInfoManager::Private::processNotesUserInfo(UserDetails& details, Buffer& buf)
 {
     QString notes = codec->toUnicode( buf.read(buf.getLEWord() - 1) );
     buf.seekForward( sizeof(Byte) );
 
     qDebug() << "notes!" << notes;
-    lastUserDetails.setNotes(notes);
+    details.setNotes(notes);
 }
 
-void UserInfoManager::Private::processInterestsUserInfo(Buffer& buf)
+void UserInfoManager::Private::processInterestsUserInfo(UserDetails& details, Buffer& buf)
 {
     Q_UNUSED(buf)
     /* TODO: process user interests */
@@ -348,23 +360,12 @@ void UserInfoManager::Private::processInterestsUserInfo(Buffer& buf)
 */
 }
 
-void UserInfoManager::Private::processAffiliationsUserInfo(Buffer& buf)
+void UserInfoManager::Private::processAffiliationsUserInfo(UserDetails& details, Buffer& buf)
 {
+    /* affiliations are the last part of user details, request is finished by the caller */
+    Q_UNUSED(details)
     Q_UNUSED(buf)
 
-    if ( uinRequests.isEmpty() ) {
-        qDebug() << "[ICQ:UIM]" << "Error processing User Details. Request queue is empty";
-        lastUserDetails.clear();
-        return;
-    }
-
-    QString uin = uinRequests.dequeue();
-    lastUserDetails.setUin(uin);
-    fullDetails.insert(uin, lastUserDetails);
-    lastUserDetails.clear();
-
-    emit q->userDetailsAvailable(uin);
-
 /*  Byte pastCount = buf.getByte();
 
     for (int i = 0; i < pastCount; ++i) {
@@ -389,6 +390,59 @@ void UserInfoManager::Private::processAffiliationsUserInfo(Buffer& buf)
 */
 }
 
+/**
+ * Sends details request of @a subtype for @a uin and remembers it by the request sequence.
+ */
+void UserInfoManager::Private::sendRequest(const QString& uin, Word subtype, SnacPriority priority, int retries)
+{
+    Buffer buf;
+    buf.addLEWord(subtype); // data subtype
+    buf.addLEDWord( uin.toUInt() );
+
+    Word sequence = socket->sendMetaRequest(0x07D0, buf, priority);
+    if ( sequence == 0 ) {
+        return;
+    }
+
+    MetaRequest request;
+    request.uin = uin;
+    request.subtype = subtype;
+    request.sent = QDateTime::currentDateTime().toTime_t();
+    request.retries = retries;
+    request.priority = priority;
+    requests.insert(sequence, request);
+
+    if ( !requestTimer->isActive() ) {
+        requestTimer->start();
+    }
+}
+
+/**
+ * Removes request with @a sequence from the pending list. Received user details are stored
+ * if the request was successful. Availability signal is emitted in any case, so the requester
+ * doesn't wait forever (details are empty if the request failed).
+ */
+void UserInfoManager::Private::finishRequest(Word sequence, bool success)
+{
+    MetaRequest request = requests.take(sequence);
+    if ( requests.isEmpty() ) {
+        requestTimer->stop();
+    }
+
+    if ( request.subtype == 0x04BA ) {
+        if ( !success ) {
+            emit q->shortUserDetailsAvailable(request.uin);
+        }
+        return;
+    }
+
+    if ( success ) {
+        request.details.setUin(request.uin);
+        fullDetails.insert(request.uin, request.details);
+    }
+    emit q->userDetailsAvailable(request.uin);
+}
+
 UserInfoManager::UserInfoManager(Socket *socket, QObject *parent)
     : QObject(parent)
 {
@@ -396,11 +450,16 @@ UserInfoManager::UserInfoManager(Socket *socket, QObject *parent)
     d->q = this;
     d->socket = socket;
 
+    d->requestTimer = new QTimer(this);
+    d->requestTimer->setInterval(META_CHECK_INTERVAL);
+    QObject::connect( d->requestTimer, SIGNAL( timeout() ), SLOT( checkRequests() ) );
+
     QObject::connect( d->socket, SIGNAL( incomingSnac(SnacBuffer&) ), SLOT( incomingSnac(SnacBuffer&) ) );
 }
 
 UserInfoManager::~UserInfoManager()
 {
+    delete d;
 }
 
 void UserInfoManager::setTextCodec(QTextCodec *codec)
@@ -426,12 +485,7 @@ quint16 UserInfoManager::getUserStatus(const QString& uin) const
  */
 void UserInfoManager::requestOwnUserDetails(const QString& uin)
 {
-    Buffer buf;
-    buf.addLEWord(0x04B2); // data subtype
-    buf.addLEDWord( uin.toUInt() );
-
-    d->socket->sendMetaRequest(0x07D0, buf);
-    d->uinRequests.enqueue(uin);
+    d->sendRequest(uin, 0x04B2, spInteractive);
 }
 
 /**
@@ -444,30 +498,21 @@ void UserInfoManager::requestUserDetails(const QString& uin)
         return;
     }
 
-    Buffer buf;
-    buf.addLEWord(0x04D0); // data subtype
-    buf.addLEDWord( uin.toUInt() );
-
-    d->socket->sendMetaRequest(0x07D0, buf);
-    d->uinRequests.enqueue(uin);
+    d->sendRequest(uin, 0x04D0);
 }
 
 /**
- * Sends request for short user-details for selected @a uin.
+ * Sends request for short user-details for selected @a uin. @a background requests
+ * are sent after all other waiting packets and may be dropped under rate limit.
  */
-void UserInfoManager::requestShortDetails(const QString& uin)
+void UserInfoManager::requestShortDetails(const QString& uin, bool background)
 {
     if ( d->shortDetails.contains(uin) ) {
         emit shortUserDetailsAvailable(uin);
         return;
     }
 
-    Buffer buf;
-    buf.addLEWord(0x04BA); // data subtype
-    buf.addLEDWord( uin.toUInt() );
-
-    d->socket->sendMetaRequest(0x07D0, buf);
-    d->uinRequests.enqueue(uin);
+    d->sendRequest(uin, 0x04BA, background ? spBackground : spLookup);
 }
 
 ShortUserDetails UserInfoManager::shorUserDetails(const QString& uin) const
@@ -485,7 +530,7 @@ UserDetails UserInfoManager::userDetails(const QString& uin) const
  */
 void UserInfoManager::clearShortUserDetails(const QString& uin)
 {
-    d->fullDetails.remove(uin);
+    d->shortDetails.remove(uin);
 }
 
 /**
@@ -493,49 +538,117 @@ void UserInfoManager::clearShortUserDetails(const QString& uin)
  */
 void UserInfoManager::clearUserDetails(const QString& uin)
 {
-    d->shortDetails.remove(uin);
+    d->fullDetails.remove(uin);
+}
+
+/**
+ * Returns estimated heap memory used by info and statuses of online contacts in bytes.
+ */
+qint64 UserInfoManager::userInfoMemory() const
+{
+    qint64 size = d->ownInfo.memoryUsage();
+    foreach (const UserInfo& info, d->userInfoList) {
+        size += HASH_NODE_SIZE + info.memoryUsage();
+    }
+    /* status list has the same keys, they are shared with info list */
+    size += d->statusList.size() * HASH_NODE_SIZE;
+    return size;
+}
+
+qint64 UserInfoManager::shortDetailsMemory() const
+{
+    qint64 size = 0;
+    foreach (const ShortUserDetails& details, d->shortDetails) {
+        size += HASH_NODE_SIZE + details.memoryUsage();
+    }
+    return size;
+}
+
+qint64 UserInfoManager::fullDetailsMemory() const
+{
+    qint64 size = 0;
+    foreach (const UserDetails& details, d->fullDetails) {
+        size += HASH_NODE_SIZE + details.memoryUsage();
+    }
+    return size;
+}
+
+/**
+ * Returns estimated heap memory used by details requests waiting for reply, including
+ * details collected from partial replies.
+ */
+qint64 UserInfoManager::requestsMemory() const
+{
+    qint64 size = 0;
+    foreach (const Private::MetaRequest& request, d->requests) {
+        size += HASH_NODE_SIZE + sizeof(Private::MetaRequest) + heapSize(request.uin) + request.details.memoryUsage();
+    }
+    return size;
+}
+
+/**
+ * Drops all cached details. They are requested from the server again when needed.
+ */
+void UserInfoManager::clearDetailsCaches()
+{
+    d->shortDetails.clear();
+    d->fullDetails.clear();
 }
 
-void UserInfoManager::incomingMetaInfo(Word type, Buffer& data)
+/**
+ * Handles details reply. Reply is matched with the request by the meta sequence number,
+ * so replies can come in any order.
+ */
+void UserInfoManager::incomingMetaInfo(Word type, Word sequence, Buffer& data)
 {
     if ( type != 0x07DA ) {
         return;
     }
 
+    QHash<Word,Private::MetaRequest>::iterator it = d->requests.find(sequence);
+    if ( it == d->requests.end() ) {
+        qDebug() << "[ICQ:UIM]" << "reply for unknown (or timed out) request" << sequence;
+        return;
+    }
+
     Word subtype = data.getLEWord();
     Byte success = data.getByte();
     qDebug() << "[ICQ:UIM]" << "metadata subtype" << QString::number(subtype, 16) << "success byte" << QString::number( success, 16);
     if ( success != 0x0A ) {
+        d->finishRequest(sequence, false);
         return;
     }
 
+    UserDetails& details = it->details;
     switch ( subtype ) {
         case 0x0104:
-            d->processShortUserInfo(data);
+            d->processShortUserInfo(it->uin, data);
+            d->finishRequest(sequence, true);
             break;
         case 0x00C8:
-            d->processBasicUserInfo(data);
+            d->processBasicUserInfo(details, data);
             break;
         case 0x00DC:
-            d->processMoreUserInfo(data);
+            d->processMoreUserInfo(details, data);
             break;
         case 0x00EB:
-            d->processEmailUserInfo(data);
+            d->processEmailUserInfo(details, data);
             break;
         case 0x010E:
-            d->processHomepageUserInfo(data);
+            d->processHomepageUserInfo(details, data);
             break;
         case 0x00D2:
-            d->processWorkUserInfo(data);
+            d->processWorkUserInfo(details, data);
             break;
         case 0x00E6:
-            d->processNotesUserInfo(data);
+            d->processNotesUserInfo(details, data);
             break;
         case 0x00F0:
-            d->processInterestsUserInfo(data);
+            d->processInterestsUserInfo(details, data);
             break;
         case 0x00FA:
-            d->processAffiliationsUserInfo(data);
+            d->processAffiliationsUserInfo(details, data);
+            d->finishRequest(sequence, true);
             break;
         default:
             qDebug() << "[ICQ:UIM]" << "unknown subtype" << QString::number(subtype, 16);
@@ -543,6 +656,39 @@ void UserInfoManager::incomingMetaInfo(Word type, Buffer& data)
     }
 }
 
+/**
+ * Sends again requests which weren't answered in time, and gives up on requests
+ * which were retried too many times.
+ */
+void UserInfoManager::checkRequests()
+{
+    uint now = QDateTime::currentDateTime().toTime_t();
+
+    QList<Word> expired;
+    QHashIterator<Word,Private::MetaRequest> ri(d->requests);
+    while ( ri.hasNext() ) {
+        ri.next();
+        if ( now - ri.value().sent >= uint(META_REQUEST_TIMEOUT) ) {
+            expired << ri.key();
+        }
+    }
+
+    foreach (Word sequence, expired) {
+        Private::MetaRequest request = d->requests.value(sequence);
+        if ( request.retries < META_REQUEST_RETRIES ) {
+            d->requests.remove(sequence);
+            qDebug() << "[ICQ:UIM]" << "request timeout, retrying" << request.uin;
+            d->sendRequest(request.uin, request.subtype, request.priority, request.retries + 1);
+        } else {
+            qDebug() << "[ICQ:UIM]" << "request timeout, giving up" << request.uin;
+            d->finishRequest(sequence, false);
+        }
+    }
+    if ( d->requests.isEmpty() ) {
+        d->requestTimer->stop();
+    }
+}
+
 void UserInfoManager::incomingSnac(SnacBuffer& snac)
 {
     if ( snac.family() == 0x01 && snac.subtype() == 0x0F ) {
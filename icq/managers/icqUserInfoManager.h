@@ -53,13 +53,20 @@ class UserInfoManager : public QObject
 
         void requestOwnUserDetails(const QString& uin);
         void requestUserDetails(const QString& uin);
-        void requestShortDetails(const QString& uin);
+        void requestShortDetails(const QString& uin, bool background = false);
 
         ShortUserDetails shorUserDetails(const QString& uin) const;
         UserDetails userDetails(const QString& uin) const;
 
         void clearShortUserDetails(const QString& uin);
         void clearUserDetails(const QString& uin);
+
+        /* estimated memory of contact info, details caches and pending requests */
+        qint64 userInfoMemory() const;
+        qint64 shortDetailsMemory() const;
+        qint64 fullDetailsMemory() const;
+        qint64 requestsMemory() const;
+        void clearDetailsCaches();
     signals:
         void statusChanged(int status);
         void userOnline(QString userId, int status);
@@ -68,8 +75,9 @@ class UserInfoManager : public QObject
         void shortUserDetailsAvailable(const QString& uin);
         void userDetailsAvailable(const QString& uin);
     private slots:
-        void incomingMetaInfo(Word type, Buffer& data);
+        void incomingMetaInfo(Word type, Word sequence, Buffer& data);
         void incomingSnac(SnacBuffer& snac);
+        void checkRequests();
     private:
         class Private;
         Private *d;
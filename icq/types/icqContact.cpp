@@ -210,6 +210,21 @@ Contact& Contact::operator=(const Contact& other)
     return *this;
 }
 
+/**
+ * Returns estimated heap memory used by the item in bytes.
+ */
+qint64 Contact::memoryUsage() const
+{
+    /* every Tlv owns a QBuffer, which allocates its private data */
+    static const int tlvSize = HASH_NODE_SIZE + sizeof(Tlv) + 256 + HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE;
+
+    qint64 size = HEAP_BLOCK_OVERHEAD + sizeof(Private) + heapSize(d->name);
+    foreach (const Tlv& tlv, d->data.list()) {
+        size += tlvSize + tlv.size();
+    }
+    return size;
+}
+
 bool Contact::operator==(const Contact& other) const
 {
     if ( d->name == other.d->name && d->groupId == other.d->groupId && d->itemId == other.d->itemId && d->type == other.d->type ) {
@@ -67,6 +67,8 @@ class Contact
         /* set display name. updated after ssi list change */
         void setDisplayName(const QString& name);
 
+        qint64 memoryUsage() const;
+
         Contact& operator=(const Contact& other);
         bool operator==(const Contact& other) const;
         operator QByteArray() const;
@@ -282,6 +282,12 @@ void Message::setType(Byte type)
     d->type = type;
 }
 
+qint64 Message::memoryUsage() const
+{
+    return HEAP_BLOCK_OVERHEAD + sizeof(Private) + heapSize(d->icbmCookie) + heapSize(d->text)
+        + heapSize(d->sender) + heapSize(d->receiver);
+}
+
 
 } /* end of namespace ICQ */
 
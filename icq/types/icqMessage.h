@@ -101,6 +101,9 @@ class Message
         /* get/set message type */
         Byte type() const;
         void setType(Byte type);
+
+        /* estimated heap memory used by the message */
+        qint64 memoryUsage() const;
     private:
         class Private;
         QSharedDataPointer<Private> d;
@@ -19,30 +19,44 @@
  */
 
 #include "icqRateClass.h"
+#include "icqRateClock.h"
+#include "icqTlvChain.h"
 
 #include <QPair>
 #include <QQueue>
-#include <QTime>
-#include <QTimer>
+#include <QSet>
 
 #include <QtDebug>
 
 namespace ICQ
 {
 
+/* maximum queue length for each priority, zero means unbounded. Interactive messages and
+ * SSI changes are never dropped, presence packets are coalesced, lookups are dropped */
+static const int QUEUE_LIMITS[SNAC_PRIORITY_COUNT] = { 0, 0, 16, 128, 32 };
 
 class RateClass::Private : public QSharedData
 {
     public:
+        struct QueuedSnac {
+            SnacBuffer *snac;
+            qint64 queued;
+        };
+
         Private();
         Private(const Private& other);
         ~Private();
 
+        static bool supersedes(const SnacBuffer& packet, const SnacBuffer& queued);
+
         QList< QPair<Word, Word> > memberSnacs;
-        QQueue<SnacBuffer*> packetQueue;
-        QTime rateTimer;
+        QQueue<QueuedSnac> packetQueues[SNAC_PRIORITY_COUNT];
+        QueueStats stats[SNAC_PRIORITY_COUNT];
+        int queuedCount;
 
-        bool bWaitingToSend;
+        RateClock *clock;
+        /* time of the last level update (last send or server rate info) */
+        qint64 lastUpdate;
 
         Word classId;
         DWord windowSize;
@@ -57,8 +71,13 @@ class RateClass::Private : public QSharedData
 RateClass::Private::Private()
     : QSharedData()
 {
-    bWaitingToSend = false;
-    rateTimer.start();
+    queuedCount = 0;
+    clock = RateClock::system();
+    lastUpdate = clock->msecs();
+
+    classId = 0;
+    windowSize = 1;
+    clearLevel = alertLevel = limitLevel = disconnectLevel = currentLevel = maxLevel = 0;
 }
 
 RateClass::Private::Private(const Private& other)
@@ -66,16 +85,20 @@ RateClass::Private::Private(const Private& other)
 {
     memberSnacs = other.memberSnacs;
 
-    QQueue<SnacBuffer*>::const_iterator it, itEnd = other.packetQueue.constEnd();
-    for ( it = other.packetQueue.constBegin(); it != itEnd; ++it )
-    {
-        SnacBuffer *snac = new SnacBuffer(**it);
-        packetQueue.append(snac);
+    for ( int i = 0; i < SNAC_PRIORITY_COUNT; ++i ) {
+        QQueue<QueuedSnac>::const_iterator it, itEnd = other.packetQueues[i].constEnd();
+        for ( it = other.packetQueues[i].constBegin(); it != itEnd; ++it )
+        {
+            QueuedSnac item = *it;
+            item.snac = new SnacBuffer(*it->snac);
+            packetQueues[i].append(item);
+        }
+        stats[i] = other.stats[i];
     }
+    queuedCount = other.queuedCount;
 
-    rateTimer = other.rateTimer;
-
-    bWaitingToSend = other.bWaitingToSend;
+    clock = other.clock;
+    lastUpdate = other.lastUpdate;
 
     classId = other.classId;
     windowSize = other.windowSize;
@@ -89,7 +112,32 @@ RateClass::Private::Private(const Private& other)
 
 RateClass::Private::~Private()
 {
-    qDeleteAll(packetQueue);
+    for ( int i = 0; i < SNAC_PRIORITY_COUNT; ++i ) {
+        foreach (const QueuedSnac& item, packetQueues[i]) {
+            delete item.snac;
+        }
+    }
+}
+
+/**
+ * Returns true if @a packet carries everything @a queued does, so the queued one needn't
+ * be sent. Only status and user info packets with the same set of TLVs qualify: SNAC(02,04)
+ * with capabilities doesn't replace one with an away message.
+ */
+bool RateClass::Private::supersedes(const SnacBuffer& packet, const SnacBuffer& queued)
+{
+    if ( packet.family() != queued.family() || packet.subtype() != queued.subtype() ) {
+        return false;
+    }
+    bool status = packet.family() == 0x01 && packet.subtype() == 0x1E;
+    bool userInfo = packet.family() == 0x02 && packet.subtype() == 0x04;
+    if ( !status && !userInfo ) {
+        return false;
+    }
+
+    QSet<Word> packetTlvs = TlvChain( packet.Buffer::data() ).list().keys().toSet();
+    QSet<Word> queuedTlvs = TlvChain( queued.Buffer::data() ).list().keys().toSet();
+    return packetTlvs == queuedTlvs;
 }
 
 RateClass::RateClass(QObject *parent)
@@ -121,6 +169,15 @@ RateClass::~RateClass()
 {
 }
 
+/**
+ * Sets time source to @a clock. Rate class doesn't take ownership of the clock.
+ */
+void RateClass::setClock(RateClock *clock)
+{
+    d->clock = clock ? clock : RateClock::system();
+    d->lastUpdate = d->clock->msecs();
+}
+
 void RateClass::addMember(const SnacBuffer& snac)
 {
     addMember( snac.family(), snac.subtype() );
@@ -131,10 +188,109 @@ void RateClass::addMember(Word family, Word subtype)
     d->memberSnacs.append( qMakePair(family, subtype) );
 }
 
-void RateClass::enqueue(SnacBuffer* packet)
+/**
+ * Returns list of SNACs (family, subtype) which belong to this class.
+ */
+QList< QPair<Word, Word> > RateClass::members() const
+{
+    return d->memberSnacs;
+}
+
+/**
+ * Adds @a packet to the queue of @a priority, rate class takes ownership of the packet.
+ * Queued presence packet which is superseded by the new one is replaced with it. If the queue
+ * is full, the packet is deleted and false is returned.
+ */
+bool RateClass::enqueue(SnacBuffer* packet, SnacPriority priority)
+{
+    if ( priority < 0 || priority >= SNAC_PRIORITY_COUNT ) {
+        priority = spInteractive;
+    }
+    QQueue<Private::QueuedSnac>& queue = d->packetQueues[priority];
+
+    if ( priority == spPresence ) {
+        QQueue<Private::QueuedSnac>::iterator it, itEnd = queue.end();
+        for ( it = queue.begin(); it != itEnd; ++it ) {
+            if ( Private::supersedes(*packet, *it->snac) ) {
+                delete it->snac;
+                it->snac = packet;
+                ++d->stats[priority].coalesced;
+                return true;
+            }
+        }
+    }
+
+    int limit = QUEUE_LIMITS[priority];
+    if ( limit > 0 && queue.size() >= limit ) {
+        ++d->stats[priority].dropped;
+        delete packet;
+        return false;
+    }
+
+    Private::QueuedSnac item;
+    item.snac = packet;
+    item.queued = d->clock->msecs();
+    queue.enqueue(item);
+    ++d->queuedCount;
+    return true;
+}
+
+/**
+ * Takes the first packet of the highest priority queue. Caller takes ownership of the packet.
+ * Returns null if there are no queued packets. Time the packet spent in the queue (msecs)
+ * is stored in @a wait.
+ */
+SnacBuffer* RateClass::dequeue(int *wait)
+{
+    if ( d->queuedCount == 0 ) {
+        return 0;
+    }
+
+    int priority = 0;
+    while ( d->packetQueues[priority].isEmpty() ) {
+        ++priority;
+    }
+
+    Private::QueuedSnac item = d->packetQueues[priority].dequeue();
+    --d->queuedCount;
+
+    QueueStats& stats = d->stats[priority];
+    int waited = int( d->clock->msecs() - item.queued );
+    ++stats.sent;
+    stats.totalWait += waited;
+    stats.maxWait = qMax(stats.maxWait, waited);
+    if ( wait ) {
+        *wait = waited;
+    }
+
+    return item.snac;
+}
+
+int RateClass::queuedCount() const
 {
-    d->packetQueue.enqueue(packet);
-    setupTimer();
+    return d->queuedCount;
+}
+
+qint64 RateClass::queuedBytes() const
+{
+    qint64 bytes = 0;
+    for ( int i = 0; i < SNAC_PRIORITY_COUNT; ++i ) {
+        foreach (const Private::QueuedSnac& item, d->packetQueues[i]) {
+            bytes += item.snac->size();
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Returns statistics of the @a priority queue.
+ */
+RateClass::QueueStats RateClass::queueStats(SnacPriority priority) const
+{
+    if ( priority < 0 || priority >= SNAC_PRIORITY_COUNT ) {
+        return QueueStats();
+    }
+    return d->stats[priority];
 }
 
 bool RateClass::isMember(const SnacBuffer& snac) const
@@ -154,67 +310,57 @@ bool RateClass::isMember(Word family, Word subtype) const
     return false;
 }
 
+/**
+ * Returns number of msecs to wait before the next packet can be sent without
+ * getting the level below alert level (plus safety margin).
+ *
+ * The level after a send is NewLevel = ((Window - 1) * CurrentLevel + TimeDiff) / Window,
+ * so the earliest moment is TimeDiff = Window * Threshold - (Window - 1) * CurrentLevel.
+ */
 int RateClass::timeToNextSend() const
 {
-    int timeDiff = d->rateTimer.elapsed();
-    DWord newLevel = calcNewLevel(timeDiff);
-    DWord maxLevel = d->alertLevel + RATE_SAFETY_TIME;
-
-    if ( newLevel < maxLevel || newLevel < d->disconnectLevel )
-    {
-        int waitTime = ( d->windowSize * maxLevel ) - ( ( d->windowSize - 1 ) * d->currentLevel );
-        qDebug() << "We're sending too fast. Will wait " << waitTime << "ms before sending";
-        exit(1);
-        return waitTime;
+    if ( d->windowSize == 0 ) {
+        return 0;
     }
+    qint64 threshold = qint64(d->alertLevel) + RATE_SAFETY_TIME;
+    qint64 required = qint64(d->windowSize) * threshold - qint64(d->windowSize - 1) * d->currentLevel;
+    qint64 elapsed = d->clock->msecs() - d->lastUpdate;
 
-    return 0;
+    qint64 wait = required - elapsed;
+    return wait > 0 ? int(wait) : 0;
 }
 
+/**
+ * Accounts a packet sent right now.
+ */
+void RateClass::packetSent()
+{
+    updateRateInfo();
+}
+
+/**
+ * Recalculates current level for the time passed since the last update.
+ */
 void RateClass::updateRateInfo()
 {
-    d->currentLevel = calcNewLevel( d->rateTimer.elapsed() );
-    d->rateTimer.restart();
+    qint64 now = d->clock->msecs();
+    d->currentLevel = calcNewLevel( now - d->lastUpdate );
+    d->lastUpdate = now;
 }
 
-DWord RateClass::calcNewLevel(int timeDiff) const
+DWord RateClass::calcNewLevel(qint64 timeDiff) const
 {
     /* NewLevel = (Window - 1)/Window * OldLevel + 1/Window * CurrentTimeDiff
      * is the same as the code below. It was made so because of problems with precision
      */
-    DWord newLevel = ( (d->windowSize - 1) * d->currentLevel + timeDiff ) / d->windowSize;
-
-    return newLevel;
-}
-
-void RateClass::setupTimer()
-{
-    if ( !d->bWaitingToSend ) {
-        d->bWaitingToSend = true;
-
-        int ttns = timeToNextSend();
-        if ( ttns <= 0 ) {
-            slot_send();
-        } else {
-            QTimer::singleShot( ttns, this, SLOT( slot_send() ) );
-        }
+    if ( d->windowSize == 0 ) {
+        return d->currentLevel;
     }
-}
-
-void RateClass::slot_send()
-{
-    // hey, we don't need to send anything
-    if ( d->packetQueue.isEmpty() ) {
-        return;
-    }
-
-    emit dataReady( d->packetQueue.dequeue() );
-    d->bWaitingToSend = false;
-
-    // more to go
-    if ( !d->packetQueue.isEmpty() ) {
-        setupTimer();
+    qint64 newLevel = ( qint64(d->windowSize - 1) * d->currentLevel + timeDiff ) / d->windowSize;
+    if ( d->maxLevel && newLevel > d->maxLevel ) {
+        newLevel = d->maxLevel;
     }
+    return DWord(newLevel);
 }
 
 RateClass* RateClass::setClassId(Word classId)
@@ -253,9 +399,13 @@ RateClass* RateClass::setDisconnectLevel(DWord disconnectLevel)
     return this;
 }
 
+/**
+ * Sets current level reported by server, it's counted from this moment.
+ */
 RateClass* RateClass::setCurrentLevel(DWord currentLevel)
 {
     d->currentLevel = currentLevel;
+    d->lastUpdate = d->clock->msecs();
     return this;
 }
 
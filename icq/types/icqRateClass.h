@@ -24,11 +24,15 @@
 #include "icqTypes.h"
 #include "icqSnacBuffer.h"
 
+#include <QList>
+#include <QPair>
 #include <QSharedDataPointer>
 
 
 namespace ICQ {
 
+class RateClock;
+
 
 class RateClass : public QObject
 {
@@ -37,21 +41,41 @@ class RateClass : public QObject
     static const int RATE_SAFETY_TIME = 50;
 
     public:
+        /* statistics of one priority queue, wait times are in msecs */
+        struct QueueStats {
+            QueueStats() : sent(0), dropped(0), coalesced(0), totalWait(0), maxWait(0) { }
+
+            quint64 sent;
+            quint64 dropped;
+            quint64 coalesced;
+            quint64 totalWait;
+            int maxWait;
+        };
+
         RateClass(QObject *parent = 0);
         RateClass(Word classId, QObject *parent = 0);
         RateClass(const RateClass& other);
         RateClass& operator=(const RateClass& other);
         ~RateClass();
 
+        /* time source, system monotonic clock by default */
+        void setClock(RateClock *clock);
+
         /* add snac to this rate class */
         void addMember(const SnacBuffer& snac);
         void addMember(Word family, Word subtype);
+        QList< QPair<Word, Word> > members() const;
 
-        /* clear the queue */
-        void clear();
+        /* add packet to the queue of the given priority */
+        bool enqueue(SnacBuffer* packet, SnacPriority priority = spInteractive);
+        /* take the next packet to send */
+        SnacBuffer* dequeue(int *wait = 0);
 
-        /* add packet to the queue */
-        void enqueue(SnacBuffer* packet);
+        /* number of packets waiting in all queues */
+        int queuedCount() const;
+        /* size of packets waiting in all queues */
+        qint64 queuedBytes() const;
+        QueueStats queueStats(SnacPriority priority) const;
 
         /* check if snac belongs to this rate class */
         bool isMember(const SnacBuffer& snac) const;
@@ -60,6 +84,9 @@ class RateClass : public QObject
         /* calculate time to next packet send */
         int timeToNextSend() const;
 
+        /* account a packet which was just sent */
+        void packetSent();
+
         /* recalculate the rate info */
         void updateRateInfo();
 
@@ -82,14 +109,9 @@ class RateClass : public QObject
         DWord disconnectLevel() const;
         DWord currentLevel() const;
         DWord maxLevel() const;
-    signals:
-        void dataReady(SnacBuffer* packet);
-    private:
-        DWord calcNewLevel(int timeDiff) const;
-        void setupTimer();
-    private slots:
-        void slot_send();
     private:
+        DWord calcNewLevel(qint64 timeDiff) const;
+
         class Private;
         QSharedDataPointer<Private> d;
 };
@@ -0,0 +1,92 @@
+/*
+ * icqRateClock.cpp - time source for rate limits
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "icqRateClock.h"
+
+#include <QTime>
+
+#include <time.h>
+
+namespace ICQ
+{
+
+
+class SystemRateClock : public RateClock
+{
+    public:
+        SystemRateClock();
+
+        qint64 msecs() const;
+    private:
+        bool m_monotonic;
+        QTime m_fallback;
+};
+
+SystemRateClock::SystemRateClock()
+{
+    timespec ts;
+    m_monotonic = ( ::clock_gettime(CLOCK_MONOTONIC, &ts) == 0 );
+    m_fallback.start();
+}
+
+qint64 SystemRateClock::msecs() const
+{
+    if ( m_monotonic ) {
+        timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC, &ts);
+        return qint64(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+    return m_fallback.elapsed();
+}
+
+RateClock::~RateClock()
+{
+}
+
+RateClock* RateClock::system()
+{
+    static SystemRateClock clock;
+    return &clock;
+}
+
+ManualRateClock::ManualRateClock(qint64 start)
+    : m_msecs(start)
+{
+}
+
+qint64 ManualRateClock::msecs() const
+{
+    return m_msecs;
+}
+
+void ManualRateClock::advance(qint64 msecs)
+{
+    m_msecs += msecs;
+}
+
+void ManualRateClock::setMsecs(qint64 msecs)
+{
+    m_msecs = msecs;
+}
+
+
+} /* end of namespace ICQ */
+
+// vim:sw=4:ts=4:et:nowrap
@@ -0,0 +1,64 @@
+/*
+ * icqRateClock.h - time source for rate limits
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef ICQRATECLOCK_H_
+#define ICQRATECLOCK_H_
+
+#include <QtGlobal>
+
+namespace ICQ {
+
+
+/*
+ * Monotonic millisecond clock used by rate classes. It can be replaced with a manual
+ * clock to check rate limiter behaviour without waiting.
+ */
+class RateClock
+{
+    public:
+        virtual ~RateClock();
+
+        /* milliseconds from some fixed point in the past */
+        virtual qint64 msecs() const = 0;
+
+        /* default clock (CLOCK_MONOTONIC) */
+        static RateClock* system();
+};
+
+/*
+ * Clock which stands still until it's moved forward.
+ */
+class ManualRateClock : public RateClock
+{
+    public:
+        ManualRateClock(qint64 start = 0);
+
+        qint64 msecs() const;
+
+        void advance(qint64 msecs);
+        void setMsecs(qint64 msecs);
+    private:
+        qint64 m_msecs;
+};
+
+}
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /*ICQRATECLOCK_H_*/
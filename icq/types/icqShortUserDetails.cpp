@@ -19,6 +19,7 @@
  */
 
 #include "icqShortUserDetails.h"
+#include "icqTypes.h"
 
 #include <QSharedData>
 #include <QString>
@@ -141,6 +142,15 @@ bool ShortUserDetails::isEmpty()
     return false;
 }
 
+/**
+ * Returns estimated heap memory used by the details in bytes.
+ */
+qint64 ShortUserDetails::memoryUsage() const
+{
+    return HEAP_BLOCK_OVERHEAD + sizeof(Private) + heapSize(d->uin) + heapSize(d->nick)
+        + heapSize(d->firstName) + heapSize(d->lastName) + heapSize(d->email);
+}
+
 
 } /* end of namespace ICQ */
 
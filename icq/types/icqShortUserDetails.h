@@ -49,6 +49,7 @@ class ShortUserDetails
         void setEmail(const QString& email);
 
         bool isEmpty();
+        qint64 memoryUsage() const;
     private:
         class Private;
         QSharedDataPointer<Private> d;
@@ -97,6 +97,27 @@ namespace ICQ {
 
     enum VisibiltyStatus { visAll, visNormal, visContact, visPrivacy, visInvisible };
 
+    /* send priorities of outgoing SNACs. When a rate class is limited, its queued packets
+     * go out in this order. spDefault means that priority is chosen by SNAC family */
+    enum SnacPriority { spInteractive, spSsi, spPresence, spLookup, spBackground, spDefault };
+    const int SNAC_PRIORITY_COUNT = spDefault;
+
+    /* rough heap costs, used to estimate memory usage of sessions */
+    const int HEAP_BLOCK_OVERHEAD = 16; // allocator header and alignment
+    const int SHARED_DATA_SIZE = 24;    // header of QString/QByteArray data
+    const int HASH_NODE_SIZE = 32;      // QHash/QSet node without key and value
+
+    /* estimated heap memory held by a string or byte array */
+    inline qint64 heapSize(const QString& str)
+    {
+        return str.isNull() ? 0 : HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE + qint64( str.capacity() ) * int( sizeof(QChar) );
+    }
+
+    inline qint64 heapSize(const QByteArray& data)
+    {
+        return data.isNull() ? 0 : HEAP_BLOCK_OVERHEAD + SHARED_DATA_SIZE + data.capacity();
+    }
+
     const quint8 FLAP_HEADER_SIZE = 6;
     const quint8 SNAC_HEADER_SIZE = 10;
     const quint8 TLV_HEADER_SIZE = 4;
@@ -19,6 +19,7 @@
  */
 
 #include "icqUserDetails.h"
+#include "icqTypes.h"
 
 #include <QDate>
 #include <QSharedData>
@@ -467,6 +468,29 @@ bool UserDetails::isEmpty()
     return false;
 }
 
+/**
+ * Returns estimated heap memory used by the details in bytes.
+ */
+qint64 UserDetails::memoryUsage() const
+{
+    const QString *strings[] = {
+        &d->uin, &d->nick, &d->firstName, &d->lastName, &d->email,
+        &d->homeCity, &d->homeState, &d->homePhone, &d->homeFax, &d->homeAddress, &d->cellPhone, &d->homeZipCode,
+        &d->originalCity, &d->originalState, &d->homepage,
+        &d->workCity, &d->workState, &d->workPhone, &d->workFax, &d->workAddress, &d->workZipCode,
+        &d->workCompany, &d->workDepartment, &d->workPosition, &d->workWebpage, &d->notes
+    };
+
+    qint64 size = HEAP_BLOCK_OVERHEAD + sizeof(Private);
+    for ( uint i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i ) {
+        size += heapSize( *strings[i] );
+    }
+    foreach (const QString& email, d->emails) {
+        size += HEAP_BLOCK_OVERHEAD + heapSize(email);
+    }
+    return size;
+}
+
 
 } /* end of namespace ICQ */
 
@@ -127,6 +127,7 @@ class UserDetails
         void setNotes(const QString& notes);
 
         bool isEmpty();
+        qint64 memoryUsage() const;
     private:
         class Private;
         QSharedDataPointer<Private> d;
@@ -370,6 +370,19 @@ bool UserInfo::hasTlv(Word tlvType) const
     return d->tlvSet.contains(tlvType);
 }
 
+/**
+ * Returns estimated heap memory used by this user info in bytes.
+ */
+qint64 UserInfo::memoryUsage() const
+{
+    /* list node, Guid object and its 16 bytes of data for each capability */
+    static const int capabilitySize = 2 * HEAP_BLOCK_OVERHEAD + sizeof(Guid) + SHARED_DATA_SIZE + 16;
+
+    return HEAP_BLOCK_OVERHEAD + sizeof(Private) + heapSize(d->userId)
+        + qint64( d->capabilities.size() ) * capabilitySize
+        + qint64( d->tlvSet.size() ) * HASH_NODE_SIZE;
+}
+
 
 } /* end of namespace ICQ */
 
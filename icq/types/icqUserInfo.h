@@ -93,6 +93,8 @@ class UserInfo
         bool hasCapability(int capId) const;
 
         bool hasTlv(Word tlvType) const;
+
+        qint64 memoryUsage() const;
     private:
         class Private;
         QSharedDataPointer<Private> d;
@@ -5,6 +5,7 @@ HEADERS += \
 	$$PWD/icqGuid.h \
 	$$PWD/icqMessage.h \
 	$$PWD/icqRateClass.h \
+	$$PWD/icqRateClock.h \
 	$$PWD/icqSnacBuffer.h \
 	$$PWD/icqTlvChain.h \
 	$$PWD/icqTlv.h \
@@ -20,6 +21,7 @@ SOURCES += \
 	$$PWD/icqGuid.cpp \
 	$$PWD/icqMessage.cpp \
 	$$PWD/icqRateClass.cpp \
+	$$PWD/icqRateClock.cpp \
 	$$PWD/icqSnacBuffer.cpp \
 	$$PWD/icqTlvChain.cpp \
 	$$PWD/icqTlv.cpp \
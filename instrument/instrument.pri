@@ -0,0 +1,19 @@
+INCLUDEPATH += $$PWD
+
+# clock_gettime() for timers
+linux-*:LIBS *= -lrt
+
+HEADERS += \
+	$$PWD/lagmonitor.h \
+	$$PWD/messagetracer.h \
+	$$PWD/metrics.h \
+	$$PWD/metricsserver.h \
+	$$PWD/profiler.h \
+	$$PWD/recorder.h
+SOURCES += \
+	$$PWD/lagmonitor.cpp \
+	$$PWD/messagetracer.cpp \
+	$$PWD/metrics.cpp \
+	$$PWD/metricsserver.cpp \
+	$$PWD/profiler.cpp \
+	$$PWD/recorder.cpp
@@ -0,0 +1,99 @@
+/*
+ * lagmonitor.cpp - Event loop latency monitor.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "lagmonitor.h"
+#include "metrics.h"
+#include "profiler.h"
+
+#include <QTimer>
+
+namespace Instrument
+{
+
+
+/* heartbeat interval (msecs) */
+static const int LAG_INTERVAL = 100;
+
+class LagMonitor::Private
+{
+    public:
+        QTimer timer;
+        /* monotonic time when the next heartbeat is due */
+        qint64 expected;
+        Histogram *lag;
+};
+
+/**
+ * Creates monitor which measures how late its heartbeat timer fires, i.e. how long
+ * the event loop was busy. Lag is observed in eventloop_lag_seconds histogram and
+ * stalls are recorded by the profiler.
+ */
+LagMonitor::LagMonitor(QObject *parent)
+    : QObject(parent)
+{
+    d = new Private;
+    d->expected = 0;
+
+    QList<double> bounds;
+    bounds << 0.001 << 0.002 << 0.005 << 0.01 << 0.025 << 0.05 << 0.1 << 0.25 << 0.5 << 1 << 2.5 << 5;
+    d->lag = Registry::instance()->histogram("eventloop_lag_seconds", "Delay of event loop heartbeat", QString(), bounds);
+
+    d->timer.setInterval(LAG_INTERVAL);
+    QObject::connect( &d->timer, SIGNAL(timeout()), SLOT(heartbeat()) );
+}
+
+LagMonitor::~LagMonitor()
+{
+    delete d;
+}
+
+void LagMonitor::setInterval(int msecs)
+{
+    d->timer.setInterval( qMax(msecs, 10) );
+}
+
+void LagMonitor::start()
+{
+    d->expected = monotonicUsecs() + qint64( d->timer.interval() ) * 1000;
+    d->timer.start();
+}
+
+void LagMonitor::stop()
+{
+    d->timer.stop();
+}
+
+void LagMonitor::heartbeat()
+{
+    qint64 now = monotonicUsecs();
+    qint64 lag = qMax( now - d->expected, qint64(0) );
+    d->expected = now + qint64( d->timer.interval() ) * 1000;
+
+    d->lag->observe(lag / 1000000.0);
+
+    Profiler *profiler = Profiler::instance();
+    profiler->record("eventloop", "lag", -1, -1, now - lag, lag);
+    profiler->processTraceRequest();
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
@@ -0,0 +1,280 @@
+/*
+ * messagetracer.cpp - Sampled message latency tracing.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "messagetracer.h"
+#include "metrics.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QtDebug>
+
+namespace Instrument
+{
+
+
+/* default share of traced messages and duration (msecs) above which traces are logged */
+static const double TRACE_SAMPLE_RATE = 0.01;
+static const int TRACE_SLOW_THRESHOLD = 2000;
+/* maximum number of unfinished traces, older than TRACE_TIMEOUT (secs) are dropped first */
+static const int TRACE_OPEN_LIMIT = 1024;
+static const int TRACE_TIMEOUT = 300;
+/* unfinished traces are checked for the timeout at most once per N secs */
+static const int TRACE_EXPIRE_INTERVAL = 10;
+
+/* trace of the message being processed now, main thread only */
+static quint32 currentTrace = 0;
+
+class MessageTracer::Private
+{
+    public:
+        struct Trace {
+            qint64 start;
+            qint64 last;
+            QByteArray stages;  /* e.g. "xmpp-received, gateway +0.1" */
+        };
+
+        static Direction direction(quint32 trace) { return Direction(trace & 1); }
+        static QString labels(quint32 trace, const char *stage = 0);
+        static QList<double> bounds();
+
+        void expire(qint64 now);
+        void count(const char *result);
+
+        QHash<quint32,Trace> traces;
+        quint32 sequence;
+        qint64 lastExpire;
+
+        double sampleRate;
+        double credit;
+        qint64 slowThreshold;
+};
+
+QString MessageTracer::Private::labels(quint32 trace, const char *stage)
+{
+    QString labels = direction(trace) == Outgoing ? "direction=\"out\"" : "direction=\"in\"";
+    if ( stage ) {
+        labels += QString(",stage=\"%1\"").arg( QLatin1String(stage) );
+    }
+    return labels;
+}
+
+/**
+ * Returns histogram buckets from 100us, in-process stages are much faster than the network.
+ */
+QList<double> MessageTracer::Private::bounds()
+{
+    QList<double> bounds;
+    bounds << 0.0001 << 0.0005 << 0.001 << 0.005 << 0.01 << 0.05 << 0.1 << 0.5 << 1 << 5 << 10 << 30;
+    return bounds;
+}
+
+/**
+ * Drops traces which were not finished in TRACE_TIMEOUT, e.g. messages discarded
+ * without telling the tracer.
+ */
+void MessageTracer::Private::expire(qint64 now)
+{
+    lastExpire = now;
+    qint64 deadline = now - qint64(TRACE_TIMEOUT) * 1000000;
+    QMutableHashIterator<quint32,Trace> it(traces);
+    while ( it.hasNext() ) {
+        it.next();
+        if ( it.value().start < deadline ) {
+            it.remove();
+            count("expired");
+        }
+    }
+}
+
+void MessageTracer::Private::count(const char *result)
+{
+    Registry::instance()->counter( "message_traces_total", "Sampled message traces by result",
+            QString("result=\"%1\"").arg( QLatin1String(result) ) )->inc();
+}
+
+static MessageTracer *tracerInstance = 0;
+
+MessageTracer::MessageTracer()
+{
+    d = new Private;
+    d->sequence = 0;
+    d->lastExpire = monotonicUsecs();
+    d->sampleRate = TRACE_SAMPLE_RATE;
+    d->credit = 0;
+    d->slowThreshold = qint64(TRACE_SLOW_THRESHOLD) * 1000;
+}
+
+MessageTracer::~MessageTracer()
+{
+    delete d;
+}
+
+/**
+ * Returns the tracer. Like metrics, it is meant to be used from the main thread only.
+ */
+MessageTracer* MessageTracer::instance()
+{
+    static QMutex mutex;
+    if ( !tracerInstance ) {
+        mutex.lock();
+        if ( !tracerInstance ) {
+            tracerInstance = new MessageTracer;
+        }
+        mutex.unlock();
+    }
+    return tracerInstance;
+}
+
+/**
+ * Sets share of messages to be traced, from 0 (tracing is disabled) to 1 (every message).
+ */
+void MessageTracer::setSampleRate(double rate)
+{
+    d->sampleRate = qBound(0.0, rate, 1.0);
+    d->credit = 0;
+}
+
+/**
+ * Sets end-to-end latency in @a msecs above which traced messages are logged with their stages.
+ */
+void MessageTracer::setSlowThreshold(int msecs)
+{
+    d->slowThreshold = qint64( qMax(msecs, 1) ) * 1000;
+}
+
+/**
+ * Starts a trace of a message which has reached its first @a stage, if the message is sampled.
+ * Returns trace id or 0 if the message is not traced.
+ */
+quint32 MessageTracer::begin(Direction direction, const char *stage)
+{
+    /* every 1/rate-th message is sampled, so the rate holds for any traffic pattern */
+    d->credit += d->sampleRate;
+    if ( d->credit < 1.0 ) {
+        return 0;
+    }
+    d->credit -= 1.0;
+
+    /* traces of messages lost without abandon() are dropped periodically, not only when the table is full */
+    qint64 now = monotonicUsecs();
+    if ( d->traces.size() >= TRACE_OPEN_LIMIT || now - d->lastExpire >= qint64(TRACE_EXPIRE_INTERVAL) * 1000000 ) {
+        d->expire(now);
+        if ( d->traces.size() >= TRACE_OPEN_LIMIT ) {
+            d->count("rejected");
+            return 0;
+        }
+    }
+
+    /* lowest bit keeps the direction, zero is never used */
+    d->sequence = (d->sequence + 1) & 0x7FFFFFFF;
+    if ( d->sequence == 0 ) {
+        d->sequence = 1;
+    }
+    quint32 trace = (d->sequence << 1) | direction;
+
+    Private::Trace& t = d->traces[trace];
+    t.start = t.last = now;
+    t.stages = stage;
+    return trace;
+}
+
+/**
+ * Records that traced message has reached @a stage. Time since the previous stage is
+ * observed in message_stage_seconds histogram.
+ */
+void MessageTracer::mark(quint32 trace, const char *stage)
+{
+    if ( !trace ) {
+        return;
+    }
+    QHash<quint32,Private::Trace>::iterator it = d->traces.find(trace);
+    if ( it == d->traces.end() ) {
+        return;
+    }
+
+    qint64 now = monotonicUsecs();
+    qint64 elapsed = now - it->last;
+    it->last = now;
+    it->stages += ", " + QByteArray(stage) + " +" + QByteArray::number(elapsed / 1000.0, 'f', 1);
+
+    Registry::instance()->histogram( "message_stage_seconds", "Time messages spend reaching each stage from the previous one",
+            Private::labels(trace, stage), Private::bounds() )->observe(elapsed / 1000000.0);
+}
+
+/**
+ * Records the last @a stage of traced message and observes its end-to-end latency.
+ * Messages slower than the threshold are logged with all their stages.
+ */
+void MessageTracer::finish(quint32 trace, const char *stage)
+{
+    if ( !trace || !d->traces.contains(trace) ) {
+        return;
+    }
+    mark(trace, stage);
+    Private::Trace t = d->traces.take(trace);
+
+    qint64 total = t.last - t.start;
+    Registry::instance()->histogram( "message_latency_seconds", "End-to-end latency of traced messages",
+            Private::labels(trace), Private::bounds() )->observe(total / 1000000.0);
+    d->count("finished");
+
+    if ( total >= d->slowThreshold ) {
+        qWarning( "[Tracer] Slow %s message #%u took %.1f ms: %s (ms)",
+                  Private::direction(trace) == Outgoing ? "outgoing" : "incoming", trace >> 1,
+                  total / 1000.0, t.stages.constData() );
+    }
+}
+
+/**
+ * Forgets traced message which won't reach any further stage (dropped or expired).
+ */
+void MessageTracer::abandon(quint32 trace)
+{
+    if ( trace && d->traces.remove(trace) > 0 ) {
+        d->count("abandoned");
+    }
+}
+
+/**
+ * Returns current trace if it follows a message of @a direction, 0 otherwise.
+ */
+quint32 MessageTracer::current(Direction direction)
+{
+    return currentTrace && Private::direction(currentTrace) == direction ? currentTrace : 0;
+}
+
+TraceScope::TraceScope(quint32 trace)
+    : m_previous(currentTrace)
+{
+    currentTrace = trace;
+}
+
+TraceScope::~TraceScope()
+{
+    currentTrace = m_previous;
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
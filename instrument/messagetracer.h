@@ -0,0 +1,73 @@
+/*
+ * messagetracer.h - Sampled message latency tracing.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef INSTRUMENT_MESSAGETRACER_H_
+#define INSTRUMENT_MESSAGETRACER_H_
+
+#include <QtGlobal>
+
+namespace Instrument
+{
+
+
+/*
+ * Follows sampled messages through the gateway. Trace id is 0 for messages which
+ * are not sampled, so untraced messages cost one comparison per stage.
+ */
+class MessageTracer
+{
+    public:
+        enum Direction { Outgoing, Incoming };
+
+        static MessageTracer* instance();
+
+        void setSampleRate(double rate);
+        void setSlowThreshold(int msecs);
+
+        quint32 begin(Direction direction, const char *stage);
+        void mark(quint32 trace, const char *stage);
+        void finish(quint32 trace, const char *stage);
+        void abandon(quint32 trace);
+
+        static quint32 current(Direction direction);
+    private:
+        MessageTracer();
+        ~MessageTracer();
+        Q_DISABLE_COPY(MessageTracer);
+
+        class Private;
+        Private *d;
+};
+
+/* makes a trace current for the code called during the scope lifetime */
+class TraceScope
+{
+    public:
+        TraceScope(quint32 trace);
+        ~TraceScope();
+    private:
+        quint32 m_previous;
+};
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* INSTRUMENT_MESSAGETRACER_H_ */
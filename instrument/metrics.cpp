@@ -0,0 +1,444 @@
+/*
+ * metrics.cpp - Runtime metrics registry.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "metrics.h"
+
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+
+#include <time.h>
+
+namespace Instrument
+{
+
+
+/**
+ * Returns monotonic time in microseconds.
+ */
+qint64 monotonicUsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+Counter::Counter()
+    : m_value(0)
+{
+}
+
+/**
+ * Increases the counter by @a value, which must not be negative.
+ */
+void Counter::inc(double value)
+{
+    m_value += value;
+}
+
+double Counter::value() const
+{
+    return m_value;
+}
+
+Gauge::Gauge()
+    : m_value(0)
+{
+}
+
+void Gauge::set(double value)
+{
+    m_value = value;
+}
+
+void Gauge::add(double value)
+{
+    m_value += value;
+}
+
+double Gauge::value() const
+{
+    return m_value;
+}
+
+/**
+ * Creates histogram with buckets of upper @a bounds (sorted in ascending order).
+ */
+Histogram::Histogram(const QList<double>& bounds)
+    : m_bounds(bounds), m_buckets(bounds.size() + 1, 0), m_count(0), m_sum(0)
+{
+}
+
+void Histogram::observe(double value)
+{
+    int bucket = 0;
+    while ( bucket < m_bounds.size() && value > m_bounds.at(bucket) ) {
+        ++bucket;
+    }
+    ++m_buckets[bucket];
+    ++m_count;
+    m_sum += value;
+}
+
+QList<double> Histogram::bounds() const
+{
+    return m_bounds;
+}
+
+/**
+ * Returns number of observations which fell into @a bucket (not cumulative).
+ * The last bucket is +Inf.
+ */
+quint64 Histogram::bucketCount(int bucket) const
+{
+    return m_buckets.value(bucket);
+}
+
+/**
+ * Returns observation counts of all buckets (not cumulative), the last one is +Inf.
+ */
+QVector<quint64> Histogram::buckets() const
+{
+    return m_buckets;
+}
+
+quint64 Histogram::count() const
+{
+    return m_count;
+}
+
+double Histogram::sum() const
+{
+    return m_sum;
+}
+
+/**
+ * Estimates @a q quantile (0..1) by linear interpolation inside the bucket it falls into.
+ * Values above the last bound are reported as the last bound.
+ */
+double Histogram::quantile(double q) const
+{
+    return quantile(m_bounds, m_buckets, q);
+}
+
+/**
+ * Estimates @a q quantile of observations counted in @a buckets of a histogram with @a bounds,
+ * e.g. of the difference between two bucket snapshots.
+ */
+double Histogram::quantile(const QList<double>& bounds, const QVector<quint64>& buckets, double q)
+{
+    quint64 count = 0;
+    for ( int i = 0; i < buckets.size(); ++i ) {
+        count += buckets.at(i);
+    }
+    if ( count == 0 ) {
+        return 0;
+    }
+    double rank = q * count;
+    quint64 cumulative = 0;
+    for ( int i = 0; i < bounds.size(); ++i ) {
+        quint64 next = cumulative + buckets.value(i);
+        if ( next >= rank && buckets.value(i) > 0 ) {
+            double lower = i > 0 ? bounds.at(i - 1) : 0;
+            double upper = bounds.at(i);
+            return lower + (upper - lower) * (rank - cumulative) / buckets.value(i);
+        }
+        cumulative = next;
+    }
+    return bounds.isEmpty() ? 0 : bounds.last();
+}
+
+/**
+ * Returns buckets suitable for latencies in seconds, from 1ms to 10s.
+ */
+QList<double> Histogram::defaultBounds()
+{
+    QList<double> bounds;
+    bounds << 0.001 << 0.005 << 0.01 << 0.025 << 0.05 << 0.1 << 0.25 << 0.5 << 1 << 2.5 << 5 << 10;
+    return bounds;
+}
+
+ScopedTimer::ScopedTimer(Histogram *histogram)
+    : m_histogram(histogram), m_start( monotonicUsecs() )
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    if ( m_histogram ) {
+        m_histogram->observe( (monotonicUsecs() - m_start) / 1000000.0 );
+    }
+}
+
+
+class Registry::Private
+{
+    public:
+        enum Type { CounterType, GaugeType, HistogramType };
+
+        /* all series of one metric name */
+        struct Family {
+            QString name;
+            QString help;
+            Type type;
+            QMap<QString,void*> series; // key is label set
+        };
+
+        ~Private();
+
+        void* find(const QString& name, Type type, const QString& labels) const;
+        Family* family(const QString& name, const QString& help, Type type);
+
+        static QByteArray number(double value);
+        static QByteArray seriesName(const QString& name, const QString& suffix, const QString& labels, const QString& extra = QString());
+
+        QList<Family*> families;
+        QHash<QString,Family*> familyIndex;
+};
+
+Registry::Private::~Private()
+{
+    foreach (Family *family, families) {
+        QMapIterator<QString,void*> si(family->series);
+        while ( si.hasNext() ) {
+            si.next();
+            switch ( family->type ) {
+                case CounterType:
+                    delete static_cast<Counter*>( si.value() );
+                    break;
+                case GaugeType:
+                    delete static_cast<Gauge*>( si.value() );
+                    break;
+                case HistogramType:
+                    delete static_cast<Histogram*>( si.value() );
+                    break;
+            }
+        }
+        delete family;
+    }
+}
+
+void* Registry::Private::find(const QString& name, Type type, const QString& labels) const
+{
+    Family *f = familyIndex.value(name);
+    if ( !f || f->type != type ) {
+        return 0;
+    }
+    return f->series.value(labels);
+}
+
+Registry::Private::Family* Registry::Private::family(const QString& name, const QString& help, Type type)
+{
+    Family *f = familyIndex.value(name);
+    if ( !f ) {
+        f = new Family;
+        f->name = name;
+        f->help = help;
+        f->type = type;
+        families << f;
+        familyIndex.insert(name, f);
+    }
+    Q_ASSERT( f->type == type );
+    return f;
+}
+
+QByteArray Registry::Private::number(double value)
+{
+    if ( value == qint64(value) ) {
+        return QByteArray::number( qint64(value) );
+    }
+    return QByteArray::number(value, 'g', 15);
+}
+
+QByteArray Registry::Private::seriesName(const QString& name, const QString& suffix, const QString& labels, const QString& extra)
+{
+    QStringList all;
+    if ( !labels.isEmpty() ) {
+        all << labels;
+    }
+    if ( !extra.isEmpty() ) {
+        all << extra;
+    }
+    QString series = name + suffix;
+    if ( !all.isEmpty() ) {
+        series += "{" + all.join(",") + "}";
+    }
+    return series.toUtf8();
+}
+
+static Registry *registryInstance = 0;
+
+Registry::Registry()
+    : QObject(0)
+{
+    d = new Private;
+}
+
+Registry::~Registry()
+{
+    delete d;
+}
+
+/**
+ * Returns the registry. Metrics are meant to be updated from the main thread only.
+ */
+Registry* Registry::instance()
+{
+    static QMutex mutex;
+    if ( !registryInstance ) {
+        mutex.lock();
+        if ( !registryInstance ) {
+            registryInstance = new Registry;
+        }
+        mutex.unlock();
+    }
+    return registryInstance;
+}
+
+/**
+ * Returns counter @a name with @a labels (e.g. <tt>direction="in"</tt>), creating it if needed.
+ * Returned pointer stays valid for the application lifetime, so callers should keep it.
+ */
+Counter* Registry::counter(const QString& name, const QString& help, const QString& labels)
+{
+    Counter *c = static_cast<Counter*>( d->find(name, Private::CounterType, labels) );
+    if ( !c ) {
+        c = new Counter;
+        d->family(name, help, Private::CounterType)->series.insert(labels, c);
+    }
+    return c;
+}
+
+/**
+ * Returns gauge @a name with @a labels, creating it if needed.
+ */
+Gauge* Registry::gauge(const QString& name, const QString& help, const QString& labels)
+{
+    Gauge *g = static_cast<Gauge*>( d->find(name, Private::GaugeType, labels) );
+    if ( !g ) {
+        g = new Gauge;
+        d->family(name, help, Private::GaugeType)->series.insert(labels, g);
+    }
+    return g;
+}
+
+/**
+ * Returns histogram @a name with @a labels, creating it with @a bounds if needed.
+ */
+Histogram* Registry::histogram(const QString& name, const QString& help, const QString& labels, const QList<double>& bounds)
+{
+    Histogram *h = static_cast<Histogram*>( d->find(name, Private::HistogramType, labels) );
+    if ( !h ) {
+        h = new Histogram(bounds);
+        d->family(name, help, Private::HistogramType)->series.insert(labels, h);
+    }
+    return h;
+}
+
+/**
+ * Asks collectors to update their metrics.
+ */
+void Registry::collect()
+{
+    emit collecting();
+}
+
+/**
+ * Returns current values of counter or gauge @a name, key is the label set.
+ */
+QMap<QString,double> Registry::values(const QString& name) const
+{
+    QMap<QString,double> result;
+    Private::Family *f = d->familyIndex.value(name);
+    if ( !f || f->type == Private::HistogramType ) {
+        return result;
+    }
+    QMapIterator<QString,void*> si(f->series);
+    while ( si.hasNext() ) {
+        si.next();
+        if ( f->type == Private::CounterType ) {
+            result.insert( si.key(), static_cast<Counter*>(si.value())->value() );
+        } else {
+            result.insert( si.key(), static_cast<Gauge*>(si.value())->value() );
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns existing histogram @a name with @a labels or null.
+ */
+Histogram* Registry::findHistogram(const QString& name, const QString& labels) const
+{
+    return static_cast<Histogram*>( d->find(name, Private::HistogramType, labels) );
+}
+
+/**
+ * Returns all metrics in Prometheus text exposition format (version 0.0.4).
+ */
+QByteArray Registry::exposition()
+{
+    collect();
+
+    static const char *typeNames[] = { "counter", "gauge", "histogram" };
+
+    QByteArray out;
+    foreach (Private::Family *family, d->families) {
+        out += "# HELP " + family->name.toUtf8() + " " + family->help.toUtf8() + "\n";
+        out += "# TYPE " + family->name.toUtf8() + " " + typeNames[family->type] + "\n";
+
+        QMapIterator<QString,void*> si(family->series);
+        while ( si.hasNext() ) {
+            si.next();
+            const QString& labels = si.key();
+            switch ( family->type ) {
+                case Private::CounterType:
+                    out += Private::seriesName(family->name, QString(), labels) + " "
+                        + Private::number( static_cast<Counter*>(si.value())->value() ) + "\n";
+                    break;
+                case Private::GaugeType:
+                    out += Private::seriesName(family->name, QString(), labels) + " "
+                        + Private::number( static_cast<Gauge*>(si.value())->value() ) + "\n";
+                    break;
+                case Private::HistogramType: {
+                    Histogram *h = static_cast<Histogram*>( si.value() );
+                    QList<double> bounds = h->bounds();
+                    quint64 cumulative = 0;
+                    for ( int i = 0; i <= bounds.size(); ++i ) {
+                        cumulative += h->bucketCount(i);
+                        QString le = i < bounds.size() ? QString::fromLatin1( Private::number(bounds.at(i)) ) : QString("+Inf");
+                        out += Private::seriesName(family->name, "_bucket", labels, "le=\"" + le + "\"") + " "
+                            + QByteArray::number(cumulative) + "\n";
+                    }
+                    out += Private::seriesName(family->name, "_sum", labels) + " " + Private::number( h->sum() ) + "\n";
+                    out += Private::seriesName(family->name, "_count", labels) + " " + QByteArray::number( h->count() ) + "\n";
+                    break;
+                }
+            }
+        }
+    }
+    return out;
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
@@ -0,0 +1,128 @@
+/*
+ * metrics.h - Runtime metrics registry.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef INSTRUMENT_METRICS_H_
+#define INSTRUMENT_METRICS_H_
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+namespace Instrument
+{
+
+
+/* monotonic time in microseconds */
+qint64 monotonicUsecs();
+
+class Counter
+{
+    public:
+        Counter();
+
+        void inc(double value = 1.0);
+        double value() const;
+    private:
+        double m_value;
+};
+
+class Gauge
+{
+    public:
+        Gauge();
+
+        void set(double value);
+        void add(double value);
+        double value() const;
+    private:
+        double m_value;
+};
+
+class Histogram
+{
+    public:
+        Histogram(const QList<double>& bounds);
+
+        void observe(double value);
+
+        QList<double> bounds() const;
+        quint64 bucketCount(int bucket) const;
+        QVector<quint64> buckets() const;
+        quint64 count() const;
+        double sum() const;
+        double quantile(double q) const;
+
+        static double quantile(const QList<double>& bounds, const QVector<quint64>& buckets, double q);
+        static QList<double> defaultBounds();
+    private:
+        QList<double> m_bounds;
+        QVector<quint64> m_buckets;
+        quint64 m_count;
+        double m_sum;
+};
+
+/* observes time (seconds) between construction and destruction in a histogram */
+class ScopedTimer
+{
+    public:
+        ScopedTimer(Histogram *histogram);
+        ~ScopedTimer();
+    private:
+        Histogram *m_histogram;
+        qint64 m_start;
+};
+
+class Registry : public QObject
+{
+    Q_OBJECT
+
+    public:
+        static Registry* instance();
+
+        Counter* counter(const QString& name, const QString& help, const QString& labels = QString());
+        Gauge* gauge(const QString& name, const QString& help, const QString& labels = QString());
+        Histogram* histogram(const QString& name, const QString& help, const QString& labels = QString(),
+                             const QList<double>& bounds = Histogram::defaultBounds());
+
+        void collect();
+        QMap<QString,double> values(const QString& name) const;
+        Histogram* findHistogram(const QString& name, const QString& labels = QString()) const;
+
+        QByteArray exposition();
+    signals:
+        /* emitted before metrics are exported, so collectors can update their gauges */
+        void collecting();
+    private:
+        Registry();
+        ~Registry();
+        Q_DISABLE_COPY(Registry);
+
+        class Private;
+        Private *d;
+};
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* INSTRUMENT_METRICS_H_ */
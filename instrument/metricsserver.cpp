@@ -0,0 +1,106 @@
+/*
+ * metricsserver.cpp - HTTP endpoint exporting runtime metrics.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "metricsserver.h"
+#include "metrics.h"
+
+#include <QHostAddress>
+#include <QTcpSocket>
+
+namespace Instrument
+{
+
+/* requests larger than this are not HTTP requests we expect */
+static const int MAX_REQUEST_SIZE = 4096;
+
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QTcpServer(parent)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+}
+
+/**
+ * Starts listening on the loopback interface only, metrics are not meant to be public.
+ */
+bool MetricsServer::listenLocal(quint16 port)
+{
+    return listen(QHostAddress::LocalHost, port);
+}
+
+void MetricsServer::incomingConnection(int socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket(this);
+    if ( !socket->setSocketDescriptor(socketDescriptor) ) {
+        delete socket;
+        return;
+    }
+    QObject::connect( socket, SIGNAL( readyRead() ), SLOT( readRequest() ) );
+    QObject::connect( socket, SIGNAL( disconnected() ), socket, SLOT( deleteLater() ) );
+}
+
+/**
+ * Answers "GET /metrics" with the registry exposition, everything else with 404.
+ */
+void MetricsServer::readRequest()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>( sender() );
+    if ( !socket ) {
+        return;
+    }
+
+    QByteArray request = socket->peek(MAX_REQUEST_SIZE);
+    if ( !request.contains("\r\n\r\n") && !request.contains("\n\n") ) {
+        if ( request.size() >= MAX_REQUEST_SIZE ) {
+            socket->abort();
+            socket->deleteLater();
+        }
+        return;
+    }
+    socket->readAll();
+    QObject::disconnect( socket, SIGNAL( readyRead() ), this, SLOT( readRequest() ) );
+
+    QList<QByteArray> requestLine = request.left( request.indexOf('\n') ).trimmed().split(' ');
+    QByteArray status;
+    QByteArray body;
+    if ( requestLine.size() >= 2 && requestLine.at(0) == "GET" && ( requestLine.at(1) == "/metrics" || requestLine.at(1) == "/" ) ) {
+        status = "200 OK";
+        body = Registry::instance()->exposition();
+    } else {
+        status = "404 Not Found";
+        body = "Not Found\n";
+    }
+
+    socket->write( "HTTP/1.0 " + status + "\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: " + QByteArray::number( body.size() ) + "\r\n"
+                   "Connection: close\r\n"
+                   "\r\n" );
+    socket->write(body);
+    socket->disconnectFromHost();
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
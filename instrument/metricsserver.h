@@ -0,0 +1,49 @@
+/*
+ * metricsserver.h - HTTP endpoint exporting runtime metrics.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef INSTRUMENT_METRICSSERVER_H_
+#define INSTRUMENT_METRICSSERVER_H_
+
+#include <QTcpServer>
+
+namespace Instrument
+{
+
+
+class MetricsServer : public QTcpServer
+{
+    Q_OBJECT
+
+    public:
+        MetricsServer(QObject *parent = 0);
+        ~MetricsServer();
+
+        bool listenLocal(quint16 port);
+    protected:
+        void incomingConnection(int socketDescriptor);
+    private slots:
+        void readRequest();
+};
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* INSTRUMENT_METRICSSERVER_H_ */
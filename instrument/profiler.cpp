@@ -0,0 +1,249 @@
+/*
+ * profiler.cpp - Event handler profiler.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "profiler.h"
+#include "metrics.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QVector>
+#include <QtDebug>
+
+#include <signal.h>
+#include <unistd.h>
+
+namespace Instrument
+{
+
+
+/* handlers faster than this (usecs) are not kept in the trace buffer */
+static const int PROFILE_RECORD_THRESHOLD = 1000;
+/* handlers slower than this (msecs) are logged */
+static const int PROFILE_SLOW_THRESHOLD = 100;
+/* number of events kept for the trace */
+static const int PROFILE_BUFFER_SIZE = 4096;
+
+/* set from signal handler */
+static volatile sig_atomic_t traceRequested = 0;
+
+class Profiler::Private
+{
+    public:
+        struct Event {
+            const char *category;
+            const char *name;
+            int arg1;
+            int arg2;
+            qint64 start;
+            qint64 duration;
+        };
+
+        static QByteArray eventName(const Event& event);
+
+        /* ring buffer of the latest events */
+        QVector<Event> events;
+        int next;
+        bool wrapped;
+
+        qint64 slowThreshold;
+        QString traceFile;
+};
+
+/**
+ * Returns event name with its arguments, e.g. "snac(04,07)".
+ */
+QByteArray Profiler::Private::eventName(const Event& event)
+{
+    QByteArray name(event.name);
+    if ( event.arg1 < 0 ) {
+        return name;
+    }
+    name += '(' + QByteArray::number(event.arg1, 16).rightJustified(2, '0');
+    if ( event.arg2 >= 0 ) {
+        name += ',' + QByteArray::number(event.arg2, 16).rightJustified(2, '0');
+    }
+    name += ')';
+    return name;
+}
+
+static Profiler *profilerInstance = 0;
+
+Profiler::Profiler()
+{
+    d = new Private;
+    d->events.resize(PROFILE_BUFFER_SIZE);
+    d->next = 0;
+    d->wrapped = false;
+    d->slowThreshold = qint64(PROFILE_SLOW_THRESHOLD) * 1000;
+}
+
+Profiler::~Profiler()
+{
+    delete d;
+}
+
+/**
+ * Returns the profiler. Like metrics, it is meant to be used from the main thread only.
+ */
+Profiler* Profiler::instance()
+{
+    static QMutex mutex;
+    if ( !profilerInstance ) {
+        mutex.lock();
+        if ( !profilerInstance ) {
+            profilerInstance = new Profiler;
+        }
+        mutex.unlock();
+    }
+    return profilerInstance;
+}
+
+/**
+ * Sets duration in @a msecs above which handlers are logged as slow.
+ */
+void Profiler::setSlowThreshold(int msecs)
+{
+    d->slowThreshold = qint64( qMax(msecs, 1) ) * 1000;
+}
+
+int Profiler::slowThreshold() const
+{
+    return d->slowThreshold / 1000;
+}
+
+/**
+ * Sets file to write the trace to when it is requested with requestTrace().
+ */
+void Profiler::setTraceFile(const QString& fileName)
+{
+    d->traceFile = fileName;
+}
+
+/**
+ * Records handler @a name (with optional hex arguments, -1 if not used) which took
+ * @a duration usecs starting at monotonic time @a start.
+ */
+void Profiler::record(const char *category, const char *name, int arg1, int arg2, qint64 start, qint64 duration)
+{
+    if ( duration < PROFILE_RECORD_THRESHOLD ) {
+        return;
+    }
+
+    Private::Event& event = d->events[d->next];
+    event.category = category;
+    event.name = name;
+    event.arg1 = arg1;
+    event.arg2 = arg2;
+    event.start = start;
+    event.duration = duration;
+    if ( ++d->next == d->events.size() ) {
+        d->next = 0;
+        d->wrapped = true;
+    }
+
+    if ( duration >= d->slowThreshold ) {
+        qWarning() << "[Profiler]" << "Slow" << category << Private::eventName(event).constData()
+            << "took" << duration / 1000 << "ms";
+    }
+}
+
+/**
+ * Writes recorded events to @a fileName in Chrome trace event format
+ * (loadable by chrome://tracing). Returns false if the file can't be written.
+ */
+bool Profiler::writeTrace(const QString& fileName) const
+{
+    QFile file(fileName);
+    if ( !file.open(QIODevice::WriteOnly | QIODevice::Truncate) ) {
+        qWarning() << "[Profiler]" << "Failed to write trace to" << fileName << ":" << file.errorString();
+        return false;
+    }
+
+    QByteArray pid = QByteArray::number( getpid() );
+    QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    int count = d->wrapped ? d->events.size() : d->next;
+    int first = d->wrapped ? d->next : 0;
+    for ( int i = 0; i < count; ++i ) {
+        const Private::Event& event = d->events.at( (first + i) % d->events.size() );
+        if ( i > 0 ) {
+            out += ",";
+        }
+        out += "\n{\"name\":\"" + Private::eventName(event) + "\",\"cat\":\"" + event.category
+            + "\",\"ph\":\"X\",\"ts\":" + QByteArray::number(event.start)
+            + ",\"dur\":" + QByteArray::number(event.duration)
+            + ",\"pid\":" + pid + ",\"tid\":1}";
+    }
+    out += "\n]}\n";
+
+    file.write(out);
+    qDebug() << "[Profiler]" << "Trace of" << count << "events written to" << fileName;
+    return true;
+}
+
+/**
+ * Asks the profiler to write the trace at the next processTraceRequest() call.
+ * Safe to be called from a signal handler.
+ */
+void Profiler::requestTrace()
+{
+    traceRequested = 1;
+}
+
+/**
+ * Writes the trace to the trace file if it was requested.
+ */
+void Profiler::processTraceRequest()
+{
+    if ( !traceRequested ) {
+        return;
+    }
+    traceRequested = 0;
+
+    if ( d->traceFile.isEmpty() ) {
+        qWarning() << "[Profiler]" << "Trace requested, but trace file is not set";
+        return;
+    }
+    writeTrace(d->traceFile);
+}
+
+/**
+ * Starts timing handler @a name. Duration is observed in @a histogram (may be null)
+ * and recorded by the profiler when the scope ends.
+ */
+ProfileScope::ProfileScope(Histogram *histogram, const char *name, int arg1, int arg2)
+    : m_histogram(histogram), m_name(name), m_arg1(arg1), m_arg2(arg2), m_start( monotonicUsecs() )
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+    qint64 duration = monotonicUsecs() - m_start;
+    if ( m_histogram ) {
+        m_histogram->observe(duration / 1000000.0);
+    }
+    Profiler::instance()->record("handler", m_name, m_arg1, m_arg2, m_start, duration);
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
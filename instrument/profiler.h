@@ -0,0 +1,73 @@
+/*
+ * profiler.h - Event handler profiler.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef INSTRUMENT_PROFILER_H_
+#define INSTRUMENT_PROFILER_H_
+
+#include <QString>
+
+namespace Instrument
+{
+
+
+class Histogram;
+
+class Profiler
+{
+    public:
+        static Profiler* instance();
+
+        void setSlowThreshold(int msecs);
+        int slowThreshold() const;
+        void setTraceFile(const QString& fileName);
+
+        void record(const char *category, const char *name, int arg1, int arg2, qint64 start, qint64 duration);
+        bool writeTrace(const QString& fileName) const;
+
+        static void requestTrace();
+        void processTraceRequest();
+    private:
+        Profiler();
+        ~Profiler();
+        Q_DISABLE_COPY(Profiler);
+
+        class Private;
+        Private *d;
+};
+
+/* times a handler from construction to destruction and reports it to the profiler */
+class ProfileScope
+{
+    public:
+        ProfileScope(Histogram *histogram, const char *name, int arg1 = -1, int arg2 = -1);
+        ~ProfileScope();
+    private:
+        Histogram *m_histogram;
+        const char *m_name;
+        int m_arg1;
+        int m_arg2;
+        qint64 m_start;
+};
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* INSTRUMENT_PROFILER_H_ */
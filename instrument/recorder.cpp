@@ -0,0 +1,189 @@
+/*
+ * recorder.cpp - Raw traffic recorder.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "recorder.h"
+#include "metrics.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QtDebug>
+#include <QtEndian>
+
+#include <unistd.h>
+
+namespace Instrument
+{
+
+
+/* file signature and format version */
+static const char RECORD_MAGIC[] = "QITRACE1";
+static const int RECORD_MAGIC_SIZE = 8;
+/* direction (1 byte), time (8 bytes), data length (4 bytes) */
+static const int RECORD_FRAME_HEADER_SIZE = 13;
+/* recording stops when the file grows over this size */
+static const qint64 RECORD_MAX_FILE_SIZE = Q_INT64_C(256) * 1024 * 1024;
+
+static QString recordDirectory;
+
+class Recorder::Private
+{
+    public:
+        QFile file;
+        qint64 started;
+        qint64 size;    // file size, tracked here so writes stay buffered
+        bool full;
+};
+
+Recorder::Recorder()
+{
+    d = new Private;
+    d->started = monotonicUsecs();
+    d->size = 0;
+    d->full = false;
+}
+
+Recorder::~Recorder()
+{
+    delete d;
+}
+
+/**
+ * Enables recording to files in @a path. Empty path disables recording.
+ */
+void Recorder::setDirectory(const QString& path)
+{
+    recordDirectory = path;
+}
+
+QString Recorder::directory()
+{
+    return recordDirectory;
+}
+
+/**
+ * @class Recorder
+ * @brief Appends raw traffic of one connection to a binary file.
+ *
+ * File starts with 8 bytes "QITRACE1" signature followed by frames:
+ * direction (1 byte: 0 - in, 1 - out), time in usecs since the recording was started
+ * (8 bytes), data length (4 bytes) and the data. Numbers are big-endian.
+ *
+ * Recordings are read back with readHeader() and readFrame() by tools/parser-replay.
+ */
+
+/**
+ * Creates recorder for connection @a name (e.g. "icq-123456") in the record directory.
+ * Returns 0 if recording is disabled or the file can't be created.
+ */
+Recorder* Recorder::create(const QString& name)
+{
+    if ( recordDirectory.isEmpty() ) {
+        return 0;
+    }
+
+    /* sequence keeps names unique when a connection is recorded twice in a second */
+    static int sequence = 0;
+    QString fileName = QString("%1-%2-%3-%4.rec")
+        .arg(name)
+        .arg( QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") )
+        .arg( getpid() )
+        .arg( ++sequence );
+
+    Recorder *recorder = new Recorder;
+    recorder->d->file.setFileName( QDir(recordDirectory).filePath(fileName) );
+    if ( !recorder->d->file.open(QIODevice::WriteOnly | QIODevice::Truncate) ) {
+        qWarning() << "[Recorder]" << "Failed to open" << recorder->d->file.fileName() << recorder->d->file.errorString();
+        delete recorder;
+        return 0;
+    }
+    /* recordings contain login passwords and messages, restrict them before anything is written */
+    if ( !recorder->d->file.setPermissions(QFile::ReadOwner | QFile::WriteOwner) ) {
+        qWarning() << "[Recorder]" << "Failed to restrict permissions of" << recorder->d->file.fileName() << recorder->d->file.errorString();
+        recorder->d->file.remove();
+        delete recorder;
+        return 0;
+    }
+    recorder->d->size = recorder->d->file.write(RECORD_MAGIC, RECORD_MAGIC_SIZE);
+    return recorder;
+}
+
+QString Recorder::fileName() const
+{
+    return d->file.fileName();
+}
+
+/**
+ * Appends @a data sent or received at this moment. Writes are buffered by the file.
+ */
+void Recorder::record(Direction direction, const QByteArray& data)
+{
+    if ( d->full || data.isEmpty() ) {
+        return;
+    }
+    if ( d->size > RECORD_MAX_FILE_SIZE ) {
+        qWarning() << "[Recorder]" << d->file.fileName() << "is full, recording stopped";
+        d->file.close();
+        d->full = true;
+        return;
+    }
+
+    uchar header[RECORD_FRAME_HEADER_SIZE];
+    header[0] = direction;
+    qToBigEndian<quint64>( monotonicUsecs() - d->started, header + 1 );
+    qToBigEndian<quint32>( data.size(), header + 9 );
+    d->file.write( reinterpret_cast<const char*>(header), RECORD_FRAME_HEADER_SIZE );
+    d->file.write(data);
+    d->size += RECORD_FRAME_HEADER_SIZE + data.size();
+
+    static Counter *bytes = Registry::instance()->counter( "recorder_bytes_total", "Bytes written to traffic recordings" );
+    bytes->inc( RECORD_FRAME_HEADER_SIZE + data.size() );
+}
+
+/**
+ * Reads and checks recording signature from @a device.
+ */
+bool Recorder::readHeader(QIODevice *device)
+{
+    return device->read(RECORD_MAGIC_SIZE) == QByteArray(RECORD_MAGIC, RECORD_MAGIC_SIZE);
+}
+
+/**
+ * Reads next frame from @a device. Returns false at the end of the recording
+ * or if the frame is truncated.
+ */
+bool Recorder::readFrame(QIODevice *device, Frame& frame)
+{
+    QByteArray header = device->read(RECORD_FRAME_HEADER_SIZE);
+    if ( header.size() != RECORD_FRAME_HEADER_SIZE ) {
+        return false;
+    }
+    const uchar *raw = reinterpret_cast<const uchar*>( header.constData() );
+    frame.direction = raw[0] == In ? In : Out;
+    frame.time = qFromBigEndian<quint64>(raw + 1);
+    quint32 size = qFromBigEndian<quint32>(raw + 9);
+    frame.data = device->read(size);
+    return frame.data.size() == int(size);
+}
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
@@ -0,0 +1,68 @@
+/*
+ * recorder.h - Raw traffic recorder.
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef INSTRUMENT_RECORDER_H_
+#define INSTRUMENT_RECORDER_H_
+
+#include <QByteArray>
+#include <QString>
+
+class QIODevice;
+
+namespace Instrument
+{
+
+
+class Recorder
+{
+    public:
+        enum Direction { In, Out };
+
+        /* one recorded chunk of traffic */
+        struct Frame {
+            Direction direction;
+            qint64 time;    // usecs since the recording was started
+            QByteArray data;
+        };
+
+        ~Recorder();
+
+        static void setDirectory(const QString& path);
+        static QString directory();
+        static Recorder* create(const QString& name);
+
+        QString fileName() const;
+        void record(Direction direction, const QByteArray& data);
+
+        static bool readHeader(QIODevice *device);
+        static bool readFrame(QIODevice *device, Frame& frame);
+    private:
+        Recorder();
+        Q_DISABLE_COPY(Recorder);
+
+        class Private;
+        Private *d;
+};
+
+
+} /* end of namespace Instrument */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* INSTRUMENT_RECORDER_H_ */
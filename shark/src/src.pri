@@ -7,7 +7,8 @@ HEADERS += \
         $$PWD/componentstream.h \
         $$PWD/stream.h \
         $$PWD/stream_p.h \
-        $$PWD/streamerror.h
+        $$PWD/streamerror.h \
+        $$PWD/streammonitor.h
 SOURCES += \
         $$PWD/componentstream.cpp \
         $$PWD/stream.cpp \
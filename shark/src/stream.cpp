@@ -32,13 +32,38 @@
 #include "xmpp-core/message.h"
 #include "xmpp-core/presence.h"
 
+#include "streammonitor.h"
+
 namespace XMPP {
 
+/* reports @a handler processing to the stream monitor for the scope lifetime */
+class HandlerScope
+{
+    public:
+        HandlerScope(StreamMonitor *monitor, const char *handler)
+            : m_monitor(monitor), m_handler(handler)
+        {
+            if ( m_monitor ) {
+                m_monitor->handlerStarted(m_handler);
+            }
+        }
+        ~HandlerScope()
+        {
+            if ( m_monitor ) {
+                m_monitor->handlerFinished(m_handler);
+            }
+        }
+    private:
+        StreamMonitor *m_monitor;
+        const char *m_handler;
+};
+
 
 Stream::Stream(QObject *parent)
     : QObject(parent), d(new Private)
 {
     d->bytestream = 0;
+    d->monitor = 0;
     d->state = Closed;
 }
 
@@ -47,6 +72,7 @@ Stream::Stream(QObject *parent)
  */
 Stream::~Stream()
 {
+    delete d->monitor;
     delete d;
 }
 
@@ -68,7 +94,9 @@ StreamError Stream::lastStreamError() const
  */
 void Stream::sendStanza(const Stanza& stanza)
 {
-    write ( stanza.toString().toUtf8() );
+    if ( write( stanza.toString().toUtf8() ) && d->monitor ) {
+        d->monitor->stanzasSent(1);
+    }
 }
 
 /**
@@ -115,7 +143,33 @@ void Stream::sendStanza(const Stanza& stanza, QObject *obj, const QString& metho
     }
     d->scb.insert(stanza.id(), Private::StanzaCallback(obj,method));
     ssEnd:
-    write( stanza.toString().toUtf8() );
+    if ( write( stanza.toString().toUtf8() ) && d->monitor ) {
+        d->monitor->stanzasSent(1);
+    }
+}
+
+/**
+ * Sends already serialized stanza @a data to the outgoing stream. The data may
+ * hold several @a stanzas, it is used for statistics only.
+ * Returns false if the stream is not open or the data could not be written.
+ */
+bool Stream::sendSerialized(const QByteArray& data, int stanzas)
+{
+    if ( !write(data) ) {
+        return false;
+    }
+    if ( d->monitor ) {
+        d->monitor->stanzasSent(stanzas);
+    }
+    return true;
+}
+
+/**
+ * Returns number of bytes waiting in the output buffer of the stream.
+ */
+qint64 Stream::bytesToWrite() const
+{
+    return d->bytestream ? d->bytestream->bytesToWrite() : 0;
 }
 
 void Stream::sendStreamOpen()
@@ -152,6 +206,16 @@ void Stream::setByteStream(QIODevice *bs)
     d->bytestream = bs;
 }
 
+/**
+ * Reports traffic and handler timings of the stream to @a monitor, which is owned by
+ * the stream since then. Null disables monitoring.
+ */
+void Stream::setMonitor(StreamMonitor *monitor)
+{
+    delete d->monitor;
+    d->monitor = monitor;
+}
+
 /**
  * Sets the remote entity of the stream
  */
@@ -229,10 +293,22 @@ void Stream::processStanza(const Parser::Event& event)
     if ( event.qualifiedName() == "stream:error" ) {
         handleStreamError(event);
     } else if ( event.qualifiedName() == "message" ) {
+        if ( d->monitor ) {
+            d->monitor->stanzaReceived("message");
+        }
+        HandlerScope scope(d->monitor, "xmpp-message");
         emit stanzaMessage(event.element());
     } else if ( event.qualifiedName() == "iq" ) {
+        if ( d->monitor ) {
+            d->monitor->stanzaReceived("iq");
+        }
+        HandlerScope scope(d->monitor, "xmpp-iq");
         emit stanzaIQ(event.element());
     } else if ( event.qualifiedName() == "presence" ) {
+        if ( d->monitor ) {
+            d->monitor->stanzaReceived("presence");
+        }
+        HandlerScope scope(d->monitor, "xmpp-presence");
         emit stanzaPresence(event.element());
     } else {
         if (!handleUnknownElement(event))
@@ -244,24 +320,39 @@ void Stream::processStanza(const Parser::Event& event)
 /**
  * Write data to the outgoing stream.
  */
-void Stream::write(const QByteArray& data)
+bool Stream::write(const QByteArray& data)
 {
     if (d->state != Open)
-        return;
+        return false;
     // qDebug("[XMPP:Stream] -send-: %s", qPrintable(QString::fromUtf8(data)));
-    d->bytestream->write(data);
+    if ( d->bytestream->write(data) != data.size() ) {
+        return false;
+    }
+    if ( d->monitor ) {
+        d->monitor->dataWritten(data);
+    }
+    return true;
 }
 
 void Stream::bsReadyRead()
 {
     QByteArray data = d->bytestream->readAll();
+    if ( d->monitor ) {
+        d->monitor->dataRead(data);
+    }
     // qDebug("[XMPP:Stream] -recv-: %s", qPrintable(QString::fromUtf8(data)));
 
     d->parser.appendData(data);
-    Parser::Event event = d->parser.readNext();
-    while ( !event.isNull() ) {
+    forever {
+        Parser::Event event;
+        {
+            HandlerScope scope(d->monitor, "xmpp-parse");
+            event = d->parser.readNext();
+        }
+        if ( event.isNull() ) {
+            break;
+        }
         processEvent(event);
-        event = d->parser.readNext();
     }
 }
 
@@ -34,6 +34,7 @@ namespace XMPP {
 
 class Jid;
 class Stanza;
+class StreamMonitor;
 class IQ;
 class Message;
 class Presence;
@@ -55,6 +56,11 @@ class Stream : public QObject
 
         void sendStanza(const Stanza& stanza);
         void sendStanza(const Stanza& stanza, QObject *obj, const QString& method);
+        bool sendSerialized(const QByteArray& data, int stanzas = 1);
+
+        qint64 bytesToWrite() const;
+
+        void setMonitor(StreamMonitor *monitor);
     public slots:
         void sendStreamOpen();
         void sendStreamClose();
@@ -74,7 +80,7 @@ class Stream : public QObject
         virtual void handleStreamOpen(const Parser::Event& e) = 0;
         virtual bool handleUnknownElement(const Parser::Event& e) = 0;
 
-        void write(const QByteArray& data);
+        bool write(const QByteArray& data);
     private:
         void handleStreamError(const Parser::Event& event);
         void processEvent(const Parser::Event& event);
@@ -34,6 +34,7 @@ class Stream::Private
 
         StreamError lastStreamError;
         QIODevice *bytestream;
+        StreamMonitor *monitor;
 
         typedef QPair<QObject*,QString> StanzaCallback;
         typedef QHash<QString,StanzaCallback> SCBHash; /* stanza callback hash */
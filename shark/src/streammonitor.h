@@ -0,0 +1,61 @@
+/*
+ * streammonitor.h - Observer of stream traffic
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_STREAMMONITOR_H_
+#define XMPP_STREAMMONITOR_H_
+
+class QByteArray;
+
+namespace XMPP {
+
+
+/**
+ * @class StreamMonitor
+ * Receives traffic and handler events of one Stream, e.g. to keep metrics
+ * or to record the traffic. Methods are called from the stream's thread.
+ *
+ * @sa Stream::setMonitor()
+ */
+class StreamMonitor
+{
+    public:
+        virtual ~StreamMonitor() {}
+
+        /* @a data was written to the bytestream */
+        virtual void dataWritten(const QByteArray& data) = 0;
+        /* @a data was read from the bytestream */
+        virtual void dataRead(const QByteArray& data) = 0;
+
+        /* @a count stanzas were written */
+        virtual void stanzasSent(int count) = 0;
+        /* stanza of @a kind (message, iq or presence) was received */
+        virtual void stanzaReceived(const char *kind) = 0;
+
+        /* stream starts/finishes processing with @a handler (e.g. "xmpp-parse").
+         * Calls may nest, each handlerStarted() is followed by handlerFinished() */
+        virtual void handlerStarted(const char *handler) = 0;
+        virtual void handlerFinished(const char *handler) = 0;
+};
+
+
+} /* end of namespace XMPP */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* XMPP_STREAMMONITOR_H_ */
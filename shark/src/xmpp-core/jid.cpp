@@ -22,7 +22,7 @@
 
 #include <QCoreApplication>
 #include <QByteArray>
-#include <QHash>
+#include <QCache>
 #include <QSharedData>
 
 /* libidn */
@@ -34,6 +34,10 @@ using namespace XMPP;
 //----------------------------------------------------------------------------
 // StringPrepCache
 //----------------------------------------------------------------------------
+
+/* maximum number of cached results per stringprep profile */
+static const int STRINGPREP_CACHE_SIZE = 4096;
+
 class StringPrepCache : public QObject
 {
     public:
@@ -42,28 +46,27 @@ class StringPrepCache : public QObject
         static bool resourceprep(const QString& in, int maxbytes, QString *out);
 
     private:
+        enum Profile { Nameprep, Nodeprep, Resourceprep };
+
         class Result
         {
             public:
-                QString *norm;
+                QString norm;
+                bool valid;
 
-                Result() : norm(0)
+                Result() : valid(false)
                 {
                 }
 
-                Result(const QString& s) : norm( new QString(s) )
+                Result(const QString& s) : norm(s), valid(true)
                 {
                 }
-
-                ~Result()
-                {
-                    delete norm;
-                }
         };
 
-        QHash<QString,Result*> nameprep_table;
-        QHash<QString,Result*> nodeprep_table;
-        QHash<QString,Result*> resourceprep_table;
+        static bool prep(Profile profile, const QString& in, int maxbytes, QString *out);
+        static bool asciiPrep(Profile profile, const QString& in, int maxbytes, bool *valid, QString *out);
+
+        QCache<QString,Result> tables[3];
 
         static StringPrepCache *instance;
 
@@ -82,53 +85,38 @@ class StringPrepCache : public QObject
 StringPrepCache::StringPrepCache()
     : QObject(qApp)
 {
+    for (int i = 0; i < 3; ++i) {
+        tables[i].setMaxCost(STRINGPREP_CACHE_SIZE);
+    }
 }
 
 StringPrepCache::~StringPrepCache()
 {
-    qDeleteAll(nodeprep_table);
-    qDeleteAll(nameprep_table);
-    qDeleteAll(resourceprep_table);
 }
 
 bool StringPrepCache::nodeprep(const QString& in, int maxbytes, QString *out)
 {
-    if ( in.isEmpty() ) {
-        if (out) {
-            *out = QString();
-        }
-        return true;
-    }
-
-    StringPrepCache *that = get_instance();
-
-    Result *r = that->nodeprep_table[in];
-    if (r) {
-        if (!r->norm) {
-            return false;
-        }
-         if (out) {
-            *out = *(r->norm);
-         }
-        return true;
-    }
+    return prep(Nodeprep, in, maxbytes, out);
+}
 
-    QByteArray cs = in.toUtf8();
-    cs.resize(maxbytes);
-    if (stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_xmpp_nodeprep) != 0) {
-        that->nodeprep_table.insert(in, new Result);
-        return false;
-    }
+bool StringPrepCache::nameprep(const QString& in, int maxbytes, QString *out)
+{
+    return prep(Nameprep, in, maxbytes, out);
+}
 
-    QString norm = QString::fromUtf8(cs);
-    that->nodeprep_table.insert( in, new Result(norm) );
-    if (out) {
-        *out = norm;
-    }
-    return true;
+bool StringPrepCache::resourceprep(const QString& in, int maxbytes, QString *out)
+{
+    return prep(Resourceprep, in, maxbytes, out);
 }
 
-bool StringPrepCache::nameprep(const QString& in, int maxbytes, QString *out)
+/**
+ * Normalises @a in with the given stringprep @a profile.
+ *
+ * Pure-ASCII strings are handled inline and never reach the cache, other strings
+ * go through libidn and the result is kept in a bounded LRU table, so a stream
+ * of unique resources can't grow the cache without limits.
+ */
+bool StringPrepCache::prep(Profile profile, const QString& in, int maxbytes, QString *out)
 {
     if ( in.isEmpty() ) {
         if (out) {
@@ -137,67 +125,108 @@ bool StringPrepCache::nameprep(const QString& in, int maxbytes, QString *out)
         return true;
     }
 
+    bool valid;
+    if ( asciiPrep(profile, in, maxbytes, &valid, out) ) {
+        return valid;
+    }
+
     StringPrepCache *that = get_instance();
+    QCache<QString,Result>& table = that->tables[profile];
 
-    Result *r = that->nameprep_table[in];
+    Result *r = table.object(in);
     if (r) {
-        if (!r->norm) {
+        if (!r->valid) {
             return false;
         }
         if (out) {
-            *out = *(r->norm);
+            *out = r->norm;
         }
         return true;
     }
 
+    const Stringprep_profile *sp;
+    switch (profile) {
+        case Nameprep:
+            sp = stringprep_nameprep;
+            break;
+        case Nodeprep:
+            sp = stringprep_xmpp_nodeprep;
+            break;
+        default:
+            sp = stringprep_xmpp_resourceprep;
+            break;
+    }
+
     QByteArray cs = in.toUtf8();
     cs.resize(maxbytes);
-    if (stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_nameprep) != 0) {
-        that->nameprep_table.insert(in, new Result);
+    if (stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, sp) != 0) {
+        table.insert(in, new Result);
         return false;
     }
 
-    QString norm = QString::fromUtf8(cs);
-    that->nameprep_table.insert( in, new Result(norm) );
+    QString norm = QString::fromUtf8( cs.constData() );
+    table.insert( in, new Result(norm) );
     if (out) {
         *out = norm;
     }
     return true;
 }
 
-bool StringPrepCache::resourceprep(const QString& in, int maxbytes, QString *out)
+/**
+ * Applies the ASCII subset of the stringprep profiles: nameprep and nodeprep map
+ * upper case letters to lower case, nodeprep and resourceprep prohibit control
+ * characters, nodeprep also prohibits space and the characters "&'/:<>@.
+ *
+ * Returns false if @a in has to be handled by libidn (non-ASCII characters or a
+ * string that doesn't fit into @a maxbytes), otherwise the result is stored to
+ * @a valid and @a out.
+ */
+bool StringPrepCache::asciiPrep(Profile profile, const QString& in, int maxbytes, bool *valid, QString *out)
 {
-    if ( in.isEmpty() ) {
-        if (out) {
-            *out = QString();
-        }
-        return true;
+    if ( in.size() >= maxbytes ) {
+        return false;
     }
 
-    StringPrepCache *that = get_instance();
-
-    Result *r = that->resourceprep_table[in];
-    if (r) {
-        if (!r->norm) {
+    bool hasUpper = false;
+    bool prohibited = false;
+    const QChar *c = in.unicode();
+    const QChar *end = c + in.size();
+    for (; c != end; ++c) {
+        ushort ch = c->unicode();
+        if ( ch >= 0x80 ) {
             return false;
         }
-        if (out) {
-            *out = *(r->norm);
+        if ( ch >= 'A' && ch <= 'Z' ) {
+            hasUpper = true;
+        } else if ( profile != Nameprep && ( ch < 0x20 || ch == 0x7F ) ) {
+            prohibited = true;
+        } else if ( profile == Nodeprep ) {
+            switch (ch) {
+                case ' ':
+                case '"':
+                case '&':
+                case '\'':
+                case '/':
+                case ':':
+                case '<':
+                case '>':
+                case '@':
+                    prohibited = true;
+                    break;
+                default:
+                    break;
+            }
         }
-        return true;
     }
 
-    QByteArray cs = in.toUtf8();
-    cs.resize(maxbytes);
-    if (stringprep(cs.data(), maxbytes, (Stringprep_profile_flags)0, stringprep_xmpp_resourceprep) != 0) {
-        that->resourceprep_table.insert(in, new Result);
-        return false;
+    *valid = !prohibited;
+    if ( prohibited || !out ) {
+        return true;
     }
-
-    QString norm = QString::fromUtf8(cs);
-    that->resourceprep_table.insert( in, new Result(norm) );
-    if (out) {
-        *out = norm;
+    if ( hasUpper && profile != Resourceprep ) {
+        *out = in.toLower();
+    } else {
+        *out = in;
     }
     return true;
 }
@@ -205,44 +234,130 @@ bool StringPrepCache::resourceprep(const QString& in, int maxbytes, QString *out
 StringPrepCache *StringPrepCache::instance = 0;
 
 
+//----------------------------------------------------------------------------
+// JidStringPool
+//----------------------------------------------------------------------------
+
+/* maximum number of interned jid strings */
+static const int JID_POOL_SIZE = 8192;
+
+/*
+ * Pool of normalised jid strings. Jids which are set to the same value share
+ * the string data, so comparing them is a pointer check and keeping thousands
+ * of them (e.g. contact jids in rosters) costs a single copy.
+ */
+class JidStringPool : public QObject
+{
+    public:
+        static QString intern(const QString& str);
+
+    private:
+        QCache<QString,QString> pool;
+
+        static JidStringPool *instance;
+
+        JidStringPool();
+};
+
+JidStringPool *JidStringPool::instance = 0;
+
+JidStringPool::JidStringPool()
+    : QObject(qApp)
+{
+    pool.setMaxCost(JID_POOL_SIZE);
+}
+
+QString JidStringPool::intern(const QString& str)
+{
+    if ( str.isEmpty() ) {
+        return str;
+    }
+    if (!instance) {
+        instance = new JidStringPool;
+    }
+
+    QString *interned = instance->pool.object(str);
+    if (interned) {
+        return *interned;
+    }
+    instance->pool.insert( str, new QString(str) );
+    return str;
+}
+
+
 class Jid::Private : public QSharedData
 {
     public:
         Private();
-        Private(const Private& other);
 
         void reset();
+        void assign(const QString& node, const QString& domain, const QString& resource);
+
+        int domainOffset() const;
 
         static bool validDomain(const QString& domain, QString *normalised = 0);
         static bool validNode(const QString& node, QString *normalised = 0);
         static bool validResource(const QString& resource, QString *normalised = 0);
 
-        QString node, domain, resource;
+        /* normalised [node@]domain[/resource] string */
+        QString full;
+        /* full jid without the resource part, shares data with 'full' if there's no resource */
+        QString bare;
+        int nodeLength;
+        int resourceOffset;
+        uint fullHash;
+        uint bareHash;
         bool valid;
 };
 
 Jid::Private::Private()
     : QSharedData()
 {
-    valid = false;
+    reset();
 }
 
-Jid::Private::Private(const Private& other)
-    : QSharedData(other)
+void Jid::Private::reset()
 {
-    valid = other.valid;
-    node = other.node;
-    domain = other.domain;
-    resource = other.resource;
+    full.clear();
+    bare.clear();
+    nodeLength = 0;
+    resourceOffset = -1;
+    fullHash = bareHash = qHash( QString() );
+
+    valid = false;
 }
 
-void Jid::Private::reset()
+/**
+ * Builds jabber-id string out of normalised parts and caches its bare form and hashes.
+ */
+void Jid::Private::assign(const QString& node, const QString& domain, const QString& resource)
 {
-    domain.clear();
-    node.clear();
-    resource.clear();
+    QString str;
+    str.reserve( node.size() + domain.size() + resource.size() + 2 );
+    if ( !node.isEmpty() ) {
+        str += node;
+        str += QLatin1Char('@');
+    }
+    str += domain;
+    int bareLength = str.size();
+    if ( !resource.isEmpty() ) {
+        str += QLatin1Char('/');
+        str += resource;
+    }
 
-    valid = false;
+    full = JidStringPool::intern(str);
+    bare = resource.isEmpty() ? full : JidStringPool::intern( full.left(bareLength) );
+    nodeLength = node.size();
+    resourceOffset = resource.isEmpty() ? -1 : bareLength + 1;
+    fullHash = qHash(full);
+    bareHash = resource.isEmpty() ? fullHash : qHash(bare);
+
+    valid = true;
+}
+
+int Jid::Private::domainOffset() const
+{
+    return nodeLength ? nodeLength + 1 : 0;
 }
 
 bool Jid::Private::validDomain(const QString& domain, QString *normalised)
@@ -344,7 +459,8 @@ Jid& Jid::operator=(const char *str)
  */
 QString Jid::domain() const
 {
-    return d->domain;
+    int offset = d->domainOffset();
+    return d->full.mid(offset, d->bare.size() - offset);
 }
 
 /**
@@ -352,7 +468,10 @@ QString Jid::domain() const
  */
 QString Jid::node() const
 {
-    return d->node;
+    if ( !d->nodeLength ) {
+        return QString();
+    }
+    return d->full.left(d->nodeLength);
 }
 
 /**
@@ -360,7 +479,10 @@ QString Jid::node() const
  */
 QString Jid::resource() const
 {
-    return d->resource;
+    if ( d->resourceOffset < 0 ) {
+        return QString();
+    }
+    return d->full.mid(d->resourceOffset);
 }
 
 /**
@@ -368,11 +490,7 @@ QString Jid::resource() const
  */
 QString Jid::bare() const
 {
-    QString bare = d->domain;
-    if ( !d->node.isEmpty() ) {
-        bare.prepend(d->node + "@");
-    }
-    return bare;
+    return d->bare;
 }
 
 /**
@@ -380,14 +498,7 @@ QString Jid::bare() const
  */
 QString Jid::full() const
 {
-    QString full = d->domain;
-    if ( !d->node.isEmpty() ) {
-        full.prepend(d->node + "@");
-    }
-    if ( !d->resource.isEmpty() ) {
-        full.append("/" + d->resource);
-    }
-    return full;
+    return d->full;
 }
 
 /**
@@ -424,10 +535,7 @@ void Jid::set(const QString& jid)
         return;
     }
 
-    d->valid = true;
-    d->domain = normalisedDomain;
-    d->node = normalisedNode;
-    d->resource = normalisedResource;
+    d->assign(normalisedNode, normalisedDomain, normalisedResource);
 }
 
 /**
@@ -440,10 +548,7 @@ void Jid::set(const QString& domain, const QString& node, const QString& resourc
         d->reset();
         return;
     }
-    d->valid = true;
-    d->domain = normalisedDomain;
-    d->node = normalisedNode;
-    d->resource = normalisedResource;
+    d->assign(normalisedNode, normalisedDomain, normalisedResource);
 }
 
 /**
@@ -459,7 +564,7 @@ void Jid::setDomain(const QString& domain)
         d->reset();
         return;
     }
-    d->domain = normalised;
+    d->assign(node(), normalised, resource());
 }
 
 /**
@@ -475,7 +580,7 @@ void Jid::setNode(const QString& node)
         d->reset();
         return;
     }
-    d->node = normalised;
+    d->assign(normalised, domain(), resource());
 }
 
 /**
@@ -491,7 +596,7 @@ void Jid::setResource(const QString& resource)
         d->reset();
         return;
     }
-    d->resource = normalised;
+    d->assign(node(), domain(), normalised);
 }
 
 /**
@@ -516,6 +621,14 @@ Jid Jid::withResource(const QString& resource) const
     return jid;
 }
 
+/**
+ * Returns true if jabber-id wasn't set or was reset by an invalid value.
+ */
+bool Jid::isNull() const
+{
+    return !d->valid;
+}
+
 /**
  * Returns true if this Jid object is a valid jabber-id.
  */
@@ -529,7 +642,7 @@ bool Jid::isValid() const
  */
 bool Jid::isEmpty() const
 {
-    return d->node.isEmpty() && d->domain.isEmpty() && d->resource.isEmpty();
+    return d->full.isEmpty();
 }
 
 /**
@@ -547,10 +660,10 @@ bool Jid::compare(const Jid& other, bool compareResource) const
         return false;
     }
 
-    if ( compareResource ? ( full() == other.full() ) : ( bare() == other.bare() ) ) {
-        return true;
+    if (compareResource) {
+        return d->fullHash == other.d->fullHash && d->full == other.d->full;
     }
-    return false;
+    return d->bareHash == other.d->bareHash && d->bare == other.d->bare;
 }
 
 /**
@@ -558,16 +671,7 @@ bool Jid::compare(const Jid& other, bool compareResource) const
  */
 bool Jid::operator==(const Jid& other) const
 {
-    if ( isEmpty() && other.isEmpty() ) {
-        return true;
-    }
-    if ( !isValid() || !other.isValid() ) {
-        return false;
-    }
-    if ( full() == other.full() ) {
-        return true;
-    }
-    return false;
+    return compare(other, true);
 }
 
 bool Jid::operator!=(const Jid& other) const
@@ -577,7 +681,31 @@ bool Jid::operator!=(const Jid& other) const
 
 Jid::operator QString() const
 {
-    return full();
+    return d->full;
+}
+
+/**
+ * Returns hash value of the full jabber-id, which is computed when jid is set.
+ */
+uint Jid::hash() const
+{
+    return d->fullHash;
+}
+
+/**
+ * Returns hash value of the bare jabber-id, which is computed when jid is set.
+ */
+uint Jid::bareHash() const
+{
+    return d->bareHash;
+}
+
+/**
+ * Returns hash value for the @a jid, so it can be used as QHash key.
+ */
+uint XMPP::qHash(const Jid& jid)
+{
+    return jid.hash();
 }
 
 // vim:ts=4:sw=4:et:nowrap
@@ -67,11 +67,16 @@ class Jid
         bool operator!=(const Jid& other) const;
 
         operator QString() const;
+
+        uint hash() const;
+        uint bareHash() const;
     private:
         class Private;
         QSharedDataPointer<Private> d;
 };
 
+uint qHash(const Jid& jid);
+
 
 } // end namespace XMPP
 
@@ -173,6 +173,24 @@ void Presence::setStatus(const QString& status)
     setProperty("status", status);
 }
 
+/**
+ * Attaches entity capabilities (XEP-0115) element to the presence.
+ * @param node  URI of the software which sends the presence
+ * @param ver   verification string (see DiscoInfo::capsVerification())
+ * @param hash  hash function used to compute @a ver
+ */
+void Presence::setCaps(const QString& node, const QString& ver, const QString& hash)
+{
+    QDomElement root = doc()->documentElement();
+    root.removeChild( root.firstChildElement("c") );
+
+    QDomElement eCaps = doc()->createElementNS(NS_CAPS, "c");
+    eCaps.setAttribute("hash", hash);
+    eCaps.setAttribute("node", node);
+    eCaps.setAttribute("ver", ver);
+    root.appendChild(eCaps);
+}
+
 /**
  * Sets presence stanza type to @a type
  *
@@ -23,6 +23,8 @@
 
 #include "stanza.h"
 
+#define NS_CAPS "http://jabber.org/protocol/caps"
+
 namespace XMPP {
 
 
@@ -47,6 +49,7 @@ class Presence : public Stanza
         void setPriority(int priority);
         void setShow(Show showState);
         void setStatus(const QString& status);
+        void setCaps(const QString& node, const QString& ver, const QString& hash = "sha-1");
         using Stanza::setType;
         void setType(Type type);
     private:
@@ -28,6 +28,7 @@
 #include "xmpp-core/presence.h"
 
 #include "xmpp-ext/registration.h"
+#include "xmpp-ext/replycache.h"
 
 #include <QDomElement>
 
@@ -38,13 +39,15 @@ class GatewayTask::Private {
     public:
         Registration reg;
         ComponentStream *stream;
+
+        /* serialized registration form */
+        ReplyCache replies;
 };
 
-static void send_presence(ComponentStream *cs, const XMPP::Jid& user, const QString& legacyName, Presence::Type t)
+static Presence legacy_presence(ComponentStream *cs, const XMPP::Jid& user, const QString& legacyName, Presence::Type t)
 {
     Jid from = cs->serviceName().withNode(legacyName);
-    Presence p = Presence(t, from, user);
-    cs->sendStanza(p);
+    return Presence(t, from, user);
 }
 
 GatewayTask::GatewayTask(ComponentStream *stream)
@@ -70,38 +73,74 @@ GatewayTask::~GatewayTask()
 void GatewayTask::setRegistrationForm(const Registration& reg)
 {
     d->reg = reg;
+    d->replies.clear();
+}
+
+/**
+ * Returns cache of the serialized registration form, its hits and misses are
+ * exported by the application.
+ */
+const ReplyCache& GatewayTask::replyCache() const
+{
+    return d->replies;
 }
 
 void GatewayTask::notifyOnline(const XMPP::Jid& user, const QString& legacyName, int presence_show)
 {
     Jid from = d->stream->serviceName().withNode(legacyName);
     Presence p = Presence(Presence::Available, from, user, (Presence::Show)presence_show);
-    d->stream->sendStanza(p);
+    send(p);
 }
 
 void GatewayTask::notifyOffline(const XMPP::Jid& user, const QString& legacyName)
 {
-    send_presence(d->stream, user, legacyName, Presence::Unavailable);
+    send( legacy_presence(d->stream, user, legacyName, Presence::Unavailable) );
 }
 
 void GatewayTask::notifySubscribe(const XMPP::Jid& user, const QString& legacyName)
 {
-    send_presence(d->stream, user, legacyName, Presence::Subscribe);
+    send( legacy_presence(d->stream, user, legacyName, Presence::Subscribe) );
 }
 
 void GatewayTask::notifyUnsubscribe(const XMPP::Jid& user, const QString& legacyName)
 {
-    send_presence(d->stream, user, legacyName, Presence::Unsubscribe);
+    send( legacy_presence(d->stream, user, legacyName, Presence::Unsubscribe) );
 }
 
 void GatewayTask::notifySubscribed(const XMPP::Jid& user, const QString& legacyName)
 {
-    send_presence(d->stream, user, legacyName, Presence::Subscribed);
+    send( legacy_presence(d->stream, user, legacyName, Presence::Subscribed) );
 }
 
 void GatewayTask::notifyUnsubscribed(const XMPP::Jid& user, const QString& legacyName)
 {
-    send_presence(d->stream, user, legacyName, Presence::Unsubscribed);
+    send( legacy_presence(d->stream, user, legacyName, Presence::Unsubscribed) );
+}
+
+/**
+ * Sends @a stanza through outgoingStanza() signal, so the application can choose the
+ * connection for the recipient. If nothing is connected, the stanza is sent on the
+ * stream the task belongs to.
+ */
+void GatewayTask::send(const Stanza& stanza)
+{
+    if ( receivers( SIGNAL(outgoingStanza(XMPP::Stanza)) ) > 0 ) {
+        emit outgoingStanza(stanza);
+    } else {
+        d->stream->sendStanza(stanza);
+    }
+}
+
+/**
+ * Same as send() for the serialized stanza @a data addressed to @a recipient.
+ */
+void GatewayTask::sendSerialized(const Jid& recipient, const QByteArray& data)
+{
+    if ( receivers( SIGNAL(outgoingSerialized(XMPP::Jid,QByteArray)) ) > 0 ) {
+        emit outgoingSerialized(recipient, data);
+    } else {
+        d->stream->sendSerialized(data);
+    }
 }
 
 void GatewayTask::slotMessage(const XMPP::Message& msg)
@@ -123,13 +162,19 @@ void GatewayTask::slotRegister(const XMPP::IQ& iq)
     QString ns = iq.childElement().namespaceURI();
 
     if ( tag == "query" && ns == NS_IQ_REGISTER && iq.type() == "get" ) {
+        QByteArray cached = d->replies.reply(NS_IQ_REGISTER, iq);
+        if ( !cached.isEmpty() ) {
+            sendSerialized(iq.from(), cached);
+            return;
+        }
+
         Registration form(d->reg);
         form.setTo(iq.from());
         form.setFrom(iq.to());
         form.setId(iq.id());
         form.setType(IQ::Result);
 
-        d->stream->sendStanza(form);
+        sendSerialized( iq.from(), d->replies.insert(NS_IQ_REGISTER, form) );
         return;
     }
     if ( tag == "query" && ns == NS_IQ_REGISTER && iq.type() == "set" ) {
@@ -138,7 +183,7 @@ void GatewayTask::slotRegister(const XMPP::IQ& iq)
         if ( request.from().isEmpty() ) {
             Registration err = IQ::createReply(request);
             err.setError( Stanza::Error(Stanza::Error::UnexpectedRequest) );
-            d->stream->sendStanza(err);
+            send(err);
             return;
         }
 
@@ -146,22 +191,22 @@ void GatewayTask::slotRegister(const XMPP::IQ& iq)
             Registration reply = IQ::createReply(iq);
             reply.clearChild();
             reply.setType(IQ::Result);
-            d->stream->sendStanza(reply);
+            send(reply);
 
             Presence removeSubscription;
             removeSubscription.setTo( iq.from().bare() );
             removeSubscription.setType(Presence::Unsubscribe);
-            d->stream->sendStanza(removeSubscription);
+            send(removeSubscription);
 
             Presence removeAuth;
             removeAuth.setTo( iq.from().bare() );
             removeAuth.setType(Presence::Unsubscribed);
-            d->stream->sendStanza(removeAuth);
+            send(removeAuth);
 
             Presence logout;
             logout.setTo( iq.from() );
             logout.setType(Presence::Unavailable);
-            d->stream->sendStanza(logout);
+            send(logout);
 
             emit userUnregister(iq.from());
             return;
@@ -171,28 +216,28 @@ void GatewayTask::slotRegister(const XMPP::IQ& iq)
             Registration err(request);
             err.swapFromTo();
             err.setError( Stanza::Error(Stanza::Error::NotAcceptable) );
-            d->stream->sendStanza(err);
+            send(err);
             return;
         }
 
         /* registration success */
         IQ reply = IQ::createReply(iq);
         reply.clearChild();
-        d->stream->sendStanza(reply);
+        send(reply);
 
         /* subscribe for user presence */
         Presence subscribe;
         subscribe.setFrom(iq.to());
         subscribe.setTo( iq.from().bare() );
         subscribe.setType(Presence::Subscribe);
-        d->stream->sendStanza(subscribe);
+        send(subscribe);
 
         emit userRegister( request.from(), request.getField(Registration::Username), request.getField(Registration::Password) );
 
         Presence presence;
         presence.setFrom(iq.to());
         presence.setTo( iq.from().bare() );
-        d->stream->sendStanza(presence);
+        send(presence);
 
         /* execute log-in case */
         emit userLogIn(iq.from(), Presence::None);
@@ -208,7 +253,7 @@ void GatewayTask::slotGatewaySubscribe(const XMPP::Presence& p)
         approve.setTo( p.from() );
         approve.setFrom( p.to() );
 
-        d->stream->sendStanza(approve);
+        send(approve);
     }
 }
 
@@ -23,6 +23,8 @@
 
 #include <QObject>
 
+class QByteArray;
+
 namespace XMPP {
 
 class ComponentStream;
@@ -31,6 +33,8 @@ class Message;
 class IQ;
 class Presence;
 class Registration;
+class Stanza;
+class ReplyCache;
 
 
 class GatewayTask : public QObject
@@ -42,6 +46,7 @@ class GatewayTask : public QObject
         virtual ~GatewayTask();
 
         void setRegistrationForm(const Registration& reg);
+        const ReplyCache& replyCache() const;
     public slots:
         void notifyOnline(const XMPP::Jid& user, const QString& legacyName, int presence_show);
         void notifyOffline(const XMPP::Jid& user, const QString& legacyName);
@@ -66,6 +71,9 @@ class GatewayTask : public QObject
 
         void messageToLegacyNode(const XMPP::Jid& user, const QString& legacyNode, const QString& text);
         void messageToService(const XMPP::Jid& user, const QString& msg);
+
+        void outgoingStanza(const XMPP::Stanza& stanza);
+        void outgoingSerialized(const XMPP::Jid& recipient, const QByteArray& data);
     private slots:
         void slotMessage(const XMPP::Message& msg);
         void slotRegister(const XMPP::IQ& iq);
@@ -74,6 +82,9 @@ class GatewayTask : public QObject
         void slotSubscription(const XMPP::Presence& p);
         void slotPresence(const XMPP::Presence& p);
     private:
+        void send(const Stanza& stanza);
+        void sendSerialized(const Jid& recipient, const QByteArray& data);
+
         Q_DISABLE_COPY(GatewayTask);
         class Private;
         Private *d;
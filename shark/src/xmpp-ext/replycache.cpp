@@ -0,0 +1,179 @@
+/*
+ * replycache.cpp - cache of serialized replies to static queries
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "replycache.h"
+
+#include "xmpp-core/iq.h"
+
+#include <QByteArray>
+#include <QDomDocument>
+#include <QHash>
+#include <QString>
+
+namespace XMPP {
+
+
+class ReplyCache::Private
+{
+    public:
+        static QByteArray escape(const QString& value);
+        static QByteArray patch(const QByteArray& data, const QString& to, const QString& from, const QString& id);
+
+        /* serialized reply stanzas without 'to', 'from' and 'id' attributes */
+        QHash<QString,QByteArray> replies;
+
+        uint hits;
+        uint misses;
+};
+
+/**
+ * Escapes @a value to be used as xml attribute value.
+ */
+QByteArray ReplyCache::Private::escape(const QString& value)
+{
+    QByteArray data = value.toUtf8();
+    for (int i = 0; i < data.size(); ++i) {
+        switch ( data.at(i) ) {
+            case '&':
+            case '<':
+            case '>':
+            case '"':
+            case '\'':
+                return data.replace('&', "&amp;").replace('<', "&lt;").replace('>', "&gt;")
+                           .replace('"', "&quot;").replace('\'', "&apos;");
+            default:
+                break;
+        }
+    }
+    return data;
+}
+
+/**
+ * Inserts addressing attributes into the serialized reply @a data.
+ */
+QByteArray ReplyCache::Private::patch(const QByteArray& data, const QString& to, const QString& from, const QString& id)
+{
+    /* data starts with "<iq" followed by the rest of attributes */
+    QByteArray stanza;
+    stanza.reserve( data.size() + to.size() + from.size() + id.size() + 24 );
+    stanza += data.left(3);
+    if ( !to.isEmpty() ) {
+        stanza += " to=\"" + escape(to) + '"';
+    }
+    if ( !from.isEmpty() ) {
+        stanza += " from=\"" + escape(from) + '"';
+    }
+    if ( !id.isEmpty() ) {
+        stanza += " id=\"" + escape(id) + '"';
+    }
+    stanza += data.mid(3);
+    return stanza;
+}
+
+/**
+ * @class ReplyCache
+ * Cache of serialized replies to info/query requests which have static content
+ * (service discovery, service vCard, registration form). Replies are stored
+ * without addressing attributes, so the cached reply only gets 'to', 'from' and
+ * 'id' patched from the request instead of building and serializing DOM tree.
+ */
+
+/**
+ * Constructs an empty reply cache.
+ */
+ReplyCache::ReplyCache()
+    : d(new Private)
+{
+    d->hits = 0;
+    d->misses = 0;
+}
+
+/**
+ * Destroys reply cache.
+ */
+ReplyCache::~ReplyCache()
+{
+    delete d;
+}
+
+/**
+ * Returns serialized reply to @a request cached under @a key.
+ * Returns empty byte array if there is no such reply.
+ */
+QByteArray ReplyCache::reply(const QString& key, const IQ& request)
+{
+    QHash<QString,QByteArray>::const_iterator it = d->replies.constFind(key);
+    if ( it == d->replies.constEnd() ) {
+        ++d->misses;
+        return QByteArray();
+    }
+    ++d->hits;
+
+    QDomElement root = request.doc()->documentElement();
+    return Private::patch( it.value(), root.attribute("from"), root.attribute("to"), root.attribute("id") );
+}
+
+/**
+ * Stores @a reply under @a key and returns @a reply serialized.
+ */
+QByteArray ReplyCache::insert(const QString& key, const IQ& reply)
+{
+    IQ copy(reply);
+    QDomElement root = copy.doc()->documentElement();
+    QString to = root.attribute("to");
+    QString from = root.attribute("from");
+    QString id = root.attribute("id");
+    root.removeAttribute("to");
+    root.removeAttribute("from");
+    root.removeAttribute("id");
+
+    QByteArray data = copy.toString().toUtf8();
+    d->replies.insert(key, data);
+    return Private::patch(data, to, from, id);
+}
+
+/**
+ * Removes all cached replies. Should be called when the content of replies changes.
+ */
+void ReplyCache::clear()
+{
+    d->replies.clear();
+}
+
+/**
+ * Returns number of requests served from the cache.
+ */
+uint ReplyCache::hits() const
+{
+    return d->hits;
+}
+
+/**
+ * Returns number of requests which were not found in the cache.
+ */
+uint ReplyCache::misses() const
+{
+    return d->misses;
+}
+
+
+} /* end of namespace XMPP */
+
+// vim:ts=4:sw=4:et:nowrap
@@ -0,0 +1,56 @@
+/*
+ * replycache.h - cache of serialized replies to static queries
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef XMPP_REPLY_CACHE_H_
+#define XMPP_REPLY_CACHE_H_
+
+#include <QtGlobal>
+
+class QByteArray;
+class QString;
+
+namespace XMPP {
+
+class IQ;
+
+
+class ReplyCache
+{
+    public:
+        ReplyCache();
+        ~ReplyCache();
+
+        QByteArray reply(const QString& key, const IQ& request);
+        QByteArray insert(const QString& key, const IQ& reply);
+        void clear();
+
+        uint hits() const;
+        uint misses() const;
+    private:
+        Q_DISABLE_COPY(ReplyCache);
+        class Private;
+        Private *d;
+};
+
+
+} /* end of namespace XMPP */
+
+// vim:ts=4:sw=4:et:nowrap
+#endif /* XMPP_REPLY_CACHE_H_ */
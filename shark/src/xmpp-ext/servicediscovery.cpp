@@ -18,12 +18,15 @@
  *
  */
 
+#include <QCryptographicHash>
 #include <QDomDocument>
 #include <QListIterator>
+#include <QMap>
 #include <QSharedData>
 #include <QStringList>
 
 #include "xmpp-core/jid.h"
+#include "dataform.h"
 #include "servicediscovery.h"
 
 namespace XMPP
@@ -41,8 +44,22 @@ class DiscoInfo::Private : public QSharedData
 
         IdentityList identities;
         QStringList features;
+        /* extended information forms (XEP-0128) */
+        QList<DataForm> extensions;
 };
 
+static QString form_type(const DataForm& form)
+{
+    QListIterator<DataForm::Field> fi( form.fields() );
+    while ( fi.hasNext() ) {
+        DataForm::Field field = fi.next();
+        if ( field.name() == "FORM_TYPE" ) {
+            return field.values().value(0);
+        }
+    }
+    return QString();
+}
+
 DiscoInfo::Private::Private()
     : QSharedData()
 {
@@ -99,7 +116,16 @@ void DiscoInfo::addFeature(const QString& feature)
 }
 
 /**
- * Inserts identity and feature lists into a DOM @a element.
+ * Adds extended information @a form (XEP-0128) to the disco-info. The form should
+ * be of result type and have a hidden FORM_TYPE field.
+ */
+void DiscoInfo::addExtension(const DataForm& form)
+{
+    d->extensions << form;
+}
+
+/**
+ * Inserts identity and feature lists and extended information forms into a DOM @a element.
  */
 void DiscoInfo::pushToDomElement(QDomElement& element) const
 {
@@ -115,6 +141,9 @@ void DiscoInfo::pushToDomElement(QDomElement& element) const
         if ( !identity.name().isEmpty() ) {
             eIdentity.setAttribute( "name", identity.name() );
         }
+        if ( !identity.lang().isEmpty() ) {
+            eIdentity.setAttribute( "xml:lang", identity.lang() );
+        }
 
         element.appendChild(eIdentity);
     }
@@ -125,6 +154,76 @@ void DiscoInfo::pushToDomElement(QDomElement& element) const
         eFeature.setAttribute( "var", fi.next() );
         element.appendChild(eFeature);
     }
+
+    QListIterator<DataForm> xi(d->extensions);
+    while ( xi.hasNext() ) {
+        xi.next().toDomElement(element);
+    }
+}
+
+/**
+ * Returns entity capabilities verification string (XEP-0115) for this disco-info.
+ * It is a base64-encoded SHA-1 hash of sorted identities, features and extended
+ * information forms.
+ */
+QString DiscoInfo::capsVerification() const
+{
+    QStringList identities;
+    Private::IdentityListIterator ii(d->identities);
+    while ( ii.hasNext() ) {
+        Identity identity = ii.next();
+        identities << identity.category() + "/" + identity.type() + "/" + identity.lang() + "/" + identity.name();
+    }
+    identities.sort();
+
+    QStringList features = d->features;
+    features.sort();
+
+    QString str;
+    QStringListIterator i(identities);
+    while ( i.hasNext() ) {
+        str += i.next() + "<";
+    }
+    QStringListIterator fi(features);
+    while ( fi.hasNext() ) {
+        str += fi.next() + "<";
+    }
+
+    /* forms are sorted by FORM_TYPE, fields by var and values by value */
+    QMap<QString,DataForm> forms;
+    QListIterator<DataForm> xi(d->extensions);
+    while ( xi.hasNext() ) {
+        DataForm form = xi.next();
+        forms.insert(form_type(form), form);
+    }
+    QMapIterator<QString,DataForm> mi(forms);
+    while ( mi.hasNext() ) {
+        mi.next();
+        str += mi.key() + "<";
+
+        QMap<QString,QStringList> fields;
+        QListIterator<DataForm::Field> di( mi.value().fields() );
+        while ( di.hasNext() ) {
+            DataForm::Field field = di.next();
+            if ( field.name() != "FORM_TYPE" ) {
+                fields.insert( field.name(), field.values() );
+            }
+        }
+        QMapIterator<QString,QStringList> fli(fields);
+        while ( fli.hasNext() ) {
+            fli.next();
+            str += fli.key() + "<";
+
+            QStringList values = fli.value();
+            values.sort();
+            QStringListIterator vi(values);
+            while ( vi.hasNext() ) {
+                str += vi.next() + "<";
+            }
+        }
+    }
+
+    return QCryptographicHash::hash( str.toUtf8(), QCryptographicHash::Sha1 ).toBase64();
 }
 
 /**
@@ -145,6 +244,15 @@ DiscoInfo& DiscoInfo::operator<<(const Identity& identity)
     return *this;
 }
 
+/**
+ * Adds an extended information form to disco-info.
+ */
+DiscoInfo& DiscoInfo::operator<<(const DataForm& form)
+{
+    d->extensions << form;
+    return *this;
+}
+
 /* ***************************************************************************
  * XMPP::DiscoInfo::Identity
  *************************************************************************** */
@@ -158,11 +266,12 @@ DiscoInfo::Identity::Identity()
 {
 }
 
-DiscoInfo::Identity::Identity(const QString& category, const QString& type, const QString& name)
+DiscoInfo::Identity::Identity(const QString& category, const QString& type, const QString& name, const QString& lang)
 {
     m_category = category;
     m_type = type;
     m_name = name;
+    m_lang = lang;
 }
 
 DiscoInfo::Identity::~Identity()
@@ -189,6 +298,14 @@ QString DiscoInfo::Identity::name() const
     return m_name;
 }
 
+/**
+ * Returns xml:lang of the identity name, empty if not set.
+ */
+QString DiscoInfo::Identity::lang() const
+{
+    return m_lang;
+}
+
 /**
  * Returns identity type string.
  *
@@ -219,6 +336,14 @@ void DiscoInfo::Identity::setName(const QString& name)
     m_name = name;
 }
 
+/**
+ * Sets xml:lang of the identity name to @a lang.
+ */
+void DiscoInfo::Identity::setLang(const QString& lang)
+{
+    m_lang = lang;
+}
+
 /**
  * Sets identity type to @a type.
  *
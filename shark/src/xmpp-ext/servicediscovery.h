@@ -30,6 +30,7 @@ class QString;
 namespace XMPP
 {
 
+class DataForm;
 class Jid;
 
 
@@ -44,11 +45,15 @@ class DiscoInfo
 
         void addIdentity(const QString& category, const QString& type, const QString& name = "");
         void addFeature(const QString& feature);
+        void addExtension(const DataForm& form);
 
         void pushToDomElement(QDomElement& element) const;
 
+        QString capsVerification() const;
+
         DiscoInfo& operator<<(const QString& feature);
         DiscoInfo& operator<<(const Identity& identity);
+        DiscoInfo& operator<<(const DataForm& form);
     private:
         class Private;
         QSharedDataPointer<Private> d;
@@ -58,20 +63,23 @@ class DiscoInfo::Identity
 {
     public:
         Identity();
-        Identity(const QString& category, const QString& type, const QString& name = "");
+        Identity(const QString& category, const QString& type, const QString& name = "", const QString& lang = "");
         virtual ~Identity();
 
         QString category() const;
         QString type() const;
         QString name() const;
+        QString lang() const;
 
         void setCategory(const QString& category);
         void setType(const QString& type);
         void setName(const QString& name);
+        void setLang(const QString& lang);
     private:
         QString m_category;
         QString m_type;
         QString m_name;
+        QString m_lang;
 };
 
 class DiscoItem
@@ -2,6 +2,7 @@ HEADERS += \
         $$PWD/adhoc.h \
         $$PWD/dataform.h \
         $$PWD/registration.h \
+        $$PWD/replycache.h \
         $$PWD/rosterx.h \
         $$PWD/rosterxitem.h \
         $$PWD/servicediscovery.h \
@@ -12,6 +13,7 @@ SOURCES += \
         $$PWD/adhoc.cpp \
         $$PWD/dataform.cpp \
         $$PWD/registration.cpp \
+        $$PWD/replycache.cpp \
         $$PWD/rosterx.cpp \
         $$PWD/rosterxitem.cpp \
         $$PWD/servicediscovery.cpp \
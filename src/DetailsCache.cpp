@@ -0,0 +1,324 @@
+/*
+ * DetailsCache.cpp - Gateway-wide cache of ICQ user details
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "DetailsCache.h"
+#include "UserManager.h"
+
+#include "types/icqShortUserDetails.h"
+#include "types/icqTypes.h"
+
+#include <QCache>
+#include <QDateTime>
+#include <QHash>
+
+/* default lifetime of cached details (secs) and number of cached entries */
+static const int DETAILS_TTL        = 3600;
+static const int DETAILS_CACHE_SIZE = 4096;
+/* request which wasn't answered during this time (secs) is sent again */
+static const int REQUEST_TIMEOUT    = 30;
+
+class DetailsCache::Private
+{
+    public:
+        struct Entry {
+            ICQ::ShortUserDetails details;
+            uint fetched;
+        };
+
+        /* requests sent to the server, which are waited for */
+        struct Request {
+            uint sent;
+            /* bare jid of the user whose session sent the request */
+            QString requester;
+            QList<Waiter> waiters;
+        };
+
+        static uint now();
+
+        Entry* entry(const QString& uin);
+        bool pending(const QString& uin) const;
+
+        QCache<QString,Entry> entries;
+        /* uins which are not in the database, value is the time of the lookup */
+        QCache<QString,uint> absent;
+        QHash<QString,Request> requests;
+        int ttl;
+
+        quint64 hits;
+        quint64 staleHits;
+        quint64 misses;
+        quint64 coalesced;
+};
+
+uint DetailsCache::Private::now()
+{
+    return QDateTime::currentDateTime().toTime_t();
+}
+
+/**
+ * Returns cached entry for @a uin. Entries which are not in memory are loaded
+ * from the database. Uins missing there are remembered for the time-to-live,
+ * so the database is not queried again for every request.
+ */
+DetailsCache::Private::Entry* DetailsCache::Private::entry(const QString& uin)
+{
+    Entry *e = entries.object(uin);
+    if ( e ) {
+        return e;
+    }
+
+    uint *checked = absent.object(uin);
+    if ( checked && now() - *checked < uint(ttl) ) {
+        return 0;
+    }
+
+    e = new Entry;
+    if ( !UserManager::instance()->getDetails(uin, e->details, &e->fetched) ) {
+        delete e;
+        absent.insert( uin, new uint( now() ) );
+        return 0;
+    }
+    absent.remove(uin);
+    if ( !entries.insert(uin, e) ) {
+        return 0;
+    }
+    return e;
+}
+
+/**
+ * Returns true if request for @a uin was sent recently and may still be answered.
+ */
+bool DetailsCache::Private::pending(const QString& uin) const
+{
+    QHash<QString,Request>::const_iterator it = requests.find(uin);
+    return it != requests.end() && now() - it->sent < uint(REQUEST_TIMEOUT);
+}
+
+DetailsCache::DetailsCache()
+    : d(new Private)
+{
+    d->entries.setMaxCost(DETAILS_CACHE_SIZE);
+    d->absent.setMaxCost(DETAILS_CACHE_SIZE);
+    d->ttl = DETAILS_TTL;
+    d->hits = d->staleHits = d->misses = d->coalesced = 0;
+}
+
+DetailsCache::~DetailsCache()
+{
+    delete d;
+}
+
+/**
+ * Sets lifetime of cached details to @a secs.
+ */
+void DetailsCache::setTimeToLive(int secs)
+{
+    d->ttl = secs;
+}
+
+/**
+ * Sets maximum number of cached entries. Least recently used entries are dropped first.
+ */
+void DetailsCache::setMaxSize(int size)
+{
+    d->entries.setMaxCost(size);
+    d->absent.setMaxCost(size);
+}
+
+/**
+ * Looks for @a uin details in memory and in the database. Fills @a details if they were found.
+ * Stale details (older than time-to-live) are returned as well, they may be served while
+ * fresh ones are requested.
+ */
+DetailsCache::State DetailsCache::lookup(const QString& uin, ICQ::ShortUserDetails& details)
+{
+    Private::Entry *entry = d->entry(uin);
+    if ( !entry ) {
+        return Missing;
+    }
+    details = entry->details;
+    if ( Private::now() - entry->fetched >= uint(d->ttl) ) {
+        ++d->staleHits;
+        return Stale;
+    }
+    ++d->hits;
+    return Fresh;
+}
+
+/**
+ * Stores @a details received from the server in memory and in the database.
+ */
+void DetailsCache::insert(const ICQ::ShortUserDetails& details)
+{
+    Private::Entry *entry = new Private::Entry;
+    entry->details = details;
+    entry->fetched = Private::now();
+    d->entries.insert(details.uin(), entry);
+    d->absent.remove( details.uin() );
+
+    UserManager::instance()->setDetails(details, entry->fetched);
+}
+
+/**
+ * Adds @a waiter for @a uin details. Returns true if the details should be requested
+ * from the server, and false if a request for @a uin is already on its way.
+ */
+bool DetailsCache::addWaiter(const QString& uin, const Waiter& waiter)
+{
+    uint now = Private::now();
+    QHash<QString,Private::Request>::iterator it = d->requests.find(uin);
+    if ( it == d->requests.end() ) {
+        it = d->requests.insert( uin, Private::Request() );
+    } else if ( now - it->sent < uint(REQUEST_TIMEOUT) ) {
+        it->waiters << waiter;
+        ++d->coalesced;
+        return false;
+    }
+    it->sent = now;
+    it->requester = waiter.jid;
+    it->waiters << waiter;
+    ++d->misses;
+    return true;
+}
+
+/**
+ * Marks @a uin details as requested by the session of @a requester (bare jid) without anybody
+ * waiting for them (background refresh). Returns false if a request for @a uin is already on its way.
+ */
+bool DetailsCache::startRequest(const QString& uin, const QString& requester)
+{
+    if ( d->pending(uin) ) {
+        return false;
+    }
+    Private::Request& request = d->requests[uin];
+    request.sent = Private::now();
+    request.requester = requester;
+    return true;
+}
+
+/**
+ * Removes and returns everybody who waits for @a uin details.
+ */
+QList<DetailsCache::Waiter> DetailsCache::takeWaiters(const QString& uin)
+{
+    return d->requests.take(uin).waiters;
+}
+
+/**
+ * Drops requests which were not answered in time and returns their waiters, key is the uin.
+ */
+QMultiHash<QString,DetailsCache::Waiter> DetailsCache::takeExpiredWaiters()
+{
+    QMultiHash<QString,Waiter> expired;
+    uint now = Private::now();
+
+    QMutableHashIterator<QString,Private::Request> it(d->requests);
+    while ( it.hasNext() ) {
+        it.next();
+        if ( now - it.value().sent < uint(REQUEST_TIMEOUT) ) {
+            continue;
+        }
+        foreach (const Waiter& waiter, it.value().waiters) {
+            expired.insert(it.key(), waiter);
+        }
+        it.remove();
+    }
+    return expired;
+}
+
+/**
+ * Removes and returns waiters of the user @a jid (bare), key is the uin. Requests sent by the
+ * session of @a jid will never be answered, so their other waiters are returned as well.
+ * It should be called when the session is torn down.
+ */
+QMultiHash<QString,DetailsCache::Waiter> DetailsCache::takeWaitersOf(const QString& jid)
+{
+    QMultiHash<QString,Waiter> taken;
+
+    QMutableHashIterator<QString,Private::Request> it(d->requests);
+    while ( it.hasNext() ) {
+        it.next();
+        bool orphaned = it.value().requester == jid;
+
+        QMutableListIterator<Waiter> wi(it.value().waiters);
+        while ( wi.hasNext() ) {
+            const Waiter& waiter = wi.next();
+            if ( orphaned || waiter.jid == jid ) {
+                taken.insert(it.key(), waiter);
+                wi.remove();
+            }
+        }
+        if (orphaned) {
+            it.remove();
+        }
+    }
+    return taken;
+}
+
+/**
+ * Returns estimated heap memory of vcard requests waiting for details, key is the bare jid
+ * of the waiting user.
+ */
+QHash<QString,qint64> DetailsCache::waitersMemory() const
+{
+    QHash<QString,qint64> usage;
+    foreach (const Private::Request& request, d->requests) {
+        foreach (const Waiter& waiter, request.waiters) {
+            usage[waiter.jid] += ICQ::HEAP_BLOCK_OVERHEAD + sizeof(Waiter) + ICQ::heapSize(waiter.resource) + ICQ::heapSize(waiter.requestID);
+        }
+    }
+    return usage;
+}
+
+/**
+ * Returns number of cached entries.
+ */
+int DetailsCache::size() const
+{
+    return d->entries.size();
+}
+
+quint64 DetailsCache::hits() const
+{
+    return d->hits;
+}
+
+/**
+ * Returns number of lookups, which were served with stale details.
+ */
+quint64 DetailsCache::staleHits() const
+{
+    return d->staleHits;
+}
+
+quint64 DetailsCache::misses() const
+{
+    return d->misses;
+}
+
+/**
+ * Returns number of lookups, which were served by a request sent earlier for somebody else.
+ */
+quint64 DetailsCache::coalesced() const
+{
+    return d->coalesced;
+}
+
+// vim:et:ts=4:sw=4:nowrap
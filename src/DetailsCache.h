@@ -0,0 +1,73 @@
+/*
+ * DetailsCache.h - Gateway-wide cache of ICQ user details
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef DETAILSCACHE_H_
+#define DETAILSCACHE_H_
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+namespace ICQ {
+    class ShortUserDetails;
+}
+
+class DetailsCache
+{
+    public:
+        /* jabber user waiting for details (vcard request) */
+        struct Waiter {
+            QString jid;
+            QString resource;
+            QString requestID;
+        };
+
+        enum State { Missing, Stale, Fresh };
+
+        DetailsCache();
+        ~DetailsCache();
+
+        void setTimeToLive(int secs);
+        void setMaxSize(int size);
+
+        State lookup(const QString& uin, ICQ::ShortUserDetails& details);
+        void insert(const ICQ::ShortUserDetails& details);
+
+        bool addWaiter(const QString& uin, const Waiter& waiter);
+        bool startRequest(const QString& uin, const QString& requester);
+        QList<Waiter> takeWaiters(const QString& uin);
+        QMultiHash<QString,Waiter> takeExpiredWaiters();
+        QMultiHash<QString,Waiter> takeWaitersOf(const QString& jid);
+        QHash<QString,qint64> waitersMemory() const;
+
+        int size() const;
+        quint64 hits() const;
+        quint64 staleHits() const;
+        quint64 misses() const;
+        quint64 coalesced() const;
+    private:
+        Q_DISABLE_COPY(DetailsCache);
+
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* DETAILSCACHE_H_ */
@@ -19,9 +19,11 @@
  */
 
 #include "GatewayTask.h"
+#include "DetailsCache.h"
 #include "UserManager.h"
 
 #include "xmpp-core/jid.h"
+#include "xmpp-core/message.h"
 #include "xmpp-core/presence.h"
 #include "xmpp-ext/rosterxitem.h"
 #include "xmpp-ext/vcard.h"
@@ -30,21 +32,40 @@
 #include "types/icqShortUserDetails.h"
 #include "types/icqUserInfo.h"
 
+#include "messagetracer.h"
+#include "metrics.h"
+
 #include <QDateTime>
 #include <QHash>
 #include <QList>
+#include <QObject>
+#include <QPair>
+#include <QQueue>
 #include <QStringList>
 #include <QSqlError>
 #include <QTextCodec>
+#include <QTimer>
 #include <QVariant>
+#include <QtAlgorithms>
 
 #include <stdlib.h>
 
-
-#define GET_JID_BY_SENDER(_str_bare, _jid_user) \
-    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() ); \
-    QString _str_bare = d->icqJidTable[session]; \
-    XMPP::Jid _jid_user = d->jidResources[user_bare];
+/* stale details are refreshed one by one with this interval (msecs) */
+static const int DETAILS_REFRESH_INTERVAL = 2000;
+static const int DETAILS_REFRESH_QUEUE    = 1000;
+/* unanswered details requests are looked for this often (msecs) */
+static const int DETAILS_EXPIRE_INTERVAL  = 10000;
+/* session memory is checked against the budget this often (msecs) */
+static const int MEMORY_CHECK_INTERVAL    = 60000;
+/* number of users in the memory report */
+static const int MEMORY_REPORT_SIZE       = 10;
+
+#define GET_RECORD_BY_SENDER(_record) \
+    Private::SessionRecord *_record = Private::recordFor( sender() ); \
+    if ( !_record ) { \
+        return; \
+    } \
+    ICQ::Session *session = _record->session;
 
 class GatewayTask::Private
 {
@@ -52,23 +73,74 @@ class GatewayTask::Private
         Private(GatewayTask *parent);
         ~Private();
 
-        typedef QHash<QString, XMPP::Jid> HashJidBareFull;
-        typedef QHash<QString, ICQ::Session*> HashJidIcq;
-        typedef QHash<ICQ::Session*, QString> HashIcqJid;
+        /* Everything the gateway keeps for one jabber user */
+        class SessionRecord
+        {
+            public:
+                SessionRecord(const XMPP::Jid& user)
+                    : jid( user.bare() ), user(user), session(0), reconnects(0)
+                {
+                }
+
+                /* bare jabber-id */
+                XMPP::Jid jid;
+                /* full jabber-id of the last active resource */
+                XMPP::Jid user;
+                /* resources which are online */
+                QStringList resources;
+
+                /* legacy connection, null when the user is offline or is waiting for reconnect */
+                ICQ::Session *session;
+                int reconnects;
+        };
 
-        /* Jabber-ID-to-ICQ-Connection hash-table. (JID is bare) */
-        HashJidIcq jidIcqTable;
-        /* Connection & Jabber-ID hash-table (JID is bare) */
-        HashIcqJid icqJidTable;
-        HashJidBareFull jidResources;
+        SessionRecord* addRecord(const XMPP::Jid& user);
+        void removeRecord(SessionRecord *record);
+
+        void attachSession(SessionRecord *record, ICQ::Session *session);
+        void releaseSession(SessionRecord *record);
+        void replyEmptyVCards(const QMultiHash<QString,DetailsCache::Waiter>& waiters);
+
+        ICQ::Session* session(const XMPP::Jid& user) const;
+        static SessionRecord* recordFor(QObject *session);
+
+        static XMPP::vCard makeVCard(const ICQ::ShortUserDetails& details, ICQ::Session *session);
+
+        /*
+         * Session user-data, which points back to the session record, so the signals
+         * from legacy connections reach their user without hash lookups.
+         */
+        class SessionLink : public QObjectUserData
+        {
+            public:
+                SessionLink(SessionRecord *record)
+                    : record(record)
+                {
+                }
+
+                SessionRecord *record;
+
+                static uint id()
+                {
+                    static uint linkId = QObject::registerUserData();
+                    return linkId;
+                }
+        };
 
+        /* Session records, key is the bare jabber-id */
+        QHash<QString, SessionRecord*> records;
 
-        struct vCardRequestInfo {
-            QString requestID;
-            QString resource;
-        };
-        /* Queue of vcard requests. Key is "<jid>-<uin>", value - requestID */
-        QHash<QString,vCardRequestInfo> vCardRequests;
+        /* user details shared by all sessions */
+        DetailsCache details;
+        /* uins with stale details, requester is the bare jid whose session is used for refresh */
+        QQueue<QString> refreshQueue;
+        QHash<QString,QString> refreshRequesters;
+        QTimer *refreshTimer;
+        QTimer *expireTimer;
+
+        /* per-session memory budget in bytes, 0 - unlimited */
+        qint64 memoryBudget;
+        QTimer *memoryTimer;
 
         QString icqHost;
         quint16 icqPort;
@@ -76,8 +148,6 @@ class GatewayTask::Private
         GatewayTask *q;
 
         bool online;
-
-        QHash<QString, int> reconnects;
 };
 
 static ICQ::Session::OnlineStatus xmmpToIcqStatus(XMPP::Presence::Show status)
@@ -106,18 +176,157 @@ static ICQ::Session::OnlineStatus xmmpToIcqStatus(XMPP::Presence::Show status)
 GatewayTask::Private::Private(GatewayTask *parent)
 {
     q = parent;
+    icqPort = 0;
+    memoryBudget = 0;
+    online = false;
 }
 
 GatewayTask::Private::~Private()
 {
-    qDeleteAll(jidIcqTable);
-    icqJidTable.clear();
+    foreach (SessionRecord *record, records) {
+        delete record->session;
+    }
+    qDeleteAll(records);
+}
+
+/**
+ * Creates a record for jabber user @a user.
+ */
+GatewayTask::Private::SessionRecord* GatewayTask::Private::addRecord(const XMPP::Jid& user)
+{
+    SessionRecord *record = new SessionRecord(user);
+    records.insert(record->jid.bare(), record);
+    return record;
+}
+
+/**
+ * Drops the record and the legacy connection associated with it.
+ */
+void GatewayTask::Private::removeRecord(SessionRecord *record)
+{
+    releaseSession(record);
+    records.remove( record->jid.bare() );
+    delete record;
+}
+
+void GatewayTask::Private::attachSession(SessionRecord *record, ICQ::Session *session)
+{
+    record->session = session;
+    session->setUserData( SessionLink::id(), new SessionLink(record) );
+}
+
+/**
+ * Detaches legacy connection from the record, disconnects it and schedules it for deletion.
+ * Signals emitted by the session after this call are ignored.
+ */
+void GatewayTask::Private::releaseSession(SessionRecord *record)
+{
+    ICQ::Session *session = record->session;
+    if ( !session ) {
+        return;
+    }
+    record->session = 0;
+
+    /* requests sent by the session won't be answered, waiters of the user are gone too */
+    replyEmptyVCards( details.takeWaitersOf( record->jid.bare() ) );
+
+    SessionLink *link = static_cast<SessionLink*>( session->userData( SessionLink::id() ) );
+    if ( link ) {
+        link->record = 0;
+    }
+    session->disconnect();
+    session->deleteLater();
+}
+
+/**
+ * Answers vcard requests of @a waiters (key is the uin), whose details won't come, with empty vcards.
+ */
+void GatewayTask::Private::replyEmptyVCards(const QMultiHash<QString,DetailsCache::Waiter>& waiters)
+{
+    QHashIterator<QString,DetailsCache::Waiter> wi(waiters);
+    while ( wi.hasNext() ) {
+        wi.next();
+        XMPP::Jid user( wi.value().jid );
+        if ( !wi.value().resource.isEmpty() ) {
+            user.setResource( wi.value().resource );
+        }
+        emit q->incomingVCard( user, wi.key(), wi.value().requestID, XMPP::vCard() );
+    }
+}
+
+/**
+ * Returns legacy connection of the jabber user @a user, or null if the user is not connected.
+ */
+ICQ::Session* GatewayTask::Private::session(const XMPP::Jid& user) const
+{
+    SessionRecord *record = records.value( user.bare() );
+    return record ? record->session : 0;
+}
+
+/**
+ * Makes vcard from @a details. If @a session is set, contact capabilities known to the session
+ * are listed in the description.
+ */
+XMPP::vCard GatewayTask::Private::makeVCard(const ICQ::ShortUserDetails& details, ICQ::Session *session)
+{
+    XMPP::vCard vcard;
+    vcard.setNickname( details.nick() );
+    vcard.setFullName( QString( details.firstName() + " " + details.lastName() ).trimmed() );
+    vcard.setFamilyName( details.lastName() );
+    vcard.setGivenName( details.firstName() );
+
+    if ( !session ) {
+        return vcard;
+    }
+    ICQ::UserInfo ui = session->userInfo( details.uin() );
+    QList<ICQ::Guid> guids = ui.capabilities();
+    if ( guids.size() > 0  ) {
+        QString notes = QString("Capabilities:") + QChar(QChar::LineSeparator);
+        QListIterator<ICQ::Guid> i(guids);
+        while ( i.hasNext() ) {
+            notes += i.next().toString() + QChar(QChar::LineSeparator);
+        }
+        vcard.setDescription(notes);
+    }
+    return vcard;
+}
+
+/**
+ * Returns the record of the legacy connection @a session.
+ */
+GatewayTask::Private::SessionRecord* GatewayTask::Private::recordFor(QObject *session)
+{
+    if ( !session ) {
+        return 0;
+    }
+    SessionLink *link = static_cast<SessionLink*>( session->userData( SessionLink::id() ) );
+    return link ? link->record : 0;
 }
 
 GatewayTask::GatewayTask(QObject *parent)
     : QObject(parent)
 {
     d = new Private(this);
+
+    d->refreshTimer = new QTimer(this);
+    d->refreshTimer->setInterval(DETAILS_REFRESH_INTERVAL);
+    QObject::connect( d->refreshTimer, SIGNAL( timeout() ),
+                      SLOT( processDetailsRefresh() ) );
+
+    d->expireTimer = new QTimer(this);
+    d->expireTimer->setInterval(DETAILS_EXPIRE_INTERVAL);
+    QObject::connect( d->expireTimer, SIGNAL( timeout() ),
+                      SLOT( processDetailsExpire() ) );
+    d->expireTimer->start();
+
+    d->memoryTimer = new QTimer(this);
+    d->memoryTimer->setInterval(MEMORY_CHECK_INTERVAL);
+    QObject::connect( d->memoryTimer, SIGNAL( timeout() ),
+                      SLOT( processMemoryCheck() ) );
+    d->memoryTimer->start();
+
+    QObject::connect( Instrument::Registry::instance(), SIGNAL( collecting() ),
+                      SLOT( collectMetrics() ) );
 }
 
 GatewayTask::~GatewayTask()
@@ -125,6 +334,148 @@ GatewayTask::~GatewayTask()
     delete d;
 }
 
+/**
+ * Sets interval between background refresh requests for stale user details to @a msecs.
+ */
+void GatewayTask::setDetailsRefreshInterval(int msecs)
+{
+    d->refreshTimer->setInterval(msecs);
+}
+
+/**
+ * Limits estimated heap memory of one legacy session to @a kbytes (0 - no limit).
+ * Sessions over the budget lose their caches first.
+ */
+void GatewayTask::setSessionMemoryBudget(int kbytes)
+{
+    d->memoryBudget = qint64( qMax(0, kbytes) ) * 1024;
+}
+
+/**
+ * Accounts memory of all sessions, trims caches of sessions which are over the budget
+ * and reports the largest ones.
+ */
+void GatewayTask::processMemoryCheck()
+{
+    Instrument::Registry *registry = Instrument::Registry::instance();
+    static Instrument::Counter *trims = registry->counter(
+            "session_memory_trims_total", "Session caches dropped because of memory budget");
+
+    QHash<QString,qint64> waiters = d->details.waitersMemory();
+
+    ICQ::Session::MemoryUsage sum;
+    sum.roster = sum.userInfo = sum.shortDetails = sum.fullDetails = sum.requests = sum.messages = sum.rateQueues = 0;
+    qint64 maxTotal = 0;
+    int overBudget = 0;
+    QList< QPair<qint64,QString> > totals;
+
+    foreach (Private::SessionRecord *record, d->records) {
+        if ( !record->session ) {
+            continue;
+        }
+        QString jid = record->jid.bare();
+        ICQ::Session::MemoryUsage usage = record->session->memoryUsage();
+        usage.requests += waiters.value(jid);
+
+        if ( d->memoryBudget > 0 && usage.total() > d->memoryBudget ) {
+            record->session->trimCaches();
+            trims->inc();
+            usage = record->session->memoryUsage();
+            usage.requests += waiters.value(jid);
+            if ( usage.total() > d->memoryBudget ) {
+                ++overBudget;
+                qWarning( "[GT] Session of %s uses %lld KiB, budget is %lld KiB",
+                          qPrintable(jid), usage.total() / 1024, d->memoryBudget / 1024 );
+            }
+        }
+
+        sum.roster += usage.roster;
+        sum.userInfo += usage.userInfo;
+        sum.shortDetails += usage.shortDetails;
+        sum.fullDetails += usage.fullDetails;
+        sum.requests += usage.requests;
+        sum.messages += usage.messages;
+        sum.rateQueues += usage.rateQueues;
+        maxTotal = qMax( maxTotal, usage.total() );
+
+        QString line = QString("%1: %2 KiB (roster %3, info %4, details %5, requests %6, messages %7, rate queues %8)")
+            .arg(jid).arg( usage.total() / 1024 ).arg( usage.roster / 1024 ).arg( usage.userInfo / 1024 )
+            .arg( (usage.shortDetails + usage.fullDetails) / 1024 ).arg( usage.requests / 1024 )
+            .arg( usage.messages / 1024 ).arg( usage.rateQueues / 1024 );
+        totals << qMakePair( usage.total(), line );
+    }
+
+    QString help("Estimated heap memory of all legacy sessions by component");
+    registry->gauge("session_memory_bytes", help, "component=\"roster\"")->set(sum.roster);
+    registry->gauge("session_memory_bytes", help, "component=\"user-info\"")->set(sum.userInfo);
+    registry->gauge("session_memory_bytes", help, "component=\"short-details\"")->set(sum.shortDetails);
+    registry->gauge("session_memory_bytes", help, "component=\"full-details\"")->set(sum.fullDetails);
+    registry->gauge("session_memory_bytes", help, "component=\"requests\"")->set(sum.requests);
+    registry->gauge("session_memory_bytes", help, "component=\"messages\"")->set(sum.messages);
+    registry->gauge("session_memory_bytes", help, "component=\"rate-queues\"")->set(sum.rateQueues);
+    registry->gauge("session_memory_max_bytes", "Estimated heap memory of the largest legacy session")->set(maxTotal);
+    registry->gauge("sessions_over_memory_budget", "Sessions over memory budget after their caches were dropped")->set(overBudget);
+
+    qSort(totals);
+    QStringList report;
+    for ( int i = totals.size() - 1; i >= 0 && report.size() < MEMORY_REPORT_SIZE; --i ) {
+        report << totals.at(i).second;
+    }
+    emit memoryReport(report);
+}
+
+/**
+ * Updates session gauges before metrics are exported.
+ */
+void GatewayTask::collectMetrics()
+{
+    int connected = 0, connecting = 0, waiting = 0;
+    int queued = 0, unacked = 0;
+    foreach (Private::SessionRecord *record, d->records) {
+        if ( !record->session ) {
+            ++waiting;
+            continue;
+        }
+        if ( record->session->connectionStatus() == ICQ::Session::Connected ) {
+            ++connected;
+        } else {
+            ++connecting;
+        }
+        ICQ::Session::MessageStats stats = record->session->messageStats();
+        queued += stats.queued;
+        unacked += stats.unacked;
+    }
+
+    Instrument::Registry *registry = Instrument::Registry::instance();
+    QString help("Legacy sessions by connection state");
+    registry->gauge("gateway_sessions", help, "state=\"connected\"")->set(connected);
+    registry->gauge("gateway_sessions", help, "state=\"connecting\"")->set(connecting);
+    registry->gauge("gateway_sessions", help, "state=\"reconnect-wait\"")->set(waiting);
+    registry->gauge("icq_message_queue_depth", "Outgoing messages waiting in session queues")->set(queued);
+    registry->gauge("icq_messages_unacked", "Sent messages not acknowledged by ICQ server yet")->set(unacked);
+    registry->gauge("gateway_details_refresh_queue", "Stale user details waiting for refresh")->set( d->refreshQueue.size() );
+
+    /* cache keeps its own totals, counters just follow them */
+    help = "User details lookups by result";
+    Instrument::Counter *counter;
+    counter = registry->counter("details_cache_lookups_total", help, "result=\"hit\"");
+    counter->inc( d->details.hits() - counter->value() );
+    counter = registry->counter("details_cache_lookups_total", help, "result=\"stale\"");
+    counter->inc( d->details.staleHits() - counter->value() );
+    counter = registry->counter("details_cache_lookups_total", help, "result=\"miss\"");
+    counter->inc( d->details.misses() - counter->value() );
+    counter = registry->counter("details_cache_lookups_total", help, "result=\"coalesced\"");
+    counter->inc( d->details.coalesced() - counter->value() );
+}
+
+/**
+ * Returns user details cache, which is shared by all legacy sessions.
+ */
+DetailsCache* GatewayTask::detailsCache() const
+{
+    return &d->details;
+}
+
 void GatewayTask::setIcqServer(const QString& host, quint16 port)
 {
     d->icqHost = host;
@@ -133,13 +484,9 @@ void GatewayTask::setIcqServer(const QString& host, quint16 port)
 
 void GatewayTask::processRegister(const XMPP::Jid& user, const QString& uin, const QString& password)
 {
-    if ( d->jidIcqTable.contains(user.bare()) ) {
-        ICQ::Session *conn = d->jidIcqTable.value(user.bare());
-        d->jidIcqTable.remove(user.bare());
-        d->jidResources.remove(user.bare());
-        d->icqJidTable.remove(conn);
-
-        delete conn;
+    Private::SessionRecord *record = d->records.value( user.bare() );
+    if ( record ) {
+        d->removeRecord(record);
     }
 
     UserManager::instance()->add(user.bare(), uin, password);
@@ -152,12 +499,9 @@ void GatewayTask::processRegister(const XMPP::Jid& user, const QString& uin, con
  */
 void GatewayTask::processUnregister(const XMPP::Jid& user)
 {
-    ICQ::Session *conn = d->jidIcqTable.value(user.bare());
-    if ( conn ) {
-        d->icqJidTable.remove(conn);
-        d->jidIcqTable.remove(user.bare());
-        d->jidResources.remove(user.bare());
-        delete conn;
+    Private::SessionRecord *record = d->records.value( user.bare() );
+    if ( record ) {
+        d->removeRecord(record);
     }
     UserManager::instance()->del(user);
 }
@@ -172,10 +516,13 @@ void GatewayTask::processUserOnline(const XMPP::Jid& user, int showStatus)
     }
     ICQ::Session::OnlineStatus icqStatus = xmmpToIcqStatus(XMPP::Presence::Show(showStatus));
 
-    if ( d->jidIcqTable.contains( user.bare() ) ) {
-        ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
-        conn->setOnlineStatus(icqStatus);
-        d->jidResources.insert(user.bare(), user);
+    Private::SessionRecord *record = d->records.value( user.bare() );
+    if ( record && record->session ) {
+        record->session->setOnlineStatus(icqStatus);
+        record->user = user;
+        if ( !record->resources.contains( user.resource() ) ) {
+            record->resources << user.resource();
+        }
         return;
     }
 
@@ -206,6 +553,8 @@ void GatewayTask::processUserOnline(const XMPP::Jid& user, int showStatus)
                           SLOT( processIncomingMessage(QString,QString) ) );
         QObject::connect( conn, SIGNAL( incomingMessage(QString,QString,QDateTime) ),
                           SLOT( processIncomingMessage(QString,QString,QDateTime) ) );
+        QObject::connect( conn, SIGNAL( offlineMessagesAvailable() ),
+                          SLOT( processOfflineMessages() ) );
         QObject::connect( conn, SIGNAL( connected() ),
                           SLOT( processIcqSignOn() ) );
         QObject::connect( conn, SIGNAL( disconnected() ),
@@ -219,9 +568,12 @@ void GatewayTask::processUserOnline(const XMPP::Jid& user, int showStatus)
             QObject::connect( conn, SIGNAL( rosterAvailable() ), SLOT( processIcqFirstLogin() ) );
         }
 
-        d->jidIcqTable.insert(user.bare(), conn);
-        d->icqJidTable.insert(conn, user.bare());
-        d->jidResources.insert(user.bare(), user);
+        if ( !record ) {
+            record = d->addRecord(user);
+        }
+        record->user = user;
+        record->resources = QStringList( user.resource() );
+        d->attachSession(record, conn);
 
         QTextCodec *codec;
         if ( UserManager::instance()->hasOption(user.bare(), "encoding") ) {
@@ -235,38 +587,49 @@ void GatewayTask::processUserOnline(const XMPP::Jid& user, int showStatus)
         Q_ASSERT( codec != 0 );
         conn->setCodecForMessages(codec);
         conn->connect();
+
+        static Instrument::Counter *attempts = Instrument::Registry::instance()->counter(
+                "gateway_login_attempts_total", "ICQ logins started by the gateway" );
+        attempts->inc();
     }
 }
 
 /**
  * This slot is triggered when jabber user @a user goes offline.
+ * Legacy connection is closed when the last resource of the user goes offline.
  */
 void GatewayTask::processUserOffline(const XMPP::Jid& user)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    Private::SessionRecord *record = d->records.value( user.bare() );
     emit offlineNotifyFor(user);
-    if ( !conn ) {
+    if ( !record ) {
         return;
     }
 
-    QStringListIterator ci(conn->contactList());
-    while ( ci.hasNext() ) {
-        emit contactOffline( user, ci.next() );
+    record->resources.removeAll( user.resource() );
+    if ( record->session && !record->resources.isEmpty() ) {
+        if ( record->user == user ) {
+            record->user = user.withResource( record->resources.last() );
+        }
+        return;
     }
 
-    d->jidIcqTable.remove( user.bare() );
-    d->icqJidTable.remove(conn);
-    d->jidResources.remove( user.bare() );
-    conn->disconnect();
-    conn->deleteLater();
+    if ( record->session ) {
+        QStringListIterator ci( record->session->contactList() );
+        while ( ci.hasNext() ) {
+            emit contactOffline( user, ci.next() );
+        }
+    }
+    d->removeRecord(record);
 }
 
 void GatewayTask::processUserStatusRequest(const XMPP::Jid& user)
 {
-    ICQ::Session *session = d->jidIcqTable.value( user.bare() );
-    if ( !session ) {
+    Private::SessionRecord *record = d->records.value( user.bare() );
+    if ( !record || !record->session ) {
         return;
     }
+    ICQ::Session *session = record->session;
     if ( session->onlineStatus() == ICQ::Session::Offline ) {
         emit offlineNotifyFor(user);
     } else {
@@ -297,7 +660,7 @@ void GatewayTask::processUserStatusRequest(const XMPP::Jid& user)
  */
 void GatewayTask::processSubscribeRequest(const XMPP::Jid& user, const QString& uin)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    ICQ::Session *conn = d->session(user);
     if ( !conn ) {
         return;
     }
@@ -309,7 +672,7 @@ void GatewayTask::processSubscribeRequest(const XMPP::Jid& user, const QString&
  */
 void GatewayTask::processUnsubscribeRequest(const XMPP::Jid& user, const QString& uin)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    ICQ::Session *conn = d->session(user);
     if ( !conn ) {
         return;
     }
@@ -318,7 +681,7 @@ void GatewayTask::processUnsubscribeRequest(const XMPP::Jid& user, const QString
 
 void GatewayTask::processAuthGrant(const XMPP::Jid& user, const QString& uin)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    ICQ::Session *conn = d->session(user);
     if ( !conn ) {
         return;
     }
@@ -327,7 +690,7 @@ void GatewayTask::processAuthGrant(const XMPP::Jid& user, const QString& uin)
 
 void GatewayTask::processAuthDeny(const XMPP::Jid& user, const QString& uin)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    ICQ::Session *conn = d->session(user);
     if ( !conn ) {
         return;
     }
@@ -339,26 +702,90 @@ void GatewayTask::processAuthDeny(const XMPP::Jid& user, const QString& uin)
  */
 void GatewayTask::processSendMessage(const XMPP::Jid& user, const QString& uin, const QString& message)
 {
-    ICQ::Session *conn = d->jidIcqTable.value( user.bare() );
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    quint32 trace = Instrument::MessageTracer::current(Instrument::MessageTracer::Outgoing);
+
+    ICQ::Session *conn = d->session(user);
     if ( !conn ) {
+        tracer->abandon(trace);
         return;
     }
+    tracer->mark(trace, "gateway");
     conn->sendMessage(uin, message);
 }
 
+/**
+ * Sends vcard of @a uin to jabber user @a user. Details cached for the whole gateway (or stored
+ * in the database) are sent at once, stale ones are refreshed in background. Missing details are
+ * requested from server, simultaneous requests for one uin are served by one server request.
+ */
 void GatewayTask::processVCardRequest(const XMPP::Jid& user, const QString& uin, const QString& requestID)
 {
-    ICQ::Session *session = d->jidIcqTable.value( user.bare() );
+    ICQ::Session *session = d->session(user);
     if ( !session ) {
         emit incomingVCard(user, uin, requestID, XMPP::vCard() );
         return;
     }
-    QString key = user.bare()+"-"+uin;
-    Private::vCardRequestInfo info;
-    info.requestID = requestID;
-    info.resource = user.resource();
-    d->vCardRequests.insert(key, info);
-    session->requestShortUserDetails(uin);
+
+    ICQ::ShortUserDetails details;
+    DetailsCache::State state = d->details.lookup(uin, details);
+    if ( state != DetailsCache::Missing ) {
+        emit incomingVCard( user, uin, requestID, Private::makeVCard(details, session) );
+        if ( state == DetailsCache::Stale && !d->refreshRequesters.contains(uin)
+                && d->refreshQueue.size() < DETAILS_REFRESH_QUEUE ) {
+            d->refreshQueue.enqueue(uin);
+            d->refreshRequesters.insert( uin, user.bare() );
+            if ( !d->refreshTimer->isActive() ) {
+                d->refreshTimer->start();
+            }
+        }
+        return;
+    }
+
+    DetailsCache::Waiter waiter;
+    waiter.jid = user.bare();
+    waiter.resource = user.resource();
+    waiter.requestID = requestID;
+    if ( d->details.addWaiter(uin, waiter) ) {
+        session->requestShortUserDetails(uin);
+    }
+}
+
+/**
+ * Sends one background request for stale user details. Requests are paced by the refresh
+ * timer, so they don't take the rate budget needed for interactive traffic.
+ */
+void GatewayTask::processDetailsRefresh()
+{
+    while ( !d->refreshQueue.isEmpty() ) {
+        QString uin = d->refreshQueue.dequeue();
+        Private::SessionRecord *record = d->records.value( d->refreshRequesters.take(uin) );
+        if ( !record || !record->session ) {
+            continue;
+        }
+        if ( d->details.startRequest( uin, record->jid.bare() ) ) {
+            record->session->requestShortUserDetails(uin, true);
+            break;
+        }
+    }
+    if ( d->refreshQueue.isEmpty() ) {
+        d->refreshTimer->stop();
+    }
+}
+
+/**
+ * Answers vcard requests, whose details were not received in time, with empty vcards.
+ */
+void GatewayTask::processDetailsExpire()
+{
+    QMultiHash<QString,DetailsCache::Waiter> expired = d->details.takeExpiredWaiters();
+    if ( expired.isEmpty() ) {
+        return;
+    }
+    static Instrument::Counter *counter = Instrument::Registry::instance()->counter(
+            "details_requests_expired_total", "Vcard requests answered empty because details did not come in time" );
+    counter->inc( expired.size() );
+    d->replyEmptyVCards(expired);
 }
 
 /**
@@ -366,17 +793,17 @@ void GatewayTask::processVCardRequest(const XMPP::Jid& user, const QString& uin,
  */
 void GatewayTask::processCmd_RosterRequest(const XMPP::Jid& user)
 {
-    ICQ::Session *session = d->jidIcqTable.value( user.bare() );
-    if ( !session ) {
+    ICQ::Session *conn = d->session(user);
+    if ( !conn ) {
         return;
     }
 
-    QStringList contacts = session->contactList();
+    QStringList contacts = conn->contactList();
     QStringListIterator i(contacts);
     QList<XMPP::RosterXItem> items;
     while ( i.hasNext() ) {
         QString uin = i.next();
-        QString name = session->contactName(uin);
+        QString name = conn->contactName(uin);
         XMPP::RosterXItem item(uin, XMPP::RosterXItem::Add, name);
         items << item;
     }
@@ -414,20 +841,15 @@ void GatewayTask::processShutdown()
     QStringListIterator ui(UserManager::instance()->getUserList());
     while ( ui.hasNext() ) {
         QString user = ui.next();
-        if ( d->jidIcqTable.contains(user) ) {
-            ICQ::Session *session = d->jidIcqTable.value(user);
-
-            QStringListIterator ci( session->contactList() );
-            while ( ci.hasNext() ) {
-                emit contactOffline( user, ci.next() );
+        Private::SessionRecord *record = d->records.value(user);
+        if ( record ) {
+            if ( record->session ) {
+                QStringListIterator ci( record->session->contactList() );
+                while ( ci.hasNext() ) {
+                    emit contactOffline( user, ci.next() );
+                }
             }
-
-            d->jidIcqTable.remove(user);
-            d->icqJidTable.remove(session);
-            d->jidResources.remove(user);
-
-            session->disconnect();
-            session->deleteLater();
+            d->removeRecord(record);
         }
         emit offlineNotifyFor(user);
     }
@@ -435,15 +857,21 @@ void GatewayTask::processShutdown()
 
 void GatewayTask::processIcqError(const QString& desc)
 {
-    GET_JID_BY_SENDER(user_bare,user);
-    emit gatewayMessage(user, desc);
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
+    emit gatewayMessage(record->user, desc);
 }
 
 void GatewayTask::processIcqSignOn()
 {
-    GET_JID_BY_SENDER(user_bare,user);
-    emit onlineNotifyFor(user, XMPP::Presence::None);
-    d->reconnects.remove(user_bare);
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
+    emit onlineNotifyFor(record->user, XMPP::Presence::None);
+    record->reconnects = 0;
+
+    static Instrument::Counter *logins = Instrument::Registry::instance()->counter(
+            "gateway_logins_total", "Successful ICQ logins" );
+    logins->inc();
 }
 
 void GatewayTask::processIcqSignOff()
@@ -452,36 +880,35 @@ void GatewayTask::processIcqSignOff()
         return;
     }
 
-    ICQ::Session *conn = qobject_cast<ICQ::Session*>( sender() );
-    if ( !d->icqJidTable.contains(conn) ) {
-        return;
-    }
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
 
-    QString user_bare = d->icqJidTable[conn];
-    XMPP::Jid user = d->jidResources[user_bare];
+    XMPP::Jid user = record->user;
     emit offlineNotifyFor(user);
+    d->releaseSession(record);
 
-    d->icqJidTable.remove(conn);
-    d->jidIcqTable.remove(user_bare);
-    d->jidResources.remove(user_bare);
-    conn->deleteLater();
-
-    bool reconnect = UserManager::instance()->getOption(user_bare, "auto-reconnect").toBool();
-    if ( reconnect ) {
-        int rCount = d->reconnects.value(user_bare);
-        if ( rCount >= 3 ) { // limit number of reconnects to 3.
-            emit gatewayMessage(user, "Tried to reconnect 3 times, but no result. Stopping reconnects.");
-            return;
-        }
-        d->reconnects.insert(user_bare, ++rCount);
-        // qDebug() << "[GT]" << "Processing auto-reconnect for user" << user;
-        emit probeRequest(user);
+    bool reconnect = UserManager::instance()->getOption(record->jid.bare(), "auto-reconnect").toBool();
+    if ( !reconnect ) {
+        d->removeRecord(record);
+        return;
     }
+    if ( record->reconnects >= 3 ) { // limit number of reconnects to 3.
+        d->removeRecord(record);
+        emit gatewayMessage(user, "Tried to reconnect 3 times, but no result. Stopping reconnects.");
+        return;
+    }
+    ++record->reconnects;
+    static Instrument::Counter *reconnects = Instrument::Registry::instance()->counter(
+            "gateway_reconnects_total", "Automatic reconnects after the ICQ connection was lost" );
+    reconnects->inc();
+    // qDebug() << "[GT]" << "Processing auto-reconnect for user" << user;
+    emit probeRequest(user);
 }
 
 void GatewayTask::processIcqStatus(int status)
 {
-    GET_JID_BY_SENDER(user_bare,user);
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
 
     int show;
     switch ( status ) {
@@ -501,12 +928,12 @@ void GatewayTask::processIcqStatus(int status)
             show = XMPP::Presence::None;
             break;
     }
-    emit onlineNotifyFor(user, show);
+    emit onlineNotifyFor(record->user, show);
 }
 
 void GatewayTask::processIcqFirstLogin()
 {
-    GET_JID_BY_SENDER(user_bare,user);
+    GET_RECORD_BY_SENDER(record);
 
     QStringList contacts = session->contactList();
     QStringListIterator i(contacts);
@@ -517,13 +944,13 @@ void GatewayTask::processIcqFirstLogin()
         XMPP::RosterXItem item(uin, XMPP::RosterXItem::Add, name);
         items << item;
     }
-    emit rosterAdd(user, items);
-    UserManager::instance()->setOption(user_bare, "first_login", QVariant(false));
+    emit rosterAdd(record->user, items);
+    UserManager::instance()->setOption(record->jid.bare(), "first_login", QVariant(false));
 }
 
 void GatewayTask::processContactOnline(const QString& uin, int status)
 {
-    GET_JID_BY_SENDER(user_bare,user);
+    GET_RECORD_BY_SENDER(record);
 
     int showStatus;
     switch ( status ) {
@@ -544,32 +971,62 @@ void GatewayTask::processContactOnline(const QString& uin, int status)
             break;
     }
 
-    emit contactOnline( user, uin, showStatus, session->contactName(uin) );
+    emit contactOnline( record->user, uin, showStatus, session->contactName(uin) );
 }
 
 void GatewayTask::processContactOffline(const QString& uin)
 {
-    ICQ::Session *conn = qobject_cast<ICQ::Session*>( sender() );
-    if ( !conn || !d->icqJidTable.contains(conn) ) {
-        return;
-    }
-    QString user_bare = d->icqJidTable[conn];
-    XMPP::Jid user = d->jidResources[user_bare];
-    emit contactOffline(user, uin);
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
+    emit contactOffline(record->user, uin);
 }
 
 void GatewayTask::processIncomingMessage(const QString& senderUin, const QString& message)
 {
-    GET_JID_BY_SENDER(user_bare,user);
+    GET_RECORD_BY_SENDER(record);
+    Instrument::MessageTracer::instance()->mark( Instrument::MessageTracer::current(Instrument::MessageTracer::Incoming), "gateway" );
     QString msg = QString(message).replace('\r', "");
-    emit incomingMessage(user, senderUin, msg, session->contactName(senderUin));
+    emit incomingMessage(record->user, senderUin, msg, session->contactName(senderUin));
 }
 
 void GatewayTask::processIncomingMessage(const QString& senderUin, const QString& message, const QDateTime& timestamp)
 {
-    GET_JID_BY_SENDER(user_bare,user);
+    GET_RECORD_BY_SENDER(record);
+    Instrument::MessageTracer::instance()->mark( Instrument::MessageTracer::current(Instrument::MessageTracer::Incoming), "gateway" );
     QString msg = QString(message).replace('\r', "");
-    emit incomingMessage(user, senderUin, msg, session->contactName(senderUin), timestamp.toUTC());
+    emit incomingMessage(record->user, senderUin, msg, session->contactName(senderUin), timestamp.toUTC());
+}
+
+/**
+ * Sends offline messages received during login to the jabber user as one batch.
+ */
+void GatewayTask::processOfflineMessages()
+{
+    GET_RECORD_BY_SENDER(record);
+
+    QList< QPair<QString,XMPP::Message> > messages;
+    foreach (const ICQ::Session::OfflineMessage& offline, session->takeOfflineMessages()) {
+        XMPP::Message msg;
+        msg.setBody( QString(offline.text).replace('\r', "") );
+        msg.setNick( session->contactName(offline.sender) );
+        msg.setType(XMPP::Message::Chat);
+        msg.setTimestamp( offline.timestamp.toUTC() );
+        /* sender's transport jid is set by jabber connection */
+        messages << qMakePair(offline.sender, msg);
+    }
+    emit offlineMessages(record->user, messages);
+}
+
+/**
+ * This slot is triggered when offline messages were delivered to @a user,
+ * so they can be deleted from ICQ server.
+ */
+void GatewayTask::processOfflineMessagesDelivered(const XMPP::Jid& user)
+{
+    ICQ::Session *session = d->session(user);
+    if ( session ) {
+        session->ackOfflineMessages();
+    }
 }
 
 /**
@@ -577,11 +1034,10 @@ void GatewayTask::processIncomingMessage(const QString& senderUin, const QString
  */
 void GatewayTask::processAuthGranted(const QString& uin)
 {
-    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
-    XMPP::Jid user = d->icqJidTable[session];
+    GET_RECORD_BY_SENDER(record);
 
     // qDebug() << "[GT]" << user << "granted auth to" << uin << "nick" << session->contactName(uin);
-    emit subscriptionReceived( user, uin, session->contactName(uin) );
+    emit subscriptionReceived( record->jid, uin, session->contactName(uin) );
 }
 
 /**
@@ -589,11 +1045,11 @@ void GatewayTask::processAuthGranted(const QString& uin)
  */
 void GatewayTask::processAuthDenied(const QString& uin)
 {
-    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
-    XMPP::Jid user = d->icqJidTable[session];
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
 
     // qDebug() << "[GT]" << user << "denied auth to" << uin;
-    emit subscriptionRemoved(user, uin);
+    emit subscriptionRemoved(record->jid, uin);
 }
 
 /**
@@ -601,47 +1057,41 @@ void GatewayTask::processAuthDenied(const QString& uin)
  */
 void GatewayTask::processAuthRequest(const QString& uin)
 {
-    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
-    XMPP::Jid user = d->icqJidTable[session];
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(session);
 
-    emit subscriptionRequest(user, uin);
+    emit subscriptionRequest(record->jid, uin);
 }
 
 void GatewayTask::processShortUserDetails(const QString& uin)
 {
-    GET_JID_BY_SENDER(user_bare,user);
-    QString key = QString(user_bare)+"-"+uin;
+    GET_RECORD_BY_SENDER(record);
+    Q_UNUSED(record);
+
+    ICQ::ShortUserDetails details = session->shortUserDetails(uin);
+    if ( !details.isEmpty() ) {
+        d->details.insert(details);
+        /* gateway cache keeps them now, session should request fresh ones next time */
+        session->removeShortUserDetails(uin);
+    }
 
-    if ( !d->vCardRequests.contains(key) ) {
+    QList<DetailsCache::Waiter> waiters = d->details.takeWaiters(uin);
+    if ( waiters.isEmpty() ) {
         // qDebug() << "[GT]" << "Request was not logged";
         return;
     }
 
-    Private::vCardRequestInfo info = d->vCardRequests.take(key);
-
-    ICQ::ShortUserDetails details = session->shortUserDetails(uin);
-    XMPP::vCard vcard;
-    vcard.setNickname( details.nick() );
-    vcard.setFullName( QString( details.firstName() + " " + details.lastName() ).trimmed() );
-    vcard.setFamilyName( details.lastName() );
-    vcard.setGivenName( details.firstName() );
+    foreach (const DetailsCache::Waiter& waiter, waiters) {
+        /* capabilities are taken from the waiter's own session */
+        Private::SessionRecord *waiterRecord = d->records.value(waiter.jid);
+        ICQ::Session *waiterSession = waiterRecord ? waiterRecord->session : 0;
 
-    ICQ::UserInfo ui = session->userInfo(uin);
-    QList<ICQ::Guid> guids = ui.capabilities();
-    if ( guids.size() > 0  ) {
-        QString notes = QString("Capabilities:") + QChar(QChar::LineSeparator);
-        QListIterator<ICQ::Guid> i(guids);
-        while ( i.hasNext() ) {
-            notes += i.next().toString() + QChar(QChar::LineSeparator);
+        XMPP::Jid user(waiter.jid);
+        if ( !waiter.resource.isEmpty() ) {
+            user.setResource(waiter.resource);
         }
-        vcard.setDescription(notes);
+        emit incomingVCard( user, uin, waiter.requestID, Private::makeVCard(details, waiterSession) );
     }
-
-    if ( !info.resource.isEmpty() ) {
-        user.setResource(info.resource);
-    }
-
-    emit incomingVCard(user, uin, info.requestID, vcard);
 }
 
 // vim:et:ts=4:sw=4:nowrap
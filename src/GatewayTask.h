@@ -23,14 +23,19 @@
 
 #include <QObject>
 #include <QList>
+#include <QPair>
+
+class DetailsCache;
 
 namespace XMPP {
     class Jid;
+    class Message;
     class RosterXItem;
     class vCard;
 }
 
 class QDateTime;
+class QStringList;
 
 class GatewayTask : public QObject
 {
@@ -41,6 +46,10 @@ class GatewayTask : public QObject
         virtual ~GatewayTask();
 
         void setIcqServer(const QString& host, quint16 port);
+
+        void setDetailsRefreshInterval(int msecs);
+        void setSessionMemoryBudget(int kbytes);
+        DetailsCache* detailsCache() const;
     public slots:
         void processRegister(const XMPP::Jid& user, const QString& uin, const QString& password);
         void processUnregister(const XMPP::Jid& user);
@@ -52,6 +61,7 @@ class GatewayTask : public QObject
         void processAuthGrant(const XMPP::Jid& user, const QString& uin);
         void processAuthDeny(const XMPP::Jid& user, const QString& uin);
         void processSendMessage(const XMPP::Jid& user, const QString& uin, const QString& message);
+        void processOfflineMessagesDelivered(const XMPP::Jid& user);
 
         void processVCardRequest(const XMPP::Jid& user, const QString& uin, const QString& requestID);
 
@@ -76,10 +86,19 @@ class GatewayTask : public QObject
 
         void incomingMessage(const XMPP::Jid& user, const QString& uin, const QString& text, const QString& nick);
         void incomingMessage(const XMPP::Jid& user, const QString& uin, const QString& text, const QString& nick, const QDateTime& timestamp);
+        void offlineMessages(const XMPP::Jid& user, const QList< QPair<QString,XMPP::Message> >& messages);
         void gatewayMessage(const XMPP::Jid& user, const QString& text);
 
         void rosterAdd(const XMPP::Jid& user, const QList<XMPP::RosterXItem>& items);
+
+        /* users with the largest sessions, one line per user */
+        void memoryReport(const QStringList& report);
     private slots:
+        void processDetailsRefresh();
+        void processDetailsExpire();
+        void processMemoryCheck();
+        void collectMetrics();
+
         void processIcqError(const QString& desc);
         void processIcqSignOn();
         void processIcqSignOff();
@@ -90,6 +109,7 @@ class GatewayTask : public QObject
         void processContactOffline(const QString& uin);
         void processIncomingMessage(const QString& senderUin, const QString& message);
         void processIncomingMessage(const QString& senderUin, const QString& message, const QDateTime& timestamp);
+        void processOfflineMessages();
 
         void processAuthGranted(const QString& uin);
         void processAuthDenied(const QString& uin);
@@ -19,6 +19,7 @@
  */
 
 #include "JabberConnection.h"
+#include "StreamMetrics.h"
 #include "UserManager.h"
 
 #include "xmpp-core/connector.h"
@@ -32,30 +33,50 @@
 #include "xmpp-ext/dataform.h"
 #include "xmpp-ext/gatewaytask.h"
 #include "xmpp-ext/registration.h"
+#include "xmpp-ext/replycache.h"
 #include "xmpp-ext/servicediscovery.h"
 #include "xmpp-ext/vcard.h"
 #include "xmpp-ext/rosterx.h"
 
+#include "messagetracer.h"
+#include "metrics.h"
+#include "recorder.h"
+
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QFile>
 #include <QHash>
+#include <QSet>
+#include <QSignalMapper>
 #include <QStringList>
 #include <QTextCodec>
+#include <QTimer>
 #include <QUrl>
 #include <QVariant>
+#include <QtDebug>
 #include <qmath.h>
 
 #include <stdlib.h>
+#include <unistd.h>
 
 using namespace XMPP;
 
 #define NS_IQ_GATEWAY "jabber:iq:gateway"
+#define CAPS_NODE "http://github.com/holycheater/qt-icq-transport"
 
 static const int SEC_MINUTE = 60;
 static const int SEC_HOUR   = 3600;
 static const int SEC_DAY    = 86400;
 static const int SEC_WEEK   = 604800;
 
+/* default presence batching window (msecs) and batch size */
+static const int PRESENCE_BATCH_WINDOW = 50;
+static const int PRESENCE_BATCH_SIZE   = 200;
+
+/* reconnect delay of a failed component link (msecs), doubled on each failure */
+static const int RECONNECT_DELAY_MIN = 1000;
+static const int RECONNECT_DELAY_MAX = 60000;
+
 class JabberConnection::Private {
 
     public:
@@ -64,33 +85,108 @@ class JabberConnection::Private {
         void processDiscoItems(const IQ& iq);
         void processPromptRequest(const IQ& iq);
         void processPrompt(const IQ& iq);
+        void processPerfSnapshot(const IQ& iq, AdHoc& cmd);
+        QString recentPercentiles(const QString& key, Instrument::Histogram *histogram);
 
         void initCommands();
+        bool isAdmin(const Jid& jid) const;
+
+        ComponentStream* createStream(int slot);
+        ComponentStream* addStream();
+        ComponentStream* streamFor(const Jid& recipient) const;
+        bool dropStream(ComponentStream *stream);
+        void replaceStream(int slot);
+        void send(const Stanza& stanza);
+        bool sendSerialized(const Jid& recipient, const QByteArray& data, int stanzas = 1);
+
+        void queuePresence(const Presence& presence, const QString& uin);
+        void flushPresences(const Jid& recipient);
+        struct PresenceBatch;
+        void sendPresences(const PresenceBatch& batch);
 
         JabberConnection *q;
 
-        Connector* connector;
-        ComponentStream* stream;
+        /* component connections to the server, each one has its own connector */
+        QList<Connector*> connectors;
+        QList<ComponentStream*> streams;
+        /* gateway tasks of the streams, owned by them */
+        QList<XMPP::GatewayTask*> gatewayTasks;
+        /* registration form cache hits and misses of the replaced streams */
+        uint registerHits;
+        uint registerMisses;
+        /* streams which have passed the handshake and are used for sending */
+        QList<ComponentStream*> activeStreams;
+        /* streams which were closed or failed */
+        QList<ComponentStream*> failedStreams;
+        /* per-slot reconnect timers (mapped to the slot index) and current backoff delays */
+        QList<QTimer*> reconnectTimers;
+        QList<int> reconnectDelays;
+        QSignalMapper *reconnectMapper;
+
+        QString host;
+        quint16 port;
+
         Jid jid;
         vCard vcard;
         DiscoInfo disco;
+        /* disco-info of legacy contacts (uin@component.domain) */
+        DiscoInfo contactDisco;
+        /* entity capabilities verification strings for disco and contactDisco */
+        QString capsVer;
+        QString contactCapsVer;
         QString secret;
 
         QDateTime startTime;
 
         /* list of adhoc commands */
         QHash<QString,DiscoItem> commands;
-
-        XMPP::GatewayTask *gwtask;
+        /* commands available to service administrators only */
+        QHash<QString,DiscoItem> adminCommands;
+        /* bare jids of service administrators */
+        QSet<QString> admins;
+
+        /* serialized replies to disco-info and service vCard requests */
+        ReplyCache discoReplies;
+        ReplyCache vcardReplies;
+
+        /* contact presences waiting to be sent to one jabber user */
+        struct PresenceBatch {
+            Jid recipient;
+            /* uin order of the first change */
+            QStringList order;
+            /* latest serialized presence of each contact, key is uin */
+            QHash<QString,QByteArray> presences;
+        };
+        typedef QHash<QString,PresenceBatch> PresenceBatches;
+        /* pending batches, keys are recipient's bare jid and then full jid */
+        QHash<QString,PresenceBatches> presenceBatches;
+        QTimer *presenceTimer;
+        int presenceBatchSize;
+
+        /* largest legacy sessions, shown by perf-snapshot */
+        QStringList memoryReport;
+        /* histogram bucket counts at the previous perf-snapshot */
+        QHash<QString, QVector<quint64> > snapshotBuckets;
 };
 
 void JabberConnection::Private::initCommands()
 {
+    /* cached disco replies contain command nodes and service jid */
+    discoReplies.clear();
+    vcardReplies.clear();
     commands.clear();
 
     commands.insert( "fetch-contacts", DiscoItem(jid, "fetch-contacts", "Fetch ICQ contacts") );
     commands.insert( "cmd-uptime",     DiscoItem(jid, "cmd-uptime",     "Report service uptime") );
     commands.insert( "set-options",    DiscoItem(jid, "set-options",    "Set service parameters") );
+
+    adminCommands.clear();
+    adminCommands.insert( "perf-snapshot", DiscoItem(jid, "perf-snapshot", "Performance snapshot") );
+}
+
+bool JabberConnection::Private::isAdmin(const Jid& jid) const
+{
+    return admins.contains( jid.bare() );
 }
 
 static XMPP::GatewayTask* init_gateway_task(JabberConnection *jc, XMPP::ComponentStream *stream)
@@ -119,10 +215,259 @@ static XMPP::GatewayTask* init_gateway_task(JabberConnection *jc, XMPP::Componen
     QObject::connect( gw_task, SIGNAL(denyAuth(XMPP::Jid,QString)),
                       jc, SIGNAL(userAuthDeny(XMPP::Jid,QString)) );
     QObject::connect( gw_task, SIGNAL(messageToLegacyNode(XMPP::Jid,QString,QString)),
-                      jc, SIGNAL(outgoingMessage(XMPP::Jid,QString,QString)) );
+                      jc, SLOT(slotLegacyMessage(XMPP::Jid,QString,QString)) );
+    /* replies go through the user's slot in the pool, not the link the request came on */
+    QObject::connect( gw_task, SIGNAL(outgoingStanza(XMPP::Stanza)),
+                      jc, SLOT(slotGatewayStanza(XMPP::Stanza)) );
+    QObject::connect( gw_task, SIGNAL(outgoingSerialized(XMPP::Jid,QByteArray)),
+                      jc, SLOT(slotGatewaySerialized(XMPP::Jid,QByteArray)) );
     return gw_task;
 }
 
+/**
+ * Creates component stream (with its own connector) for the pool @a slot and connects it
+ * to the connection handler. Gateway task, which handles registration, presences and
+ * messages received by the stream, is owned by the stream.
+ */
+ComponentStream* JabberConnection::Private::createStream(int slot)
+{
+    Connector *connector = new Connector;
+    if ( !host.isEmpty() ) {
+        connector->setOptHostPort(host, port);
+    }
+    ComponentStream *stream = new ComponentStream(connector);
+    stream->setMonitor( new StreamMetrics( Instrument::Recorder::create( "xmpp-" + QString::number(slot) ) ) );
+
+    QObject::connect( connector, SIGNAL(error(Connector::ErrorType)),
+            q, SLOT(slotConnectorError()) );
+
+    QObject::connect( stream, SIGNAL(stanzaIQ(XMPP::IQ)),
+            q, SLOT(stream_iq(XMPP::IQ)) );
+
+    QObject::connect( stream, SIGNAL(streamReady()),
+            q, SLOT(slotStreamReady()) );
+    QObject::connect( stream, SIGNAL(streamClosed()),
+            q, SLOT(slotStreamClosed()) );
+    QObject::connect( stream, SIGNAL(streamError()),
+            q, SLOT(slotStreamError()) );
+
+    XMPP::GatewayTask *task = init_gateway_task(q, stream);
+
+    if ( slot < streams.size() ) {
+        connectors[slot] = connector;
+        streams[slot] = stream;
+        gatewayTasks[slot] = task;
+    } else {
+        connectors << connector;
+        streams << stream;
+        gatewayTasks << task;
+    }
+    return stream;
+}
+
+/**
+ * Creates one more stream slot in the pool.
+ */
+ComponentStream* JabberConnection::Private::addStream()
+{
+    int slot = streams.size();
+
+    QTimer *timer = new QTimer(q);
+    timer->setSingleShot(true);
+    QObject::connect( timer, SIGNAL(timeout()), reconnectMapper, SLOT(map()) );
+    reconnectMapper->setMapping(timer, slot);
+    reconnectTimers << timer;
+    reconnectDelays << RECONNECT_DELAY_MIN;
+
+    return createStream(slot);
+}
+
+/**
+ * Returns the stream for stanzas addressed to @a recipient. Each user has a fixed slot in
+ * the pool chosen by the bare jid hash, so all the stanzas for one user go through one
+ * connection and keep their order. While the slot link is down, its users are moved to
+ * the next live link, the users of other slots stay where they are.
+ * Returns null if no link is up.
+ */
+ComponentStream* JabberConnection::Private::streamFor(const Jid& recipient) const
+{
+    int slot = streams.size() == 1 ? 0 : recipient.bareHash() % streams.size();
+    for (int i = 0; i < streams.size(); ++i) {
+        ComponentStream *stream = streams.at( (slot + i) % streams.size() );
+        if ( activeStreams.contains(stream) ) {
+            return stream;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Removes @a stream from the sending pool, so its traffic is moved to the remaining streams,
+ * and schedules reconnect of its slot with backoff.
+ * Returns false if there are no live streams left.
+ */
+bool JabberConnection::Private::dropStream(ComponentStream *stream)
+{
+    int slot = streams.indexOf(stream);
+    if ( slot == -1 || failedStreams.contains(stream) ) {
+        return true;
+    }
+    activeStreams.removeAll(stream);
+    failedStreams << stream;
+
+    int alive = streams.size() - failedStreams.size();
+    if ( alive == 0 ) {
+        return false;
+    }
+
+    int delay = reconnectDelays.at(slot);
+    reconnectDelays[slot] = qMin(delay * 2, RECONNECT_DELAY_MAX);
+    reconnectTimers.at(slot)->start(delay);
+    qWarning("[JC] Component link %d dropped, %d link(s) left, reconnecting in %d ms", slot, alive, delay);
+    return true;
+}
+
+/**
+ * Replaces failed stream of the pool @a slot with a new one and connects it to the server.
+ */
+void JabberConnection::Private::replaceStream(int slot)
+{
+    ComponentStream *stream = streams.at(slot);
+    if ( !failedStreams.contains(stream) ) {
+        return;
+    }
+    failedStreams.removeAll(stream);
+
+    /* the task goes away with the stream, keep its totals */
+    registerHits += gatewayTasks.at(slot)->replyCache().hits();
+    registerMisses += gatewayTasks.at(slot)->replyCache().misses();
+
+    /* the old stream may still emit closing signals while it is torn down */
+    stream->disconnect(q);
+    connectors.at(slot)->disconnect(q);
+    stream->deleteLater();
+    connectors.at(slot)->deleteLater();
+
+    qDebug("[JC] Reconnecting component link %d", slot);
+    createStream(slot)->connectToServer(jid, secret);
+}
+
+/**
+ * Sends @a stanza. Contact presences queued for the recipient are sent before it,
+ * so the user receives everything in order.
+ */
+void JabberConnection::Private::send(const Stanza& stanza)
+{
+    if ( !presenceBatches.isEmpty() ) {
+        flushPresences( stanza.to() );
+    }
+    ComponentStream *stream = streamFor( stanza.to() );
+    if ( !stream ) {
+        qWarning("[JC] No component link is up, stanza to %s dropped", qPrintable( stanza.to().full() ));
+        return;
+    }
+    stream->sendStanza(stanza);
+}
+
+bool JabberConnection::Private::sendSerialized(const Jid& recipient, const QByteArray& data, int stanzas)
+{
+    if ( !presenceBatches.isEmpty() ) {
+        flushPresences(recipient);
+    }
+    ComponentStream *stream = streamFor(recipient);
+    if ( !stream ) {
+        qWarning("[JC] No component link is up, %d stanza(s) to %s dropped", stanzas, qPrintable( recipient.full() ));
+        return false;
+    }
+    return stream->sendSerialized(data, stanzas);
+}
+
+/**
+ * Adds contact @a uin presence to the recipient's batch. Earlier pending presence
+ * from the same contact is replaced. Batch is sent when the batching window is over
+ * or when it grows up to the batch size.
+ */
+void JabberConnection::Private::queuePresence(const Presence& presence, const QString& uin)
+{
+    if ( presenceBatchSize <= 1 ) {
+        send(presence);
+        return;
+    }
+
+    PresenceBatch& batch = presenceBatches[ presence.to().bare() ][ presence.to().full() ];
+    if ( batch.presences.isEmpty() ) {
+        batch.recipient = presence.to();
+    }
+    if ( !batch.presences.contains(uin) ) {
+        batch.order << uin;
+    }
+    batch.presences.insert( uin, presence.toString().toUtf8() );
+
+    if ( batch.presences.size() >= presenceBatchSize ) {
+        flushPresences( presence.to() );
+    } else if ( !presenceTimer->isActive() ) {
+        presenceTimer->start();
+    }
+}
+
+/**
+ * Sends pending presences addressed to @a recipient. If it is a bare jid, presences
+ * for all of its resources are sent. For a full jid presences addressed to the bare
+ * jid are sent first, they are delivered to that resource as well.
+ */
+void JabberConnection::Private::flushPresences(const Jid& recipient)
+{
+    QHash<QString,PresenceBatches>::iterator it = presenceBatches.find( recipient.bare() );
+    if ( it == presenceBatches.end() ) {
+        return;
+    }
+
+    if ( recipient.resource().isEmpty() ) {
+        PresenceBatches batches = it.value();
+        presenceBatches.erase(it);
+        foreach (const PresenceBatch& batch, batches) {
+            sendPresences(batch);
+        }
+        return;
+    }
+
+    QList<PresenceBatch> batches;
+    PresenceBatches::iterator bi = it.value().find( recipient.bare() );
+    if ( bi != it.value().end() ) {
+        batches << bi.value();
+        it.value().erase(bi);
+    }
+    bi = it.value().find( recipient.full() );
+    if ( bi != it.value().end() ) {
+        batches << bi.value();
+        it.value().erase(bi);
+    }
+    if ( it.value().isEmpty() ) {
+        presenceBatches.erase(it);
+    }
+    foreach (const PresenceBatch& batch, batches) {
+        sendPresences(batch);
+    }
+}
+
+/**
+ * Serializes presences of @a batch and sends them with one write.
+ */
+void JabberConnection::Private::sendPresences(const PresenceBatch& batch)
+{
+    QByteArray data;
+    foreach (const QString& uin, batch.order) {
+        data += batch.presences.value(uin);
+    }
+    ComponentStream *stream = streamFor(batch.recipient);
+    if ( !stream ) {
+        qWarning("[JC] No component link is up, %d presence(s) to %s dropped",
+                batch.order.size(), qPrintable( batch.recipient.full() ));
+        return;
+    }
+    stream->sendSerialized( data, batch.order.size() );
+}
+
 /**
  * Constructs jabber-connection object.
  */
@@ -132,30 +477,36 @@ JabberConnection::JabberConnection(QObject *parent)
     d = new Private;
     d->q = this;
 
-    d->connector = new XMPP::Connector;
-    d->stream = new XMPP::ComponentStream(d->connector);
+    d->port = 0;
+    d->registerHits = 0;
+    d->registerMisses = 0;
+    d->reconnectMapper = new QSignalMapper(this);
+    QObject::connect( d->reconnectMapper, SIGNAL(mapped(int)),
+            SLOT(reconnectStream(int)) );
+    d->addStream();
+
+    d->presenceBatchSize = PRESENCE_BATCH_SIZE;
+    d->presenceTimer = new QTimer(this);
+    d->presenceTimer->setSingleShot(true);
+    d->presenceTimer->setInterval(PRESENCE_BATCH_WINDOW);
+    QObject::connect( d->presenceTimer, SIGNAL(timeout()),
+            SLOT(flushPresences()) );
 
     d->disco << DiscoInfo::Identity("gateway", "icq", "ICQ Transport");
-    d->disco << NS_IQ_REGISTER << NS_QUERY_ADHOC << NS_VCARD_TEMP << NS_IQ_GATEWAY
-            << NS_ROSTERX;
+    d->disco << NS_QUERY_DISCO_INFO << NS_IQ_REGISTER << NS_QUERY_ADHOC << NS_VCARD_TEMP
+            << NS_IQ_GATEWAY << NS_ROSTERX;
+    d->capsVer = d->disco.capsVerification();
+
+    d->contactDisco << DiscoInfo::Identity("client", "pc", "ICQ Contact");
+    d->contactDisco << NS_QUERY_DISCO_INFO << NS_VCARD_TEMP;
+    d->contactCapsVer = d->contactDisco.capsVerification();
 
     d->vcard.setFullName("ICQ Transport");
     d->vcard.setDescription("Qt ICQ Transport");
     d->vcard.setUrl( QUrl("http://github.com/holycheater/qt-icq-transport") );
 
-    QObject::connect( d->stream, SIGNAL(stanzaIQ(XMPP::IQ)),
-            SLOT(stream_iq(XMPP::IQ)) );
-
-    QObject::connect( d->stream, SIGNAL(streamReady()),
-            SLOT(slotStreamReady()) );
-    QObject::connect( d->stream, SIGNAL(streamReady()),
-            SIGNAL(connected()) );
-    QObject::connect( d->stream, SIGNAL(streamClosed()),
-            SLOT(slotStreamClosed()) );
-    QObject::connect( d->stream, SIGNAL(streamError()),
-            SLOT(slotStreamError()) );
-
-    d->gwtask = init_gateway_task(this, d->stream);
+    QObject::connect( Instrument::Registry::instance(), SIGNAL(collecting()),
+            SLOT(collectMetrics()) );
 }
 
 /**
@@ -163,9 +514,54 @@ JabberConnection::JabberConnection(QObject *parent)
  */
 JabberConnection::~JabberConnection()
 {
-    delete d->gwtask;
-    delete d->stream;
-    delete d->connector;
+    qDeleteAll(d->streams);
+    qDeleteAll(d->connectors);
+}
+
+/**
+ * Updates stream gauges before metrics are exported.
+ */
+void JabberConnection::collectMetrics()
+{
+    Instrument::Registry *registry = Instrument::Registry::instance();
+
+    qint64 buffered = 0;
+    foreach (ComponentStream *stream, d->streams) {
+        buffered += stream->bytesToWrite();
+    }
+    registry->gauge("xmpp_output_buffer_bytes", "Bytes waiting in output buffers of component streams")->set(buffered);
+    registry->gauge("xmpp_streams_active", "Component streams which passed the handshake")->set( d->activeStreams.size() );
+
+    int presences = 0;
+    foreach (const Private::PresenceBatches& batches, d->presenceBatches) {
+        foreach (const Private::PresenceBatch& batch, batches) {
+            presences += batch.presences.size();
+        }
+    }
+    registry->gauge("xmpp_presence_batch_queued", "Contact presences waiting in batches")->set(presences);
+
+    uint registerHits = d->registerHits;
+    uint registerMisses = d->registerMisses;
+    foreach (XMPP::GatewayTask *task, d->gatewayTasks) {
+        registerHits += task->replyCache().hits();
+        registerMisses += task->replyCache().misses();
+    }
+
+    /* caches keep their own totals, counters just follow them */
+    QString help = "Cached reply lookups by result";
+    Instrument::Counter *counter;
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"disco\",result=\"hit\"");
+    counter->inc( d->discoReplies.hits() - counter->value() );
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"disco\",result=\"miss\"");
+    counter->inc( d->discoReplies.misses() - counter->value() );
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"vcard\",result=\"hit\"");
+    counter->inc( d->vcardReplies.hits() - counter->value() );
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"vcard\",result=\"miss\"");
+    counter->inc( d->vcardReplies.misses() - counter->value() );
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"register\",result=\"hit\"");
+    counter->inc( registerHits - counter->value() );
+    counter = registry->counter("reply_cache_lookups_total", help, "cache=\"register\",result=\"miss\"");
+    counter->inc( registerMisses - counter->value() );
 }
 
 /**
@@ -173,7 +569,77 @@ JabberConnection::~JabberConnection()
  */
 void JabberConnection::login()
 {
-    d->stream->connectToServer(d->jid, d->secret);
+    foreach (ComponentStream *stream, d->streams) {
+        stream->connectToServer(d->jid, d->secret);
+    }
+}
+
+/**
+ * Sets number of parallel component connections to the server. Outgoing stanzas are
+ * distributed between the connections by recipient's bare jid.
+ * @note It should be called before login(), the server should allow several connections
+ * for one component.
+ */
+void JabberConnection::setConnectionCount(int count)
+{
+    while ( d->streams.size() < count ) {
+        d->addStream();
+    }
+}
+
+/**
+ * Sets bare jids of service administrators, which are allowed to run admin commands.
+ */
+void JabberConnection::setAdmins(const QStringList& admins)
+{
+    d->admins.clear();
+    foreach (QString admin, admins) {
+        d->admins << admin.toLower();
+    }
+}
+
+/**
+ * Stores the list of largest legacy sessions for the perf-snapshot command.
+ */
+void JabberConnection::setMemoryReport(const QStringList& report)
+{
+    d->memoryReport = report;
+}
+
+/**
+ * Sets contact presence batching window to @a msecs. Presences for one user are collected
+ * during the window and then sent with one write.
+ */
+void JabberConnection::setPresenceBatchWindow(int msecs)
+{
+    d->presenceTimer->setInterval( qMax(msecs, 0) );
+}
+
+/**
+ * Sets maximum number of contact presences in one batch to @a size. Batch is sent as soon
+ * as it reaches the size. Batching is disabled if @a size is less than 2.
+ */
+void JabberConnection::setPresenceBatchSize(int size)
+{
+    d->presenceBatchSize = size;
+    if ( size <= 1 ) {
+        flushPresences();
+    }
+}
+
+/**
+ * Sends all pending contact presences.
+ */
+void JabberConnection::flushPresences()
+{
+    d->presenceTimer->stop();
+    QHash<QString,Private::PresenceBatches> pending = d->presenceBatches;
+    d->presenceBatches.clear();
+    foreach (const Private::PresenceBatches& batches, pending) {
+        foreach (const Private::PresenceBatch& batch, batches) {
+            d->sendPresences(batch);
+        }
+    }
 }
 
 /**
@@ -190,7 +656,11 @@ void JabberConnection::setUsername(const QString& username)
  */
 void JabberConnection::setServer(const QString& host, quint16 port)
 {
-    d->connector->setOptHostPort(host, port);
+    d->host = host;
+    d->port = port;
+    foreach (Connector *connector, d->connectors) {
+        connector->setOptHostPort(host, port);
+    }
 }
 
 /**
@@ -212,7 +682,7 @@ void JabberConnection::sendSubscribe(const Jid& toUser, const QString& uin)
     subscribe.setFrom( d->jid.withNode(uin) );
     subscribe.setTo(toUser);
 
-    d->stream->sendStanza(subscribe);
+    d->send(subscribe);
 }
 
 /**
@@ -227,7 +697,7 @@ void JabberConnection::sendSubscribed(const Jid& toUser, const QString& fromUin,
     subscribed.setTo(toUser);
     subscribed.setNick(nick);
 
-    d->stream->sendStanza(subscribed);
+    d->send(subscribed);
 }
 
 /**
@@ -241,7 +711,7 @@ void JabberConnection::sendUnsubscribe(const Jid& toUser, const QString& fromUin
     unsubscribe.setFrom( d->jid.withNode(fromUin) );
     unsubscribe.setTo(toUser);
 
-    d->stream->sendStanza(unsubscribe);
+    d->send(unsubscribe);
 }
 
 /**
@@ -255,7 +725,7 @@ void JabberConnection::sendUnsubscribed(const Jid& toUser, const QString& fromUi
     unsubscribed.setFrom( d->jid.withNode(fromUin) );
     unsubscribed.setTo(toUser);
 
-    d->stream->sendStanza(unsubscribed);
+    d->send(unsubscribed);
 }
 
 /**
@@ -268,8 +738,9 @@ void JabberConnection::sendOnlinePresence(const Jid& toUser, const QString& from
     presence.setTo(toUser);
     presence.setShow( Presence::Show(showStatus) );
     presence.setNick(nick);
+    presence.setCaps(CAPS_NODE, d->contactCapsVer);
 
-    d->stream->sendStanza(presence);
+    d->queuePresence(presence, fromUin);
 }
 
 /**
@@ -282,7 +753,7 @@ void JabberConnection::sendOfflinePresence(const Jid& toUser, const QString& fro
     presence.setTo(toUser);
     presence.setType(Presence::Unavailable);
 
-    d->stream->sendStanza(presence);
+    d->queuePresence(presence, fromUin);
 }
 
 /**
@@ -294,8 +765,9 @@ void JabberConnection::sendOnlinePresence(const Jid& recipient, int showStatus)
     presence.setFrom(d->jid);
     presence.setTo(recipient);
     presence.setShow( Presence::Show(showStatus) );
+    presence.setCaps(CAPS_NODE, d->capsVer);
 
-    d->stream->sendStanza(presence);
+    d->send(presence);
 }
 
 /**
@@ -308,7 +780,7 @@ void JabberConnection::sendOfflinePresence(const Jid& recipient)
     presence.setTo(recipient);
     presence.setType(Presence::Unavailable);
 
-    d->stream->sendStanza(presence);
+    d->send(presence);
 }
 
 void JabberConnection::sendPresenceProbe(const Jid& user)
@@ -318,7 +790,7 @@ void JabberConnection::sendPresenceProbe(const Jid& user)
     presence.setTo(user);
     presence.setType(Presence::Probe);
 
-    d->stream->sendStanza(presence);
+    d->send(presence);
 }
 
 /**
@@ -339,7 +811,8 @@ void JabberConnection::sendMessage(const Jid& recipient, const QString& uin, con
     msg.setType(Message::Chat);
     msg.setTimestamp(timestamp);
 
-    d->stream->sendStanza(msg);
+    d->send(msg);
+    Instrument::MessageTracer::instance()->finish( Instrument::MessageTracer::current(Instrument::MessageTracer::Incoming), "xmpp-sent" );
 }
 
 void JabberConnection::sendMessage(const Jid& recipient, const QString& uin, const QString& message, const QString& nick)
@@ -351,7 +824,8 @@ void JabberConnection::sendMessage(const Jid& recipient, const QString& uin, con
     msg.setNick(nick);
     msg.setType(Message::Chat);
 
-    d->stream->sendStanza(msg);
+    d->send(msg);
+    Instrument::MessageTracer::instance()->finish( Instrument::MessageTracer::current(Instrument::MessageTracer::Incoming), "xmpp-sent" );
 }
 
 /**
@@ -365,7 +839,31 @@ void JabberConnection::sendMessage(const Jid& recipient, const QString& message)
     msg.setBody(message);
     msg.setType(Message::Chat);
 
-    d->stream->sendStanza(msg);
+    d->send(msg);
+}
+
+/**
+ * Sends offline @a messages to @a recipient with a single write. Each message comes
+ * with the sender's legacy uin, which is turned into a transport jid here.
+ * offlineMessagesDelivered() is emitted once the batch is written to the stream.
+ */
+void JabberConnection::sendOfflineMessages(const Jid& recipient, const QList< QPair<QString,XMPP::Message> >& messages)
+{
+    QByteArray data;
+    QListIterator< QPair<QString,XMPP::Message> > mi(messages);
+    while ( mi.hasNext() ) {
+        const QPair<QString,XMPP::Message>& offline = mi.next();
+        Message msg = offline.second;
+        msg.setFrom( d->jid.withNode(offline.first) );
+        msg.setTo(recipient);
+        data += msg.toString().toUtf8();
+    }
+
+    if ( d->sendSerialized( recipient, data, messages.size() ) ) {
+        emit offlineMessagesDelivered(recipient);
+    } else {
+        qDebug() << "[JC]" << "failed to deliver offline messages to" << recipient.full();
+    }
 }
 
 void JabberConnection::sendVCard(const Jid& recipient, const QString& uin, const QString& requestID, const vCard& vcard)
@@ -378,10 +876,10 @@ void JabberConnection::sendVCard(const Jid& recipient, const QString& uin, const
 
     if ( vcard.isEmpty() ) {
         reply.setError(Stanza::Error::ItemNotFound);
-        d->stream->sendStanza(reply);
+        d->send(reply);
     }
     vcard.toIQ(reply);
-    d->stream->sendStanza(reply);
+    d->send(reply);
 }
 
 void JabberConnection::slotRosterAdd(const Jid& user, const QList<XMPP::RosterXItem>& items)
@@ -402,7 +900,7 @@ void JabberConnection::slotRosterAdd(const Jid& user, const QList<XMPP::RosterXI
     x.setItems(copy);
     x.toIQ(contacts);
 
-    d->stream->sendStanza(contacts);
+    d->send(contacts);
 }
 
 void JabberConnection::Private::processAdHoc(const IQ& iq)
@@ -418,18 +916,32 @@ void JabberConnection::Private::processAdHoc(const IQ& iq)
         cmd.setAction(AdHoc::ActionNone);
         cmd.toIQ(reply);
 
-        stream->sendStanza(reply);
+        send(reply);
         return;
     }
     if ( cmd.action() != AdHoc::Execute ) {
         return;
     }
 
+    if ( adminCommands.contains(cmd.node()) ) {
+        if ( !isAdmin( iq.from() ) ) {
+            IQ err = IQ::createReply(iq);
+            err.setError(Stanza::Error::Forbidden);
+
+            send(err);
+            return;
+        }
+        if ( cmd.node() == "perf-snapshot" ) {
+            processPerfSnapshot(iq, cmd);
+        }
+        return;
+    }
+
     if ( !commands.contains(cmd.node()) ) {
         IQ reply = IQ::createReply(iq);
         reply.setError(Stanza::Error::ItemNotFound);
 
-        stream->sendStanza(reply);
+        send(reply);
         return;
     }
 
@@ -438,7 +950,7 @@ void JabberConnection::Private::processAdHoc(const IQ& iq)
             IQ err = IQ::createReply(iq);
             err.setError(Stanza::Error::NotAuthorized);
 
-            stream->sendStanza(err);
+            send(err);
             return;
         }
         emit q->cmd_RosterRequest( iq.from() );
@@ -460,13 +972,13 @@ void JabberConnection::Private::processAdHoc(const IQ& iq)
         msg.setTo( iq.from() );
         msg.setFrom(jid);
         msg.setBody("Uptime: "+uptimeText);
-        stream->sendStanza(msg);
+        send(msg);
     } else if ( cmd.node() == "set-options" ) {
         if ( !UserManager::instance()->isRegistered(iq.from().bare()) ) {
             IQ err = IQ::createReply(iq);
             err.setError(Stanza::Error::NotAuthorized);
 
-            stream->sendStanza(err);
+            send(err);
             return;
         }
 
@@ -524,7 +1036,7 @@ void JabberConnection::Private::processAdHoc(const IQ& iq)
 
             IQ reply = IQ::createReply(iq);
             cmd.toIQ(reply);
-            stream->sendStanza(reply);
+            send(reply);
             return;
         }
     }
@@ -535,34 +1047,196 @@ void JabberConnection::Private::processAdHoc(const IQ& iq)
     cmd.setForm( DataForm() );
     cmd.toIQ(completedNotify);
 
-    stream->sendStanza(completedNotify);
+    send(completedNotify);
+}
+
+/**
+ * Returns p50 and p99 of @a histogram observations made since the previous perf-snapshot
+ * (since the start for the first one). @a key identifies the histogram between snapshots.
+ */
+QString JabberConnection::Private::recentPercentiles(const QString& key, Instrument::Histogram *histogram)
+{
+    if ( !histogram ) {
+        return "n/a";
+    }
+    QVector<quint64> current = histogram->buckets();
+    QVector<quint64> recent = current;
+    QVector<quint64> previous = snapshotBuckets.value(key);
+    for ( int i = 0; i < previous.size() && i < recent.size(); ++i ) {
+        recent[i] -= previous.at(i);
+    }
+    snapshotBuckets.insert(key, current);
+
+    quint64 count = 0;
+    foreach (quint64 n, recent) {
+        count += n;
+    }
+    if ( count == 0 ) {
+        return "n/a";
+    }
+    QList<double> bounds = histogram->bounds();
+    return QString("p50 %1 ms, p99 %2 ms (%3 samples)")
+        .arg( Instrument::Histogram::quantile(bounds, recent, 0.5) * 1000, 0, 'f', 1 )
+        .arg( Instrument::Histogram::quantile(bounds, recent, 0.99) * 1000, 0, 'f', 1 )
+        .arg(count);
+}
+
+/**
+ * Replies to the perf-snapshot command with a form of current runtime metrics.
+ */
+void JabberConnection::Private::processPerfSnapshot(const IQ& iq, AdHoc& cmd)
+{
+    Instrument::Registry *registry = Instrument::Registry::instance();
+    registry->collect();
+
+    DataForm form;
+    form.setType(DataForm::Result);
+    form.setTitle("Performance snapshot");
+
+    QMap<QString,double> sessions = registry->values("gateway_sessions");
+    double totalSessions = 0;
+    QMapIterator<QString,double> si(sessions);
+    while ( si.hasNext() ) {
+        si.next();
+        totalSessions += si.value();
+    }
+    form << DataForm::Field::fromNameLabelValue( "sessions", "Sessions", QString::number(totalSessions) );
+    si.toFront();
+    while ( si.hasNext() ) {
+        si.next();
+        /* label set is state="..." */
+        QString state = si.key().section('"', 1, 1);
+        form << DataForm::Field::fromNameLabelValue( "sessions-" + state, "Sessions (" + state + ")", QString::number( si.value() ) );
+    }
+
+    double rateQueue = 0;
+    foreach (double depth, registry->values("icq_rate_queue_depth")) {
+        rateQueue += depth;
+    }
+    form << DataForm::Field::fromNameLabelValue( "rate-queue-depth", "Rate queue depth", QString::number(rateQueue) );
+
+    /* percentiles are taken over the time since the previous snapshot */
+    QString delayText = recentPercentiles( "rate-queue-delay", registry->findHistogram("icq_rate_queue_delay_seconds") );
+    form << DataForm::Field::fromNameLabelValue( "rate-queue-delay", "Rate queue delay", delayText );
+
+    QString lagText = recentPercentiles( "eventloop-lag", registry->findHistogram("eventloop_lag_seconds") );
+    form << DataForm::Field::fromNameLabelValue( "eventloop-lag", "Event loop lag", lagText );
+
+    /* end-to-end latency of sampled messages */
+    QStringList directions;
+    directions << "out" << "in";
+    foreach (const QString& direction, directions) {
+        QString latencyText = recentPercentiles( "message-latency-" + direction,
+                registry->findHistogram( "message_latency_seconds", "direction=\"" + direction + "\"" ) );
+        form << DataForm::Field::fromNameLabelValue( "message-latency-" + direction,
+                direction == "out" ? "Message latency (to ICQ)" : "Message latency (to XMPP)", latencyText );
+    }
+
+    form << DataForm::Field::fromNameLabelValue( "xmpp-output-buffer", "XMPP output buffer (bytes)",
+            QString::number( registry->values("xmpp_output_buffer_bytes").value(QString()) ) );
+    form << DataForm::Field::fromNameLabelValue( "message-queue", "Queued ICQ messages",
+            QString::number( registry->values("icq_message_queue_depth").value(QString()) ) );
+    form << DataForm::Field::fromNameLabelValue( "messages-unacked", "Unacknowledged ICQ messages",
+            QString::number( registry->values("icq_messages_unacked").value(QString()) ) );
+
+    QMap<QString,double> lookups = registry->values("details_cache_lookups_total");
+    double hits = lookups.value("result=\"hit\"") + lookups.value("result=\"stale\"") + lookups.value("result=\"coalesced\"");
+    double total = hits + lookups.value("result=\"miss\"");
+    QString hitRate = total > 0 ? QString::number(hits * 100 / total, 'f', 1) + "%" : QString("n/a");
+    form << DataForm::Field::fromNameLabelValue( "details-cache-hit-rate", "Details cache hit rate", hitRate );
+
+    /* disco, vCard and registration form replies together */
+    lookups = registry->values("reply_cache_lookups_total");
+    hits = 0;
+    total = 0;
+    QMapIterator<QString,double> it(lookups);
+    while ( it.hasNext() ) {
+        it.next();
+        if ( it.key().endsWith("result=\"hit\"") ) {
+            hits += it.value();
+        }
+        total += it.value();
+    }
+    hitRate = total > 0 ? QString::number(hits * 100 / total, 'f', 1) + "%" : QString("n/a");
+    form << DataForm::Field::fromNameLabelValue( "reply-cache-hit-rate", "Reply cache hit rate", hitRate );
+
+    /* second field of statm is resident set size in pages */
+    QString rssText = "n/a";
+    QFile statm("/proc/self/statm");
+    if ( statm.open(QIODevice::ReadOnly) ) {
+        QList<QByteArray> fields = statm.readAll().split(' ');
+        if ( fields.size() > 1 ) {
+            qint64 rss = fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+            rssText = QString::number(rss / 1024) + " KiB";
+        }
+    }
+    form << DataForm::Field::fromNameLabelValue( "rss", "Resident memory", rssText );
+
+    double sessionMemory = 0;
+    foreach (double bytes, registry->values("session_memory_bytes")) {
+        sessionMemory += bytes;
+    }
+    form << DataForm::Field::fromNameLabelValue( "session-memory", "Session memory (estimated)",
+            QString::number( qint64(sessionMemory) / 1024 ) + " KiB" );
+    DataForm::Field top("session-memory-top", "Largest sessions", DataForm::Field::TextMulti);
+    foreach (const QString& line, memoryReport) {
+        top.addValue(line);
+    }
+    form << top;
+
+    IQ reply = IQ::createReply(iq);
+    cmd.setStatus(AdHoc::Completed);
+    cmd.setAction(AdHoc::ActionNone);
+    cmd.setForm(form);
+    cmd.toIQ(reply);
+
+    send(reply);
 }
 
 void JabberConnection::Private::processDiscoInfo(const IQ& iq)
 {
     // qDebug() << "disco-info query from" << iq.from().full() << "to" << iq.to().full();
 
-    /* disco-info to command-node query handling */
     QString node = iq.childElement().attribute("node");
-    if ( !node.isEmpty() & commands.contains(node) ) {
-        // qDebug() << "[JC]" << "disco-info to command node: " << node;
+    bool toContact = !iq.to().node().isEmpty();
+    QString ver = toContact ? contactCapsVer : capsVer;
+
+    /* replies to unknown nodes are not cached, they would be keyed by arbitrary strings */
+    bool cacheable = node.isEmpty() || commands.contains(node) || node == CAPS_NODE "#" + ver;
+    /* each node has its own entry, service and contact replies are kept apart */
+    QString key = QString(NS_QUERY_DISCO_INFO) + ( toContact ? " contact#" : "#" ) + node;
+
+    if (cacheable) {
+        QByteArray cached = discoReplies.reply(key, iq);
+        if ( !cached.isEmpty() ) {
+            sendSerialized(iq.from(), cached);
+            return;
+        }
+    }
+
+    IQ reply = IQ::createReply(iq);
 
-        IQ adhoc_info = IQ::createReply(iq);
+    /* disco-info to command-node query handling */
+    if ( !node.isEmpty() && ( commands.contains(node) || (adminCommands.contains(node) && isAdmin( iq.from() )) ) ) {
+        // qDebug() << "[JC]" << "disco-info to command node: " << node;
 
+        DiscoItem item = commands.contains(node) ? commands.value(node) : adminCommands.value(node);
         DiscoInfo info;
-        info << DiscoInfo::Identity("automation", "command-node", commands.value(node).name() );
+        info << DiscoInfo::Identity("automation", "command-node", item.name() );
         info << NS_DATA_FORMS;
         info << NS_QUERY_ADHOC;
-        info.pushToDomElement( adhoc_info.childElement() );
-
-        stream->sendStanza(adhoc_info);
-        return;
+        info.pushToDomElement( reply.childElement() );
+    } else if (toContact) {
+        contactDisco.pushToDomElement( reply.childElement() );
+    } else {
+        disco.pushToDomElement( reply.childElement() );
     }
 
-    IQ reply = IQ::createReply(iq);
-
-    disco.pushToDomElement( reply.childElement() );
-    stream->sendStanza(reply);
+    if (cacheable) {
+        sendSerialized( iq.from(), discoReplies.insert(key, reply) );
+    } else {
+        send(reply);
+    }
 }
 
 void JabberConnection::Private::processDiscoItems(const IQ& iq)
@@ -579,11 +1253,20 @@ void JabberConnection::Private::processDiscoItems(const IQ& iq)
                 ci.next();
                 items << ci.value();
             }
+        }
+        if ( isAdmin( iq.from() ) ) {
+            QHashIterator<QString,DiscoItem> ci(adminCommands);
+            while ( ci.hasNext() ) {
+                ci.next();
+                items << ci.value();
+            }
+        }
+        if ( !items.items().isEmpty() ) {
             items.pushToDomElement( reply.childElement() );
         }
     }
 
-    stream->sendStanza(reply);
+    send(reply);
 }
 
 void JabberConnection::Private::processPromptRequest(const IQ& iq)
@@ -602,7 +1285,7 @@ void JabberConnection::Private::processPromptRequest(const IQ& iq)
     prompt.childElement().appendChild(ePrompt);
     ePrompt.appendChild(ePromptText);
 
-    stream->sendStanza(prompt);
+    send(prompt);
 }
 
 void JabberConnection::Private::processPrompt(const IQ& iq)
@@ -615,7 +1298,7 @@ void JabberConnection::Private::processPrompt(const IQ& iq)
     int u = uin.toInt(&ok, 10);
     if ( !ok && u <= 0 ) {
         reply.setError(Stanza::Error::ItemNotFound);
-        stream->sendStanza(reply);
+        send(reply);
         return;
     }
 
@@ -626,7 +1309,7 @@ void JabberConnection::Private::processPrompt(const IQ& iq)
     QDomText eJidText = doc.createTextNode( jid.withNode(uin) );
     eJid.appendChild(eJidText);
 
-    stream->sendStanza(reply);
+    send(reply);
 }
 
 void JabberConnection::stream_iq(const XMPP::IQ& iq)
@@ -651,7 +1334,7 @@ void JabberConnection::stream_iq(const XMPP::IQ& iq)
             reply.swapFromTo();
             reply.setError(Stanza::Error::BadRequest);
 
-            d->stream->sendStanza(reply);
+            d->send(reply);
             return;
         }
         if ( !iq.to().node().isEmpty() ) {
@@ -664,14 +1347,20 @@ void JabberConnection::stream_iq(const XMPP::IQ& iq)
             reply.swapFromTo();
             reply.setError(Stanza::Error::ItemNotFound);
 
-            d->stream->sendStanza(reply);
+            d->send(reply);
+            return;
+        }
+
+        QByteArray cached = d->vcardReplies.reply(NS_VCARD_TEMP, iq);
+        if ( !cached.isEmpty() ) {
+            d->sendSerialized(iq.from(), cached);
             return;
         }
 
         IQ reply = IQ::createReply(iq);
         d->vcard.toIQ(reply);
 
-        d->stream->sendStanza(reply);
+        d->sendSerialized( iq.from(), d->vcardReplies.insert(NS_VCARD_TEMP, reply) );
         return;
     }
     if ( iq.childElement().tagName() == "query" && iq.type() == "set" ) {
@@ -699,23 +1388,87 @@ void JabberConnection::stream_iq(const XMPP::IQ& iq)
              qPrintable(iq.childElement().namespaceURI()) );
 }
 
+/**
+ * Starts a trace of the message received from jabber user and passes it to the gateway.
+ * The trace follows the message through handlers connected to outgoingMessage().
+ */
+void JabberConnection::slotLegacyMessage(const XMPP::Jid& fromUser, const QString& toUin, const QString& message)
+{
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    Instrument::TraceScope scope( tracer->begin(Instrument::MessageTracer::Outgoing, "xmpp-received") );
+    emit outgoingMessage(fromUser, toUin, message);
+}
+
+/**
+ * Sends @a stanza of a gateway task on the stream chosen for its recipient.
+ */
+void JabberConnection::slotGatewayStanza(const XMPP::Stanza& stanza)
+{
+    d->send(stanza);
+}
+
+/**
+ * Sends serialized stanza @a data of a gateway task on the stream chosen for @a recipient.
+ */
+void JabberConnection::slotGatewaySerialized(const XMPP::Jid& recipient, const QByteArray& data)
+{
+    d->sendSerialized(recipient, data);
+}
+
 void JabberConnection::slotStreamReady()
 {
-    d->startTime = QDateTime::currentDateTime();
-    qDebug("[JC] Component signed on");
+    ComponentStream *stream = qobject_cast<ComponentStream*>( sender() );
+    Q_ASSERT( stream != 0 );
+
+    d->activeStreams << stream;
+    d->reconnectDelays[ d->streams.indexOf(stream) ] = RECONNECT_DELAY_MIN;
+    qDebug("[JC] Component signed on (link %d of %d)", d->activeStreams.size(), d->streams.size());
+
+    /* gateway goes online with the first link, others just join the pool */
+    if ( d->startTime.isNull() ) {
+        d->startTime = QDateTime::currentDateTime();
+        emit connected();
+    }
 }
 
 void JabberConnection::slotStreamError()
 {
+    ComponentStream *stream = qobject_cast<ComponentStream*>( sender() );
+    Q_ASSERT( stream != 0 );
+
     qCritical("[JC] Stream error: %s",
-            qPrintable(d->stream->lastStreamError().conditionString()) );
-    exit(1);
+            qPrintable(stream->lastStreamError().conditionString()) );
+    if ( !d->dropStream(stream) ) {
+        exit(1);
+    }
 }
 
 void JabberConnection::slotStreamClosed()
 {
+    ComponentStream *stream = qobject_cast<ComponentStream*>( sender() );
+    Q_ASSERT( stream != 0 );
+
     qDebug("[JC] Stream closed");
-    exit(0);
+    if ( !d->dropStream(stream) ) {
+        exit(0);
+    }
+}
+
+void JabberConnection::slotConnectorError()
+{
+    Connector *connector = qobject_cast<Connector*>( sender() );
+    Q_ASSERT( connector != 0 );
+
+    int slot = d->connectors.indexOf(connector);
+    qCritical("[JC] Failed to connect component link %d", slot);
+    if ( slot != -1 && !d->dropStream( d->streams.at(slot) ) ) {
+        exit(1);
+    }
+}
+
+void JabberConnection::reconnectStream(int slot)
+{
+    d->replaceStream(slot);
 }
 
 // vim:et:ts=4:sw=4:nowrap
@@ -23,13 +23,16 @@
 
 #include <QObject>
 #include <QList>
+#include <QPair>
 
 #include "componentstream.h"
 
 class QDateTime;
+class QStringList;
 
 namespace XMPP {
     class Jid;
+    class Message;
     class Registration;
     class RosterXItem;
     class vCard;
@@ -48,6 +51,10 @@ class JabberConnection : public QObject
         void setUsername(const QString& username);
         void setServer(const QString& host, quint16 port);
         void setPassword(const QString& password);
+        void setConnectionCount(int count);
+        void setPresenceBatchWindow(int msecs);
+        void setPresenceBatchSize(int size);
+        void setAdmins(const QStringList& admins);
     public slots:
         void sendSubscribe(const XMPP::Jid& toUser, const QString& fromUin);
         void sendSubscribed(const XMPP::Jid& toUser, const QString& fromUin, const QString& nick);
@@ -64,10 +71,15 @@ class JabberConnection : public QObject
         void sendMessage(const XMPP::Jid& recipient, const QString& uin, const QString& message, const QString& nick, const QDateTime& timestamp);
         void sendMessage(const XMPP::Jid& recipient, const QString& uin, const QString& message, const QString& nick);
         void sendMessage(const XMPP::Jid& recipient, const QString& message);
+        void sendOfflineMessages(const XMPP::Jid& recipient, const QList< QPair<QString,XMPP::Message> >& messages);
 
         void sendVCard(const XMPP::Jid& recipient, const QString& uin, const QString& requestID, const XMPP::vCard& vcard);
 
         void slotRosterAdd(const XMPP::Jid& user, const QList<XMPP::RosterXItem>& items);
+
+        void flushPresences();
+
+        void setMemoryReport(const QStringList& report);
     signals:
         void userUnregistered(const XMPP::Jid& jid);
         void userRegistered(const XMPP::Jid& jid, const QString& uin, const QString& password);
@@ -82,16 +94,24 @@ class JabberConnection : public QObject
         void vCardRequest(const XMPP::Jid& jid, const QString& uin, const QString& requestID);
 
         void outgoingMessage(const XMPP::Jid& fromUser, const QString& toUin, const QString& message);
+        void offlineMessagesDelivered(const XMPP::Jid& user);
 
         void connected();
 
         void cmd_RosterRequest(const XMPP::Jid& user);
     private slots:
         void stream_iq(const XMPP::IQ&);
+        void slotLegacyMessage(const XMPP::Jid& fromUser, const QString& toUin, const QString& message);
+        void slotGatewayStanza(const XMPP::Stanza& stanza);
+        void slotGatewaySerialized(const XMPP::Jid& recipient, const QByteArray& data);
 
         void slotStreamReady();
         void slotStreamError();
         void slotStreamClosed();
+        void slotConnectorError();
+        void reconnectStream(int slot);
+
+        void collectMetrics();
     private:
         class Private;
         Private *d;
@@ -0,0 +1,418 @@
+/*
+ * LogWriter.cpp - Asynchronous log writer
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "LogWriter.h"
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QString>
+#include <QWaitCondition>
+
+#include <stdio.h>
+#include <time.h>
+
+/* writer thread wakes up at least this often (msecs) */
+static const int LOG_FLUSH_INTERVAL = 100;
+static const int LOG_QUEUE_SIZE = 10000;
+
+class LogWriter::Private
+{
+    public:
+        /* queued log message */
+        struct Node {
+            QByteArray text;
+            QtMsgType type;
+            uint time;
+            QAtomicPointer<Node> next;
+        };
+
+        /* messages starting with prefix are limited to a number per second */
+        struct RateLimit {
+            QByteArray prefix;
+            int limit;
+            QAtomicInt second;
+            QAtomicInt count;
+            QAtomicInt suppressed;
+        };
+
+        /* timestamp formatted for one second, each consumer keeps its own */
+        struct Stamp {
+            Stamp() : time(0) {}
+            uint time;
+            QByteArray text;
+        };
+
+        Private();
+
+        static const char* typeName(QtMsgType type);
+
+        bool allow(RateLimit *rate, uint now);
+
+        void push(Node *node);
+        Node* pop();
+
+        QByteArray drain(Stamp& stamp);
+        static void format(QByteArray& out, Stamp& stamp, QtMsgType type, uint time, const QByteArray& text);
+        void reportLosses(QByteArray& out, Stamp& stamp, uint now);
+        void write(const QByteArray& data);
+
+        QFile file;
+        int queueSize;
+
+        /* multi-producer single-consumer queue, producers only touch head */
+        QAtomicPointer<Node> head;
+        Node *tail;
+        Node stub;
+        QAtomicInt size;
+
+        QAtomicInt dropped;         /* not reported yet */
+        QAtomicInt droppedTotal;
+        QAtomicInt suppressedTotal;
+        QList<RateLimit*> limits;
+
+        QAtomicInt running;
+        QAtomicInt stopping;
+        /* producers which may still push a node after they saw the thread running */
+        QAtomicInt producers;
+        QMutex waitMutex;
+        QWaitCondition wakeup;
+
+        /* serializes file writes of the writer thread and synchronous writes.
+         * The mutex is contended only while the thread starts or stops. */
+        QMutex syncMutex;
+        /* timestamp of synchronous writes, guarded by syncMutex */
+        Stamp syncStamp;
+        /* used by the queue consumer only */
+        Stamp writerStamp;
+        uint reportTime;
+};
+
+LogWriter::Private::Private()
+    : head(&stub), tail(&stub), size(0), dropped(0), droppedTotal(0), suppressedTotal(0),
+      running(0), stopping(0), producers(0), reportTime(0)
+{
+    queueSize = LOG_QUEUE_SIZE;
+    stub.next = 0;
+}
+
+const char* LogWriter::Private::typeName(QtMsgType type)
+{
+    switch ( type ) {
+        case QtDebugMsg:
+            return "[DEBUG]";
+        case QtWarningMsg:
+            return "[WARN]";
+        case QtCriticalMsg:
+            return "[CRIT]";
+        case QtFatalMsg:
+            return "[FATAL]";
+        default:
+            return "";
+    }
+}
+
+/**
+ * Returns true if one more message fits into the @a rate limit for current second.
+ */
+bool LogWriter::Private::allow(RateLimit *rate, uint now)
+{
+    int second = rate->second;
+    if ( second != int(now) && rate->second.testAndSetOrdered(second, now) ) {
+        rate->count = 0;
+    }
+    if ( rate->count.fetchAndAddOrdered(1) < rate->limit ) {
+        return true;
+    }
+    rate->suppressed.ref();
+    suppressedTotal.ref();
+    return false;
+}
+
+/**
+ * Appends @a node to the queue. Safe to be called from any thread.
+ */
+void LogWriter::Private::push(Node *node)
+{
+    node->next = 0;
+    Node *prev = head.fetchAndStoreOrdered(node);
+    prev->next = node;
+}
+
+/**
+ * Takes the oldest node from the queue. Must be called by one consumer at a time.
+ * Returns 0 if the queue is empty or a producer has not linked its node yet.
+ */
+LogWriter::Private::Node* LogWriter::Private::pop()
+{
+    Node *first = tail;
+    Node *next = first->next;
+    if ( first == &stub ) {
+        if ( !next ) {
+            return 0;
+        }
+        tail = next;
+        first = next;
+        next = next->next;
+    }
+    if ( next ) {
+        tail = next;
+        return first;
+    }
+    if ( first != (Node*)head ) {
+        return 0;
+    }
+    push(&stub);
+    next = first->next;
+    if ( next ) {
+        tail = next;
+        return first;
+    }
+    return 0;
+}
+
+/**
+ * Formats all queued messages into one block. Must be called by one consumer at a time.
+ */
+QByteArray LogWriter::Private::drain(Stamp& stamp)
+{
+    QByteArray out;
+    Node *node;
+    while ( (node = pop()) != 0 ) {
+        size.deref();
+        format(out, stamp, node->type, node->time, node->text);
+        delete node;
+    }
+    reportLosses( out, stamp, ::time(0) );
+    return out;
+}
+
+/**
+ * Appends a log line to @a out. Timestamp is formatted once per second and kept in
+ * the caller's @a stamp.
+ */
+void LogWriter::Private::format(QByteArray& out, Stamp& stamp, QtMsgType type, uint time, const QByteArray& text)
+{
+    if ( time != stamp.time || stamp.text.isEmpty() ) {
+        stamp.time = time;
+        stamp.text = "[" + QDateTime::fromTime_t(time).toString(Qt::ISODate).toLatin1() + "] ";
+    }
+    out += stamp.text;
+    out += typeName(type);
+    out += ' ';
+    out += text;
+    out += '\n';
+}
+
+/**
+ * Once per second writes how many messages were dropped or suppressed by rate limits.
+ */
+void LogWriter::Private::reportLosses(QByteArray& out, Stamp& stamp, uint now)
+{
+    if ( now == reportTime ) {
+        return;
+    }
+    reportTime = now;
+
+    int count = dropped.fetchAndStoreOrdered(0);
+    if ( count > 0 ) {
+        format( out, stamp, QtWarningMsg, now, "Log queue is full, " + QByteArray::number(count) + " messages dropped" );
+    }
+    foreach (RateLimit *rate, limits) {
+        count = rate->suppressed.fetchAndStoreOrdered(0);
+        if ( count > 0 ) {
+            format( out, stamp, QtWarningMsg, now, QByteArray::number(count) + " messages " + rate->prefix + " suppressed by rate limit" );
+        }
+    }
+}
+
+void LogWriter::Private::write(const QByteArray& data)
+{
+    if ( file.isOpen() ) {
+        file.write(data);
+        file.flush();
+    } else {
+        fwrite( data.constData(), 1, data.size(), stderr );
+    }
+}
+
+/**
+ * Creates log writer which appends to @a fileName. Messages are written
+ * synchronously until the writer thread is started.
+ */
+LogWriter::LogWriter(const QString& fileName, QObject *parent)
+    : QThread(parent)
+{
+    d = new Private;
+    d->file.setFileName(fileName);
+    d->file.open(QIODevice::Append);
+}
+
+LogWriter::~LogWriter()
+{
+    stop();
+    qDeleteAll(d->limits);
+    delete d;
+}
+
+/**
+ * Sets maximum number of messages waiting to be written. Messages above the limit are dropped.
+ */
+void LogWriter::setQueueSize(int size)
+{
+    d->queueSize = qMax(1, size);
+}
+
+/**
+ * Limits debug and warning messages starting with @a prefix (e.g. "[ICQ:Socket]")
+ * to @a perSecond messages. Should be called before the writer is started.
+ */
+void LogWriter::addRateLimit(const QByteArray& prefix, int perSecond)
+{
+    Private::RateLimit *rate = new Private::RateLimit;
+    rate->prefix = prefix;
+    rate->limit = perSecond;
+    d->limits << rate;
+}
+
+/**
+ * Queues log message @a msg. It is safe to call this method from any thread,
+ * it never waits for disk I/O while the writer thread is running.
+ * Returns false if the message was dropped.
+ */
+bool LogWriter::log(QtMsgType type, const char *msg)
+{
+    uint now = ::time(0);
+
+    if ( type == QtDebugMsg || type == QtWarningMsg ) {
+        foreach (Private::RateLimit *rate, d->limits) {
+            if ( qstrncmp(msg, rate->prefix.constData(), rate->prefix.size()) == 0 && !d->allow(rate, now) ) {
+                return false;
+            }
+        }
+    }
+
+    d->producers.ref();
+    if ( !d->running ) {
+        d->producers.deref();
+        QMutexLocker locker(&d->syncMutex);
+        QByteArray out;
+        d->format( out, d->syncStamp, type, now, QByteArray(msg) );
+        d->write(out);
+        return true;
+    }
+
+    int queued = d->size.fetchAndAddOrdered(1);
+    if ( queued >= d->queueSize ) {
+        d->size.deref();
+        d->dropped.ref();
+        d->droppedTotal.ref();
+        d->producers.deref();
+        return false;
+    }
+
+    Private::Node *node = new Private::Node;
+    node->text = msg;
+    node->type = type;
+    node->time = now;
+    d->push(node);
+    d->producers.deref();
+
+    /* the writer checks the queue under waitMutex before it sleeps, so the wakeup can't be lost */
+    if ( queued == 0 ) {
+        QMutexLocker locker(&d->waitMutex);
+        d->wakeup.wakeOne();
+    }
+    return true;
+}
+
+/**
+ * Writes all queued messages and stops the writer thread. Further messages
+ * are written synchronously until the thread is started again.
+ */
+void LogWriter::stop()
+{
+    if ( !d->running && !isRunning() ) {
+        return;
+    }
+    d->waitMutex.lock();
+    d->stopping = 1;
+    d->wakeup.wakeOne();
+    d->waitMutex.unlock();
+    wait();
+    d->stopping = 0;
+
+    /* producers which saw the thread running may still be pushing, their nodes
+     * are drained once nobody can push anymore */
+    d->running = 0;
+    while ( d->producers != 0 ) {
+        yieldCurrentThread();
+    }
+
+    QMutexLocker locker(&d->syncMutex);
+    d->write( d->drain(d->syncStamp) );
+}
+
+/**
+ * Returns number of messages dropped because the queue was full.
+ */
+int LogWriter::dropped() const
+{
+    return d->droppedTotal;
+}
+
+/**
+ * Returns number of messages suppressed by rate limits.
+ */
+int LogWriter::suppressed() const
+{
+    return d->suppressedTotal;
+}
+
+void LogWriter::run()
+{
+    d->running = 1;
+    forever {
+        bool stopping = d->stopping;
+
+        QByteArray batch = d->drain(d->writerStamp);
+        if ( !batch.isEmpty() ) {
+            QMutexLocker locker(&d->syncMutex);
+            d->write(batch);
+        }
+        if ( stopping ) {
+            break;
+        }
+        if ( batch.isEmpty() ) {
+            d->waitMutex.lock();
+            if ( d->size == 0 && !d->stopping ) {
+                d->wakeup.wait(&d->waitMutex, LOG_FLUSH_INTERVAL);
+            }
+            d->waitMutex.unlock();
+        }
+    }
+}
+
+// vim:et:ts=4:sw=4:nowrap
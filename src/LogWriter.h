@@ -0,0 +1,55 @@
+/*
+ * LogWriter.h - Asynchronous log writer
+ * Copyright (C) 2008  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LOGWRITER_H_
+#define LOGWRITER_H_
+
+#include <QThread>
+
+class QByteArray;
+class QString;
+
+class LogWriter : public QThread
+{
+    Q_OBJECT
+
+    public:
+        LogWriter(const QString& fileName, QObject *parent = 0);
+        ~LogWriter();
+
+        void setQueueSize(int size);
+        void addRateLimit(const QByteArray& prefix, int perSecond);
+
+        bool log(QtMsgType type, const char *msg);
+        void stop();
+
+        int dropped() const;
+        int suppressed() const;
+    protected:
+        void run();
+    private:
+        Q_DISABLE_COPY(LogWriter);
+
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* LOGWRITER_H_ */
@@ -37,9 +37,14 @@ static QSet<QString> supportedOptions;
 Options::Options()
 {
     m_options.insert("config-file", defaultConfigFile);
-    supportedOptions << "log-file" << "pid-file" << "database"
+    supportedOptions << "log-file" << "log-rate-limit" << "pid-file" << "database"
                      << "jabber-server" << "jabber-port" << "jabber-domain" << "jabber-secret"
-                     << "icq-server" << "icq-port";
+                     << "jabber-connections" << "presence-batch-window" << "presence-batch-size"
+                     << "icq-server" << "icq-port"
+                     << "details-cache-ttl" << "details-cache-size" << "details-refresh-interval"
+                     << "metrics-port" << "admin-jids" << "trace-file" << "slow-handler-threshold"
+                     << "message-trace-rate" << "slow-message-threshold"
+                     << "session-memory-budget" << "record-dir";
 }
 
 Options::~Options()
@@ -0,0 +1,133 @@
+/*
+ * StreamMetrics.cpp - Metrics and traffic recording of component streams
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "StreamMetrics.h"
+
+#include "metrics.h"
+#include "profiler.h"
+#include "recorder.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QStack>
+
+/* gateway-wide stream metrics */
+static Instrument::Counter* stanzaCounter(const char *direction, const char *kind)
+{
+    return Instrument::Registry::instance()->counter( "xmpp_stanzas_total", "XMPP stanzas sent and received",
+            QString("direction=\"%1\",kind=\"%2\"").arg(direction, kind) );
+}
+
+static Instrument::Counter* bytesCounter(const char *direction)
+{
+    return Instrument::Registry::instance()->counter( "xmpp_bytes_total", "Bytes written to and read from XMPP streams",
+            QString("direction=\"%1\"").arg(direction) );
+}
+
+class StreamMetrics::Private
+{
+    public:
+        Instrument::Histogram* handlerHistogram(const char *handler);
+
+        Instrument::Recorder *recorder;
+
+        /* handlers being timed, innermost on top */
+        QStack<Instrument::ProfileScope*> scopes;
+        /* handler names are literals of the stream, so they are keyed by pointer */
+        QHash<const char*, Instrument::Histogram*> histograms;
+        QHash<const char*, Instrument::Counter*> received;
+};
+
+Instrument::Histogram* StreamMetrics::Private::handlerHistogram(const char *handler)
+{
+    Instrument::Histogram *histogram = histograms.value(handler);
+    if ( !histogram ) {
+        histogram = Instrument::Registry::instance()->histogram( "handler_duration_seconds", "Time spent in event handlers",
+                QString("handler=\"%1\"").arg(handler) );
+        histograms.insert(handler, histogram);
+    }
+    return histogram;
+}
+
+/**
+ * Creates stream monitor, which exports stream traffic as metrics and writes it
+ * with @a recorder (owned by the monitor, may be null).
+ */
+StreamMetrics::StreamMetrics(Instrument::Recorder *recorder)
+    : d(new Private)
+{
+    d->recorder = recorder;
+}
+
+StreamMetrics::~StreamMetrics()
+{
+    qDeleteAll(d->scopes);
+    delete d->recorder;
+    delete d;
+}
+
+void StreamMetrics::dataWritten(const QByteArray& data)
+{
+    static Instrument::Counter *sent = bytesCounter("out");
+    sent->inc( data.size() );
+    if ( d->recorder ) {
+        d->recorder->record(Instrument::Recorder::Out, data);
+    }
+}
+
+void StreamMetrics::dataRead(const QByteArray& data)
+{
+    static Instrument::Counter *received = bytesCounter("in");
+    received->inc( data.size() );
+    if ( d->recorder ) {
+        d->recorder->record(Instrument::Recorder::In, data);
+    }
+}
+
+void StreamMetrics::stanzasSent(int count)
+{
+    static Instrument::Counter *sent = stanzaCounter("out", "stanza");
+    sent->inc(count);
+}
+
+void StreamMetrics::stanzaReceived(const char *kind)
+{
+    Instrument::Counter *counter = d->received.value(kind);
+    if ( !counter ) {
+        counter = stanzaCounter("in", kind);
+        d->received.insert(kind, counter);
+    }
+    counter->inc();
+}
+
+void StreamMetrics::handlerStarted(const char *handler)
+{
+    d->scopes.push( new Instrument::ProfileScope( d->handlerHistogram(handler), handler ) );
+}
+
+void StreamMetrics::handlerFinished(const char *handler)
+{
+    Q_UNUSED(handler);
+    if ( !d->scopes.isEmpty() ) {
+        delete d->scopes.pop();
+    }
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,54 @@
+/*
+ * StreamMetrics.h - Metrics and traffic recording of component streams
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef STREAMMETRICS_H_
+#define STREAMMETRICS_H_
+
+#include "streammonitor.h"
+
+#include <QtGlobal>
+
+namespace Instrument {
+    class Recorder;
+}
+
+class StreamMetrics : public XMPP::StreamMonitor
+{
+    public:
+        StreamMetrics(Instrument::Recorder *recorder = 0);
+        ~StreamMetrics();
+
+        void dataWritten(const QByteArray& data);
+        void dataRead(const QByteArray& data);
+
+        void stanzasSent(int count);
+        void stanzaReceived(const char *kind);
+
+        void handlerStarted(const char *handler);
+        void handlerFinished(const char *handler);
+    private:
+        Q_DISABLE_COPY(StreamMetrics);
+
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* STREAMMETRICS_H_ */
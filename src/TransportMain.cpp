@@ -19,10 +19,18 @@
  */
 
 #include "TransportMain.h"
+#include "DetailsCache.h"
 #include "GatewayTask.h"
 #include "JabberConnection.h"
+#include "LogWriter.h"
 #include "Options.h"
 
+#include "lagmonitor.h"
+#include "messagetracer.h"
+#include "metricsserver.h"
+#include "profiler.h"
+#include "recorder.h"
+
 #include <signal.h>
 #include <stdlib.h>
 
@@ -31,12 +39,15 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QProcess>
+#include <QRegExp>
 #include <QSqlDatabase>
 #include <QStringList>
 #include <QTextCodec>
-#include <QTextStream>
 #include <QTimer>
 
+/* default number of per-packet debug messages a second */
+static const int LOG_RATE_LIMIT = 50;
+
 enum { PermOk, PermErrIsDir, PermErrDir, PermErrFile };
 
 static int checkFilePermissions(const QString& fileName)
@@ -67,7 +78,7 @@ TransportMain::TransportMain(int& argc, char **argv)
 
     m_gateway = 0;
     m_connection = 0;
-    m_logfile = 0;
+    m_logWriter = 0;
     m_transport = 0;
 
     m_runmode = Sandbox;
@@ -102,6 +113,8 @@ TransportMain::TransportMain(int& argc, char **argv)
     if ( signal(SIGINT, sighandler) == SIG_IGN ) {
         signal(SIGINT, SIG_IGN);
     }
+    /* SIGUSR1 writes the profiler trace */
+    signal(SIGUSR1, tracehandler);
 }
 
 TransportMain::~TransportMain()
@@ -109,7 +122,9 @@ TransportMain::~TransportMain()
     delete m_options;
     delete m_gateway;
     delete m_connection;
-    delete m_logfile;
+
+    qInstallMsgHandler(0);
+    delete m_logWriter;
 }
 
 void TransportMain::shutdown()
@@ -117,6 +132,7 @@ void TransportMain::shutdown()
     if ( m_runmode == Transport ) {
         Q_ASSERT(m_gateway != 0);
         m_gateway->processShutdown();
+        m_connection->flushPresences();
     } else if ( m_runmode == Sandbox ) {
         QFile(m_options->getOption("pid-file")).remove();
         if ( m_transport ) {
@@ -213,8 +229,7 @@ void TransportMain::setup_sandbox()
             break;
     }
 
-    m_logfile = new QFile(logfile);
-    m_logfile->open(QIODevice::Append);
+    m_logWriter = new LogWriter(logfile);
     qInstallMsgHandler(loghandler);
 
     /* TODO: config variables check */
@@ -244,10 +259,25 @@ void TransportMain::startForkedTransport()
 
 void TransportMain::setup_transport()
 {
-    m_logfile = new QFile(m_options->getOption("log-file"), this);
-    m_logfile->open(QIODevice::Append);
+    /* per-packet messages of misbehaving peers should not flood the log */
+    int rateLimit = LOG_RATE_LIMIT;
+    if ( m_options->hasOption("log-rate-limit") ) {
+        rateLimit = m_options->getOption("log-rate-limit").toInt();
+    }
+    m_logWriter = new LogWriter( m_options->getOption("log-file") );
+    if ( rateLimit > 0 ) {
+        m_logWriter->addRateLimit("[ICQ:Socket]", rateLimit);
+        m_logWriter->addRateLimit("[ICQ:MM]", rateLimit);
+    }
+    m_logWriter->start();
     qInstallMsgHandler(loghandler);
 
+    /* streams and sessions check it when they are created */
+    if ( m_options->hasOption("record-dir") ) {
+        Instrument::Recorder::setDirectory( m_options->getOption("record-dir") );
+        qWarning( "Recording raw traffic, including passwords and messages, to %s", qPrintable( m_options->getOption("record-dir") ) );
+    }
+
     m_gateway = new GatewayTask(this);
     m_connection = new JabberConnection(this);
 
@@ -259,11 +289,57 @@ void TransportMain::setup_transport()
 
     m_gateway->setIcqServer( m_options->getOption("icq-server"),
                              m_options->getOption("icq-port").toUInt() );
+    if ( m_options->hasOption("details-cache-ttl") ) {
+        m_gateway->detailsCache()->setTimeToLive( m_options->getOption("details-cache-ttl").toInt() );
+    }
+    if ( m_options->hasOption("details-cache-size") ) {
+        m_gateway->detailsCache()->setMaxSize( m_options->getOption("details-cache-size").toInt() );
+    }
+    if ( m_options->hasOption("details-refresh-interval") ) {
+        m_gateway->setDetailsRefreshInterval( m_options->getOption("details-refresh-interval").toInt() );
+    }
+    if ( m_options->hasOption("session-memory-budget") ) {
+        m_gateway->setSessionMemoryBudget( m_options->getOption("session-memory-budget").toInt() );
+    }
 
     m_connection->setUsername( m_options->getOption("jabber-domain") );
     m_connection->setServer( m_options->getOption("jabber-server"),
                              m_options->getOption("jabber-port").toUInt() );
     m_connection->setPassword( m_options->getOption("jabber-secret") );
+    if ( m_options->hasOption("jabber-connections") ) {
+        m_connection->setConnectionCount( m_options->getOption("jabber-connections").toInt() );
+    }
+    if ( m_options->hasOption("presence-batch-window") ) {
+        m_connection->setPresenceBatchWindow( m_options->getOption("presence-batch-window").toInt() );
+    }
+    if ( m_options->hasOption("presence-batch-size") ) {
+        m_connection->setPresenceBatchSize( m_options->getOption("presence-batch-size").toInt() );
+    }
+    if ( m_options->hasOption("admin-jids") ) {
+        m_connection->setAdmins( m_options->getOption("admin-jids").split(QRegExp("[\\s,]+"), QString::SkipEmptyParts) );
+    }
+
+    if ( m_options->getOption("metrics-port").toUInt() > 0 ) {
+        Instrument::MetricsServer *metrics = new Instrument::MetricsServer(this);
+        if ( !metrics->listenLocal( m_options->getOption("metrics-port").toUInt() ) ) {
+            qCritical( "Failed to start metrics server: %s", qPrintable( metrics->errorString() ) );
+        }
+    }
+
+    Instrument::Profiler *profiler = Instrument::Profiler::instance();
+    if ( m_options->hasOption("slow-handler-threshold") ) {
+        profiler->setSlowThreshold( m_options->getOption("slow-handler-threshold").toInt() );
+    }
+    profiler->setTraceFile( m_options->getOption("trace-file") );
+    Instrument::MessageTracer *tracer = Instrument::MessageTracer::instance();
+    if ( m_options->hasOption("message-trace-rate") ) {
+        tracer->setSampleRate( m_options->getOption("message-trace-rate").toDouble() );
+    }
+    if ( m_options->hasOption("slow-message-threshold") ) {
+        tracer->setSlowThreshold( m_options->getOption("slow-message-threshold").toInt() );
+    }
+    Instrument::LagMonitor *lagMonitor = new Instrument::LagMonitor(this);
+    lagMonitor->start();
 
     connect_signals();
     m_connection->login();
@@ -320,10 +396,16 @@ void TransportMain::connect_signals()
                           m_connection, SLOT(sendMessage(XMPP::Jid,QString,QString,QString)) );
     QObject::connect( m_gateway, SIGNAL(incomingMessage(XMPP::Jid,QString,QString,QString,QDateTime)),
                           m_connection, SLOT(sendMessage(XMPP::Jid,QString,QString,QString,QDateTime)) );
+    QObject::connect( m_gateway, SIGNAL(offlineMessages(XMPP::Jid,QList<QPair<QString,XMPP::Message> >)),
+                      m_connection, SLOT(sendOfflineMessages(XMPP::Jid,QList<QPair<QString,XMPP::Message> >)) );
+    QObject::connect( m_connection, SIGNAL(offlineMessagesDelivered(XMPP::Jid)),
+                      m_gateway, SLOT(processOfflineMessagesDelivered(XMPP::Jid)) );
     QObject::connect( m_gateway, SIGNAL(gatewayMessage(XMPP::Jid,QString)),
                       m_connection, SLOT(sendMessage(XMPP::Jid,QString)) );
     QObject::connect( m_gateway, SIGNAL(rosterAdd(XMPP::Jid,QList<XMPP::RosterXItem>)),
                       m_connection, SLOT(slotRosterAdd(XMPP::Jid,QList<XMPP::RosterXItem>)) );
+    QObject::connect( m_gateway, SIGNAL(memoryReport(QStringList)),
+                      m_connection, SLOT(setMemoryReport(QStringList)) );
 }
 
 void TransportMain::sighandler(int param)
@@ -335,35 +417,39 @@ void TransportMain::sighandler(int param)
 
     QTimer::singleShot( 0, app, SLOT(shutdown()) );
     processEvents(QEventLoop::AllEvents, 60000);
+    if ( app->m_logWriter ) {
+        app->m_logWriter->stop();
+    }
     ::exit(0);
 }
 
-void TransportMain::loghandler(QtMsgType type, const char *msg)
+void TransportMain::tracehandler(int param)
 {
-    QString msgType;
-    switch ( type ) {
-        case QtDebugMsg:
-            msgType = "[DEBUG]";
-            break;
-        case QtWarningMsg:
-            msgType = "[WARN]";
-            break;
-        case QtCriticalMsg:
-            msgType = "[CRIT]";
-            break;
-        case QtFatalMsg:
-            msgType = "[FATAL]";
-        default:
-            break;
+    Q_UNUSED(param);
+
+    TransportMain *app = qobject_cast<TransportMain*>(instance());
+    if ( app->m_runmode == Sandbox ) {
+        /* pid file contains sandbox pid, pass the request to the transport */
+        if ( app->m_transport && app->m_transport->pid() > 0 ) {
+            ::kill(app->m_transport->pid(), SIGUSR1);
+        }
+        return;
     }
+    /* trace is written by the lag monitor heartbeat */
+    Instrument::Profiler::requestTrace();
+}
 
+void TransportMain::loghandler(QtMsgType type, const char *msg)
+{
     TransportMain *app = qobject_cast<TransportMain*>(instance());
-    QFile *logfile = app->m_logfile;
-    Q_CHECK_PTR(logfile);
+    LogWriter *logWriter = app->m_logWriter;
+    Q_CHECK_PTR(logWriter);
 
-    QTextStream s(logfile);
-    s.setCodec("LATIN1");
-    s << "[" << QDateTime::currentDateTime().toString(Qt::ISODate) << "] " << msgType << " " << msg << "\n";
+    if ( type == QtFatalMsg ) {
+        /* write out everything queued before aborting */
+        logWriter->stop();
+    }
+    logWriter->log(type, msg);
     if ( type == QtFatalMsg ) {
         abort();
     }
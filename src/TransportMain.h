@@ -26,8 +26,8 @@
 
 class GatewayTask;
 class JabberConnection;
+class LogWriter;
 class Options;
-class QFile;
 class QProcess;
 
 class TransportMain : public QCoreApplication
@@ -50,6 +50,7 @@ class TransportMain : public QCoreApplication
         void connect_signals();
 
         static void sighandler(int param);
+        static void tracehandler(int param);
         static void loghandler(QtMsgType type, const char *msg);
     private slots:
         void processTransportError(QProcess::ProcessError error);
@@ -62,9 +63,9 @@ class TransportMain : public QCoreApplication
 
         /* "sandbox" mode */
         QProcess *m_transport;
-        QFile *m_logfile;
 
         /* common for all */
+        LogWriter *m_logWriter;
         Options *m_options;
         RunMode m_runmode;
 };
@@ -20,6 +20,10 @@
 
 #include "UserManager.h"
 
+#include "types/icqShortUserDetails.h"
+
+#include "metrics.h"
+
 #include <QMutex>
 #include <QSqlQuery>
 #include <QString>
@@ -43,8 +47,32 @@ UserManager::UserManager()
                 "value TEXT,"
                 "PRIMARY KEY(jid,option)"
                 ")");
+
+    query.exec("CREATE TABLE IF NOT EXISTS details ("
+                "uin TEXT,"
+                "nick TEXT,"
+                "firstname TEXT,"
+                "lastname TEXT,"
+                "email TEXT,"
+                "fetched INTEGER,"
+                "PRIMARY KEY(uin)"
+                ")");
+}
+
+static Instrument::Histogram* queryLatency(const char *operation)
+{
+    /* sqlite queries usually take well below a millisecond */
+    QList<double> bounds;
+    bounds << 0.0001 << 0.00025 << 0.0005 << 0.001 << 0.0025 << 0.005 << 0.01 << 0.05 << 0.1 << 0.5 << 1;
+    return Instrument::Registry::instance()->histogram( "db_query_duration_seconds",
+            "Latency of user database queries", QString("operation=\"%1\"").arg(operation), bounds );
 }
 
+/* measures time until the end of the scope */
+#define TIME_QUERY(_operation) \
+    static Instrument::Histogram *_queryLatency = queryLatency(_operation); \
+    Instrument::ScopedTimer _queryTimer(_queryLatency)
+
 UserManager::~UserManager()
 {
 }
@@ -64,6 +92,7 @@ UserManager* UserManager::instance()
 
 void UserManager::add(const QString& user, const QString& uin, const QString& passwd)
 {
+    TIME_QUERY("add");
     clearOptions(user);
     QSqlQuery query;
     /* prepare + bindvalue doesn't work... at least on sqlite */
@@ -72,6 +101,7 @@ void UserManager::add(const QString& user, const QString& uin, const QString& pa
 
 void UserManager::del(const QString& user)
 {
+    TIME_QUERY("del");
     QSqlQuery query;
 
     query.exec( QString("SELECT * FROM users WHERE jid = '%1'").arg(user) );
@@ -85,6 +115,7 @@ void UserManager::del(const QString& user)
 
 bool UserManager::isRegistered(const QString& user) const
 {
+    TIME_QUERY("isRegistered");
     QSqlQuery query;
     query.exec( QString("SELECT jid FROM users WHERE jid = '%1'").arg(user) );
     return query.first();
@@ -92,6 +123,7 @@ bool UserManager::isRegistered(const QString& user) const
 
 QString UserManager::getUin(const QString& user) const
 {
+    TIME_QUERY("getUin");
     QSqlQuery query;
     query.exec( QString("SELECT uin from users WHERE jid = '%1'").arg(user) );
     if ( query.first() ) {
@@ -102,6 +134,7 @@ QString UserManager::getUin(const QString& user) const
 
 QString UserManager::getPassword(const QString& user) const
 {
+    TIME_QUERY("getPassword");
     QSqlQuery query;
     query.exec( QString("SELECT password from users WHERE jid = '%1'").arg(user) );
     if ( query.first() ) {
@@ -112,6 +145,7 @@ QString UserManager::getPassword(const QString& user) const
 
 QStringList UserManager::getUserList() const
 {
+    TIME_QUERY("getUserList");
     QSqlQuery query;
     query.exec("SELECT jid FROM users");
     QStringList users;
@@ -123,6 +157,7 @@ QStringList UserManager::getUserList() const
 
 QStringList UserManager::getUserListByOptVal(const QString& option, const QVariant& value) const
 {
+    TIME_QUERY("getUserListByOptVal");
     QSqlQuery query;
     query.exec( QString("SELECT jid FROM options WHERE option = '%1' AND value = '%2'").arg(option,value.toString()) );
 
@@ -135,6 +170,7 @@ QStringList UserManager::getUserListByOptVal(const QString& option, const QVaria
 
 QVariant UserManager::getOption(const QString& user, const QString& option) const
 {
+    TIME_QUERY("getOption");
     QSqlQuery query;
     query.exec( QString("SELECT value from options WHERE jid = '%1' AND option='%2'").arg(user,option) );
 
@@ -147,12 +183,14 @@ QVariant UserManager::getOption(const QString& user, const QString& option) cons
 
 void UserManager::setOption(const QString& user, const QString& option, const QVariant& value)
 {
+    TIME_QUERY("setOption");
     QSqlQuery query;
     query.exec( QString("REPLACE INTO options (jid,option,value) VALUES('%1', '%2', '%3')").arg(user,option, value.toString()) );
 }
 
 bool UserManager::hasOption(const QString& user, const QString& option) const
 {
+    TIME_QUERY("hasOption");
     QSqlQuery query;
     query.exec( QString("SELECT value from options WHERE jid = '%1' AND option='%2'").arg(user,option) );
     return query.first();
@@ -160,6 +198,7 @@ bool UserManager::hasOption(const QString& user, const QString& option) const
 
 QHash<QString,QVariant> UserManager::options(const QString& user) const
 {
+    TIME_QUERY("options");
     QSqlQuery query;
     query.exec( QString("SELECT option, value from options WHERE jid = '%1'").arg(user) );
 
@@ -181,10 +220,56 @@ void UserManager::setOptions(const QString& user, const QHash<QString,QVariant>&
 
 void UserManager::clearOptions(const QString& user)
 {
+    TIME_QUERY("clearOptions");
     QSqlQuery query;
     query.exec( QString("DELETE FROM options WHERE jid='%1'").arg(user) );
 }
 
+/**
+ * Reads stored details for @a uin. Returns false if there are no stored details,
+ * otherwise fills @a details and sets @a fetched to the time when they were received.
+ */
+bool UserManager::getDetails(const QString& uin, ICQ::ShortUserDetails& details, uint *fetched) const
+{
+    TIME_QUERY("getDetails");
+    QSqlQuery query;
+    query.prepare("SELECT nick, firstname, lastname, email, fetched FROM details WHERE uin = :uin");
+    query.bindValue(":uin", uin);
+    query.exec();
+    if ( !query.first() ) {
+        return false;
+    }
+
+    details.setUin(uin);
+    details.setNick( query.value(0).toString() );
+    details.setFirstName( query.value(1).toString() );
+    details.setLastName( query.value(2).toString() );
+    details.setEmail( query.value(3).toString() );
+    if ( fetched ) {
+        *fetched = query.value(4).toUInt();
+    }
+    return true;
+}
+
+/**
+ * Stores @a details received at @a fetched time (seconds since epoch).
+ */
+void UserManager::setDetails(const ICQ::ShortUserDetails& details, uint fetched)
+{
+    TIME_QUERY("setDetails");
+    QSqlQuery query;
+    /* details come from the legacy network and may contain anything, so they are bound */
+    query.prepare("REPLACE INTO details (uin,nick,firstname,lastname,email,fetched) "
+            "VALUES(:uin, :nick, :firstname, :lastname, :email, :fetched)");
+    query.bindValue( ":uin", details.uin() );
+    query.bindValue( ":nick", details.nick() );
+    query.bindValue( ":firstname", details.firstName() );
+    query.bindValue( ":lastname", details.lastName() );
+    query.bindValue( ":email", details.email() );
+    query.bindValue( ":fetched", fetched );
+    query.exec();
+}
+
 UserManager* UserManager::m_instance = 0;
 
 // vim:et:ts=4:sw=4:nowrap
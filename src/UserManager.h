@@ -27,6 +27,10 @@ class QString;
 class QStringList;
 class QVariant;
 
+namespace ICQ {
+    class ShortUserDetails;
+}
+
 #define qUsrMgr UserManager::instance()
 
 class UserManager
@@ -51,6 +55,9 @@ class UserManager
         QHash<QString,QVariant> options(const QString& user) const;
         void setOptions(const QString& user, const QHash<QString,QVariant>& list);
         void clearOptions(const QString& user);
+
+        bool getDetails(const QString& uin, ICQ::ShortUserDetails& details, uint *fetched) const;
+        void setDetails(const ICQ::ShortUserDetails& details, uint fetched);
     private:
         UserManager();
         ~UserManager();
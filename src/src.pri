@@ -1,14 +1,20 @@
 HEADERS += \
+	$$PWD/DetailsCache.h \
 	$$PWD/GatewayTask.h \
 	$$PWD/JabberConnection.h \
+	$$PWD/LogWriter.h \
 	$$PWD/Options.h \
+	$$PWD/StreamMetrics.h \
 	$$PWD/TransportMain.h \
 	$$PWD/UserManager.h
 
 SOURCES += \
+	$$PWD/DetailsCache.cpp \
 	$$PWD/GatewayTask.cpp \
 	$$PWD/JabberConnection.cpp \
+	$$PWD/LogWriter.cpp \
 	$$PWD/Options.cpp \
+	$$PWD/StreamMetrics.cpp \
 	$$PWD/TransportMain.cpp \
 	$$PWD/UserManager.cpp \
 	$$PWD/main.cpp
@@ -0,0 +1,19 @@
+TARGET = tst_caps
+TEMPLATE = app
+
+include(../../common.pri)
+include(../../shark/shark.pri)
+
+CONFIG += qtestlib
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+QMAKE_DISTCLEAN += \
+	$$PWD/.moc \
+	$$PWD/.obj
+
+QMAKE_DEL_FILE = rm -rf
+
+SOURCES += \
+	$$PWD/tst_caps.cpp
@@ -0,0 +1,108 @@
+/*
+ * tst_caps.cpp - Entity capabilities verification string test
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "xmpp-ext/dataform.h"
+#include "xmpp-ext/servicediscovery.h"
+
+#include <QDomDocument>
+#include <QtTest>
+
+using namespace XMPP;
+
+/**
+ * Checks DiscoInfo::capsVerification() against the examples of XEP-0115.
+ */
+class TestCaps : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void simpleGeneration();
+        void complexGeneration();
+        void identityLang();
+};
+
+static DataForm::Field form_field(const QString& name, const QStringList& values,
+        DataForm::Field::FieldType type = DataForm::Field::TextSingle)
+{
+    DataForm::Field field(name, type);
+    QStringListIterator vi(values);
+    while ( vi.hasNext() ) {
+        field.addValue( vi.next() );
+    }
+    return field;
+}
+
+/* XEP-0115 5.2 Simple Generation Example */
+void TestCaps::simpleGeneration()
+{
+    DiscoInfo info;
+    info << DiscoInfo::Identity("client", "pc", "Exodus 0.9.1");
+    info << "http://jabber.org/protocol/disco#info"
+         << "http://jabber.org/protocol/disco#items"
+         << "http://jabber.org/protocol/muc"
+         << "http://jabber.org/protocol/caps";
+
+    QCOMPARE( info.capsVerification(), QString("QgayPKawpkPSDYmwT/WM94uAlu0=") );
+}
+
+/* XEP-0115 5.3 Complex Generation Example */
+void TestCaps::complexGeneration()
+{
+    DataForm form;
+    form.setType(DataForm::Result);
+    form << form_field( "FORM_TYPE", QStringList() << "urn:xmpp:dataforms:softwareinfo", DataForm::Field::Hidden );
+    form << form_field( "ip_version", QStringList() << "ipv4" << "ipv6", DataForm::Field::TextMulti );
+    form << form_field( "os", QStringList() << "Mac" );
+    form << form_field( "os_version", QStringList() << "10.5.1" );
+    form << form_field( "software", QStringList() << "Psi" );
+    form << form_field( "software_version", QStringList() << "0.11" );
+
+    DiscoInfo info;
+    info << DiscoInfo::Identity("client", "pc", "Psi 0.11", "en");
+    info << DiscoInfo::Identity("client", "pc", QString::fromUtf8("\xce\xa8 0.11"), "el");
+    info << "http://jabber.org/protocol/disco#items"
+         << "http://jabber.org/protocol/caps"
+         << "http://jabber.org/protocol/disco#info"
+         << "http://jabber.org/protocol/muc";
+    info << form;
+
+    QCOMPARE( info.capsVerification(), QString("q07IKJEyjvHSyhy//CH0CxmKi8w=") );
+}
+
+void TestCaps::identityLang()
+{
+    DiscoInfo info;
+    info << DiscoInfo::Identity("client", "pc", "Psi 0.11", "en");
+
+    QDomDocument doc;
+    QDomElement query = doc.createElementNS(NS_QUERY_DISCO_INFO, "query");
+    doc.appendChild(query);
+    info.pushToDomElement(query);
+
+    QDomElement identity = query.firstChildElement("identity");
+    QCOMPARE( identity.attribute("xml:lang"), QString("en") );
+    QCOMPARE( identity.attribute("name"), QString("Psi 0.11") );
+}
+
+QTEST_MAIN(TestCaps)
+#include "tst_caps.moc"
+
+// vim:ts=4:sw=4:et:nowrap
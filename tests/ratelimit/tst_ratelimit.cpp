@@ -0,0 +1,214 @@
+/*
+ * tst_ratelimit.cpp - OSCAR rate limiter test
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "types/icqRateClass.h"
+#include "types/icqRateClock.h"
+#include "types/icqTlvChain.h"
+
+#include <QtTest>
+
+using namespace ICQ;
+
+/* parameters of the ICBM rate class announced by ICQ servers */
+static const qint64 WINDOW = 80;
+static const qint64 CLEAR_LEVEL = 2500;
+static const qint64 ALERT_LEVEL = 2000;
+static const qint64 LIMIT_LEVEL = 1500;
+static const qint64 DISCONNECT_LEVEL = 800;
+static const qint64 MAX_LEVEL = 6000;
+
+/* RateClass keeps this many msecs above the alert level */
+static const qint64 SAFETY_TIME = 50;
+static const qint64 THRESHOLD = ALERT_LEVEL + SAFETY_TIME;
+
+/**
+ * Drives RateClass with a manual clock and checks it against the OSCAR moving average
+ * NewLevel = ((Window - 1) * OldLevel + TimeDiff) / Window.
+ */
+class TestRateLimit : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void init();
+        void cleanup();
+
+        void clearLevel();
+        void alertLevel();
+        void limitLevel();
+        void disconnectRecover();
+        void presenceCoalescing();
+    private:
+        void send(qint64 timeDiff);
+
+        ManualRateClock *clock;
+        RateClass *rc;
+};
+
+/* level after a packet sent @a timeDiff msecs after the previous update */
+static qint64 nextLevel(qint64 level, qint64 timeDiff)
+{
+    return qMin( ( (WINDOW - 1) * level + timeDiff ) / WINDOW, MAX_LEVEL );
+}
+
+/* msecs to wait at @a level, @a elapsed msecs after the last update, to stay at the threshold */
+static qint64 expectedWait(qint64 level, qint64 elapsed)
+{
+    return qMax( WINDOW * THRESHOLD - (WINDOW - 1) * level - elapsed, qint64(0) );
+}
+
+void TestRateLimit::init()
+{
+    clock = new ManualRateClock(1000000);
+    rc = new RateClass(1);
+    rc->setClock(clock);
+    rc->setWindowSize(WINDOW)->setClearLevel(CLEAR_LEVEL)->setAlertLevel(ALERT_LEVEL)
+        ->setLimitLevel(LIMIT_LEVEL)->setDisconnectLevel(DISCONNECT_LEVEL)->setMaxLevel(MAX_LEVEL);
+}
+
+void TestRateLimit::cleanup()
+{
+    delete rc;
+    delete clock;
+}
+
+/* sends a packet @a timeDiff msecs after the previous one and checks the new level */
+void TestRateLimit::send(qint64 timeDiff)
+{
+    qint64 level = rc->currentLevel();
+    clock->advance(timeDiff);
+    rc->packetSent();
+    QCOMPARE( qint64( rc->currentLevel() ), nextLevel(level, timeDiff) );
+}
+
+/* far above the clear level nothing waits */
+void TestRateLimit::clearLevel()
+{
+    rc->setCurrentLevel(MAX_LEVEL);
+    QCOMPARE( rc->timeToNextSend(), 0 );
+
+    for ( int i = 0; i < 20; ++i ) {
+        QCOMPARE( rc->timeToNextSend(), 0 );
+        send(100);
+        QVERIFY( qint64( rc->currentLevel() ) > CLEAR_LEVEL );
+    }
+}
+
+/* a burst from the clear level is stopped right at the alert level plus safety time */
+void TestRateLimit::alertLevel()
+{
+    rc->setCurrentLevel(CLEAR_LEVEL);
+
+    int burst = 0;
+    while ( rc->timeToNextSend() == 0 ) {
+        send(0);
+        QVERIFY( qint64( rc->currentLevel() ) >= THRESHOLD );
+        ++burst;
+    }
+    QVERIFY( burst > 0 );
+
+    qint64 wait = expectedWait(rc->currentLevel(), 0);
+    QCOMPARE( qint64( rc->timeToNextSend() ), wait );
+
+    /* waiting time goes down with the clock */
+    clock->advance(wait - 1);
+    QCOMPARE( rc->timeToNextSend(), 1 );
+    clock->advance(1);
+    QCOMPARE( rc->timeToNextSend(), 0 );
+
+    rc->packetSent();
+    QCOMPARE( qint64( rc->currentLevel() ), THRESHOLD );
+}
+
+/* a sender which ignored the limiter gets below the limit level and is held until it's back at the alert level */
+void TestRateLimit::limitLevel()
+{
+    rc->setCurrentLevel(THRESHOLD);
+    while ( qint64( rc->currentLevel() ) >= LIMIT_LEVEL ) {
+        send(10);
+    }
+    QVERIFY( qint64( rc->currentLevel() ) > DISCONNECT_LEVEL );
+
+    qint64 wait = expectedWait(rc->currentLevel(), 0);
+    QCOMPARE( qint64( rc->timeToNextSend() ), wait );
+    QVERIFY( wait > THRESHOLD );
+
+    clock->advance(wait);
+    QCOMPARE( rc->timeToNextSend(), 0 );
+    rc->packetSent();
+    QCOMPARE( qint64( rc->currentLevel() ), THRESHOLD );
+}
+
+/* level reported by the server after a disconnect recovers after one long wait, idle time is capped by max level */
+void TestRateLimit::disconnectRecover()
+{
+    qint64 level = DISCONNECT_LEVEL - 100;
+    rc->setCurrentLevel(level);
+
+    qint64 wait = expectedWait(level, 0);
+    QCOMPARE( qint64( rc->timeToNextSend() ), wait );
+
+    clock->advance(wait / 2);
+    QCOMPARE( qint64( rc->timeToNextSend() ), expectedWait(level, wait / 2) );
+    clock->advance(wait - wait / 2);
+    QCOMPARE( rc->timeToNextSend(), 0 );
+    rc->packetSent();
+    QCOMPARE( qint64( rc->currentLevel() ), THRESHOLD );
+
+    /* ten idle minutes bring the level to its maximum */
+    send(600000);
+    QCOMPARE( qint64( rc->currentLevel() ), MAX_LEVEL );
+    QVERIFY( qint64( rc->currentLevel() ) > CLEAR_LEVEL );
+    QCOMPARE( rc->timeToNextSend(), 0 );
+}
+
+/* SNAC(02,04) with the given TLVs, each TLV holds @a value */
+static SnacBuffer* userInfoPacket(const QList<Word>& types, const QByteArray& value)
+{
+    TlvChain chain;
+    foreach (Word type, types) {
+        chain.addTlv(type, value);
+    }
+    return new SnacBuffer( 0x02, 0x04, chain.data() );
+}
+
+/* only a presence packet with the same TLVs replaces the queued one */
+void TestRateLimit::presenceCoalescing()
+{
+    rc->enqueue( userInfoPacket(QList<Word>() << 0x05, "caps"), spPresence );
+    rc->enqueue( userInfoPacket(QList<Word>() << 0x03 << 0x04, "away"), spPresence );
+    QCOMPARE( rc->queuedCount(), 2 );
+    QCOMPARE( rc->queueStats(spPresence).coalesced, quint64(0) );
+
+    rc->enqueue( userInfoPacket(QList<Word>() << 0x05, "new caps"), spPresence );
+    QCOMPARE( rc->queuedCount(), 2 );
+    QCOMPARE( rc->queueStats(spPresence).coalesced, quint64(1) );
+
+    SnacBuffer *caps = rc->dequeue();
+    QCOMPARE( TlvChain( caps->Buffer::data() ).getTlvData(0x05), QByteArray("new caps") );
+    delete caps;
+    delete rc->dequeue();
+    QCOMPARE( rc->queuedCount(), 0 );
+}
+
+QTEST_MAIN(TestRateLimit)
+#include "tst_ratelimit.moc"
+
+// vim:ts=4:sw=4:et:nowrap
@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# e2e-bench.sh - Runs the transport between oscar-sim and xmpp-sim and reports
+# login/message latencies, presences per second and memory per user.
+#
+# Usage: e2e-bench.sh [users] [duration] [message-rate]
+# Build qt-icq-transport, tools/oscar-sim and tools/xmpp-sim first.
+#
+
+USERS=${1:-1000}
+DURATION=${2:-120}
+MESSAGE_RATE=${3:-50}
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+TRANSPORT=${TRANSPORT:-$TOOLS/../qt-icq-transport}
+WORKDIR=$(mktemp -d /tmp/e2e-bench.XXXXXX)
+
+cat > "$WORKDIR/config.xml" <<CONFIG
+<?xml version="1.0" encoding="utf-8"?>
+<qt-icq-transport>
+	<database>$WORKDIR/users.db</database>
+	<log-file>$WORKDIR/transport.log</log-file>
+	<pid-file>$WORKDIR/transport.pid</pid-file>
+	<jabber-domain>icq.localhost</jabber-domain>
+	<jabber-secret>secret</jabber-secret>
+	<jabber-server>127.0.0.1</jabber-server>
+	<jabber-port>15555</jabber-port>
+	<icq-server>127.0.0.1</icq-server>
+	<icq-port>15190</icq-port>
+</qt-icq-transport>
+CONFIG
+
+ulimit -n 65536 2>/dev/null
+
+"$TOOLS/oscar-sim/oscar-sim" -port 15190 -roster 50 -presence-rate 0.05 > "$WORKDIR/oscar-sim.log" 2>&1 &
+OSCAR_PID=$!
+
+# -fork runs the transport itself without the restarting sandbox parent, so
+# $! is the process whose memory xmpp-sim samples
+"$TRANSPORT" -config-file "$WORKDIR/config.xml" -fork &
+TRANSPORT_PID=$!
+sleep 1
+
+"$TOOLS/xmpp-sim/xmpp-sim" -port 15555 -transport icq.localhost -users "$USERS" \
+    -duration "$DURATION" -message-rate "$MESSAGE_RATE" -presence-rate 5 -iq-rate 5 \
+    -pid "$TRANSPORT_PID" -record "$WORKDIR/stanzas.xml"
+
+kill $TRANSPORT_PID $OSCAR_PID 2>/dev/null
+wait 2>/dev/null
+echo "Logs and recorded stanzas are in $WORKDIR"
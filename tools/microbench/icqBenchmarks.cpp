@@ -0,0 +1,478 @@
+/*
+ * icqBenchmarks.cpp - Benchmarks of OSCAR protocol types
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "microbench.h"
+
+#include "metrics.h"
+#include "icqSocket.h"
+#include "managers/icqMessageManager.h"
+#include "managers/icqRateManager.h"
+
+#include "types/icqBuffer.h"
+#include "types/icqFlapBuffer.h"
+#include "types/icqGuid.h"
+#include "types/icqMessage.h"
+#include "types/icqRateClass.h"
+#include "types/icqRateClock.h"
+#include "types/icqSnacBuffer.h"
+#include "types/icqTlv.h"
+#include "types/icqTlvChain.h"
+#include "types/icqTypes.h"
+#include "types/icqUserInfo.h"
+
+#include <QIODevice>
+#include <QMetaObject>
+#include <QTextCodec>
+#include <QtTest>
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace ICQ;
+
+/* number of capabilities in the Capabilities table */
+static const int CAPABILITY_COUNT = sizeof(Capabilities) / sizeof(Capabilities[0]);
+
+/* 64 words, 64 dwords and 64 bytes */
+static QByteArray wordBlock()
+{
+    static QByteArray block;
+    if ( block.isEmpty() ) {
+        Buffer buffer;
+        for ( int i = 0; i < 64; ++i ) {
+            buffer.addWord(i);
+            buffer.addDWord(i * 65537);
+            buffer.addByte(i);
+        }
+        block = buffer.data();
+    }
+    return block;
+}
+
+/* ten TLVs of 0..90 bytes, like in a login or presence packet */
+static QByteArray tlvBlock()
+{
+    static QByteArray block;
+    if ( block.isEmpty() ) {
+        TlvChain chain;
+        for ( int i = 0; i < 10; ++i ) {
+            chain.addTlv( i + 1, QByteArray(i * 10, 'a' + i) );
+        }
+        block = chain.data();
+    }
+    return block;
+}
+
+/* user info block of SNAC(03,0B) sent by a typical client */
+static QByteArray userInfoBlock()
+{
+    static QByteArray block;
+    if ( block.isEmpty() ) {
+        Buffer caps;
+        for ( int i = 0; i < 12; ++i ) {
+            caps.addData( Capabilities[i % CAPABILITY_COUNT].data() );
+        }
+        Buffer dc;
+        dc.addDWord(0xC0A80001).addDWord(0).addByte(4).addWord(9).addDWord(0x12345678).addDWord(0x50).addDWord(0x4A000000);
+
+        TlvChain chain;
+        chain.addTlv( 0x01, Buffer().addDWord(0x50).data() );
+        chain.addTlv( 0x03, Buffer().addDWord(1250000000).data() );
+        chain.addTlv( 0x05, Buffer().addDWord(1100000000).data() );
+        chain.addTlv( 0x06, Buffer().addWord(0x0002).addWord(0x0001).data() );
+        chain.addTlv( 0x0A, Buffer().addDWord(0x0A000001).data() );
+        chain.addTlv( 0x0C, dc.data() );
+        chain.addTlv( 0x0D, caps.data() );
+
+        QString uin("123456789");
+        Buffer buffer;
+        buffer.addByte( uin.length() );
+        buffer.addData(uin);
+        buffer.addWord(0);
+        buffer.addWord( chain.list().size() );
+        buffer.addData( chain.data() );
+        block = buffer.data();
+    }
+    return block;
+}
+
+/* raw FLAP with SNAC(04,07) */
+static QByteArray snacBlock()
+{
+    static QByteArray block;
+    if ( block.isEmpty() ) {
+        SnacBuffer snac(0x04, 0x07);
+        snac.setRequestId(0x80001234);
+        snac.addData( QByteArray(8, 'c') );
+        snac.addWord(1);
+        snac.addData( tlvBlock() );
+        block = snac.data();
+    }
+    return block;
+}
+
+/* raw FLAP with SNAC(04,07): channel 1 message with the fixed user info TLVs of a contact */
+static QByteArray incomingIcbmBlock()
+{
+    static QByteArray block;
+    if ( block.isEmpty() ) {
+        QByteArray text("Hello, how are you? This is a message of average length.");
+        Buffer data;
+        data.addByte(0x05).addByte(0x01).addWord(1).addByte(0x01); // capabilities fragment
+        data.addByte(0x01).addByte(0x01).addWord( 4 + text.size() ); // text fragment
+        data.addWord(0x0000).addWord(0x0000);
+        data.addData(text);
+
+        QString uin("987654321");
+        SnacBuffer snac(0x04, 0x07);
+        snac.setRequestId(0x80001234);
+        snac.addData( QByteArray("\x01\x02\x03\x04\x05\x06\x07\x08", 8) );
+        snac.addWord(1);
+        snac.addByte( uin.length() );
+        snac.addData(uin);
+        snac.addWord(0); // warning level
+
+        TlvChain fixed;
+        fixed.addTlv( 0x01, Buffer().addWord(0x50).data() ); // user class
+        fixed.addTlv( 0x06, Buffer().addDWord(0).data() ); // online status
+        fixed.addTlv( 0x0F, Buffer().addDWord(0).data() ); // idle time
+        snac.addWord( fixed.list().size() );
+        snac.addData( fixed.data() );
+
+        TlvChain chain;
+        chain.addTlv( 0x02, data.data() );
+        snac.addData( chain.data() );
+        block = snac.data();
+    }
+    return block;
+}
+
+/* messages sent or received by one iteration of the ICBM rate benchmarks */
+static const int ICBM_BATCH_SIZE = 1000;
+
+/* packets queued and drained by one iteration of the rate queue benchmark */
+static const int RATE_BATCH_SIZE = 100;
+
+/* device which plays the role of a TCP connection: fed data is read, written data is discarded */
+class BenchDevice : public QIODevice
+{
+    public:
+        BenchDevice()
+        {
+            open(QIODevice::ReadWrite);
+        }
+
+        /* readyRead() is emitted synchronously, so the data is processed when the call returns */
+        void feed(const QByteArray& data)
+        {
+            m_buffer += data;
+            emit readyRead();
+        }
+
+        bool isSequential() const
+        {
+            return true;
+        }
+
+        qint64 bytesAvailable() const
+        {
+            return m_buffer.size() + QIODevice::bytesAvailable();
+        }
+    protected:
+        qint64 readData(char *data, qint64 maxSize)
+        {
+            int size = qMin( qint64( m_buffer.size() ), maxSize );
+            memcpy( data, m_buffer.constData(), size );
+            m_buffer.remove(0, size);
+            return size;
+        }
+
+        qint64 writeData(const char *data, qint64 maxSize)
+        {
+            Q_UNUSED(data);
+            benchSink += maxSize;
+            return maxSize;
+        }
+    private:
+        QByteArray m_buffer;
+};
+
+/* message with a fixed cookie, so acks pending in the manager don't pile up */
+static Message icbmMessage(Byte channel)
+{
+    Message msg;
+    msg.setChannel(channel);
+    msg.setIcbmCookie( QByteArray("\x01\x02\x03\x04\x05\x06\x07\x08", 8) );
+    msg.setReceiver("123456789");
+    msg.setText("Hello, how are you? This is a message of average length.");
+    return msg;
+}
+
+/* serializes a message through the manager and the socket, as when relaying from XMPP */
+static void icbmSerialize(Byte channel)
+{
+    BenchDevice device;
+    Socket socket;
+    socket.setIODevice(&device);
+    MessageManager manager(&socket);
+    manager.setTextCodec( QTextCodec::codecForName("cp1251") );
+
+    Message msg = icbmMessage(channel);
+    QBENCHMARK {
+        benchSink += manager.sendMessage(msg).size();
+    }
+}
+
+static void reportRate(const char *path, qint64 usecs)
+{
+    qDebug( "%s: %d messages in %lld usecs, %.0f messages/s", path, ICBM_BATCH_SIZE, usecs,
+            ICBM_BATCH_SIZE * 1000000.0 / qMax( usecs, qint64(1) ) );
+}
+
+/**
+ * Relays batches of messages to ICQ: MessageManager::sendMessage, SNAC(04,06)
+ * serialization and the socket write. QTestLib reports time per batch, the
+ * rate of one more batch is printed with qDebug.
+ */
+void MicroBench::icbmSendRate()
+{
+    BenchDevice device;
+    Socket socket;
+    socket.setIODevice(&device);
+    MessageManager manager(&socket);
+    manager.setTextCodec( QTextCodec::codecForName("cp1251") );
+
+    Message msg = icbmMessage(0x01);
+    QBENCHMARK {
+        for ( int i = 0; i < ICBM_BATCH_SIZE; ++i ) {
+            benchSink += manager.sendMessage(msg).size();
+        }
+    }
+
+    qint64 start = Instrument::monotonicUsecs();
+    for ( int i = 0; i < ICBM_BATCH_SIZE; ++i ) {
+        benchSink += manager.sendMessage(msg).size();
+    }
+    reportRate( "send", Instrument::monotonicUsecs() - start );
+}
+
+/**
+ * Receives batches of SNAC(04,07) through the socket device: readyRead drives
+ * Socket::processIncomingData, which dispatches to the message manager.
+ */
+void MicroBench::icbmReceiveRate()
+{
+    BenchDevice device;
+    Socket socket;
+    socket.setIODevice(&device);
+    MessageManager manager(&socket);
+    manager.setTextCodec( QTextCodec::codecForName("cp1251") );
+
+    QByteArray block = incomingIcbmBlock();
+    QBENCHMARK {
+        for ( int i = 0; i < ICBM_BATCH_SIZE; ++i ) {
+            device.feed(block);
+        }
+    }
+
+    qint64 start = Instrument::monotonicUsecs();
+    for ( int i = 0; i < ICBM_BATCH_SIZE; ++i ) {
+        device.feed(block);
+    }
+    reportRate( "receive", Instrument::monotonicUsecs() - start );
+}
+
+static void dropDebugMessages(QtMsgType type, const char *msg)
+{
+    if ( type != QtDebugMsg ) {
+        fprintf(stderr, "%s\n", msg);
+    }
+}
+
+/**
+ * Queues messages in a rate limited ICBM class and drains the queue with RateManager's
+ * timer slot. A manual clock is moved to the next send time, so nothing sleeps.
+ */
+void MicroBench::rateQueueDrain()
+{
+    ManualRateClock clock;
+    BenchDevice device;
+    Socket socket;
+    socket.setIODevice(&device);
+    RateManager manager(&socket);
+    manager.setClock(&clock);
+
+    RateClass *rc = new RateClass(1);
+    rc->addMember(0x04, 0x06);
+    rc->setWindowSize(80)->setClearLevel(2500)->setAlertLevel(2000)->setLimitLevel(1500)->setMaxLevel(6000);
+    manager.addClass(rc);
+    rc->setCurrentLevel(2000);
+
+    SnacBuffer snac( 0x04, 0x06, tlvBlock() );
+    /* RateManager logs every queued packet */
+    QtMsgHandler handler = qInstallMsgHandler(dropDebugMessages);
+    QBENCHMARK {
+        for ( int i = 0; i < RATE_BATCH_SIZE; ++i ) {
+            socket.write(snac, spInteractive);
+        }
+        while ( rc->queuedCount() > 0 ) {
+            clock.advance( rc->timeToNextSend() );
+            QMetaObject::invokeMethod(&manager, "sendQueued");
+        }
+        /* start every batch from the alert level */
+        rc->setCurrentLevel(2000);
+    }
+    qInstallMsgHandler(handler);
+}
+
+void MicroBench::bufferAddWords()
+{
+    QBENCHMARK {
+        Buffer buffer;
+        for ( int i = 0; i < 64; ++i ) {
+            buffer.addWord(i);
+            buffer.addDWord(i);
+            buffer.addByte(i);
+        }
+        benchSink += buffer.size();
+    }
+}
+
+void MicroBench::bufferGetWords()
+{
+    Buffer buffer( wordBlock() );
+    QBENCHMARK {
+        buffer.seek(0);
+        quint64 sum = 0;
+        for ( int i = 0; i < 64; ++i ) {
+            sum += buffer.getWord();
+            sum += buffer.getDWord();
+            sum += buffer.getByte();
+        }
+        benchSink += sum;
+    }
+}
+
+void MicroBench::tlvFromBuffer()
+{
+    Buffer buffer( tlvBlock() );
+    QBENCHMARK {
+        buffer.seek(0);
+        while ( !buffer.atEnd() ) {
+            benchSink += Tlv::fromBuffer(buffer).type();
+        }
+    }
+}
+
+void MicroBench::tlvChainParse()
+{
+    QByteArray block = tlvBlock();
+    QBENCHMARK {
+        TlvChain chain(block);
+        benchSink += chain.list().size();
+    }
+}
+
+void MicroBench::tlvChainSerialize()
+{
+    TlvChain chain( tlvBlock() );
+    QBENCHMARK {
+        benchSink += chain.data().size();
+    }
+}
+
+void MicroBench::userInfoFromBuffer()
+{
+    Buffer buffer( userInfoBlock() );
+    QBENCHMARK {
+        buffer.seek(0);
+        benchSink += UserInfo::fromBuffer(buffer).capabilities().size();
+    }
+}
+
+void MicroBench::userInfoMergeFrom()
+{
+    Buffer buffer( userInfoBlock() );
+    UserInfo update = UserInfo::fromBuffer(buffer);
+    UserInfo info;
+    QBENCHMARK {
+        info.mergeFrom(update);
+        benchSink += info.onlineStatus();
+    }
+}
+
+/* checks every known capability, as done when a contact comes online */
+void MicroBench::guidCapabilityScan()
+{
+    Buffer buffer( userInfoBlock() );
+    UserInfo info = UserInfo::fromBuffer(buffer);
+    QBENCHMARK {
+        int found = 0;
+        for ( int i = 0; i < CAPABILITY_COUNT; ++i ) {
+            found += info.hasCapability(i);
+        }
+        benchSink += found;
+    }
+}
+
+/* prefix match of client identification capabilities */
+void MicroBench::guidIsEqualPrefix()
+{
+    Buffer buffer( userInfoBlock() );
+    QList<Guid> caps = UserInfo::fromBuffer(buffer).capabilities();
+    QBENCHMARK {
+        int found = 0;
+        foreach (const Guid& cap, caps) {
+            for ( int i = ccKopete; i < CAPABILITY_COUNT; ++i ) {
+                found += cap.isEqual(Capabilities[i], 12);
+            }
+        }
+        benchSink += found;
+    }
+}
+
+void MicroBench::snacParse()
+{
+    QByteArray block = snacBlock();
+    QBENCHMARK {
+        SnacBuffer snac = FlapBuffer::fromRawData(block);
+        benchSink += snac.family() + snac.subtype() + snac.requestId() + snac.dataSize();
+    }
+}
+
+void MicroBench::snacSerialize()
+{
+    SnacBuffer snac = FlapBuffer::fromRawData( snacBlock() );
+    QBENCHMARK {
+        benchSink += snac.data().size();
+    }
+}
+
+void MicroBench::icbmChannel1Serialize()
+{
+    icbmSerialize(0x01);
+}
+
+void MicroBench::icbmChannel2Serialize()
+{
+    icbmSerialize(0x02);
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,35 @@
+/*
+ * main.cpp - Microbenchmarks of protocol types
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "microbench.h"
+
+#include <QTextCodec>
+#include <QtTest>
+
+volatile quint64 benchSink = 0;
+
+void MicroBench::initTestCase()
+{
+    QTextCodec::setCodecForCStrings( QTextCodec::codecForName("UTF-8") );
+}
+
+QTEST_MAIN(MicroBench)
+
+// vim:et:ts=4:sw=4:nowrap
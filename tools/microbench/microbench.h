@@ -0,0 +1,68 @@
+/*
+ * microbench.h - Microbenchmarks of protocol types
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef MICROBENCH_H_
+#define MICROBENCH_H_
+
+#include <QObject>
+
+/* results are accumulated here, so the compiler can't drop benchmarked code */
+extern volatile quint64 benchSink;
+
+/**
+ * QTestLib benchmarks. OSCAR benchmarks are implemented in icqBenchmarks.cpp,
+ * XMPP ones in xmppBenchmarks.cpp.
+ */
+class MicroBench : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void initTestCase();
+
+        void bufferAddWords();
+        void bufferGetWords();
+        void tlvFromBuffer();
+        void tlvChainParse();
+        void tlvChainSerialize();
+        void userInfoFromBuffer();
+        void userInfoMergeFrom();
+        void guidCapabilityScan();
+        void guidIsEqualPrefix();
+        void snacParse();
+        void snacSerialize();
+        void icbmChannel1Serialize();
+        void icbmChannel2Serialize();
+        void icbmSendRate();
+        void icbmReceiveRate();
+        void rateQueueDrain();
+
+        void jidSet();
+        void jidSetUnique();
+        void jidSetMemory();
+        void jidBare();
+        void parserStanzaCorpus();
+        void messageToString();
+        void presenceToString();
+        void capsVerification();
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* MICROBENCH_H_ */
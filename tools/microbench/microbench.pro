@@ -0,0 +1,24 @@
+TARGET = microbench
+TEMPLATE = app
+
+include(../../common.pri)
+include(../../icq/icq.pri)
+include(../../shark/shark.pri)
+
+CONFIG += qtestlib
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+QMAKE_DISTCLEAN += \
+	$$PWD/.moc \
+	$$PWD/.obj
+
+QMAKE_DEL_FILE = rm -rf
+
+HEADERS += \
+	$$PWD/microbench.h
+SOURCES += \
+	$$PWD/icqBenchmarks.cpp \
+	$$PWD/main.cpp \
+	$$PWD/xmppBenchmarks.cpp
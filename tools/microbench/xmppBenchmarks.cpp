@@ -0,0 +1,269 @@
+/*
+ * xmppBenchmarks.cpp - Benchmarks of XMPP types and parser
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "microbench.h"
+
+#include "xmpp-core/jid.h"
+#include "xmpp-core/message.h"
+#include "xmpp-core/parser.h"
+#include "xmpp-core/presence.h"
+#include "xmpp-ext/dataform.h"
+#include "xmpp-ext/servicediscovery.h"
+
+#include <QByteArray>
+#include <QStringList>
+#include <QtTest>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace XMPP;
+
+static const char streamHeader[] =
+    "<stream:stream xmlns='jabber:component:accept' xmlns:stream='http://etherx.jabber.org/streams' "
+    "from='icq.example.org' id='3BF96D32'>";
+
+/* stanzas the transport typically receives from the server */
+static const char *stanzaCorpus[] = {
+    "<message from='user@example.org/home' to='123456789@icq.example.org' type='chat' id='m1'>"
+        "<body>Hello, how are you? This is a message of average length.</body>"
+        "<active xmlns='http://jabber.org/protocol/chatstates'/></message>",
+    "<presence from='user@example.org/home' to='icq.example.org'><show>away</show>"
+        "<status>Out for lunch</status><priority>5</priority>"
+        "<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://psi-im.org/caps' ver='q07IKJEyjvHSyhy//CH0CxmKi8w='/></presence>",
+    "<iq from='user@example.org/home' to='icq.example.org' type='get' id='disco1'>"
+        "<query xmlns='http://jabber.org/protocol/disco#info'/></iq>",
+    "<iq from='user@example.org/home' to='987654321@icq.example.org' type='get' id='vc1'>"
+        "<vCard xmlns='vcard-temp'/></iq>",
+    "<presence from='user@example.org/home' to='987654321@icq.example.org' type='subscribed'/>"
+};
+static const int STANZA_CORPUS_SIZE = sizeof(stanzaCorpus) / sizeof(stanzaCorpus[0]);
+
+/* local parts and resources of the jid corpus, in mixed case as typed by users */
+static const char *jidUsers[] = { "john.smith", "Alice", "bob_1983", "MARIA.k", "dev-null", "ivan.petrov" };
+static const char *jidDomains[] = { "jabber.org", "Example.COM", "gmail.com", "jabber.ru", "xmpp.example.net" };
+static const char *jidResources[] = { "", "Home", "Psi+", "gajim.A1B2C3", "Miranda IM", "android-5f3e",
+    "\xd0\x94\xd0\xbe\xd0\xbc" };
+
+/* more unique jids than the stringprep cache of Jid keeps, so every pass evicts */
+static const int UNIQUE_JID_CORPUS_SIZE = 16384;
+
+/**
+ * Jids the transport sees in a session: contacts' legacy jids, users' full jids with
+ * various resources and domains, and the bare gateway domain.
+ */
+static QStringList jidCorpus()
+{
+    static QStringList corpus;
+    if ( !corpus.isEmpty() ) {
+        return corpus;
+    }
+
+    static const int users = sizeof(jidUsers) / sizeof(jidUsers[0]);
+    static const int domains = sizeof(jidDomains) / sizeof(jidDomains[0]);
+    static const int resources = sizeof(jidResources) / sizeof(jidResources[0]);
+    for ( int i = 0; i < 256; ++i ) {
+        switch ( i % 4 ) {
+            case 0:
+            case 1:
+                corpus << QString("%1@icq.example.org").arg(100000000 + i * 7919);
+                break;
+            case 2: {
+                QString jid = QString("%1@%2").arg( jidUsers[i % users] ).arg( jidDomains[i % domains] );
+                QString resource = QString::fromUtf8( jidResources[i % resources] );
+                corpus << ( resource.isEmpty() ? jid : jid + '/' + resource );
+                break;
+            }
+            default:
+                corpus << ( i % 8 == 3 ? QString("icq.example.org") : QString("%1@icq.example.org/Registered").arg(200000000 + i) );
+        }
+    }
+    return corpus;
+}
+
+/* one iteration parses the whole jid corpus */
+void MicroBench::jidSet()
+{
+    QStringList corpus = jidCorpus();
+    Jid jid;
+    QBENCHMARK {
+        QStringListIterator i(corpus);
+        while ( i.hasNext() ) {
+            jid.set( i.next() );
+            benchSink += jid.bare().length();
+        }
+    }
+}
+
+/**
+ * Jids which are never seen twice, like resources of many users reconnecting:
+ * an ASCII half handled without libidn and a half with non-ASCII nodes and
+ * resources, which goes through the stringprep cache.
+ */
+static QStringList uniqueJidCorpus()
+{
+    static QStringList corpus;
+    if ( !corpus.isEmpty() ) {
+        return corpus;
+    }
+
+    for ( int i = 0; i < UNIQUE_JID_CORPUS_SIZE; ++i ) {
+        switch ( i % 4 ) {
+            case 0:
+                corpus << QString("user%1@example.org/gajim.%2").arg(i).arg(i * 40503, 8, 16, QChar('0'));
+                break;
+            case 1:
+                corpus << QString("%1@icq.example.org/Registered").arg(100000000 + i);
+                break;
+            case 2:
+                corpus << QString::fromUtf8("user%1@jabber.ru/\xd0\x9d\xd0\xbe\xd1\x83\xd1\x82 %2").arg(i).arg(i);
+                break;
+            default:
+                corpus << QString::fromUtf8("\xd0\x98\xd0\xb2\xd0\xb0\xd0\xbd%1@jabber.ru/Psi+").arg(i);
+        }
+    }
+    return corpus;
+}
+
+/* one iteration parses the whole unique corpus, so cached results are evicted */
+void MicroBench::jidSetUnique()
+{
+    QStringList corpus = uniqueJidCorpus();
+    Jid jid;
+    QBENCHMARK {
+        QStringListIterator i(corpus);
+        while ( i.hasNext() ) {
+            jid.set( i.next() );
+            benchSink += jid.bare().length();
+        }
+    }
+}
+
+/**
+ * Heap retained by Jid::set after a pass over the unique corpus, i.e. the memory
+ * held by the stringprep cache. Reported with qDebug, QTestLib has no memory metric.
+ */
+void MicroBench::jidSetMemory()
+{
+#ifdef __GLIBC__
+    QStringList corpus = uniqueJidCorpus();
+    Jid jid;
+    for ( int pass = 1; pass <= 2; ++pass ) {
+        struct mallinfo before = mallinfo();
+        QStringListIterator i(corpus);
+        while ( i.hasNext() ) {
+            jid.set( i.next() );
+        }
+        jid = Jid();
+        struct mallinfo after = mallinfo();
+
+        qint64 retained = qint64(after.uordblks) - before.uordblks;
+        qDebug( "pass %d: %d unique jids, %lld bytes retained, %.1f bytes per jid",
+                pass, corpus.size(), retained, double(retained) / corpus.size() );
+    }
+#else
+    QSKIP("mallinfo() is available with glibc only", SkipAll);
+#endif
+}
+
+void MicroBench::jidBare()
+{
+    Jid jid("username@example.org/resource");
+    QBENCHMARK {
+        benchSink += jid.bare().length();
+    }
+}
+
+/* one iteration parses the whole corpus, opening a new stream each time */
+void MicroBench::parserStanzaCorpus()
+{
+    QByteArray data(streamHeader);
+    for ( int i = 0; i < STANZA_CORPUS_SIZE; ++i ) {
+        data += stanzaCorpus[i];
+    }
+
+    QBENCHMARK {
+        Parser parser;
+        parser.appendData(data);
+        int events = 0;
+        Parser::Event event = parser.readNext();
+        while ( !event.isNull() ) {
+            ++events;
+            event = parser.readNext();
+        }
+        benchSink += events;
+    }
+}
+
+void MicroBench::messageToString()
+{
+    Message msg;
+    msg.setType(Message::Chat);
+    msg.setFrom( Jid("123456789@icq.example.org") );
+    msg.setTo( Jid("user@example.org/home") );
+    msg.setBody("Hello, how are you? This is a message of average length.");
+    QBENCHMARK {
+        benchSink += msg.toString().length();
+    }
+}
+
+void MicroBench::presenceToString()
+{
+    Presence presence( Presence::Available, Jid("123456789@icq.example.org"), Jid("user@example.org"), Presence::Away );
+    presence.setStatus("Out for lunch");
+    QBENCHMARK {
+        benchSink += presence.toString().length();
+    }
+}
+
+static DataForm::Field formField(const QString& name, const QString& value, DataForm::Field::FieldType type = DataForm::Field::TextSingle)
+{
+    DataForm::Field field(name, type);
+    field.addValue(value);
+    return field;
+}
+
+/* entity capabilities of a client with two identities and a software info form (XEP-0115 5.3) */
+void MicroBench::capsVerification()
+{
+    DataForm form;
+    form.setType(DataForm::Result);
+    form << formField( "FORM_TYPE", "urn:xmpp:dataforms:softwareinfo", DataForm::Field::Hidden );
+    form << formField( "os", "Mac" );
+    form << formField( "os_version", "10.5.1" );
+    form << formField( "software", "Psi" );
+    form << formField( "software_version", "0.11" );
+
+    DiscoInfo info;
+    info << DiscoInfo::Identity("client", "pc", "Psi 0.11", "en");
+    info << DiscoInfo::Identity("client", "pc", QString::fromUtf8("\xce\xa8 0.11"), "el");
+    info << "http://jabber.org/protocol/disco#items"
+         << "http://jabber.org/protocol/caps"
+         << "http://jabber.org/protocol/disco#info"
+         << "http://jabber.org/protocol/muc";
+    info << form;
+
+    QBENCHMARK {
+        benchSink += info.capsVerification().length();
+    }
+}
+
+// vim:et:ts=4:sw=4:nowrap
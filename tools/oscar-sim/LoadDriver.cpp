@@ -0,0 +1,216 @@
+/*
+ * LoadDriver.cpp - Drives many ICQ sessions against the simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "LoadDriver.h"
+
+#include "icqSession.h"
+
+#include <QList>
+#include <QTextCodec>
+#include <QTimer>
+#include <QtDebug>
+
+static const int DRIVER_TICK_INTERVAL = 100;
+static const int DRIVER_REPORT_INTERVAL = 10000;
+
+class LoadDriver::Private
+{
+    public:
+        QString host;
+        quint16 port;
+        uint firstUin;
+        int loginRate;
+        double messageRate;
+        double messageCredit;
+
+        int total;
+        QList<ICQ::Session*> sessions;
+        QList<ICQ::Session*> online;
+
+        QTimer loginTimer;
+        QTimer messageTimer;
+        QTimer reportTimer;
+
+        quint64 errors;
+        quint64 disconnects;
+        quint64 sent;
+        quint64 received;
+};
+
+/**
+ * @class LoadDriver
+ * @brief Logs in a number of ICQ::Session objects and makes them talk to each other.
+ *
+ * Sessions are logged in at a fixed rate, so the login path is loaded the same way
+ * as after a transport restart. Online sessions send messages to random other sessions.
+ */
+
+LoadDriver::LoadDriver(QObject *parent)
+    : QObject(parent)
+{
+    d = new Private;
+    d->host = "127.0.0.1";
+    d->port = 5190;
+    d->firstUin = 100000;
+    d->loginRate = 50;
+    d->messageRate = 0;
+    d->messageCredit = 0;
+    d->total = 0;
+    d->errors = 0;
+    d->disconnects = 0;
+    d->sent = 0;
+    d->received = 0;
+
+    QObject::connect( &d->loginTimer, SIGNAL( timeout() ), SLOT( loginNext() ) );
+    QObject::connect( &d->messageTimer, SIGNAL( timeout() ), SLOT( sendMessages() ) );
+    QObject::connect( &d->reportTimer, SIGNAL( timeout() ), SLOT( report() ) );
+}
+
+LoadDriver::~LoadDriver()
+{
+    qDeleteAll(d->sessions);
+    delete d;
+}
+
+/**
+ * Sets server address, it must be an IP address.
+ */
+void LoadDriver::setServer(const QString& host, quint16 port)
+{
+    d->host = host;
+    d->port = port;
+}
+
+void LoadDriver::setFirstUin(uint uin)
+{
+    d->firstUin = uin;
+}
+
+void LoadDriver::setLoginRate(int perSecond)
+{
+    d->loginRate = qMax(perSecond, 1);
+}
+
+/**
+ * Sets number of messages per second sent by all the sessions together.
+ */
+void LoadDriver::setMessageRate(double perSecond)
+{
+    d->messageRate = qMax(perSecond, 0.0);
+}
+
+/**
+ * Starts logging in @a sessions sessions.
+ */
+void LoadDriver::start(int sessions)
+{
+    d->total = sessions;
+    d->loginTimer.start( qMax(1000 / d->loginRate, 1) );
+    d->messageTimer.start(DRIVER_TICK_INTERVAL);
+    d->reportTimer.start(DRIVER_REPORT_INTERVAL);
+}
+
+void LoadDriver::loginNext()
+{
+    if ( d->sessions.size() >= d->total ) {
+        d->loginTimer.stop();
+        return;
+    }
+
+    ICQ::Session *session = new ICQ::Session(this);
+    session->setUin( QString::number( d->firstUin + d->sessions.size() ) );
+    session->setPassword("password");
+    session->setServerHost(d->host);
+    session->setServerPort(d->port);
+    session->setCodecForMessages( QTextCodec::codecForName("windows-1251") );
+
+    QObject::connect( session, SIGNAL( connected() ), SLOT( processConnected() ) );
+    QObject::connect( session, SIGNAL( disconnected() ), SLOT( processDisconnected() ) );
+    QObject::connect( session, SIGNAL( error(QString) ), SLOT( processError(QString) ) );
+    QObject::connect( session, SIGNAL( incomingMessage(QString,QString) ), SLOT( processIncomingMessage(QString,QString) ) );
+
+    d->sessions << session;
+    session->connect();
+}
+
+void LoadDriver::sendMessages()
+{
+    if ( d->online.size() < 2 ) {
+        return;
+    }
+    d->messageCredit += d->messageRate * DRIVER_TICK_INTERVAL / 1000.0;
+    while ( d->messageCredit >= 1 ) {
+        d->messageCredit -= 1;
+        ICQ::Session *sender = d->online.at( qrand() % d->online.size() );
+        ICQ::Session *recipient = d->online.at( qrand() % d->online.size() );
+        if ( sender == recipient ) {
+            continue;
+        }
+        sender->sendMessage( recipient->uin(), "Load test message " + QString::number(++d->sent) );
+    }
+}
+
+void LoadDriver::report()
+{
+    int queued = 0;
+    int unacked = 0;
+    quint64 acked = 0;
+    foreach (ICQ::Session *session, d->online) {
+        ICQ::Session::MessageStats stats = session->messageStats();
+        queued += stats.queued;
+        unacked += stats.unacked;
+        acked += stats.acked;
+    }
+    qDebug() << "[Driver]" << d->online.size() << "of" << d->sessions.size() << "sessions online,"
+        << d->errors << "errors," << d->disconnects << "disconnects,"
+        << d->sent << "sent," << d->received << "received,"
+        << queued << "queued," << unacked << "unacked," << acked << "acked";
+}
+
+void LoadDriver::processConnected()
+{
+    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
+    if ( session && !d->online.contains(session) ) {
+        d->online << session;
+    }
+}
+
+void LoadDriver::processDisconnected()
+{
+    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
+    d->online.removeOne(session);
+    ++d->disconnects;
+}
+
+void LoadDriver::processError(const QString& errorString)
+{
+    ICQ::Session *session = qobject_cast<ICQ::Session*>( sender() );
+    ++d->errors;
+    qDebug() << "[Driver]" << ( session ? session->uin() : QString() ) << "error:" << errorString;
+}
+
+void LoadDriver::processIncomingMessage(const QString& uin, const QString& message)
+{
+    Q_UNUSED(uin)
+    Q_UNUSED(message)
+    ++d->received;
+}
+
+// vim:et:ts=4:sw=4:nowrap
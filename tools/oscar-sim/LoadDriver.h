@@ -0,0 +1,55 @@
+/*
+ * LoadDriver.h - Drives many ICQ sessions against the simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef LOADDRIVER_H_
+#define LOADDRIVER_H_
+
+#include <QObject>
+
+class LoadDriver : public QObject
+{
+    Q_OBJECT
+
+    public:
+        LoadDriver(QObject *parent = 0);
+        ~LoadDriver();
+
+        void setServer(const QString& host, quint16 port);
+        void setFirstUin(uint uin);
+        void setLoginRate(int perSecond);
+        void setMessageRate(double perSecond);
+
+        void start(int sessions);
+    private slots:
+        void loginNext();
+        void sendMessages();
+        void report();
+
+        void processConnected();
+        void processDisconnected();
+        void processError(const QString& errorString);
+        void processIncomingMessage(const QString& uin, const QString& message);
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* LOADDRIVER_H_ */
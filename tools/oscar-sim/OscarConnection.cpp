@@ -0,0 +1,706 @@
+/*
+ * OscarConnection.cpp - Client connection to the OSCAR server simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "OscarConnection.h"
+#include "OscarServer.h"
+
+#include "types/icqFlapBuffer.h"
+#include "types/icqSnacBuffer.h"
+#include "types/icqTlv.h"
+#include "types/icqTlvChain.h"
+
+#include <QDateTime>
+#include <QTcpSocket>
+#include <QVector>
+#include <QtDebug>
+
+using namespace ICQ;
+
+/* roster contacts get uins starting from this one */
+static const uint SIM_CONTACT_UIN_BASE = 900000000;
+/* limits to keep SNACs well below the 64k FLAP size */
+static const int SIM_SSI_ITEMS_PER_SNAC = 200;
+static const int SIM_ARRIVALS_PER_SNAC = 50;
+
+static const Word SIM_STATUS_ONLINE = 0x0000;
+static const Word SIM_STATUS_AWAY   = 0x0001;
+
+class OscarConnection::Private
+{
+    public:
+        enum Stage { stageHello, stageAuth, stageBos, stageReady };
+
+        void sendFlap(FlapBuffer& flap);
+        void send(SnacBuffer& snac, DWord requestId = 0);
+        void sendMeta(Word type, Word sequence, const QByteArray& data);
+
+        QString contactUin(int index) const;
+        void addUserInfo(SnacBuffer& snac, const QString& uin, Word status);
+
+        void processHello(FlapBuffer& flap);
+        void processSnac(SnacBuffer& snac);
+
+        void sendAuthKey(SnacBuffer& snac);
+        void sendLoginReply(SnacBuffer& snac);
+        void sendFamilies();
+        void sendVersions(SnacBuffer& snac);
+        void sendRates(SnacBuffer& snac);
+        void sendSsiParameters(SnacBuffer& snac);
+        void sendRoster(SnacBuffer& snac);
+        void sendSsiAck(SnacBuffer& snac);
+        void sendOwnInfo(SnacBuffer& snac);
+        void sendArrivals();
+        void processMessage(SnacBuffer& snac);
+        void processMetaRequest(SnacBuffer& snac);
+
+        void toggleContact();
+        void sendContactMessage();
+
+        OscarConnection *q;
+        OscarServer *server;
+        QTcpSocket *socket;
+
+        Stage stage;
+        Word sequence;
+        QString uin;
+        QByteArray authKey;
+
+        /* presence of roster contacts, index is contact number */
+        QVector<bool> online;
+        double presenceCredit;
+        double messageCredit;
+        uint messageCount;
+};
+
+void OscarConnection::Private::sendFlap(FlapBuffer& flap)
+{
+    flap.setSequence(++sequence);
+    socket->write( flap.data() );
+}
+
+void OscarConnection::Private::send(SnacBuffer& snac, DWord requestId)
+{
+    snac.setRequestId(requestId);
+    sendFlap(snac);
+}
+
+/**
+ * Sends SNAC(15,03) - SRV_META_REPLY of @a type for request @a sequence.
+ */
+void OscarConnection::Private::sendMeta(Word type, Word sequence, const QByteArray& data)
+{
+    Tlv tlv(0x01);
+    tlv.addLEWord( data.size() + 8 );
+    tlv.addLEDWord( uin.toUInt() );
+    tlv.addLEWord(type);
+    tlv.addLEWord(sequence);
+    tlv.addData(data);
+
+    SnacBuffer snac(0x15, 0x03);
+    snac.addTlv(tlv);
+    send(snac);
+}
+
+QString OscarConnection::Private::contactUin(int index) const
+{
+    return QString::number(SIM_CONTACT_UIN_BASE + index);
+}
+
+/**
+ * Appends user info block (as in SNAC(03,0B)) of @a uin with online @a status.
+ */
+void OscarConnection::Private::addUserInfo(SnacBuffer& snac, const QString& uin, Word status)
+{
+    snac.addByte( uin.length() );
+    snac.addData(uin);
+    snac.addWord(0); // warning level
+    snac.addWord(3); // tlv count
+
+    Tlv classTlv(0x01);
+    classTlv.addWord(0x0050);
+    snac.addTlv(classTlv);
+
+    Tlv statusTlv(0x06);
+    statusTlv.addWord(0x0000); // status flags
+    statusTlv.addWord(status);
+    snac.addTlv(statusTlv);
+
+    Tlv signonTlv(0x03);
+    signonTlv.addDWord( QDateTime::currentDateTime().toTime_t() );
+    snac.addTlv(signonTlv);
+}
+
+/**
+ * Client's answer to the FLAP hello: version only on login stage, version with
+ * auth cookie on BOS stage.
+ */
+void OscarConnection::Private::processHello(FlapBuffer& flap)
+{
+    flap.getDWord(); // flap version
+    TlvChain chain = flap.readAll();
+    if ( !chain.hasTlv(0x06) ) {
+        stage = stageAuth;
+        return;
+    }
+
+    uin = server->takeCookie( chain.getTlvData(0x06) );
+    if ( uin.isEmpty() ) {
+        qDebug() << "[Sim]" << "Unknown auth cookie";
+        socket->disconnectFromHost();
+        return;
+    }
+    stage = stageBos;
+    server->addSession(q);
+    sendFamilies();
+}
+
+/* << SNAC(17,06) - CLI_AUTH_KEY_REQUEST
+ * >> SNAC(17,07) - SRV_AUTH_KEY_RESPONSE */
+void OscarConnection::Private::sendAuthKey(SnacBuffer& snac)
+{
+    TlvChain chain = snac.readAll();
+    uin = chain.getTlvData(0x01);
+
+    authKey = QByteArray::number( qrand() );
+
+    SnacBuffer reply(0x17, 0x07);
+    reply.addWord( authKey.size() );
+    reply.addData(authKey);
+    send( reply, snac.requestId() );
+}
+
+/* << SNAC(17,02) - CLI_MD5_LOGIN
+ * >> SNAC(17,03) - SRV_LOGIN_REPLY
+ * Any password is accepted. */
+void OscarConnection::Private::sendLoginReply(SnacBuffer& snac)
+{
+    snac.seekEnd();
+
+    QString bos = socket->localAddress().toString() + ":" + QString::number( socket->localPort() );
+
+    SnacBuffer reply(0x17, 0x03);
+    reply.addTlv(0x01, uin);
+    reply.addTlv(0x05, bos);
+    reply.addTlv( 0x06, server->issueCookie(uin) );
+    send( reply, snac.requestId() );
+}
+
+/* >> SNAC(01,03) - SRV_FAMILIES */
+void OscarConnection::Private::sendFamilies()
+{
+    SnacBuffer snac(0x01, 0x03);
+    snac.addWord(0x0001).addWord(0x0002).addWord(0x0003).addWord(0x0004);
+    snac.addWord(0x0009).addWord(0x0013).addWord(0x0015);
+    send(snac);
+}
+
+/* << SNAC(01,17) - CLI_FAMILIES_VERSIONS
+ * >> SNAC(01,18) - SRV_FAMILIES_VERSIONS */
+void OscarConnection::Private::sendVersions(SnacBuffer& snac)
+{
+    SnacBuffer reply(0x01, 0x18);
+    reply.addData( snac.readAll() );
+    send( reply, snac.requestId() );
+}
+
+/* << SNAC(01,06) - CLI_RATES_REQUEST
+ * >> SNAC(01,07) - SRV_RATE_LIMIT_INFO
+ * One class with the usual ICQ levels, covering all the families the client uses. */
+void OscarConnection::Private::sendRates(SnacBuffer& snac)
+{
+    static const Word families[] = { 0x01, 0x02, 0x03, 0x04, 0x09, 0x13, 0x15 };
+    static const int familyCount = sizeof(families) / sizeof(Word);
+    static const Word subtypeCount = 0x21;
+
+    SnacBuffer reply(0x01, 0x07);
+    reply.addWord(1); // class count
+
+    reply.addWord(1); // class id
+    reply.addDWord(0x50); // window size
+    reply.addDWord(2500); // clear level
+    reply.addDWord(2000); // alert level
+    reply.addDWord(1500); // limit level
+    reply.addDWord(800); // disconnect level
+    reply.addDWord(6000); // current level
+    reply.addDWord(6000); // max level
+    reply.addDWord(0); // last time
+    reply.addByte(0); // current state
+
+    reply.addWord(1); // class id
+    reply.addWord(familyCount * subtypeCount);
+    for ( int i = 0; i < familyCount; ++i ) {
+        for ( Word subtype = 1; subtype <= subtypeCount; ++subtype ) {
+            reply.addWord( families[i] ).addWord(subtype);
+        }
+    }
+    send( reply, snac.requestId() );
+}
+
+/* << SNAC(13,02) - CLI_SSI_RIGHTS_REQUEST
+ * >> SNAC(13,03) - SRV_SSI_RIGHTS_REPLY */
+void OscarConnection::Private::sendSsiParameters(SnacBuffer& snac)
+{
+    Tlv limits(0x04);
+    limits.addWord(65000); // contacts
+    limits.addWord(1000); // groups
+    limits.addWord(1000); // visible
+    limits.addWord(1000); // invisible
+    for ( int i = 0; i < 10; ++i ) {
+        limits.addWord(0);
+    }
+    limits.addWord(1000); // ignored
+
+    SnacBuffer reply(0x13, 0x03);
+    reply.addTlv(limits);
+    send( reply, snac.requestId() );
+}
+
+/* << SNAC(13,04) - CLI_SSI_REQUEST
+ * >> SNAC(13,06) - SRV_SSIxREPLY
+ * Roster is the master group, one group with all the contacts. Large rosters
+ * are split into several SNACs, all but the last one are flagged. */
+void OscarConnection::Private::sendRoster(SnacBuffer& snac)
+{
+    int rosterSize = server->rosterSize();
+
+    online.fill(false, rosterSize);
+    for ( int i = 0; i < rosterSize; ++i ) {
+        online[i] = ( qrand() % 100 ) < server->onlinePercent();
+    }
+
+    QList<QByteArray> items;
+
+    Buffer master;
+    master.addWord(0); // name length
+    master.addWord(0).addWord(0).addWord(0x0001); // group id, item id, type
+    Tlv masterChilds(0xC8);
+    masterChilds.addWord(1);
+    Buffer masterData;
+    masterData.addData( masterChilds.data() );
+    master.addWord( masterData.size() ).addData(masterData);
+    items << master.data();
+
+    Buffer group;
+    QByteArray groupName("General");
+    group.addWord( groupName.size() ).addData(groupName);
+    group.addWord(1).addWord(0).addWord(0x0001);
+    Tlv groupChilds(0xC8);
+    for ( int i = 0; i < rosterSize; ++i ) {
+        groupChilds.addWord(i + 1);
+    }
+    group.addWord( groupChilds.data().size() ).addData( groupChilds.data() );
+    items << group.data();
+
+    for ( int i = 0; i < rosterSize; ++i ) {
+        QByteArray name = contactUin(i).toLatin1();
+        Buffer buddy;
+        buddy.addWord( name.size() ).addData(name);
+        buddy.addWord(1).addWord(i + 1).addWord(0x0000);
+        Tlv nick(0x0131);
+        nick.addData( "Contact " + QByteArray::number(i) );
+        buddy.addWord( nick.data().size() ).addData( nick.data() );
+        items << buddy.data();
+    }
+
+    for ( int first = 0; first < items.size(); first += SIM_SSI_ITEMS_PER_SNAC ) {
+        int count = qMin( SIM_SSI_ITEMS_PER_SNAC, items.size() - first );
+
+        SnacBuffer reply(0x13, 0x06);
+        reply.addByte(0); // ssi version
+        reply.addWord(count);
+        for ( int i = first; i < first + count; ++i ) {
+            reply.addData( items.at(i) );
+        }
+        reply.addDWord( QDateTime::currentDateTime().toTime_t() );
+        if ( first + count < items.size() ) {
+            reply.setFlags(0x0001);
+        }
+        send( reply, snac.requestId() );
+    }
+}
+
+/* << SNAC(13,08/09/0A) - CLI_SSIxADD/UPDATE/DELETE
+ * >> SNAC(13,0E) - SRV_SSIxMODIFICATION_ACK, one per item since the client expects so */
+void OscarConnection::Private::sendSsiAck(SnacBuffer& snac)
+{
+    while ( !snac.atEnd() ) {
+        snac.read( snac.getWord() ); // name
+        snac.seekForward( sizeof(Word) * 3 ); // group id, item id, type
+        snac.read( snac.getWord() ); // data
+
+        SnacBuffer reply(0x13, 0x0E);
+        reply.addWord(0x0000);
+        send( reply, snac.requestId() );
+    }
+}
+
+/* << SNAC(01,1E) - CLI_SETxSTATUS
+ * >> SNAC(01,0F) - SRV_ONLINExINFO */
+void OscarConnection::Private::sendOwnInfo(SnacBuffer& snac)
+{
+    TlvChain chain = snac.readAll();
+    Word status = SIM_STATUS_ONLINE;
+    if ( chain.hasTlv(0x06) ) {
+        Tlv tlv = chain.getTlv(0x06);
+        tlv.getWord(); // status flags
+        status = tlv.getWord();
+    }
+
+    SnacBuffer reply(0x01, 0x0F);
+    addUserInfo(reply, uin, status);
+    send( reply, snac.requestId() );
+}
+
+/* >> SNAC(03,0B) - SRV_USER_ONLINE for contacts online at login */
+void OscarConnection::Private::sendArrivals()
+{
+    SnacBuffer *snac = 0;
+    int count = 0;
+    for ( int i = 0; i < online.size(); ++i ) {
+        if ( !online.at(i) ) {
+            continue;
+        }
+        if ( !snac ) {
+            snac = new SnacBuffer(0x03, 0x0B);
+        }
+        addUserInfo( *snac, contactUin(i), SIM_STATUS_ONLINE );
+        if ( ++count == SIM_ARRIVALS_PER_SNAC ) {
+            send(*snac);
+            delete snac;
+            snac = 0;
+            count = 0;
+        }
+    }
+    if ( snac ) {
+        send(*snac);
+        delete snac;
+    }
+}
+
+/* << SNAC(04,06) - CLI_SEND_ICBM
+ * >> SNAC(04,0C) - SRV_MSG_ACK, if the client asked for it
+ * Messages to other simulated sessions are delivered to them. */
+void OscarConnection::Private::processMessage(SnacBuffer& snac)
+{
+    QByteArray cookie = snac.read(8);
+    Word channel = snac.getWord();
+    QByteArray recipient = snac.read( snac.getByte() );
+    TlvChain chain = snac.readAll();
+
+    if ( chain.hasTlv(0x03) ) {
+        SnacBuffer ack(0x04, 0x0C);
+        ack.addData(cookie);
+        ack.addWord(channel);
+        ack.addByte( recipient.size() );
+        ack.addData(recipient);
+        send( ack, snac.requestId() );
+    }
+
+    OscarConnection *peer = server->session(recipient);
+    Word dataTlv = channel == 1 ? 0x02 : 0x05;
+    if ( peer && peer->isReady() && chain.hasTlv(dataTlv) ) {
+        peer->deliverMessage( uin, cookie, channel, chain.getTlv(dataTlv).data() );
+    }
+}
+
+/* << SNAC(15,02) - CLI_META_REQ
+ * >> SNAC(15,03) - SRV_META_REPLY */
+void OscarConnection::Private::processMetaRequest(SnacBuffer& snac)
+{
+    Tlv request = Tlv::fromBuffer(snac);
+    snac.seekEnd();
+
+    request.getLEWord(); // chunk size
+    request.getLEDWord(); // requester uin
+    Word type = request.getLEWord();
+    Word sequence = request.getLEWord();
+
+    if ( type == 0x003C ) { // offline messages request
+        QDateTime now = QDateTime::currentDateTime().toUTC();
+        for ( int i = 0; i < server->offlineMessages(); ++i ) {
+            QByteArray text = "Offline message " + QByteArray::number(i);
+            Buffer data;
+            data.addLEDWord( SIM_CONTACT_UIN_BASE + i % qMax(1, online.size()) );
+            data.addLEWord( now.date().year() );
+            data.addByte( now.date().month() ).addByte( now.date().day() );
+            data.addByte( now.time().hour() ).addByte( now.time().minute() );
+            data.addByte(0x01); // plain message
+            data.addByte(0x00); // flags
+            data.addLEWord( text.size() + 1 );
+            data.addData(text).addByte(0);
+            sendMeta(0x0041, sequence, data.data());
+        }
+        sendMeta( 0x0042, sequence, QByteArray(1, 0) );
+    } else if ( type == 0x07D0 ) { // meta info request
+        Word subtype = request.getLEWord();
+        QString target = QString::number( request.getLEDWord() );
+
+        Buffer data;
+        if ( subtype == 0x04BA ) { // short info
+            QByteArray nick = "Nick " + target.toLatin1();
+            QByteArray first = "First";
+            QByteArray last = "Last";
+            QByteArray email = target.toLatin1() + "@example.com";
+
+            data.addLEWord(0x0104).addByte(0x0A);
+            foreach (QByteArray field, QList<QByteArray>() << nick << first << last << email) {
+                data.addLEWord( field.size() + 1 ).addData(field).addByte(0);
+            }
+            data.addByte(0); // auth flag
+            data.addByte(0);
+            data.addByte(0); // gender
+        } else {
+            /* full info is not simulated, the client gives up on the request */
+            data.addLEWord(0x00C8).addByte(0x32);
+        }
+        sendMeta(0x07DA, sequence, data.data());
+    }
+}
+
+/**
+ * Switches random roster contact between online and offline.
+ */
+void OscarConnection::Private::toggleContact()
+{
+    if ( online.isEmpty() ) {
+        return;
+    }
+    int index = qrand() % online.size();
+    online[index] = !online.at(index);
+
+    SnacBuffer snac( 0x03, online.at(index) ? 0x0B : 0x0C );
+    addUserInfo( snac, contactUin(index), qrand() % 4 ? SIM_STATUS_ONLINE : SIM_STATUS_AWAY );
+    send(snac);
+}
+
+/**
+ * Sends plain text message from random online contact.
+ */
+void OscarConnection::Private::sendContactMessage()
+{
+    if ( online.isEmpty() ) {
+        return;
+    }
+    int index = qrand() % online.size();
+    if ( !online.at(index) ) {
+        return;
+    }
+
+    QByteArray text = "Message " + QByteArray::number(++messageCount) + " from simulated contact";
+
+    Tlv tlv(0x02);
+    tlv.addByte(0x05).addByte(0x01); // capabilities fragment
+    tlv.addWord(1).addByte(0x01);
+    tlv.addByte(0x01).addByte(0x01); // message fragment
+    tlv.addWord( text.size() + 4 );
+    tlv.addWord(0x0000).addWord(0x0000); // charset, subset
+    tlv.addData(text);
+
+    QByteArray cookie;
+    for ( int i = 0; i < 8; ++i ) {
+        cookie += char( qrand() & 0xFF );
+    }
+    q->deliverMessage( contactUin(index), cookie, 1, tlv.data() );
+}
+
+void OscarConnection::Private::processSnac(SnacBuffer& snac)
+{
+    uint key = (uint(snac.family()) << 16) | snac.subtype();
+    switch ( key ) {
+        case 0x00170006:
+            sendAuthKey(snac);
+            break;
+        case 0x00170002:
+            sendLoginReply(snac);
+            break;
+        case 0x00010017:
+            sendVersions(snac);
+            break;
+        case 0x00010006:
+            sendRates(snac);
+            break;
+        case 0x00020002: {
+            SnacBuffer reply(0x02, 0x03);
+            send( reply, snac.requestId() );
+            break;
+        }
+        case 0x00030002: {
+            SnacBuffer reply(0x03, 0x03);
+            send( reply, snac.requestId() );
+            break;
+        }
+        case 0x00040004: {
+            SnacBuffer reply(0x04, 0x05);
+            reply.addWord(0x0002); // channel
+            reply.addDWord(0x00000003); // flags
+            reply.addWord(8000); // max snac size
+            reply.addWord(999).addWord(999); // max sender/receiver warning level
+            reply.addWord(0); // min message interval
+            reply.addWord(0);
+            send( reply, snac.requestId() );
+            break;
+        }
+        case 0x00090002: {
+            SnacBuffer reply(0x09, 0x03);
+            Tlv visible(0x01);
+            visible.addWord(1000);
+            Tlv invisible(0x02);
+            invisible.addWord(1000);
+            reply.addTlv(visible);
+            reply.addTlv(invisible);
+            send( reply, snac.requestId() );
+            break;
+        }
+        case 0x00130002:
+            sendSsiParameters(snac);
+            break;
+        case 0x00130004:
+            sendRoster(snac);
+            break;
+        case 0x00130008:
+        case 0x00130009:
+        case 0x0013000A:
+            sendSsiAck(snac);
+            break;
+        case 0x0001001E:
+            sendOwnInfo(snac);
+            break;
+        case 0x00010002: // CLI_READY
+            stage = stageReady;
+            sendArrivals();
+            break;
+        case 0x00040006:
+            processMessage(snac);
+            break;
+        case 0x00150002:
+            processMetaRequest(snac);
+            break;
+        default:
+            break;
+    }
+}
+
+OscarConnection::OscarConnection(QTcpSocket *socket, OscarServer *server)
+    : QObject(server)
+{
+    d = new Private;
+    d->q = this;
+    d->server = server;
+    d->socket = socket;
+    d->socket->setParent(this);
+    d->stage = Private::stageHello;
+    d->sequence = 0;
+    d->presenceCredit = 0;
+    d->messageCredit = 0;
+    d->messageCount = 0;
+
+    QObject::connect( d->socket, SIGNAL( readyRead() ), SLOT( readData() ) );
+    QObject::connect( d->socket, SIGNAL( disconnected() ), SLOT( processDisconnected() ) );
+
+    /* both login and BOS stages start with FLAP version hello */
+    FlapBuffer hello(FlapBuffer::AuthChannel);
+    hello.addDWord(0x1);
+    d->sendFlap(hello);
+}
+
+OscarConnection::~OscarConnection()
+{
+    d->server->removeSession(this);
+    delete d;
+}
+
+QString OscarConnection::uin() const
+{
+    return d->uin;
+}
+
+/**
+ * Returns true if the client has finished BOS login.
+ */
+bool OscarConnection::isReady() const
+{
+    return d->stage == Private::stageReady;
+}
+
+/**
+ * Generates contact events for one simulation step. Fractional numbers of events
+ * are accumulated until they make a whole one.
+ */
+void OscarConnection::simulate(double presenceEvents, double messageEvents)
+{
+    d->presenceCredit += presenceEvents;
+    while ( d->presenceCredit >= 1 ) {
+        d->presenceCredit -= 1;
+        d->toggleContact();
+    }
+    d->messageCredit += messageEvents;
+    while ( d->messageCredit >= 1 ) {
+        d->messageCredit -= 1;
+        d->sendContactMessage();
+    }
+}
+
+/**
+ * Sends SNAC(04,07) - SRV_CLIENT_ICBM from @a sender with message @a tlv
+ * (TLV 0x02 for channel 1, TLV 0x05 for channel 2).
+ */
+void OscarConnection::deliverMessage(const QString& sender, const QByteArray& cookie, int channel, const QByteArray& tlv)
+{
+    SnacBuffer snac(0x04, 0x07);
+    snac.addData(cookie);
+    snac.addWord(channel);
+    snac.addByte( sender.length() );
+    snac.addData(sender);
+    snac.addWord(0); // warning level
+    snac.addWord(0); // fixed part tlv count
+    snac.addData(tlv);
+    d->send(snac);
+
+    d->server->countMessage();
+}
+
+void OscarConnection::readData()
+{
+    while ( d->socket->bytesAvailable() >= FLAP_HEADER_SIZE ) {
+        FlapBuffer flap = FlapBuffer::fromRawData( d->socket->peek(FLAP_HEADER_SIZE) );
+        if ( d->socket->bytesAvailable() - FLAP_HEADER_SIZE < flap.flapDataSize() ) {
+            return;
+        }
+        d->socket->read(FLAP_HEADER_SIZE);
+        flap.setData( d->socket->read( flap.flapDataSize() ) );
+
+        if ( flap.channel() == FlapBuffer::AuthChannel && d->stage == Private::stageHello ) {
+            d->processHello(flap);
+        } else if ( flap.channel() == FlapBuffer::DataChannel ) {
+            SnacBuffer snac = flap;
+            d->processSnac(snac);
+        } else if ( flap.channel() == FlapBuffer::CloseChannel ) {
+            d->socket->disconnectFromHost();
+            return;
+        }
+    }
+}
+
+void OscarConnection::processDisconnected()
+{
+    deleteLater();
+}
+
+// vim:et:ts=4:sw=4:nowrap
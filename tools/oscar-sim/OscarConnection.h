@@ -0,0 +1,51 @@
+/*
+ * OscarConnection.h - Client connection to the OSCAR server simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef OSCARCONNECTION_H_
+#define OSCARCONNECTION_H_
+
+#include <QObject>
+
+class OscarServer;
+class QTcpSocket;
+
+class OscarConnection : public QObject
+{
+    Q_OBJECT
+
+    public:
+        OscarConnection(QTcpSocket *socket, OscarServer *server);
+        ~OscarConnection();
+
+        QString uin() const;
+        bool isReady() const;
+
+        void simulate(double presenceEvents, double messageEvents);
+        void deliverMessage(const QString& sender, const QByteArray& cookie, int channel, const QByteArray& tlv);
+    private slots:
+        void readData();
+        void processDisconnected();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* OSCARCONNECTION_H_ */
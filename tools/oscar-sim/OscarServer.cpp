@@ -0,0 +1,238 @@
+/*
+ * OscarServer.cpp - Local OSCAR server simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "OscarServer.h"
+#include "OscarConnection.h"
+
+#include <QHash>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtDebug>
+
+/* simulation step (msecs) */
+static const int SIM_TICK_INTERVAL = 100;
+static const int SIM_REPORT_INTERVAL = 10000;
+static const int SIM_COOKIE_SIZE = 256;
+
+class OscarServer::Private
+{
+    public:
+        int rosterSize;
+        int onlinePercent;
+        double presenceRate;
+        double messageRate;
+        int offlineMessages;
+
+        /* auth cookies issued by the login stage, value is uin */
+        QHash<QByteArray,QString> cookies;
+        /* logged in sessions, key is uin */
+        QHash<QString,OscarConnection*> sessions;
+
+        QTimer tickTimer;
+        QTimer reportTimer;
+
+        quint64 connections;
+        quint64 logins;
+        quint64 messages;
+};
+
+/**
+ * @class OscarServer
+ * @brief Stand-in for ICQ login and BOS servers.
+ *
+ * Both login stages are served on the same port: login reply points the client
+ * back to the server it came from. Every account is accepted, rosters are generated
+ * and contacts change their presence and send messages at configured rates.
+ */
+
+OscarServer::OscarServer(QObject *parent)
+    : QTcpServer(parent)
+{
+    d = new Private;
+    d->rosterSize = 100;
+    d->onlinePercent = 30;
+    d->presenceRate = 0;
+    d->messageRate = 0;
+    d->offlineMessages = 0;
+    d->connections = 0;
+    d->logins = 0;
+    d->messages = 0;
+
+    QObject::connect( &d->tickTimer, SIGNAL( timeout() ), SLOT( tick() ) );
+    d->tickTimer.start(SIM_TICK_INTERVAL);
+
+    QObject::connect( &d->reportTimer, SIGNAL( timeout() ), SLOT( report() ) );
+    d->reportTimer.start(SIM_REPORT_INTERVAL);
+}
+
+OscarServer::~OscarServer()
+{
+    delete d;
+}
+
+/**
+ * Sets number of contacts in generated rosters. SSI item ids are 16-bit, so it's limited to 65000.
+ */
+void OscarServer::setRosterSize(int size)
+{
+    d->rosterSize = qBound(0, size, 65000);
+}
+
+int OscarServer::rosterSize() const
+{
+    return d->rosterSize;
+}
+
+/**
+ * Sets share of roster contacts which are online right after login.
+ */
+void OscarServer::setOnlinePercent(int percent)
+{
+    d->onlinePercent = qBound(0, percent, 100);
+}
+
+int OscarServer::onlinePercent() const
+{
+    return d->onlinePercent;
+}
+
+/**
+ * Sets number of contact presence changes per second for each session.
+ */
+void OscarServer::setPresenceRate(double perSecond)
+{
+    d->presenceRate = qMax(perSecond, 0.0);
+}
+
+/**
+ * Sets number of messages from contacts per second for each session.
+ */
+void OscarServer::setMessageRate(double perSecond)
+{
+    d->messageRate = qMax(perSecond, 0.0);
+}
+
+/**
+ * Sets number of offline messages returned to each session.
+ */
+void OscarServer::setOfflineMessages(int count)
+{
+    d->offlineMessages = qMax(count, 0);
+}
+
+int OscarServer::offlineMessages() const
+{
+    return d->offlineMessages;
+}
+
+/**
+ * Returns new auth cookie for @a uin, it is valid for one BOS login.
+ */
+QByteArray OscarServer::issueCookie(const QString& uin)
+{
+    QByteArray cookie;
+    cookie.reserve(SIM_COOKIE_SIZE);
+    while ( cookie.size() < SIM_COOKIE_SIZE ) {
+        cookie += char( qrand() & 0xFF );
+    }
+    d->cookies.insert(cookie, uin);
+    return cookie;
+}
+
+/**
+ * Returns uin of the @a cookie owner and forgets the cookie. Returns null string for unknown cookies.
+ */
+QString OscarServer::takeCookie(const QByteArray& cookie)
+{
+    return d->cookies.take(cookie);
+}
+
+/**
+ * Registers logged in session. Previous session of the same uin is disconnected.
+ */
+void OscarServer::addSession(OscarConnection *connection)
+{
+    OscarConnection *previous = d->sessions.value( connection->uin() );
+    d->sessions.insert(connection->uin(), connection);
+    ++d->logins;
+    if ( previous ) {
+        qDebug() << "[Sim]" << "Duplicate login for" << connection->uin();
+        previous->deleteLater();
+    }
+}
+
+void OscarServer::removeSession(OscarConnection *connection)
+{
+    if ( d->sessions.value( connection->uin() ) == connection ) {
+        d->sessions.remove( connection->uin() );
+    }
+}
+
+/**
+ * Returns logged in session of @a uin or null.
+ */
+OscarConnection* OscarServer::session(const QString& uin) const
+{
+    return d->sessions.value(uin);
+}
+
+/**
+ * Accounts a message passed to a client.
+ */
+void OscarServer::countMessage()
+{
+    ++d->messages;
+}
+
+void OscarServer::incomingConnection(int socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket;
+    if ( !socket->setSocketDescriptor(socketDescriptor) ) {
+        qWarning() << "[Sim]" << "Failed to accept connection:" << socket->errorString();
+        delete socket;
+        return;
+    }
+    ++d->connections;
+    new OscarConnection(socket, this);
+}
+
+/**
+ * Generates events of all sessions for one simulation step.
+ */
+void OscarServer::tick()
+{
+    if ( d->presenceRate == 0 && d->messageRate == 0 ) {
+        return;
+    }
+    double step = SIM_TICK_INTERVAL / 1000.0;
+    foreach (OscarConnection *connection, d->sessions) {
+        if ( connection->isReady() ) {
+            connection->simulate(d->presenceRate * step, d->messageRate * step);
+        }
+    }
+}
+
+void OscarServer::report()
+{
+    qDebug() << "[Sim]" << d->sessions.size() << "sessions," << d->connections << "connections,"
+        << d->logins << "logins," << d->messages << "messages";
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,64 @@
+/*
+ * OscarServer.h - Local OSCAR server simulator
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef OSCARSERVER_H_
+#define OSCARSERVER_H_
+
+#include <QTcpServer>
+
+class OscarConnection;
+
+class OscarServer : public QTcpServer
+{
+    Q_OBJECT
+
+    public:
+        OscarServer(QObject *parent = 0);
+        ~OscarServer();
+
+        void setRosterSize(int size);
+        int rosterSize() const;
+        void setOnlinePercent(int percent);
+        int onlinePercent() const;
+        void setPresenceRate(double perSecond);
+        void setMessageRate(double perSecond);
+        void setOfflineMessages(int count);
+        int offlineMessages() const;
+
+        QByteArray issueCookie(const QString& uin);
+        QString takeCookie(const QByteArray& cookie);
+
+        void addSession(OscarConnection *connection);
+        void removeSession(OscarConnection *connection);
+        OscarConnection* session(const QString& uin) const;
+
+        void countMessage();
+    protected:
+        void incomingConnection(int socketDescriptor);
+    private slots:
+        void tick();
+        void report();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* OSCARSERVER_H_ */
@@ -0,0 +1,106 @@
+/*
+ * main.cpp - OSCAR server simulator for load testing
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "LoadDriver.h"
+#include "OscarServer.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QHash>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTextCodec>
+
+#include <stdio.h>
+
+static const char usage[] =
+    "Usage: oscar-sim [options]\n"
+    "Server:\n"
+    "  -listen ADDR          address to listen on (127.0.0.1)\n"
+    "  -port N               port to listen on (5190)\n"
+    "  -roster N             contacts in each roster (100)\n"
+    "  -online N             percent of contacts online at login (30)\n"
+    "  -presence-rate N      contact presence changes per second per session (0)\n"
+    "  -message-rate N       messages from contacts per second per session (0)\n"
+    "  -offline N            offline messages for each session (0)\n"
+    "Load driver:\n"
+    "  -sessions N           log in N ICQ sessions against the server (0)\n"
+    "  -server ADDR          drive a server running elsewhere instead of starting one\n"
+    "  -first-uin N          uin of the first session (100000)\n"
+    "  -login-rate N         logins per second (50)\n"
+    "  -send-rate N          messages per second sent by all sessions together (0)\n"
+    "\n"
+    "Point the transport to the server with icq-server/icq-port options.\n"
+    "Thousands of sessions need a higher open files limit (ulimit -n).\n";
+
+int main(int argc, char **argv)
+{
+    QTextCodec::setCodecForCStrings( QTextCodec::codecForName("UTF-8") );
+    QCoreApplication app(argc, argv);
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+
+    QHash<QString,QString> options;
+    options.insert("listen", "127.0.0.1");
+    options.insert("port", "5190");
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    while ( !args.isEmpty() ) {
+        QString arg = args.takeFirst();
+        if ( !arg.startsWith('-') || arg == "-help" || arg == "--help" || args.isEmpty() ) {
+            fputs(usage, stderr);
+            return arg.startsWith("-h") || arg == "--help" ? 0 : 1;
+        }
+        options.insert( arg.mid(1), args.takeFirst() );
+    }
+
+    quint16 port = options.value("port").toUInt();
+    QString host = options.value("listen");
+
+    if ( !options.contains("server") ) {
+        OscarServer *server = new OscarServer(&app);
+        server->setRosterSize( options.value("roster", "100").toInt() );
+        server->setOnlinePercent( options.value("online", "30").toInt() );
+        server->setPresenceRate( options.value("presence-rate", "0").toDouble() );
+        server->setMessageRate( options.value("message-rate", "0").toDouble() );
+        server->setOfflineMessages( options.value("offline", "0").toInt() );
+        if ( !server->listen(QHostAddress(host), port) ) {
+            fprintf( stderr, "Failed to listen on %s:%d: %s\n", qPrintable(host), port, qPrintable( server->errorString() ) );
+            return 1;
+        }
+        qDebug( "[Sim] Listening on %s:%d", qPrintable(host), port );
+    } else {
+        host = options.value("server");
+    }
+
+    int sessions = options.value("sessions", "0").toInt();
+    if ( sessions > 0 ) {
+        LoadDriver *driver = new LoadDriver(&app);
+        driver->setServer(host, port);
+        driver->setFirstUin( options.value("first-uin", "100000").toUInt() );
+        driver->setLoginRate( options.value("login-rate", "50").toInt() );
+        driver->setMessageRate( options.value("send-rate", "0").toDouble() );
+        driver->start(sessions);
+    }
+
+    return app.exec();
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,24 @@
+TARGET = oscar-sim
+TEMPLATE = app
+
+include(../../common.pri)
+include(../../icq/icq.pri)
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+QMAKE_DISTCLEAN += \
+	$$PWD/.moc \
+	$$PWD/.obj
+
+QMAKE_DEL_FILE = rm -rf
+
+HEADERS += \
+	$$PWD/LoadDriver.h \
+	$$PWD/OscarConnection.h \
+	$$PWD/OscarServer.h
+SOURCES += \
+	$$PWD/LoadDriver.cpp \
+	$$PWD/OscarConnection.cpp \
+	$$PWD/OscarServer.cpp \
+	$$PWD/main.cpp
@@ -0,0 +1,83 @@
+/*
+ * ReplayDevice.cpp - In-memory device fed with recorded traffic
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "ReplayDevice.h"
+
+#include <string.h>
+
+/**
+ * @class ReplayDevice
+ * @brief Sequential device which plays the role of a socket for replayed connections.
+ *
+ * Fed data is read by the connection like data received from the network, data written
+ * by the connection is only counted.
+ */
+
+ReplayDevice::ReplayDevice(QObject *parent)
+    : QIODevice(parent), m_written(0)
+{
+    open(QIODevice::ReadWrite);
+}
+
+ReplayDevice::~ReplayDevice()
+{
+}
+
+/**
+ * Appends @a data to the incoming buffer. readyRead() is emitted synchronously,
+ * so the data is processed when the call returns.
+ */
+void ReplayDevice::feed(const QByteArray& data)
+{
+    m_buffer += data;
+    emit readyRead();
+}
+
+qint64 ReplayDevice::bytesWritten() const
+{
+    return m_written;
+}
+
+bool ReplayDevice::isSequential() const
+{
+    return true;
+}
+
+qint64 ReplayDevice::bytesAvailable() const
+{
+    return m_buffer.size() + QIODevice::bytesAvailable();
+}
+
+qint64 ReplayDevice::readData(char *data, qint64 maxSize)
+{
+    int size = qMin( qint64( m_buffer.size() ), maxSize );
+    memcpy( data, m_buffer.constData(), size );
+    m_buffer.remove(0, size);
+    return size;
+}
+
+qint64 ReplayDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data);
+    m_written += maxSize;
+    return maxSize;
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,49 @@
+/*
+ * ReplayDevice.h - In-memory device fed with recorded traffic
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef REPLAYDEVICE_H_
+#define REPLAYDEVICE_H_
+
+#include <QByteArray>
+#include <QIODevice>
+
+class ReplayDevice : public QIODevice
+{
+    Q_OBJECT
+
+    public:
+        ReplayDevice(QObject *parent = 0);
+        ~ReplayDevice();
+
+        void feed(const QByteArray& data);
+        qint64 bytesWritten() const;
+
+        bool isSequential() const;
+        qint64 bytesAvailable() const;
+    protected:
+        qint64 readData(char *data, qint64 maxSize);
+        qint64 writeData(const char *data, qint64 maxSize);
+    private:
+        QByteArray m_buffer;
+        qint64 m_written;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* REPLAYDEVICE_H_ */
@@ -0,0 +1,299 @@
+/*
+ * Replayer.cpp - Replays recorded traffic into protocol parsers
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Replayer.h"
+#include "ReplayDevice.h"
+
+#include "icqSocket.h"
+#include "stream.h"
+
+#include "metrics.h"
+#include "recorder.h"
+
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QStringList>
+#include <QTimer>
+#include <QtDebug>
+
+/* first byte of every FLAP packet */
+static const char FLAP_START = 0x2A;
+
+/* stream which only parses and dispatches stanzas */
+class ReplayStream : public XMPP::Stream
+{
+    public:
+        ReplayStream(ReplayDevice *device, QObject *parent = 0)
+            : XMPP::Stream(parent)
+        {
+            setByteStream(device);
+        }
+
+        QString baseNS() const
+        {
+            return "jabber:component:accept";
+        }
+    protected:
+        void handleStreamOpen(const XMPP::Parser::Event& event)
+        {
+            Q_UNUSED(event);
+        }
+
+        bool handleUnknownElement(const XMPP::Parser::Event& event)
+        {
+            return event.qualifiedName() == "handshake";
+        }
+};
+
+class Replayer::Private
+{
+    public:
+        enum Kind { Icq, Xmpp };
+
+        void createConnection();
+        void destroyConnection();
+        double units() const;
+        void report();
+
+        Kind kind;
+        /* incoming frames only, outgoing ones were produced by the transport */
+        QList<Instrument::Recorder::Frame> frames;
+        qint64 bytes;
+
+        bool paced;
+        double speed;
+        int repeat;
+
+        int round;
+        int next;
+        qint64 started;
+        double unitsBefore;
+
+        ReplayDevice *device;
+        ICQ::Socket *socket;
+        ReplayStream *stream;
+        QTimer timer;
+};
+
+/**
+ * Creates a fresh connection object for the next round, parsers keep state between frames.
+ */
+void Replayer::Private::createConnection()
+{
+    device = new ReplayDevice;
+    if ( kind == Icq ) {
+        socket = new ICQ::Socket;
+        socket->setIODevice(device);
+    } else {
+        stream = new ReplayStream(device);
+    }
+}
+
+void Replayer::Private::destroyConnection()
+{
+    delete socket;
+    delete stream;
+    delete device;
+    socket = 0;
+    stream = 0;
+    device = 0;
+}
+
+/**
+ * Returns number of SNACs or stanzas received so far, as counted by the socket or stream.
+ */
+double Replayer::Private::units() const
+{
+    QString name = kind == Icq ? "icq_snac_packets_total" : "xmpp_stanzas_total";
+    double sum = 0;
+    QMapIterator<QString,double> it( Instrument::Registry::instance()->values(name) );
+    while ( it.hasNext() ) {
+        it.next();
+        if ( it.key().contains("direction=\"in\"") ) {
+            sum += it.value();
+        }
+    }
+    return sum;
+}
+
+void Replayer::Private::report()
+{
+    double elapsed = qMax( (Instrument::monotonicUsecs() - started) / 1000000.0, 0.000001 );
+    double totalBytes = double(bytes) * repeat;
+    double totalFrames = double( frames.size() ) * repeat;
+    double received = units() - unitsBefore;
+
+    qDebug( "[Replay] %.0f frames, %.0f bytes, %.0f %s in %.3f s", totalFrames, totalBytes, received,
+            kind == Icq ? "snacs" : "stanzas", elapsed );
+    qDebug( "[Replay] %.1f MB/s, %.0f frames/s, %.0f %s/s", totalBytes / elapsed / 1048576, totalFrames / elapsed,
+            received / elapsed, kind == Icq ? "snacs" : "stanzas" );
+
+    QStringList handlers;
+    if ( kind == Icq ) {
+        handlers << "icq-snac";
+    } else {
+        handlers << "xmpp-parse" << "xmpp-message" << "xmpp-presence" << "xmpp-iq";
+    }
+    foreach (const QString& handler, handlers) {
+        Instrument::Histogram *h = Instrument::Registry::instance()->findHistogram(
+                "handler_duration_seconds", "handler=\"" + handler + "\"" );
+        if ( h && h->count() > 0 ) {
+            qDebug( "[Replay] %s: %llu calls, mean %.1f us, p99 < %.1f ms", qPrintable(handler), h->count(),
+                    h->sum() / h->count() * 1000000, h->quantile(0.99) * 1000 );
+        }
+    }
+}
+
+/**
+ * @class Replayer
+ * @brief Feeds a traffic recording through ICQ::Socket or XMPP::Stream.
+ *
+ * Only incoming frames are replayed, one frame per readyRead() like they were received.
+ * Kind of the connection is detected from the data: FLAP packets start with '*'.
+ * By default frames are fed as fast as possible, which measures parsing and dispatching
+ * throughput. Paced replay keeps original intervals between frames (scaled by speed).
+ * Nothing is connected to the parsed SNACs and stanzas, so only parsers are measured.
+ */
+
+Replayer::Replayer(QObject *parent)
+    : QObject(parent)
+{
+    d = new Private;
+    d->kind = Private::Icq;
+    d->bytes = 0;
+    d->paced = false;
+    d->speed = 1.0;
+    d->repeat = 1;
+    d->round = 0;
+    d->next = 0;
+    d->started = 0;
+    d->unitsBefore = 0;
+    d->device = 0;
+    d->socket = 0;
+    d->stream = 0;
+
+    d->timer.setSingleShot(true);
+    QObject::connect( &d->timer, SIGNAL( timeout() ), SLOT( playNext() ) );
+}
+
+Replayer::~Replayer()
+{
+    d->destroyConnection();
+    delete d;
+}
+
+/**
+ * Reads recording @a fileName into memory.
+ */
+bool Replayer::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if ( !file.open(QIODevice::ReadOnly) ) {
+        qCritical( "[Replay] Failed to open %s: %s", qPrintable(fileName), qPrintable( file.errorString() ) );
+        return false;
+    }
+    if ( !Instrument::Recorder::readHeader(&file) ) {
+        qCritical( "[Replay] %s is not a traffic recording", qPrintable(fileName) );
+        return false;
+    }
+
+    Instrument::Recorder::Frame frame;
+    while ( Instrument::Recorder::readFrame(&file, frame) ) {
+        if ( frame.direction == Instrument::Recorder::In ) {
+            d->frames << frame;
+            d->bytes += frame.data.size();
+        }
+    }
+    if ( !file.atEnd() ) {
+        qWarning( "[Replay] %s is truncated, replaying %d complete frames", qPrintable(fileName), d->frames.size() );
+    }
+    if ( d->frames.isEmpty() ) {
+        qCritical( "[Replay] %s has no incoming traffic", qPrintable(fileName) );
+        return false;
+    }
+    d->kind = d->frames.first().data.startsWith(FLAP_START) ? Private::Icq : Private::Xmpp;
+    qDebug( "[Replay] Loaded %d %s frames, %lld bytes", d->frames.size(), d->kind == Private::Icq ? "ICQ" : "XMPP", d->bytes );
+    return true;
+}
+
+void Replayer::setPaced(bool paced, double speed)
+{
+    d->paced = paced;
+    d->speed = speed > 0 ? speed : 1.0;
+}
+
+/**
+ * Replays the recording @a count times, each time through a new connection object.
+ */
+void Replayer::setRepeat(int count)
+{
+    d->repeat = qMax(count, 1);
+}
+
+void Replayer::start()
+{
+    d->round = 0;
+    d->next = 0;
+    d->unitsBefore = d->units();
+    d->started = Instrument::monotonicUsecs();
+
+    if ( d->paced ) {
+        d->createConnection();
+        playNext();
+        return;
+    }
+    for ( d->round = 0; d->round < d->repeat; ++d->round ) {
+        d->createConnection();
+        foreach (const Instrument::Recorder::Frame& frame, d->frames) {
+            d->device->feed(frame.data);
+        }
+        d->destroyConnection();
+    }
+    d->report();
+    emit finished();
+}
+
+/**
+ * Feeds the next frame and schedules the following one at its recorded time.
+ */
+void Replayer::playNext()
+{
+    d->device->feed( d->frames.at(d->next).data );
+    ++d->next;
+
+    if ( d->next == d->frames.size() ) {
+        d->next = 0;
+        d->destroyConnection();
+        if ( ++d->round == d->repeat ) {
+            d->report();
+            emit finished();
+            return;
+        }
+        d->createConnection();
+        playNext();
+        return;
+    }
+
+    qint64 delay = d->frames.at(d->next).time - d->frames.at(d->next - 1).time;
+    d->timer.start( int( delay / 1000 / d->speed ) );
+}
+
+// vim:et:ts=4:sw=4:nowrap
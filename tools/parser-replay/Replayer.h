@@ -0,0 +1,51 @@
+/*
+ * Replayer.h - Replays recorded traffic into protocol parsers
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef REPLAYER_H_
+#define REPLAYER_H_
+
+#include <QObject>
+
+class QString;
+
+class Replayer : public QObject
+{
+    Q_OBJECT
+
+    public:
+        Replayer(QObject *parent = 0);
+        ~Replayer();
+
+        bool load(const QString& fileName);
+        void setPaced(bool paced, double speed = 1.0);
+        void setRepeat(int count);
+
+        void start();
+    signals:
+        void finished();
+    private slots:
+        void playNext();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* REPLAYER_H_ */
@@ -0,0 +1,85 @@
+/*
+ * main.cpp - Replays recorded transport traffic into protocol parsers
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Replayer.h"
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QTextCodec>
+
+#include <stdio.h>
+
+static const char usage[] =
+    "Usage: parser-replay [options] FILE\n"
+    "  -paced                keep original intervals between frames\n"
+    "  -speed N              speed up paced replay N times (1)\n"
+    "  -repeat N             replay the recording N times (1)\n"
+    "\n"
+    "FILE is a recording made by the transport with record-dir option.\n"
+    "Incoming traffic of an ICQ session or a component stream is fed through\n"
+    "ICQ::Socket or XMPP::Stream and parsing throughput is reported.\n"
+    "Only the parsers run: no managers, sessions or gateway are attached, so\n"
+    "this is not an end-to-end benchmark (see tools/e2e-bench.sh).\n";
+
+int main(int argc, char **argv)
+{
+    QTextCodec::setCodecForCStrings( QTextCodec::codecForName("UTF-8") );
+    QCoreApplication app(argc, argv);
+
+    bool paced = false;
+    double speed = 1.0;
+    int repeat = 1;
+    QString fileName;
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    while ( !args.isEmpty() ) {
+        QString arg = args.takeFirst();
+        if ( arg == "-paced" ) {
+            paced = true;
+        } else if ( arg == "-speed" && !args.isEmpty() ) {
+            speed = args.takeFirst().toDouble();
+        } else if ( arg == "-repeat" && !args.isEmpty() ) {
+            repeat = args.takeFirst().toInt();
+        } else if ( !arg.startsWith('-') && fileName.isEmpty() ) {
+            fileName = arg;
+        } else {
+            fputs(usage, stderr);
+            return arg.startsWith("-h") || arg == "--help" ? 0 : 1;
+        }
+    }
+    if ( fileName.isEmpty() ) {
+        fputs(usage, stderr);
+        return 1;
+    }
+
+    Replayer replayer;
+    if ( !replayer.load(fileName) ) {
+        return 1;
+    }
+    replayer.setPaced(paced, speed);
+    replayer.setRepeat(repeat);
+    QObject::connect( &replayer, SIGNAL( finished() ), &app, SLOT( quit() ), Qt::QueuedConnection );
+    replayer.start();
+
+    return app.exec();
+}
+
+// vim:et:ts=4:sw=4:nowrap
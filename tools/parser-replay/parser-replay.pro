@@ -0,0 +1,23 @@
+TARGET = parser-replay
+TEMPLATE = app
+
+include(../../common.pri)
+include(../../icq/icq.pri)
+include(../../shark/shark.pri)
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+QMAKE_DISTCLEAN += \
+	$$PWD/.moc \
+	$$PWD/.obj
+
+QMAKE_DEL_FILE = rm -rf
+
+HEADERS += \
+	$$PWD/ReplayDevice.h \
+	$$PWD/Replayer.h
+SOURCES += \
+	$$PWD/ReplayDevice.cpp \
+	$$PWD/Replayer.cpp \
+	$$PWD/main.cpp
@@ -0,0 +1,509 @@
+/*
+ * Benchmark.cpp - Scripted XMPP users driving the transport end-to-end
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Benchmark.h"
+#include "ComponentServer.h"
+
+#include "metrics.h"
+
+#include "xmpp-core/iq.h"
+#include "xmpp-core/jid.h"
+#include "xmpp-core/message.h"
+#include "xmpp-core/presence.h"
+#include "xmpp-ext/registration.h"
+#include "xmpp-ext/servicediscovery.h"
+
+#include <QCoreApplication>
+#include <QDomElement>
+#include <QFile>
+#include <QHash>
+#include <QTimer>
+#include <QVector>
+#include <QtAlgorithms>
+#include <QtDebug>
+
+#include <unistd.h>
+
+using namespace XMPP;
+
+static const int BENCH_TICK_INTERVAL = 100;
+static const int BENCH_REPORT_INTERVAL = 5000;
+static const char BENCH_MESSAGE_PREFIX[] = "bench ";
+
+class Benchmark::Private
+{
+    public:
+        struct User {
+            enum State { Idle, Registering, LoggingIn, Online };
+            Jid jid;
+            QString uin;
+            State state;
+            qint64 started;
+        };
+
+        void registerNext();
+        void sendMessage();
+        void sendPresence();
+        void sendIq();
+
+        int randomOnline() const;
+        qint64 residentMemory() const;
+        static qint64 percentile(QVector<qint64> values, double q);
+        static QString latencies(const QVector<qint64>& values);
+
+        ComponentServer *server;
+        Jid transport;
+
+        QVector<User> users;
+        /* user index by bare jid */
+        QHash<QString,int> userIndex;
+        /* indexes of online users */
+        QVector<int> online;
+        int nextUser;
+
+        uint firstUin;
+        int loginRate;
+        double messageRate;
+        double presenceRate;
+        double iqRate;
+        int duration;
+        qint64 transportPid;
+        qint64 baseMemory;
+
+        double loginCredit;
+        double messageCredit;
+        double presenceCredit;
+        double iqCredit;
+
+        /* send time of pending messages and iqs, usecs */
+        QHash<quint64,qint64> pendingMessages;
+        QHash<QString,qint64> pendingIqs;
+        quint64 messageSequence;
+        quint64 iqSequence;
+
+        QVector<qint64> loginLatency;
+        QVector<qint64> messageLatency;
+        QVector<qint64> iqLatency;
+
+        quint64 messagesSent;
+        quint64 presencesReceived;
+        quint64 presencesReported;
+        quint64 stanzasReceived;
+        qint64 reportTime;
+
+        QFile record;
+        QTimer tickTimer;
+        QTimer reportTimer;
+};
+
+/**
+ * Registers the next user and logs it in when the registration is confirmed.
+ */
+void Benchmark::Private::registerNext()
+{
+    User& user = users[nextUser++];
+
+    Registration reg;
+    reg.setType(IQ::Set);
+    reg.setFrom(user.jid);
+    reg.setTo(transport);
+    reg.setId( "reg-" + QString::number(nextUser - 1) );
+    reg.setField(Registration::Username, user.uin);
+    reg.setField(Registration::Password, QString("password"));
+
+    user.state = User::Registering;
+    user.started = Instrument::monotonicUsecs();
+    server->send(reg);
+}
+
+/**
+ * Sends chat message between two online users, it goes through ICQ and comes back
+ * to the recipient's jabber user.
+ */
+void Benchmark::Private::sendMessage()
+{
+    if ( online.size() < 2 ) {
+        return;
+    }
+    int from = randomOnline();
+    int to = randomOnline();
+    if ( from == to ) {
+        return;
+    }
+
+    Message msg;
+    msg.setType(Message::Chat);
+    msg.setFrom( users.at(from).jid );
+    msg.setTo( transport.withNode( users.at(to).uin ) );
+    msg.setBody( BENCH_MESSAGE_PREFIX + QString::number(++messageSequence) );
+
+    pendingMessages.insert( messageSequence, Instrument::monotonicUsecs() );
+    ++messagesSent;
+    server->send(msg);
+}
+
+/**
+ * Changes presence of an online user, so the transport changes ICQ status.
+ */
+void Benchmark::Private::sendPresence()
+{
+    if ( online.isEmpty() ) {
+        return;
+    }
+    static const Presence::Show shows[] = { Presence::None, Presence::Away, Presence::Chat, Presence::NotAvailable };
+    Presence presence( Presence::Available, users.at( randomOnline() ).jid, transport, shows[qrand() % 4] );
+    server->send(presence);
+}
+
+/**
+ * Sends disco-info query to the transport.
+ */
+void Benchmark::Private::sendIq()
+{
+    if ( online.isEmpty() ) {
+        return;
+    }
+    IQ iq;
+    iq.setType(IQ::Get);
+    iq.setFrom( users.at( randomOnline() ).jid );
+    iq.setTo(transport);
+    iq.setId( "iq-" + QString::number(++iqSequence) );
+    iq.setChildElement("query", NS_QUERY_DISCO_INFO);
+
+    pendingIqs.insert( iq.id(), Instrument::monotonicUsecs() );
+    server->send(iq);
+}
+
+int Benchmark::Private::randomOnline() const
+{
+    return online.at( qrand() % online.size() );
+}
+
+/**
+ * Returns resident memory of the transport process in bytes, 0 if unknown.
+ */
+qint64 Benchmark::Private::residentMemory() const
+{
+    if ( transportPid <= 0 ) {
+        return 0;
+    }
+    QFile statm( "/proc/" + QString::number(transportPid) + "/statm" );
+    if ( !statm.open(QIODevice::ReadOnly) ) {
+        return 0;
+    }
+    /* second field is resident set size in pages */
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    return fields.value(1).toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+qint64 Benchmark::Private::percentile(QVector<qint64> values, double q)
+{
+    if ( values.isEmpty() ) {
+        return 0;
+    }
+    qSort(values);
+    return values.at( qMin( int(q * values.size()), values.size() - 1 ) );
+}
+
+/**
+ * Formats latency percentiles (usecs) in milliseconds.
+ */
+QString Benchmark::Private::latencies(const QVector<qint64>& values)
+{
+    if ( values.isEmpty() ) {
+        return "n/a";
+    }
+    return QString("p50 %1 p90 %2 p99 %3 max %4 ms")
+        .arg( percentile(values, 0.5) / 1000.0, 0, 'f', 1 )
+        .arg( percentile(values, 0.9) / 1000.0, 0, 'f', 1 )
+        .arg( percentile(values, 0.99) / 1000.0, 0, 'f', 1 )
+        .arg( percentile(values, 1.0) / 1000.0, 0, 'f', 1 );
+}
+
+/**
+ * @class Benchmark
+ * @brief Simulated jabber users of the transport.
+ *
+ * Users are registered and logged in at a fixed rate. Online users send messages to each
+ * other through the transport and ICQ (so both stand-ins are needed), change presence
+ * and query the transport. Latencies and transport memory are reported periodically.
+ */
+
+Benchmark::Benchmark(ComponentServer *server, QObject *parent)
+    : QObject(parent)
+{
+    d = new Private;
+    d->server = server;
+    d->transport = Jid("icq.localhost");
+    d->nextUser = 0;
+    d->firstUin = 100000;
+    d->loginRate = 50;
+    d->messageRate = 0;
+    d->presenceRate = 0;
+    d->iqRate = 0;
+    d->duration = 60;
+    d->transportPid = 0;
+    d->baseMemory = 0;
+    d->loginCredit = d->messageCredit = d->presenceCredit = d->iqCredit = 0;
+    d->messageSequence = 0;
+    d->iqSequence = 0;
+    d->messagesSent = 0;
+    d->presencesReceived = 0;
+    d->presencesReported = 0;
+    d->stanzasReceived = 0;
+    d->reportTime = 0;
+
+    QObject::connect( server, SIGNAL( streamReady() ), SLOT( processStreamReady() ) );
+    QObject::connect( server, SIGNAL( stanzaReceived(QDomElement,QString) ), SLOT( processStanza(QDomElement,QString) ) );
+    QObject::connect( &d->tickTimer, SIGNAL( timeout() ), SLOT( tick() ) );
+    QObject::connect( &d->reportTimer, SIGNAL( timeout() ), SLOT( report() ) );
+}
+
+Benchmark::~Benchmark()
+{
+    delete d;
+}
+
+void Benchmark::setTransport(const QString& domain)
+{
+    d->transport = Jid(domain);
+}
+
+/**
+ * Creates @a count users named userN@domain. User N is registered with uin firstUin + N,
+ * so setFirstUin() should be called before.
+ */
+void Benchmark::setUsers(int count, const QString& domain)
+{
+    d->users.resize(count);
+    d->userIndex.clear();
+    for ( int i = 0; i < count; ++i ) {
+        Private::User& user = d->users[i];
+        user.jid = Jid( "user" + QString::number(i) + "@" + domain + "/bench" );
+        user.uin = QString::number(d->firstUin + i);
+        user.state = Private::User::Idle;
+        user.started = 0;
+        d->userIndex.insert(user.jid.bare(), i);
+    }
+}
+
+void Benchmark::setFirstUin(uint uin)
+{
+    d->firstUin = uin;
+}
+
+void Benchmark::setLoginRate(int perSecond)
+{
+    d->loginRate = qMax(perSecond, 1);
+}
+
+/**
+ * Sets number of messages per second sent by all users together.
+ */
+void Benchmark::setMessageRate(double perSecond)
+{
+    d->messageRate = qMax(perSecond, 0.0);
+}
+
+void Benchmark::setPresenceRate(double perSecond)
+{
+    d->presenceRate = qMax(perSecond, 0.0);
+}
+
+void Benchmark::setIqRate(double perSecond)
+{
+    d->iqRate = qMax(perSecond, 0.0);
+}
+
+/**
+ * Sets benchmark duration in seconds, counted from the first component connection.
+ */
+void Benchmark::setDuration(int secs)
+{
+    d->duration = qMax(secs, 1);
+}
+
+/**
+ * Sets pid of the transport process, its memory usage is reported per online user.
+ */
+void Benchmark::setTransportPid(qint64 pid)
+{
+    d->transportPid = pid;
+}
+
+/**
+ * Writes every stanza received from the transport to @a fileName, one per line.
+ */
+bool Benchmark::setRecordFile(const QString& fileName)
+{
+    d->record.setFileName(fileName);
+    return d->record.open(QIODevice::WriteOnly | QIODevice::Truncate);
+}
+
+/**
+ * Waits for the transport to connect, users are logged in after that.
+ */
+void Benchmark::start()
+{
+    qDebug() << "[Bench]" << "Waiting for" << d->transport.full() << "to connect";
+}
+
+void Benchmark::processStreamReady()
+{
+    if ( d->tickTimer.isActive() ) {
+        return;
+    }
+    d->baseMemory = d->residentMemory();
+    d->reportTime = Instrument::monotonicUsecs();
+    d->tickTimer.start(BENCH_TICK_INTERVAL);
+    d->reportTimer.start(BENCH_REPORT_INTERVAL);
+    QTimer::singleShot( d->duration * 1000, this, SLOT( finish() ) );
+}
+
+void Benchmark::processStanza(const QDomElement& stanza, const QString& raw)
+{
+    ++d->stanzasReceived;
+    if ( d->record.isOpen() ) {
+        d->record.write( raw.toUtf8() + "\n" );
+    }
+
+    Jid to( stanza.attribute("to") );
+    Jid from( stanza.attribute("from") );
+    int index = d->userIndex.value(to.bare(), -1);
+    if ( index < 0 ) {
+        return;
+    }
+    Private::User& user = d->users[index];
+    qint64 now = Instrument::monotonicUsecs();
+
+    if ( stanza.tagName() == "presence" ) {
+        ++d->presencesReceived;
+        QString type = stanza.attribute("type");
+        if ( type == "subscribe" ) {
+            d->server->send( Presence(Presence::Subscribed, user.jid, from) );
+        } else if ( type == "probe" && user.state == Private::User::Online ) {
+            d->server->send( Presence(Presence::Available, user.jid, from) );
+        } else if ( type.isEmpty() && from.compare(d->transport, false) && user.state == Private::User::LoggingIn ) {
+            /* transport is online for the user after ICQ login */
+            user.state = Private::User::Online;
+            d->online << index;
+            d->loginLatency << now - user.started;
+        }
+    } else if ( stanza.tagName() == "message" ) {
+        Message msg(stanza);
+        if ( msg.body().startsWith(BENCH_MESSAGE_PREFIX) ) {
+            quint64 sequence = msg.body().mid( qstrlen(BENCH_MESSAGE_PREFIX) ).toULongLong();
+            QHash<quint64,qint64>::iterator it = d->pendingMessages.find(sequence);
+            if ( it != d->pendingMessages.end() ) {
+                d->messageLatency << now - it.value();
+                d->pendingMessages.erase(it);
+            }
+        }
+    } else if ( stanza.tagName() == "iq" ) {
+        QString type = stanza.attribute("type");
+        if ( type == "result" || type == "error" ) {
+            QString id = stanza.attribute("id");
+            if ( id.startsWith("reg-") && user.state == Private::User::Registering ) {
+                if ( type == "error" ) {
+                    qWarning() << "[Bench]" << "Registration failed for" << user.jid.full();
+                    return;
+                }
+                user.state = Private::User::LoggingIn;
+                user.started = now;
+                d->server->send( Presence(Presence::Available, user.jid, d->transport) );
+            } else if ( d->pendingIqs.contains(id) ) {
+                d->iqLatency << now - d->pendingIqs.take(id);
+            }
+        } else {
+            /* queries and roster pushes to the user are acknowledged */
+            d->server->send( IQ::createReply( IQ(stanza) ) );
+        }
+    }
+}
+
+void Benchmark::tick()
+{
+    double step = BENCH_TICK_INTERVAL / 1000.0;
+
+    d->loginCredit += d->loginRate * step;
+    while ( d->loginCredit >= 1 && d->nextUser < d->users.size() ) {
+        d->loginCredit -= 1;
+        d->registerNext();
+    }
+    if ( d->nextUser == d->users.size() ) {
+        d->loginCredit = 0;
+    }
+
+    d->messageCredit += d->messageRate * step;
+    while ( d->messageCredit >= 1 ) {
+        d->messageCredit -= 1;
+        d->sendMessage();
+    }
+    d->presenceCredit += d->presenceRate * step;
+    while ( d->presenceCredit >= 1 ) {
+        d->presenceCredit -= 1;
+        d->sendPresence();
+    }
+    d->iqCredit += d->iqRate * step;
+    while ( d->iqCredit >= 1 ) {
+        d->iqCredit -= 1;
+        d->sendIq();
+    }
+}
+
+void Benchmark::report()
+{
+    qint64 now = Instrument::monotonicUsecs();
+    double elapsed = qMax( (now - d->reportTime) / 1000000.0, 0.001 );
+    double presenceRate = (d->presencesReceived - d->presencesReported) / elapsed;
+    d->presencesReported = d->presencesReceived;
+    d->reportTime = now;
+
+    qDebug() << "[Bench]" << d->online.size() << "of" << d->users.size() << "users online, login"
+        << qPrintable( Private::latencies(d->loginLatency) );
+    qDebug() << "[Bench]" << "messages" << d->messagesSent << "sent" << d->messageLatency.size() << "received,"
+        << d->pendingMessages.size() << "pending, latency" << qPrintable( Private::latencies(d->messageLatency) );
+    qDebug() << "[Bench]" << "presences" << qPrintable( QString::number(presenceRate, 'f', 1) ) << "/s,"
+        << "iq latency" << qPrintable( Private::latencies(d->iqLatency) ) << "," << d->stanzasReceived << "stanzas received";
+
+    qint64 memory = d->residentMemory();
+    if ( memory > 0 ) {
+        qint64 perUser = d->online.isEmpty() ? 0 : (memory - d->baseMemory) / d->online.size();
+        qDebug() << "[Bench]" << "transport RSS" << memory / 1024 << "KiB," << perUser / 1024.0 << "KiB per online user";
+    }
+}
+
+/**
+ * Reports final results, logs all users out and quits.
+ */
+void Benchmark::finish()
+{
+    d->tickTimer.stop();
+    d->reportTimer.stop();
+    report();
+
+    foreach (int index, d->online) {
+        d->server->send( Presence(Presence::Unavailable, d->users.at(index).jid, d->transport) );
+    }
+    d->record.close();
+    QTimer::singleShot( 1000, QCoreApplication::instance(), SLOT( quit() ) );
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,61 @@
+/*
+ * Benchmark.h - Scripted XMPP users driving the transport end-to-end
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <QObject>
+
+class ComponentServer;
+class QDomElement;
+
+class Benchmark : public QObject
+{
+    Q_OBJECT
+
+    public:
+        Benchmark(ComponentServer *server, QObject *parent = 0);
+        ~Benchmark();
+
+        void setTransport(const QString& domain);
+        void setUsers(int count, const QString& domain);
+        void setFirstUin(uint uin);
+        void setLoginRate(int perSecond);
+        void setMessageRate(double perSecond);
+        void setPresenceRate(double perSecond);
+        void setIqRate(double perSecond);
+        void setDuration(int secs);
+        void setTransportPid(qint64 pid);
+        bool setRecordFile(const QString& fileName);
+
+        void start();
+    private slots:
+        void processStreamReady();
+        void processStanza(const QDomElement& stanza, const QString& raw);
+        void tick();
+        void report();
+        void finish();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* BENCHMARK_H_ */
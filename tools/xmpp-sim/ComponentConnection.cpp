@@ -0,0 +1,153 @@
+/*
+ * ComponentConnection.cpp - Component stream accepted by the XMPP server stand-in
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "ComponentConnection.h"
+
+#include "componentstream.h"
+#include "stream.h"
+#include "xmpp-core/parser.h"
+
+#include <QCryptographicHash>
+#include <QDomElement>
+#include <QTcpSocket>
+#include <QXmlAttributes>
+#include <QtDebug>
+
+class ComponentConnection::Private
+{
+    public:
+        void processEvent(const XMPP::Parser::Event& event);
+        void close(const QByteArray& condition = QByteArray());
+
+        ComponentConnection *q;
+        QTcpSocket *socket;
+        XMPP::Parser parser;
+        QByteArray secret;
+        QByteArray streamId;
+        QString domain;
+        bool ready;
+};
+
+/**
+ * Handles XEP-0114 handshake: stream header from the component, our header with
+ * stream id, then the component proves it knows the secret with sha1(id + secret).
+ */
+void ComponentConnection::Private::processEvent(const XMPP::Parser::Event& event)
+{
+    switch ( event.type() ) {
+        case XMPP::Parser::Event::DocumentOpen: {
+            domain = event.attributes().value("to");
+            streamId = QByteArray::number( qrand() ) + QByteArray::number( qrand() );
+            socket->write( "<?xml version='1.0'?><stream:stream xmlns:stream='" NS_ETHERX "' xmlns='" NS_COMPONENT "'"
+                           " from='" + domain.toUtf8() + "' id='" + streamId + "'>" );
+            break;
+        }
+        case XMPP::Parser::Event::Element: {
+            QDomElement element = event.element();
+            if ( element.tagName() == "handshake" ) {
+                QByteArray expected = QCryptographicHash::hash(streamId + secret, QCryptographicHash::Sha1).toHex();
+                if ( element.text().toLatin1().toLower() != expected ) {
+                    qDebug() << "[XSim]" << "Handshake failed for" << domain;
+                    close("not-authorized");
+                    return;
+                }
+                socket->write("<handshake/>");
+                ready = true;
+                qDebug() << "[XSim]" << "Component" << domain << "connected";
+                emit q->ready();
+            } else if (ready) {
+                emit q->stanzaReceived( element, event.actualString() );
+            }
+            break;
+        }
+        case XMPP::Parser::Event::DocumentClose:
+            close();
+            break;
+        case XMPP::Parser::Event::Error:
+            qDebug() << "[XSim]" << "Parser error on stream of" << domain;
+            close("not-well-formed");
+            break;
+    }
+}
+
+void ComponentConnection::Private::close(const QByteArray& condition)
+{
+    if ( !condition.isEmpty() ) {
+        socket->write( "<stream:error><" + condition + " xmlns='" NS_STREAMS "'/></stream:error>" );
+    }
+    socket->write("</stream:stream>");
+    socket->disconnectFromHost();
+}
+
+ComponentConnection::ComponentConnection(QTcpSocket *socket, const QByteArray& secret, QObject *parent)
+    : QObject(parent)
+{
+    d = new Private;
+    d->q = this;
+    d->socket = socket;
+    d->socket->setParent(this);
+    d->secret = secret;
+    d->ready = false;
+
+    QObject::connect( d->socket, SIGNAL( readyRead() ), SLOT( readData() ) );
+    QObject::connect( d->socket, SIGNAL( disconnected() ), SLOT( processDisconnected() ) );
+}
+
+ComponentConnection::~ComponentConnection()
+{
+    delete d;
+}
+
+/**
+ * Returns true if the component has passed the handshake.
+ */
+bool ComponentConnection::isReady() const
+{
+    return d->ready;
+}
+
+QString ComponentConnection::domain() const
+{
+    return d->domain;
+}
+
+bool ComponentConnection::write(const QByteArray& data)
+{
+    return d->ready && d->socket->write(data) == data.size();
+}
+
+void ComponentConnection::readData()
+{
+    d->parser.appendData( d->socket->readAll() );
+    XMPP::Parser::Event event = d->parser.readNext();
+    while ( !event.isNull() ) {
+        d->processEvent(event);
+        event = d->parser.readNext();
+    }
+}
+
+void ComponentConnection::processDisconnected()
+{
+    d->ready = false;
+    emit closed();
+    deleteLater();
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,54 @@
+/*
+ * ComponentConnection.h - Component stream accepted by the XMPP server stand-in
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef COMPONENTCONNECTION_H_
+#define COMPONENTCONNECTION_H_
+
+#include <QObject>
+
+class QDomElement;
+class QTcpSocket;
+
+class ComponentConnection : public QObject
+{
+    Q_OBJECT
+
+    public:
+        ComponentConnection(QTcpSocket *socket, const QByteArray& secret, QObject *parent = 0);
+        ~ComponentConnection();
+
+        bool isReady() const;
+        QString domain() const;
+
+        bool write(const QByteArray& data);
+    signals:
+        void ready();
+        void closed();
+        void stanzaReceived(const QDomElement& stanza, const QString& raw);
+    private slots:
+        void readData();
+        void processDisconnected();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* COMPONENTCONNECTION_H_ */
@@ -0,0 +1,116 @@
+/*
+ * ComponentServer.cpp - XMPP server stand-in accepting component connections
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "ComponentServer.h"
+#include "ComponentConnection.h"
+
+#include "xmpp-core/stanza.h"
+
+#include <QList>
+#include <QTcpSocket>
+#include <QtDebug>
+
+class ComponentServer::Private
+{
+    public:
+        QByteArray secret;
+        /* streams which passed the handshake */
+        QList<ComponentConnection*> streams;
+        int next;
+};
+
+/**
+ * @class ComponentServer
+ * @brief Minimal XMPP server side of XEP-0114 (jabber:component:accept).
+ *
+ * Accepts any number of component streams with the configured secret. Stanzas
+ * from the component are passed on with stanzaReceived(), stanzas to it are
+ * sent over the streams in turn, like a server would do with several connections.
+ */
+
+ComponentServer::ComponentServer(QObject *parent)
+    : QTcpServer(parent)
+{
+    d = new Private;
+    d->next = 0;
+}
+
+ComponentServer::~ComponentServer()
+{
+    delete d;
+}
+
+void ComponentServer::setSecret(const QString& secret)
+{
+    d->secret = secret.toUtf8();
+}
+
+/**
+ * Returns number of component streams which have passed the handshake.
+ */
+int ComponentServer::streamCount() const
+{
+    return d->streams.size();
+}
+
+/**
+ * Sends @a stanza to the component. Returns false if there are no streams.
+ */
+bool ComponentServer::send(const XMPP::Stanza& stanza)
+{
+    if ( d->streams.isEmpty() ) {
+        return false;
+    }
+    d->next = ( d->next + 1 ) % d->streams.size();
+    return d->streams.at(d->next)->write( stanza.toString().toUtf8() );
+}
+
+void ComponentServer::incomingConnection(int socketDescriptor)
+{
+    QTcpSocket *socket = new QTcpSocket;
+    if ( !socket->setSocketDescriptor(socketDescriptor) ) {
+        qWarning() << "[XSim]" << "Failed to accept connection:" << socket->errorString();
+        delete socket;
+        return;
+    }
+
+    ComponentConnection *connection = new ComponentConnection(socket, d->secret, this);
+    QObject::connect( connection, SIGNAL( ready() ), SLOT( processStreamReady() ) );
+    QObject::connect( connection, SIGNAL( closed() ), SLOT( processStreamClosed() ) );
+    QObject::connect( connection, SIGNAL( stanzaReceived(QDomElement,QString) ), SIGNAL( stanzaReceived(QDomElement,QString) ) );
+}
+
+void ComponentServer::processStreamReady()
+{
+    ComponentConnection *connection = qobject_cast<ComponentConnection*>( sender() );
+    d->streams << connection;
+    emit streamReady();
+}
+
+void ComponentServer::processStreamClosed()
+{
+    ComponentConnection *connection = qobject_cast<ComponentConnection*>( sender() );
+    if ( d->streams.removeOne(connection) ) {
+        qDebug() << "[XSim]" << "Component stream closed," << d->streams.size() << "left";
+    }
+    d->next = 0;
+}
+
+// vim:et:ts=4:sw=4:nowrap
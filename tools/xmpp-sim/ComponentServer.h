@@ -0,0 +1,58 @@
+/*
+ * ComponentServer.h - XMPP server stand-in accepting component connections
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef COMPONENTSERVER_H_
+#define COMPONENTSERVER_H_
+
+#include <QTcpServer>
+
+class QDomElement;
+
+namespace XMPP {
+    class Stanza;
+}
+
+class ComponentServer : public QTcpServer
+{
+    Q_OBJECT
+
+    public:
+        ComponentServer(QObject *parent = 0);
+        ~ComponentServer();
+
+        void setSecret(const QString& secret);
+        int streamCount() const;
+
+        bool send(const XMPP::Stanza& stanza);
+    signals:
+        void streamReady();
+        void stanzaReceived(const QDomElement& stanza, const QString& raw);
+    protected:
+        void incomingConnection(int socketDescriptor);
+    private slots:
+        void processStreamReady();
+        void processStreamClosed();
+    private:
+        class Private;
+        Private *d;
+};
+
+// vim:et:ts=4:sw=4:nowrap
+#endif /* COMPONENTSERVER_H_ */
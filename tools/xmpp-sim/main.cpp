@@ -0,0 +1,107 @@
+/*
+ * main.cpp - XMPP server stand-in for transport benchmarks
+ * Copyright (C) 2009  Alexander Saltykov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Benchmark.h"
+#include "ComponentServer.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QHash>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTextCodec>
+
+#include <stdio.h>
+
+static const char usage[] =
+    "Usage: xmpp-sim [options]\n"
+    "Server:\n"
+    "  -listen ADDR          address to listen on (127.0.0.1)\n"
+    "  -port N               component port to listen on (5555)\n"
+    "  -secret S             component secret (secret)\n"
+    "  -transport DOMAIN     jabber domain of the transport (icq.localhost)\n"
+    "Users:\n"
+    "  -users N              jabber users to register and log in (100)\n"
+    "  -user-domain DOMAIN   domain of the users (localhost)\n"
+    "  -first-uin N          uin registered for the first user (100000)\n"
+    "  -login-rate N         logins per second (50)\n"
+    "  -message-rate N       messages per second sent by all users together (0)\n"
+    "  -presence-rate N      presence changes per second by all users together (0)\n"
+    "  -iq-rate N            disco queries per second to the transport (0)\n"
+    "  -duration N           benchmark length in seconds after the transport connects (60)\n"
+    "Report:\n"
+    "  -pid N                pid of the transport, its memory usage is reported\n"
+    "  -record FILE          write all stanzas from the transport to FILE\n"
+    "\n"
+    "Run oscar-sim for the ICQ side and point the transport to both of them\n"
+    "(jabber-server/jabber-port and icq-server/icq-port options).\n";
+
+int main(int argc, char **argv)
+{
+    QTextCodec::setCodecForCStrings( QTextCodec::codecForName("UTF-8") );
+    QCoreApplication app(argc, argv);
+    qsrand( QDateTime::currentDateTime().toTime_t() );
+
+    QHash<QString,QString> options;
+    options.insert("listen", "127.0.0.1");
+    options.insert("port", "5555");
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+    while ( !args.isEmpty() ) {
+        QString arg = args.takeFirst();
+        if ( !arg.startsWith('-') || arg == "-help" || arg == "--help" || args.isEmpty() ) {
+            fputs(usage, stderr);
+            return arg.startsWith("-h") || arg == "--help" ? 0 : 1;
+        }
+        options.insert( arg.mid(1), args.takeFirst() );
+    }
+
+    quint16 port = options.value("port").toUInt();
+    QString host = options.value("listen");
+
+    ComponentServer *server = new ComponentServer(&app);
+    server->setSecret( options.value("secret", "secret") );
+    if ( !server->listen(QHostAddress(host), port) ) {
+        fprintf( stderr, "Failed to listen on %s:%d: %s\n", qPrintable(host), port, qPrintable( server->errorString() ) );
+        return 1;
+    }
+    qDebug( "[XSim] Listening on %s:%d", qPrintable(host), port );
+
+    Benchmark *bench = new Benchmark(server, &app);
+    bench->setTransport( options.value("transport", "icq.localhost") );
+    bench->setFirstUin( options.value("first-uin", "100000").toUInt() );
+    bench->setUsers( options.value("users", "100").toInt(), options.value("user-domain", "localhost") );
+    bench->setLoginRate( options.value("login-rate", "50").toInt() );
+    bench->setMessageRate( options.value("message-rate", "0").toDouble() );
+    bench->setPresenceRate( options.value("presence-rate", "0").toDouble() );
+    bench->setIqRate( options.value("iq-rate", "0").toDouble() );
+    bench->setDuration( options.value("duration", "60").toInt() );
+    bench->setTransportPid( options.value("pid", "0").toLongLong() );
+    if ( options.contains("record") && !bench->setRecordFile( options.value("record") ) ) {
+        fprintf( stderr, "Failed to open %s\n", qPrintable( options.value("record") ) );
+        return 1;
+    }
+    bench->start();
+
+    return app.exec();
+}
+
+// vim:et:ts=4:sw=4:nowrap
@@ -0,0 +1,25 @@
+TARGET = xmpp-sim
+TEMPLATE = app
+
+include(../../common.pri)
+include(../../instrument/instrument.pri)
+include(../../shark/shark.pri)
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+QMAKE_DISTCLEAN += \
+	$$PWD/.moc \
+	$$PWD/.obj
+
+QMAKE_DEL_FILE = rm -rf
+
+HEADERS += \
+	$$PWD/Benchmark.h \
+	$$PWD/ComponentConnection.h \
+	$$PWD/ComponentServer.h
+SOURCES += \
+	$$PWD/Benchmark.cpp \
+	$$PWD/ComponentConnection.cpp \
+	$$PWD/ComponentServer.cpp \
+	$$PWD/main.cpp